@@ -0,0 +1,318 @@
+#include "echopool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#define MAX_THREADS     ECHO_POOL_WORKERS
+
+/* Balance benchmark under skewed load: a few connections send most of the
+ * messages, as in a chat with a handful of talkative users. Each message
+ * costs the same fixed work. With every connection tied to one thread, as
+ * in thread i % THREADS, the threads with the busy connections finish last.
+ * On the pool every connection has a serial executor and idle workers steal
+ * the executors that have work. */
+struct message
+{
+    echo_task_t m_task;
+    int m_work;
+};
+
+struct run
+{
+    long *r_counts;
+    int r_conns;
+    int r_thread;
+    int r_threads;
+    int r_work;
+    long r_served;
+};
+
+static double bench_static( long *counts, int conns, int threads, int work,
+        long *done );
+static double bench_pool( long *counts, int conns, int threads, int work,
+        long *done );
+static void *serve_static( void *arg );
+static void deliver( echo_task_t *task );
+static void spin( int work );
+static void report( const char *mode, double time, long *done, int threads );
+static double now( void );
+
+static atomic_int g_slots;
+static atomic_long g_done[ MAX_THREADS ];
+static _Thread_local int t_slot = -1;
+
+int main( int argc, char *argv[ ] )
+{
+    long done[ MAX_THREADS ];
+    double weight, sum;
+    long *counts, messages;
+    int conns, threads, skew, work, opt, i, j;
+
+    conns = 64;
+    messages = 200000;
+    threads = 4;
+    skew = 1;
+    work = 2000;
+
+    while( ( opt = getopt( argc, argv, "c:n:t:s:w:" ) ) != -1 )
+    {
+        if( opt == 'c' )
+        {
+            conns = atoi( optarg );
+        }
+        else if( opt == 'n' )
+        {
+            messages = atol( optarg );
+        }
+        else if( opt == 't' )
+        {
+            threads = atoi( optarg );
+        }
+        else if( opt == 's' )
+        {
+            skew = atoi( optarg );
+        }
+        else if( opt == 'w' )
+        {
+            work = atoi( optarg );
+        }
+        else
+        {
+            fprintf( stderr, "USAGE: %s [-c CONNECTIONS] [-n MESSAGES] "
+                    "[-t THREADS] [-s SKEW] [-w WORK]\n", argv[ 0 ] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if( conns <= 0 || messages <= 0 || threads <= 0 ||
+            threads > MAX_THREADS || skew < 0 || work < 0 )
+    {
+        fprintf( stderr, "%s: invalid arguments.\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    if( ( counts = malloc( conns * sizeof( long ) ) ) == NULL )
+    {
+        fprintf( stderr, "Out of memory.\n" );
+        return EXIT_FAILURE;
+    }
+
+    /* Connection i sends in proportion to 1 / ( i + 1 )^SKEW. */
+    for( sum = 0, i = 0; i < conns; i++ )
+    {
+        for( weight = 1, j = 0; j < skew; j++ )
+        {
+            weight /= i + 1;
+        }
+
+        sum += weight;
+    }
+
+    for( i = 0; i < conns; i++ )
+    {
+        for( weight = 1, j = 0; j < skew; j++ )
+        {
+            weight /= i + 1;
+        }
+
+        counts[ i ] = messages * weight / sum + 1;
+    }
+
+    printf( "%-8s %12s %12s %12s %10s\n", "mode", "makespan_ms",
+            "min_msgs", "max_msgs", "max/mean" );
+    report( "static", bench_static( counts, conns, threads, work, done ),
+            done, threads );
+    report( "pool", bench_pool( counts, conns, threads, work, done ), done,
+            threads );
+
+    free( counts );
+
+    return EXIT_SUCCESS;
+}
+
+/* Returns the seconds until the last thread is done. */
+double bench_static( long *counts, int conns, int threads, int work,
+        long *done )
+{
+    pthread_t thread[ MAX_THREADS ];
+    struct run runs[ MAX_THREADS ];
+    double start;
+    int i;
+
+    start = now( );
+
+    for( i = 0; i < threads; i++ )
+    {
+        runs[ i ].r_counts = counts;
+        runs[ i ].r_conns = conns;
+        runs[ i ].r_thread = i;
+        runs[ i ].r_threads = threads;
+        runs[ i ].r_work = work;
+        pthread_create( &thread[ i ], NULL, serve_static, &runs[ i ] );
+    }
+
+    for( i = 0; i < threads; i++ )
+    {
+        pthread_join( thread[ i ], NULL );
+        done[ i ] = runs[ i ].r_served;
+    }
+
+    return now( ) - start;
+}
+
+/* Returns the seconds until the last executor is drained. Messages are
+ * submitted in turns over the connections, as they would arrive. */
+double bench_pool( long *counts, int conns, int threads, int work,
+        long *done )
+{
+    echo_serial_t **serials;
+    struct message *message;
+    long *left, remaining;
+    echo_pool_t *pool;
+    double start;
+    int i, err;
+
+    if( ( serials = malloc( conns * sizeof( echo_serial_t* ) ) ) == NULL ||
+            ( left = malloc( conns * sizeof( long ) ) ) == NULL ||
+            ( pool = echo_pool_create( threads, &err ) ) == NULL )
+    {
+        fprintf( stderr, "Out of memory.\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    for( remaining = 0, i = 0; i < conns; i++ )
+    {
+        if( ( serials[ i ] = echo_serial_create( pool, &err ) ) == NULL )
+        {
+            fprintf( stderr, "Out of memory.\n" );
+            exit( EXIT_FAILURE );
+        }
+
+        left[ i ] = counts[ i ];
+        remaining += counts[ i ];
+    }
+
+    atomic_store( &g_slots, 0 );
+
+    for( i = 0; i < MAX_THREADS; i++ )
+    {
+        atomic_store( &g_done[ i ], 0 );
+    }
+
+    start = now( );
+
+    while( remaining > 0 )
+    {
+        for( i = 0; i < conns; i++ )
+        {
+            if( left[ i ] == 0 )
+                continue;
+
+            if( ( message = malloc( sizeof( struct message ) ) ) == NULL )
+            {
+                fprintf( stderr, "Out of memory.\n" );
+                exit( EXIT_FAILURE );
+            }
+
+            message->m_task.et_run = deliver;
+            message->m_work = work;
+            echo_serial_submit( serials[ i ], &message->m_task );
+            left[ i ]--;
+            remaining--;
+        }
+    }
+
+    for( i = 0; i < conns; i++ )
+    {
+        echo_serial_destroy( serials[ i ] );
+    }
+
+    start = now( ) - start;
+    echo_pool_destroy( pool );
+
+    for( i = 0; i < threads; i++ )
+    {
+        done[ i ] = atomic_load( &g_done[ i ] );
+    }
+
+    free( left );
+    free( serials );
+
+    return start;
+}
+
+/* Serves the connections of one thread one after the other. */
+void *serve_static( void *arg )
+{
+    struct run *run;
+    long served, j;
+    int i;
+
+    run = ( struct run* )arg;
+
+    for( served = 0, i = run->r_thread; i < run->r_conns;
+            i += run->r_threads )
+    {
+        for( j = 0; j < run->r_counts[ i ]; j++ )
+        {
+            spin( run->r_work );
+            served++;
+        }
+    }
+
+    run->r_served = served;
+
+    return NULL;
+}
+
+void deliver( echo_task_t *task )
+{
+    if( t_slot == -1 )
+        t_slot = atomic_fetch_add( &g_slots, 1 );
+
+    spin( ( ( struct message* )task )->m_work );
+    atomic_fetch_add_explicit( &g_done[ t_slot ], 1, memory_order_relaxed );
+    free( task );
+}
+
+void spin( int work )
+{
+    volatile unsigned int x;
+    int i;
+
+    for( x = 1, i = 0; i < work; i++ )
+    {
+        x = x * 1103515245 + 12345;
+    }
+}
+
+void report( const char *mode, double time, long *done, int threads )
+{
+    long min, max, total;
+    int i;
+
+    for( min = max = done[ 0 ], total = 0, i = 0; i < threads; i++ )
+    {
+        if( done[ i ] < min )
+            min = done[ i ];
+
+        if( done[ i ] > max )
+            max = done[ i ];
+
+        total += done[ i ];
+    }
+
+    printf( "%-8s %12.1f %12ld %12ld %10.2f\n", mode, time * 1e3, min, max,
+            total > 0 ? max / ( ( double )total / threads ) : 0 );
+}
+
+double now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,217 @@
+#include "echoqueue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#define MAX_PRODUCERS   64
+
+/* Contention benchmark of the hand-off between connection threads and the
+ * outbox thread: producers push preallocated nodes as fast as they can and
+ * one consumer takes them, through the lock-free queue or through a list
+ * under a mutex with a condition variable, as server.c did before. */
+struct locked
+{
+    pthread_mutex_t l_lock;
+    pthread_cond_t l_cond;
+    echo_queue_node_t *l_head;
+    echo_queue_node_t *l_tail;
+};
+
+struct run
+{
+    echo_queue_t *r_queue;
+    struct locked *r_locked;
+    echo_queue_node_t *r_nodes;
+    long r_items;
+};
+
+static double bench( int producers, long items, int locked );
+static void *produce( void *arg );
+static void *produce_locked( void *arg );
+static echo_queue_node_t *take_locked( struct locked *locked );
+static double now( void );
+
+int main( int argc, char *argv[ ] )
+{
+    int producers[ ] = { 1, 2, 4, 8, 16 };
+    long items;
+    int max, opt;
+    size_t i;
+
+    items = 1000000;
+    max = MAX_PRODUCERS;
+
+    while( ( opt = getopt( argc, argv, "n:p:" ) ) != -1 )
+    {
+        if( opt == 'n' )
+        {
+            items = atol( optarg );
+        }
+        else if( opt == 'p' )
+        {
+            max = atoi( optarg );
+        }
+        else
+        {
+            fprintf( stderr, "USAGE: %s [-n ITEMS] [-p MAX_PRODUCERS]\n",
+                    argv[ 0 ] );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if( items <= 0 || max <= 0 || max > MAX_PRODUCERS )
+    {
+        fprintf( stderr, "%s: invalid arguments.\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    printf( "%-10s %12s %12s\n", "producers", "mpsc_Mops", "mutex_Mops" );
+
+    for( i = 0; i < sizeof( producers ) / sizeof( int ) &&
+            producers[ i ] <= max; i++ )
+    {
+        printf( "%-10d %12.2f %12.2f\n", producers[ i ],
+                bench( producers[ i ], items, 0 ),
+                bench( producers[ i ], items, 1 ) );
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Returns millions of items handed over per second. */
+double bench( int producers, long items, int locked )
+{
+    pthread_t threads[ MAX_PRODUCERS ];
+    struct run runs[ MAX_PRODUCERS ];
+    echo_queue_node_t *nodes;
+    struct locked shared;
+    echo_queue_t *queue;
+    double start;
+    long i, total;
+    int err;
+
+    total = items * producers;
+
+    if( ( nodes = calloc( total, sizeof( echo_queue_node_t ) ) ) == NULL ||
+            ( queue = echo_queue_create( &err ) ) == NULL )
+    {
+        fprintf( stderr, "Out of memory.\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    pthread_mutex_init( &shared.l_lock, NULL );
+    pthread_cond_init( &shared.l_cond, NULL );
+    shared.l_head = NULL;
+    shared.l_tail = NULL;
+    start = now( );
+
+    for( i = 0; i < producers; i++ )
+    {
+        runs[ i ].r_queue = queue;
+        runs[ i ].r_nodes = nodes + i * items;
+        runs[ i ].r_items = items;
+        runs[ i ].r_locked = &shared;
+        pthread_create( &threads[ i ], NULL,
+                locked ? produce_locked : produce, &runs[ i ] );
+    }
+
+    for( i = 0; i < total; i++ )
+    {
+        if( locked )
+            take_locked( &shared );
+        else
+            echo_queue_wait( queue, -1 );
+    }
+
+    start = now( ) - start;
+
+    for( i = 0; i < producers; i++ )
+    {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    pthread_cond_destroy( &shared.l_cond );
+    pthread_mutex_destroy( &shared.l_lock );
+    echo_queue_destroy( queue );
+    free( nodes );
+
+    return total / start / 1e6;
+}
+
+void *produce( void *arg )
+{
+    struct run *run;
+    long i;
+
+    run = ( struct run* )arg;
+
+    for( i = 0; i < run->r_items; i++ )
+    {
+        echo_queue_push( run->r_queue, &run->r_nodes[ i ] );
+    }
+
+    return NULL;
+}
+
+void *produce_locked( void *arg )
+{
+    struct locked *shared;
+    struct run *run;
+    long i;
+
+    run = ( struct run* )arg;
+    shared = run->r_locked;
+
+    for( i = 0; i < run->r_items; i++ )
+    {
+        pthread_mutex_lock( &shared->l_lock );
+        atomic_store_explicit( &run->r_nodes[ i ].eqn_next, NULL,
+                memory_order_relaxed );
+
+        if( shared->l_tail == NULL )
+            shared->l_head = &run->r_nodes[ i ];
+        else
+            atomic_store_explicit( &shared->l_tail->eqn_next,
+                    &run->r_nodes[ i ], memory_order_relaxed );
+
+        shared->l_tail = &run->r_nodes[ i ];
+        pthread_cond_signal( &shared->l_cond );
+        pthread_mutex_unlock( &shared->l_lock );
+    }
+
+    return NULL;
+}
+
+echo_queue_node_t *take_locked( struct locked *shared )
+{
+    echo_queue_node_t *node;
+
+    pthread_mutex_lock( &shared->l_lock );
+
+    while( shared->l_head == NULL )
+    {
+        pthread_cond_wait( &shared->l_cond, &shared->l_lock );
+    }
+
+    node = shared->l_head;
+    shared->l_head = atomic_load_explicit( &node->eqn_next,
+            memory_order_relaxed );
+
+    if( shared->l_head == NULL )
+        shared->l_tail = NULL;
+
+    pthread_mutex_unlock( &shared->l_lock );
+
+    return node;
+}
+
+double now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,227 @@
+#include "echoframe.h"
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#define PORT        5047
+#define BACKLOG     16
+
+/* Loopback comparison of the two receive paths of a connection thread: a
+ * call for the header and one for the payload of every frame, against a
+ * read-ahead buffer the frames are parsed out of. A sender writes
+ * chat-sized frames in bursts, as a busy member pasting lines does. */
+struct run
+{
+    tcp_context_t *r_listener;
+    long r_frames;
+    int r_burst;
+    size_t r_size;
+};
+
+static void *send_thread( void *arg );
+static int bench( const char *mode, size_t ahead, struct run *run );
+static double now( void );
+
+int main( int argc, char *argv[ ] )
+{
+    tcp_context_t *listener;
+    struct run run;
+    size_t ahead;
+    int opt, err;
+
+    run.r_frames = 1000000;
+    run.r_burst = 32;
+    run.r_size = 64;
+    ahead = 65536;
+
+    while( ( opt = getopt( argc, argv, "n:b:s:r:" ) ) != -1 )
+    {
+        if( opt == 'n' )
+        {
+            run.r_frames = atol( optarg );
+        }
+        else if( opt == 'b' )
+        {
+            run.r_burst = atoi( optarg );
+        }
+        else if( opt == 's' )
+        {
+            run.r_size = strtoul( optarg, NULL, 10 );
+        }
+        else if( opt == 'r' )
+        {
+            ahead = strtoul( optarg, NULL, 10 );
+        }
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if( optind != argc || run.r_frames <= 0 || run.r_burst <= 0 ||
+            run.r_size > ECHO_FRAME_MAX || ahead < ECHO_FRAME_HEADER )
+    {
+        fprintf( stderr, "USAGE: %s [-n FRAMES] [-b BURST] [-s SIZE] "
+                "[-r READ_AHEAD]\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    if( ( listener = tcp_context_create( &err ) ) == NULL ||
+            tcp_context_bind( listener, PORT, &err ) == -1 ||
+            tcp_context_listen( listener, BACKLOG, &err ) == -1 )
+    {
+        fprintf( stderr, "listen: %s.\n", strerror( err ) );
+        return EXIT_FAILURE;
+    }
+
+    run.r_listener = listener;
+    printf( "%-12s %12s %10s %12s\n", "path", "frames/s", "MB/s",
+            "calls/frame" );
+
+    if( bench( "per-frame", 0, &run ) == -1 ||
+            bench( "read-ahead", ahead, &run ) == -1 )
+        return EXIT_FAILURE;
+
+    tcp_context_destroy( listener );
+
+    return EXIT_SUCCESS;
+}
+
+/* Without a read-ahead each frame takes at least two calls. */
+int bench( const char *mode, size_t ahead, struct run *run )
+{
+    echo_frame_reader_t reader;
+    char *buffer, *payload;
+    tcp_context_t *ctx;
+    echo_frame_t frame;
+    pthread_t thread;
+    double start, elapsed;
+    long i;
+    int retval, err;
+
+    payload = malloc( ECHO_FRAME_MAX );
+    buffer = ahead > 0 ? malloc( ahead ) : NULL;
+
+    if( payload == NULL || ( ahead > 0 && buffer == NULL ) ||
+            pthread_create( &thread, NULL, send_thread, run ) != 0 ||
+            ( ctx = tcp_context_accept( run->r_listener, &err ) ) == NULL )
+    {
+        fprintf( stderr, "%s: cannot connect.\n", mode );
+        return -1;
+    }
+
+    if( buffer != NULL )
+        echo_frame_reader_init( &reader, buffer, ahead );
+
+    start = now( );
+
+    for( i = 0; i < run->r_frames; i++ )
+    {
+        if( buffer != NULL )
+        {
+            retval = echo_frame_reader_header( &reader, ctx, &frame, &err );
+
+            if( retval == 1 )
+                retval = echo_frame_reader_payload( &reader, ctx, &frame,
+                        payload, ECHO_FRAME_MAX, &err ) + 1;
+        }
+        else
+        {
+            retval = echo_frame_recv_header( ctx, &frame, &err );
+
+            if( retval == 1 )
+                retval = echo_frame_recv_payload( ctx, &frame, payload,
+                        ECHO_FRAME_MAX, &err ) + 1;
+        }
+
+        if( retval != 1 )
+        {
+            fprintf( stderr, "%s: stream failed.\n", mode );
+            return -1;
+        }
+    }
+
+    elapsed = now( ) - start;
+
+    if( buffer != NULL )
+    {
+        printf( "%-12s %12.0f %10.1f %12.3f\n", mode,
+                run->r_frames / elapsed, run->r_frames *
+                ( ECHO_FRAME_HEADER + run->r_size ) / elapsed / ( 1 << 20 ),
+                ( double )reader.efr_calls / run->r_frames );
+    }
+    else
+    {
+        printf( "%-12s %12.0f %10.1f %12s\n", mode, run->r_frames / elapsed,
+                run->r_frames * ( ECHO_FRAME_HEADER + run->r_size ) /
+                elapsed / ( 1 << 20 ), ">= 2" );
+    }
+
+    pthread_join( thread, NULL );
+    tcp_context_destroy( ctx );
+    free( payload );
+    free( buffer );
+
+    return 0;
+}
+
+/* Each burst goes out with one call, like the client's batched sends. */
+void *send_thread( void *arg )
+{
+    struct run *run;
+    tcp_context_t *ctx;
+    echo_frame_t frame;
+    char *burst, *wire;
+    size_t length, sent;
+    ssize_t bytes;
+    long frames;
+    int i, err;
+
+    run = ( struct run* )arg;
+    length = ( ECHO_FRAME_HEADER + run->r_size ) * run->r_burst;
+
+    if( ( burst = calloc( 1, length ) ) == NULL ||
+            ( ctx = tcp_context_create( &err ) ) == NULL ||
+            tcp_context_connect( ctx, "localhost", PORT, &err ) == -1 )
+        return NULL;
+
+    frame.ef_length = run->r_size;
+    frame.ef_type = ECHO_FRAME_CHAT;
+    frame.ef_flags = 0;
+
+    for( wire = burst, i = 0; i < run->r_burst; i++ )
+    {
+        echo_frame_encode( &frame, ( unsigned char* )wire );
+        wire += ECHO_FRAME_HEADER + run->r_size;
+    }
+
+    for( frames = 0; frames < run->r_frames; frames += run->r_burst )
+    {
+        if( run->r_frames - frames < run->r_burst )
+            length = ( ECHO_FRAME_HEADER + run->r_size ) *
+                ( run->r_frames - frames );
+
+        for( sent = 0; sent < length; sent += bytes )
+        {
+            if( ( bytes = tcp_context_send( ctx, burst + sent,
+                            length - sent, &err ) ) <= 0 )
+                break;
+        }
+    }
+
+    tcp_context_destroy( ctx );
+    free( burst );
+
+    return NULL;
+}
+
+double now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
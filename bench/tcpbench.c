@@ -0,0 +1,235 @@
+#include "tcpcontext.h"
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#define BASE_PORT   5040
+#define BACKLOG     16
+#define HEADER      8
+#define MESSAGE     64
+#define WRITE_SIZE  65536
+
+/* Loopback comparison of socket tuning profiles. Latency is measured on
+ * chat-sized round trips whose header and body are written separately,
+ * as a framed protocol without gathered writes does, which is where
+ * Nagle's algorithm and delayed ACKs meet. Throughput is measured on a
+ * bulk stream. */
+struct run
+{
+    tcp_context_t *r_listener;
+    int r_rounds;
+    size_t r_bytes;
+};
+
+static void *echo_thread( void *arg );
+static int bench( const char *spec, int port, int rounds, size_t bytes );
+static int recv_all( tcp_context_t *ctx, char *buffer, size_t size );
+static int compare( const void *a, const void *b );
+static double now( void );
+
+int main( int argc, char *argv[ ] )
+{
+    int rounds, megabytes, opt, i;
+
+    rounds = 200;
+    megabytes = 256;
+
+    while( ( opt = getopt( argc, argv, "n:m:" ) ) != -1 )
+    {
+        if( opt == 'n' )
+        {
+            rounds = atoi( optarg );
+        }
+        else if( opt == 'm' )
+        {
+            megabytes = atoi( optarg );
+        }
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if( optind >= argc || rounds <= 0 || megabytes <= 0 )
+    {
+        fprintf( stderr, "USAGE: %s [-n ROUNDS] [-m MEGABYTES] PROFILE...\n",
+                argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    printf( "%-32s %10s %10s %10s\n", "profile", "p50_us", "p99_us",
+            "MB/s" );
+
+    for( i = optind; i < argc; i++ )
+    {
+        if( bench( argv[ i ], BASE_PORT + i - optind, rounds,
+                    ( size_t )megabytes << 20 ) == -1 )
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int bench( const char *spec, int port, int rounds, size_t bytes )
+{
+    char message[ MESSAGE ], *chunk;
+    tcp_context_t *listener, *ctx;
+    tcp_profile_t profile;
+    struct run run;
+    pthread_t thread;
+    double *samples, start;
+    size_t sent;
+    ssize_t size;
+    int i, err;
+
+    if( tcp_profile_parse( spec, &profile, &err ) == -1 )
+    {
+        fprintf( stderr, "%s: invalid profile.\n", spec );
+        return -1;
+    }
+
+    if( ( listener = tcp_context_create( &err ) ) == NULL ||
+            tcp_context_set_profile( listener, &profile, &err ) == -1 ||
+            tcp_context_bind( listener, port, &err ) == -1 ||
+            tcp_context_listen( listener, BACKLOG, &err ) == -1 )
+    {
+        fprintf( stderr, "%s: %s.\n", spec, strerror( err ) );
+        return -1;
+    }
+
+    run.r_listener = listener;
+    run.r_rounds = rounds;
+    run.r_bytes = bytes;
+    samples = malloc( rounds * sizeof( double ) );
+    chunk = calloc( 1, WRITE_SIZE );
+
+    if( samples == NULL || chunk == NULL ||
+            ( ctx = tcp_context_create( &err ) ) == NULL ||
+            tcp_context_connect( ctx, "localhost", port, &err ) == -1 ||
+            tcp_context_set_profile( ctx, &profile, &err ) == -1 ||
+            pthread_create( &thread, NULL, echo_thread, &run ) != 0 )
+    {
+        fprintf( stderr, "%s: cannot connect.\n", spec );
+        return -1;
+    }
+
+    memset( message, 'x', MESSAGE );
+
+    for( i = 0; i < rounds; i++ )
+    {
+        start = now( );
+
+        if( tcp_context_send( ctx, message, HEADER, &err ) != HEADER ||
+                tcp_context_send( ctx, message + HEADER, MESSAGE - HEADER,
+                    &err ) != MESSAGE - HEADER ||
+                recv_all( ctx, message, MESSAGE ) == -1 )
+        {
+            fprintf( stderr, "%s: round trip failed.\n", spec );
+            return -1;
+        }
+
+        samples[ i ] = ( now( ) - start ) * 1e6;
+    }
+
+    qsort( samples, rounds, sizeof( double ), compare );
+    start = now( );
+
+    for( sent = 0; sent < bytes; sent += size )
+    {
+        size = bytes - sent < WRITE_SIZE ? bytes - sent : WRITE_SIZE;
+
+        if( ( size = tcp_context_send( ctx, chunk, size, &err ) ) <= 0 )
+        {
+            fprintf( stderr, "%s: stream failed.\n", spec );
+            return -1;
+        }
+    }
+
+    /* The receiver acknowledges the whole stream with one byte. */
+    recv_all( ctx, message, 1 );
+    printf( "%-32s %10.1f %10.1f %10.1f\n", spec, samples[ rounds / 2 ],
+            samples[ rounds - 1 - rounds / 100 ],
+            bytes / ( now( ) - start ) / ( 1 << 20 ) );
+
+    pthread_join( thread, NULL );
+    tcp_context_destroy( ctx );
+    tcp_context_destroy( listener );
+    free( samples );
+    free( chunk );
+
+    return 0;
+}
+
+void *echo_thread( void *arg )
+{
+    char message[ MESSAGE ], *chunk;
+    tcp_context_t *ctx;
+    struct run *run;
+    size_t received;
+    ssize_t size;
+    int i, err;
+
+    run = ( struct run* )arg;
+
+    if( ( ctx = tcp_context_accept( run->r_listener, &err ) ) == NULL ||
+            ( chunk = malloc( WRITE_SIZE ) ) == NULL )
+        return NULL;
+
+    for( i = 0; i < run->r_rounds; i++ )
+    {
+        if( recv_all( ctx, message, MESSAGE ) == -1 ||
+                tcp_context_send( ctx, message, MESSAGE, &err ) != MESSAGE )
+            break;
+    }
+
+    for( received = 0; received < run->r_bytes; received += size )
+    {
+        if( ( size = tcp_context_recv( ctx, chunk, WRITE_SIZE,
+                        &err ) ) <= 0 )
+            break;
+    }
+
+    tcp_context_send( ctx, message, 1, &err );
+    tcp_context_destroy( ctx );
+    free( chunk );
+
+    return NULL;
+}
+
+int recv_all( tcp_context_t *ctx, char *buffer, size_t size )
+{
+    ssize_t bytes;
+    int err;
+
+    while( size > 0 )
+    {
+        if( ( bytes = tcp_context_recv( ctx, buffer, size, &err ) ) <= 0 )
+            return -1;
+
+        buffer += bytes;
+        size -= bytes;
+    }
+
+    return 0;
+}
+
+int compare( const void *a, const void *b )
+{
+    double x, y;
+
+    x = *( const double* )a;
+    y = *( const double* )b;
+
+    return ( x > y ) - ( x < y );
+}
+
+double now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -35,6 +35,19 @@ extern void bag_array_strerror( int errnum, char *buf, size_t buflen );
  */
 extern bag_array_t *bag_array_create( int *err );
 
+/*! \fn int bag_array_reserve( bag_array_t *bag, ssize_t capacity, int *err )
+ *  \brief Makes room for capacity elements at once, so that inserting up
+ *  to that many does not reallocate.
+ *  \param[in] bag The bag to be grown.
+ *  \param[in] capacity The number of elements to make room for.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM Not enough memory to resize bag.
+ */
+extern int bag_array_reserve( bag_array_t *bag, ssize_t capacity, int *err );
+
 /*! \fn ssize_t bag_array_find_first( bag_array_t *bag, void *key, ssize_t *index, int ( *cmp )( const void*,const void* ), int *err )
  *  \brief Finds the first element in the bag.
  *  \param[in] bag The bag to be searched.
@@ -0,0 +1,150 @@
+#ifndef ECHOADMIN_H
+#define ECHOADMIN_H
+
+/*! \file echoadmin.h
+ *  \brief Contains definitions for the admin socket, a local UNIX socket
+ *  served by a thread of its own that takes one command per line.
+ *
+ *  A command is split on blanks and handed to the owner's handler, which
+ *  writes its reply. The reply ends with a line "OK", or "ERROR" followed
+ *  by the reason. Connections publish what they are to a table of sessions
+ *  that the handler lists without locks: each slot is written by its
+ *  connection's thread alone and read under a sequence count, a reader
+ *  that races a login or a logout tries again.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#define ECHO_ADMIN_SLOTS    4096
+#define ECHO_ADMIN_NAME     64
+#define ECHO_ADMIN_LINE     512
+#define ECHO_ADMIN_ARGS     8
+#define ECHO_ADMIN_IDLE     30000
+
+/*! Session slot, written by its connection's thread */
+typedef struct
+{
+    atomic_int eas_used;        /*!< Claimed by a connection */
+    atomic_uint eas_sequence;   /*!< Odd while being filled or emptied */
+    atomic_uint eas_id;         /*!< Connection ID */
+    atomic_int eas_fd;          /*!< Socket of the connection */
+    atomic_llong eas_since;     /*!< Login time */
+    atomic_ullong eas_frames;   /*!< Frames received */
+    atomic_ullong eas_bytes;    /*!< Bytes received, headers included */
+    _Atomic uint64_t eas_name[ ECHO_ADMIN_NAME / 8 ];   /*!< Username */
+} echo_admin_session_t;
+
+/*! Consistent copy of a session */
+typedef struct
+{
+    uint32_t eav_id;                    /*!< Connection ID */
+    int eav_fd;                         /*!< Socket of the connection */
+    time_t eav_since;                   /*!< Login time */
+    unsigned long long eav_frames;      /*!< Frames received */
+    unsigned long long eav_bytes;       /*!< Bytes received */
+    char eav_name[ ECHO_ADMIN_NAME ];   /*!< Username */
+    unsigned int eav_sequence;          /*!< Sequence count copied at */
+} echo_admin_view_t;
+
+/*! Command handler: returns NULL on success, otherwise the reason of the
+ *  failure. Runs on the admin thread. */
+typedef const char *( *echo_admin_handler_t )( int argc, char *argv[ ],
+        FILE *out, void *arg );
+
+/*! Opaque admin socket */
+typedef struct echo_admin echo_admin_t;
+
+/*! \fn echo_admin_t *echo_admin_create( const char *path, echo_admin_handler_t handler, void *arg, int *err )
+ *  \brief Binds the admin socket, readable and writable by the owner only,
+ *  and starts its thread. A file left at path by a server gone is
+ *  replaced.
+ *  \param[in] path The path of the socket.
+ *  \param[in] handler The handler of the commands.
+ *  \param[in] arg The argument passed to the handler.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new admin socket is returned. Otherwise NULL is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided, or path too long.
+ *  \exception EADDRINUSE A server already listens at path.
+ *  \exception EEXIST Something other than a socket is at path.
+ *  \exception ENOMEM No memory available.
+ */
+extern echo_admin_t *echo_admin_create( const char *path,
+        echo_admin_handler_t handler, void *arg, int *err );
+
+/*! \fn echo_admin_session_t *echo_admin_open( echo_admin_t *admin, uint32_t id, int fd, const char *name )
+ *  \brief Publishes a session. Called by the connection's thread.
+ *  \param[in] admin The admin socket.
+ *  \param[in] id The connection ID.
+ *  \param[in] fd The socket of the connection.
+ *  \param[in] name The username.
+ *  \return The slot of the session, or NULL when every slot is taken and
+ *  the session is not listed.
+ */
+extern echo_admin_session_t *echo_admin_open( echo_admin_t *admin,
+        uint32_t id, int fd, const char *name );
+
+/*! \fn void echo_admin_count( echo_admin_session_t *session, size_t bytes )
+ *  \brief Counts a frame received. Called by the connection's thread, it
+ *  costs two plain stores. A copy made meanwhile may count the frame in
+ *  one of the totals only.
+ *  \param[in] session The slot, may be NULL.
+ *  \param[in] bytes The size of the frame, header included.
+ */
+extern void echo_admin_count( echo_admin_session_t *session, size_t bytes );
+
+/*! \fn void echo_admin_close( echo_admin_session_t *session )
+ *  \brief Withdraws a session, before its socket is closed. Called by the
+ *  connection's thread.
+ *  \param[in] session The slot, may be NULL.
+ */
+extern void echo_admin_close( echo_admin_session_t *session );
+
+/*! \fn int echo_admin_view( const echo_admin_session_t *session, echo_admin_view_t *view )
+ *  \brief Copies a session without stopping its thread.
+ *  \param[in] session The slot.
+ *  \param[out] view The copy.
+ *  \return 1 when the copy was made, 0 when the slot is empty or changed
+ *  under every try.
+ */
+extern int echo_admin_view( const echo_admin_session_t *session,
+        echo_admin_view_t *view );
+
+/*! \fn int echo_admin_same( const echo_admin_session_t *session, const echo_admin_view_t *view )
+ *  \brief Tells whether a slot still holds the session copied, so that
+ *  what was learned from its socket in the meantime is known to be that
+ *  session's.
+ *  \param[in] session The slot.
+ *  \param[in] view The copy.
+ *  \return 1 when it does, 0 otherwise.
+ */
+extern int echo_admin_same( const echo_admin_session_t *session,
+        const echo_admin_view_t *view );
+
+/*! \fn echo_admin_session_t *echo_admin_slot( echo_admin_t *admin, size_t i )
+ *  \brief Gives a slot of the table, for the handler to walk.
+ *  \param[in] admin The admin socket.
+ *  \param[in] i The index of the slot, below ECHO_ADMIN_SLOTS.
+ *  \return The slot.
+ */
+extern echo_admin_session_t *echo_admin_slot( echo_admin_t *admin,
+        size_t i );
+
+/*! \fn void echo_admin_stop( echo_admin_t *admin )
+ *  \brief Stops the thread, closes the socket and removes its file. The
+ *  table stays, connection threads winding down may still close their
+ *  sessions.
+ *  \param[in] admin The admin socket.
+ */
+extern void echo_admin_stop( echo_admin_t *admin );
+
+/*! \fn void echo_admin_destroy( echo_admin_t *admin )
+ *  \brief Stops the admin socket if it runs, and frees it with its table.
+ *  Sessions must be closed first.
+ *  \param[in] admin The admin socket.
+ */
+extern void echo_admin_destroy( echo_admin_t *admin );
+
+#endif /* ECHOADMIN_H */
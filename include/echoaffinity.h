@@ -0,0 +1,88 @@
+#ifndef ECHOAFFINITY_H
+#define ECHOAFFINITY_H
+
+/*! \file echoaffinity.h
+ *  \brief Contains definitions for the placement of threads on CPUs and
+ *  NUMA nodes.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#define ECHO_AFFINITY_CPUS  1024
+
+/*! Opaque set of CPUs threads are spread over */
+typedef struct echo_affinity echo_affinity_t;
+
+/*! \fn echo_affinity_t *echo_affinity_create( const char *list, int *err )
+ *  \brief Creates a CPU set from a list such as "0-3,8,10-11", which must
+ *  only name CPUs the process may run on. The NUMA node of every CPU is
+ *  read from sysfs.
+ *  \param[in] list The CPU list, NULL for every allowed CPU.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new CPU set is returned. Otherwise NULL is returned
+ *  and err parameter is set appropriately.
+ *  \exception EINVAL Malformed list or CPU not allowed.
+ *  \exception ENOMEM No memory available.
+ */
+extern echo_affinity_t *echo_affinity_create( const char *list, int *err );
+
+/*! \fn size_t echo_affinity_cpus( const echo_affinity_t *affinity )
+ *  \brief Counts the CPUs of a set.
+ *  \param[in] affinity The CPU set.
+ *  \return The number of CPUs.
+ */
+extern size_t echo_affinity_cpus( const echo_affinity_t *affinity );
+
+/*! \fn int echo_affinity_node( const echo_affinity_t *affinity, int cpu )
+ *  \brief Gets the NUMA node of a CPU of the set.
+ *  \param[in] affinity The CPU set.
+ *  \param[in] cpu The CPU number.
+ *  \return The node number, zero on hosts without NUMA information and -1
+ *  for CPUs outside the set.
+ */
+extern int echo_affinity_node( const echo_affinity_t *affinity, int cpu );
+
+/*! \fn int echo_affinity_place( echo_affinity_t *affinity, pthread_attr_t *attr, int *err )
+ *  \brief Picks the CPU running the fewest placed threads and pins the
+ *  thread created with attr to it. Memory the thread allocates and touches
+ *  first then comes from that CPU's node.
+ *  \param[in] affinity The CPU set.
+ *  \param[in,out] attr The attributes of the thread to be created.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the CPU number is returned, to be handed to
+ *  echo_affinity_leave once the thread ends. Otherwise -1 is returned and
+ *  err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ */
+extern int echo_affinity_place( echo_affinity_t *affinity,
+        pthread_attr_t *attr, int *err );
+
+/*! \fn void echo_affinity_leave( echo_affinity_t *affinity, int cpu )
+ *  \brief Accounts for a placed thread that ended or was never started.
+ *  \param[in] affinity The CPU set.
+ *  \param[in] cpu The CPU returned by echo_affinity_place.
+ */
+extern void echo_affinity_leave( echo_affinity_t *affinity, int cpu );
+
+/*! \fn int echo_affinity_current( void )
+ *  \brief Gets the CPU the calling thread runs on.
+ *  \return The CPU number, or -1 when it cannot be told.
+ */
+extern int echo_affinity_current( void );
+
+/*! \fn void echo_affinity_report( echo_affinity_t *affinity, FILE *file )
+ *  \brief Writes the threads placed on every CPU of the set, as
+ *  "cpu N node M threads LIVE placed TOTAL" lines.
+ *  \param[in] affinity The CPU set.
+ *  \param[in] file The stream written to.
+ */
+extern void echo_affinity_report( echo_affinity_t *affinity, FILE *file );
+
+/*! \fn void echo_affinity_destroy( echo_affinity_t *affinity )
+ *  \brief Destroys a CPU set.
+ *  \param[in] affinity The CPU set to be destroyed.
+ */
+extern void echo_affinity_destroy( echo_affinity_t *affinity );
+
+#endif /* ECHOAFFINITY_H */
@@ -0,0 +1,115 @@
+#ifndef ECHOARENA_H
+#define ECHOARENA_H
+
+/*! \file echoarena.h
+ *  \brief Contains definitions for the I/O buffer arena, one mapping
+ *  carved into fixed-size chunks that connections check out and return.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#define ECHO_ARENA_CHUNK    8192
+#define ECHO_ARENA_CHUNKS   1024
+#define ECHO_ARENA_HUGE     ( 2 * 1024 * 1024 )
+
+/*! Arena flags */
+enum
+{
+    ECHO_ARENA_HUGETLB = 0x01,  /*!< Ask for reserved huge pages first */
+    ECHO_ARENA_THP = 0x02       /*!< Ask for transparent huge pages */
+};
+
+/*! Backing the arena ended up with */
+enum
+{
+    ECHO_ARENA_PAGES,           /*!< Regular pages */
+    ECHO_ARENA_TRANSPARENT,     /*!< Transparent huge pages advised */
+    ECHO_ARENA_RESERVED         /*!< Reserved huge pages */
+};
+
+/*! Arena utilization */
+typedef struct
+{
+    size_t eu_chunks;       /*!< Chunks in the arena */
+    size_t eu_size;         /*!< Chunk size in bytes */
+    size_t eu_used;         /*!< Chunks checked out */
+    size_t eu_peak;         /*!< Most chunks ever checked out at once */
+    size_t eu_misses;       /*!< Checkouts refused on an empty arena */
+    int eu_backing;         /*!< ECHO_ARENA_PAGES and so on */
+} echo_arena_usage_t;
+
+/*! Opaque buffer arena */
+typedef struct echo_arena echo_arena_t;
+
+/*! \fn echo_arena_t *echo_arena_create( size_t size, size_t chunks, int flags, int *err )
+ *  \brief Maps an arena of chunks, rounded up to whole huge pages. Huge
+ *  pages that cannot be had are replaced by regular ones.
+ *  \param[in] size The chunk size, rounded up to a cache line.
+ *  \param[in] chunks The number of chunks.
+ *  \param[in] flags The ECHO_ARENA_* flags.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new arena is returned. Otherwise NULL is returned
+ *  and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
+ */
+extern echo_arena_t *echo_arena_create( size_t size, size_t chunks,
+        int flags, int *err );
+
+/*! \fn size_t echo_arena_prefault( echo_arena_t *arena, size_t chunks )
+ *  \brief Faults in the pages of the chunks a new arena hands out first,
+ *  so that the first checkouts do not take page faults. To be called
+ *  before any chunk is checked out.
+ *  \param[in] arena The arena.
+ *  \param[in] chunks The number of chunks, at most those of the arena.
+ *  \return The number of bytes faulted in.
+ */
+extern size_t echo_arena_prefault( echo_arena_t *arena, size_t chunks );
+
+/*! \fn void *echo_arena_get( echo_arena_t *arena, int *err )
+ *  \brief Checks a chunk out of the arena.
+ *  \param[in] arena The arena.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a chunk is returned. Otherwise NULL is returned and
+ *  err parameter is set appropriately.
+ *  \exception ENOBUFS Every chunk is checked out.
+ */
+extern void *echo_arena_get( echo_arena_t *arena, int *err );
+
+/*! \fn void echo_arena_put( echo_arena_t *arena, void *chunk )
+ *  \brief Returns a chunk to the arena.
+ *  \param[in] arena The arena.
+ *  \param[in] chunk The chunk returned by echo_arena_get.
+ */
+extern void echo_arena_put( echo_arena_t *arena, void *chunk );
+
+/*! \fn int echo_arena_owns( const echo_arena_t *arena, const void *chunk )
+ *  \brief Tells whether a buffer was carved from the arena.
+ *  \param[in] arena The arena.
+ *  \param[in] chunk The buffer.
+ *  \return Nonzero when the buffer lies in the arena.
+ */
+extern int echo_arena_owns( const echo_arena_t *arena, const void *chunk );
+
+/*! \fn void echo_arena_usage( echo_arena_t *arena, echo_arena_usage_t *usage )
+ *  \brief Reads the utilization of an arena.
+ *  \param[in] arena The arena.
+ *  \param[out] usage The utilization.
+ */
+extern void echo_arena_usage( echo_arena_t *arena,
+        echo_arena_usage_t *usage );
+
+/*! \fn void echo_arena_report( echo_arena_t *arena, FILE *file )
+ *  \brief Writes the utilization of an arena as "name=value" lines.
+ *  \param[in] arena The arena.
+ *  \param[in] file The stream written to.
+ */
+extern void echo_arena_report( echo_arena_t *arena, FILE *file );
+
+/*! \fn void echo_arena_destroy( echo_arena_t *arena )
+ *  \brief Unmaps an arena, every chunk must have been returned.
+ *  \param[in] arena The arena to be destroyed.
+ */
+extern void echo_arena_destroy( echo_arena_t *arena );
+
+#endif /* ECHOARENA_H */
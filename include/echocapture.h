@@ -0,0 +1,124 @@
+#ifndef ECHOCAPTURE_H
+#define ECHOCAPTURE_H
+
+/*! \file echocapture.h
+ *  \brief Contains definitions for traffic capture, which records the
+ *  frames the server receives to a file that the replay program plays back.
+ *
+ *  A capture file starts with the 4 bytes "ECAP", a 32-bit version and the
+ *  64-bit wall clock time of the start in nanoseconds. Records follow, each
+ *  one a ECHO_CAPTURE_HEADER bytes header, the time since the start in
+ *  nanoseconds on 64 bits, the connection ID and the payload length on 32
+ *  bits, the frame type and flags on 8, then the payload. Every number is
+ *  in network byte order.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#define ECHO_CAPTURE_VERSION    1
+#define ECHO_CAPTURE_PREAMBLE   16
+#define ECHO_CAPTURE_HEADER     18
+#define ECHO_CAPTURE_RING       ( 4 * 1024 * 1024 )
+#define ECHO_CAPTURE_PERIOD     10
+
+/*! Record type of a connection ending, no frame has type 0 */
+#define ECHO_CAPTURE_CLOSE      0
+
+/*! Record flag of a payload that was not kept, file data */
+#define ECHO_CAPTURE_ELIDED     0x80
+
+/*! Record read back from a capture file */
+typedef struct
+{
+    unsigned long long ecr_time;    /*!< Nanoseconds since the start */
+    uint32_t ecr_connection;        /*!< Connection the frame came on */
+    uint32_t ecr_length;            /*!< Payload length */
+    int ecr_type;                   /*!< Frame type or ECHO_CAPTURE_CLOSE */
+    int ecr_flags;                  /*!< Frame flags */
+} echo_capture_record_t;
+
+/*! Opaque capture */
+typedef struct echo_capture echo_capture_t;
+
+/*! \fn echo_capture_t *echo_capture_create( const char *path, size_t size, int *err )
+ *  \brief Creates a capture file and starts the thread that writes it.
+ *  \param[in] path The path of the file, truncated if it exists.
+ *  \param[in] size The size of the ring records wait in, a power of two.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new capture is returned. Otherwise NULL is returned
+ *  and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
+ *  \exception EAGAIN No thread could be started.
+ */
+extern echo_capture_t *echo_capture_create( const char *path, size_t size,
+        int *err );
+
+/*! \fn int echo_capture_record( echo_capture_t *capture, uint32_t connection, int type, int flags, const char *payload, size_t length, int *err )
+ *  \brief Copies a frame into the ring without taking a lock or making a
+ *  system call. Safe from any thread, records of one thread keep their
+ *  order.
+ *  \param[in] capture The capture.
+ *  \param[in] connection The ID of the connection.
+ *  \param[in] type The frame type, or ECHO_CAPTURE_CLOSE.
+ *  \param[in] flags The frame flags.
+ *  \param[in] payload The payload, or NULL to record its length alone.
+ *  \param[in] length The payload length in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception ENOBUFS The ring is full or the capture closed, the record is
+ *  dropped and counted if the ring was full.
+ */
+extern int echo_capture_record( echo_capture_t *capture, uint32_t connection,
+        int type, int flags, const char *payload, size_t length, int *err );
+
+/*! \fn unsigned long long echo_capture_dropped( echo_capture_t *capture )
+ *  \brief Counts the records dropped because the ring was full.
+ *  \param[in] capture The capture.
+ *  \return The number of records dropped.
+ */
+extern unsigned long long echo_capture_dropped( echo_capture_t *capture );
+
+/*! \fn void echo_capture_close( echo_capture_t *capture )
+ *  \brief Stops the writer thread, writes out what is left in the ring and
+ *  closes the file. Records made from then on are dropped, the capture
+ *  itself stays valid for threads still winding down.
+ *  \param[in] capture The capture.
+ */
+extern void echo_capture_close( echo_capture_t *capture );
+
+/*! \fn void echo_capture_destroy( echo_capture_t *capture )
+ *  \brief Closes the capture if it is still open and frees it. No record
+ *  may be made once it is called.
+ *  \param[in] capture The capture to be destroyed.
+ */
+extern void echo_capture_destroy( echo_capture_t *capture );
+
+/*! \fn FILE *echo_capture_open( const char *path, int *err )
+ *  \brief Opens a capture file for reading and checks its preamble.
+ *  \param[in] path The path of the file.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the file positioned at the first record is returned.
+ *  Otherwise NULL is returned and err parameter is set appropriately.
+ *  \exception EINVAL Not a capture file, or of another version.
+ */
+extern FILE *echo_capture_open( const char *path, int *err );
+
+/*! \fn int echo_capture_read( FILE *file, echo_capture_record_t *record, char *buffer, size_t size, int *err )
+ *  \brief Reads the next record of a capture file.
+ *  \param[in] file The file, as returned by echo_capture_open.
+ *  \param[out] record The record.
+ *  \param[out] buffer The buffer that holds the payload.
+ *  \param[in] size The buffer size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 1 is returned, 0 at the end of the file. Otherwise -1
+ *  is returned and err parameter is set appropriately.
+ *  \exception EMSGSIZE The payload does not fit in the buffer.
+ *  \exception EIO The file ends in the middle of a record.
+ */
+extern int echo_capture_read( FILE *file, echo_capture_record_t *record,
+        char *buffer, size_t size, int *err );
+
+#endif /* ECHOCAPTURE_H */
@@ -0,0 +1,238 @@
+#ifndef ECHOCLIENT_H
+#define ECHOCLIENT_H
+
+/*! \file echoclient.h
+ *  \brief Contains definitions for the event driven client library, which
+ *  runs any number of chat sessions on one thread.
+ */
+
+#include "echoclientcontext.h"
+#define ECHO_CLIENT_CHUNK   4096
+#define ECHO_CLIENT_FRAME   ( ECHO_FRAME_HEADER + ECHO_FRAME_MAX )
+#define ECHO_CLIENT_EVENTS  256
+
+/*! Opaque I/O loop shared by sessions */
+typedef struct echo_client_loop echo_client_loop_t;
+
+/*! Opaque chat session */
+typedef struct echo_session echo_session_t;
+
+/*! Session callbacks, any of which may be NULL */
+typedef struct
+{
+    /*! Called once the server answered the login */
+    void ( *eh_login )( echo_session_t *session, int accepted, void *arg );
+    /*! Called for every frame the server sends after the login */
+    void ( *eh_message )( echo_session_t *session, int type,
+            const char *payload, size_t size, void *arg );
+    /*! Called when every queued frame has been written */
+    void ( *eh_drain )( echo_session_t *session, void *arg );
+    /*! Called when the session ends, err is zero on an orderly close. The
+     *  session is destroyed right after. */
+    void ( *eh_close )( echo_session_t *session, int err, void *arg );
+} echo_session_handler_t;
+
+/*! \fn echo_client_loop_t *echo_client_loop_create( size_t chunks, int *err )
+ *  \brief Creates an I/O loop and its buffer pool.
+ *  \param[in] chunks The number of ECHO_CLIENT_CHUNK bytes buffers kept in
+ *  the pool, more are allocated on demand. Sessions with more pending than
+ *  a pooled buffer holds get one sized for it, up to ECHO_CLIENT_FRAME
+ *  bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new loop is returned. Otherwise NULL is returned
+ *  and err parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ *  \exception EMFILE Too many open files.
+ */
+extern echo_client_loop_t *echo_client_loop_create( size_t chunks,
+        int *err );
+
+/*! \fn int echo_client_loop_watch( echo_client_loop_t *loop, int fd, void ( *callback )( int fd, void *arg ), void *arg, int *err )
+ *  \brief Calls back whenever a file descriptor is readable, which lets
+ *  applications drive their own input from the loop.
+ *  \param[in] loop The I/O loop.
+ *  \param[in] fd The file descriptor to be watched.
+ *  \param[in] callback The function called when fd is readable.
+ *  \param[in] arg The argument handed to callback.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EEXIST The descriptor is already watched.
+ *  \exception EPERM The descriptor does not support polling.
+ */
+extern int echo_client_loop_watch( echo_client_loop_t *loop, int fd,
+        void ( *callback )( int fd, void *arg ), void *arg, int *err );
+
+/*! \fn void echo_client_loop_unwatch( echo_client_loop_t *loop, int fd )
+ *  \brief Stops watching a file descriptor.
+ *  \param[in] loop The I/O loop.
+ *  \param[in] fd The file descriptor no longer watched.
+ */
+extern void echo_client_loop_unwatch( echo_client_loop_t *loop, int fd );
+
+/*! \fn int echo_client_loop_run( echo_client_loop_t *loop, int timeout, int *err )
+ *  \brief Waits for I/O and dispatches it to sessions and watchers once,
+ *  then writes every frame queued meanwhile.
+ *  \param[in] loop The I/O loop.
+ *  \param[in] timeout Maximum wait in milliseconds, -1 waits forever.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the number of events handled is returned. Otherwise
+ *  -1 is returned and err parameter is set appropriately.
+ */
+extern int echo_client_loop_run( echo_client_loop_t *loop, int timeout,
+        int *err );
+
+/*! \fn size_t echo_client_loop_sessions( const echo_client_loop_t *loop )
+ *  \brief Counts the sessions that are still open.
+ *  \param[in] loop The I/O loop.
+ *  \return The number of open sessions.
+ */
+extern size_t echo_client_loop_sessions( const echo_client_loop_t *loop );
+
+/*! \fn void echo_client_loop_destroy( echo_client_loop_t *loop )
+ *  \brief Destroys a loop along with its remaining sessions, without
+ *  calling their handlers.
+ *  \param[in] loop The loop to be destroyed.
+ */
+extern void echo_client_loop_destroy( echo_client_loop_t *loop );
+
+/*! \fn echo_session_t *echo_client_loop_connect( echo_client_loop_t *loop, const char *host, int port, const echo_session_handler_t *handler, void *arg, int *err )
+ *  \brief Starts connecting a new session to a server.
+ *  \param[in] loop The loop on which the session runs.
+ *  \param[in] host The server's hostname.
+ *  \param[in] port The server's port number.
+ *  \param[in] handler The session callbacks, copied by the session.
+ *  \param[in] arg The argument handed to the callbacks.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new session is returned. Otherwise NULL is
+ *  returned and err parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ *  \exception EHOSTNOTFOUND The host name could not be resolved.
+ *  \exception ECONNREFUSED No-one listening on the remote address.
+ */
+extern echo_session_t *echo_client_loop_connect( echo_client_loop_t *loop,
+        const char *host, int port, const echo_session_handler_t *handler,
+        void *arg, int *err );
+
+/*! \fn int echo_session_login( echo_session_t *session, const char *uname, int features, int *err )
+ *  \brief Queues the login of a session, which may be done before the
+ *  connection completes.
+ *  \param[in] session The session.
+ *  \param[in] uname The username.
+ *  \param[in] features The ECHO_FEATURE_* bits asked for.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Username too long or session already logged in.
+ */
+extern int echo_session_login( echo_session_t *session, const char *uname,
+        int features, int *err );
+
+/*! \fn int echo_session_send( echo_session_t *session, const char *text, size_t size, int *err )
+ *  \brief Queues a chat message. Messages queued during one iteration of
+ *  the loop are written together. The server reads no more than
+ *  ECHO_FRAME_TEXT_MAX bytes of text and drops members sending more.
+ *  \param[in] session The session.
+ *  \param[in] text The message.
+ *  \param[in] size The message size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE The message is longer than ECHO_FRAME_TEXT_MAX.
+ *  \exception EAGAIN The output buffer is full, wait for eh_drain.
+ *  \exception EPIPE The session is closing.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_session_send( echo_session_t *session, const char *text,
+        size_t size, int *err );
+
+/*! \fn int echo_session_direct( echo_session_t *session, const char *to, const char *text, size_t size, int *err )
+ *  \brief Queues a private message to one user. The server answers with
+ *  an ECHO_FRAME_ERROR frame when the user is not online.
+ *  \param[in] session The session.
+ *  \param[in] to The username of the recipient.
+ *  \param[in] text The message.
+ *  \param[in] size The message size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid recipient or empty message.
+ *  \exception EMSGSIZE The recipient, its length byte and the message take
+ *  more than ECHO_FRAME_TEXT_MAX bytes.
+ *  \exception EAGAIN The output buffer is full, wait for eh_drain.
+ *  \exception EPIPE The session is closing.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_session_direct( echo_session_t *session, const char *to,
+        const char *text, size_t size, int *err );
+
+/*! \fn int echo_session_offer( echo_session_t *session, const char *name, int *err )
+ *  \brief Queues the start of a file transfer to the members of the
+ *  server. The data follows with echo_session_chunk and the transfer ends
+ *  with echo_session_end, chat messages may be sent in between. Members
+ *  get ECHO_FRAME_OFFER, ECHO_FRAME_CHUNK and ECHO_FRAME_END frames
+ *  starting with the ID the server gave the transfer.
+ *  \param[in] session The session.
+ *  \param[in] name The file name shown to the members.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Empty name.
+ *  \exception EMSGSIZE The name is longer than ECHO_FRAME_TEXT_MAX.
+ *  \exception EAGAIN The output buffer is full, wait for eh_drain.
+ *  \exception EPIPE The session is closing.
+ */
+extern int echo_session_offer( echo_session_t *session, const char *name,
+        int *err );
+
+/*! \fn int echo_session_chunk( echo_session_t *session, const char *data, size_t size, int *err )
+ *  \brief Queues the next piece of the file being transferred. Pieces are
+ *  never compressed, ECHO_FRAME_CHUNK_SIZE bytes at a time leave room for
+ *  chat messages between them.
+ *  \param[in] session The session.
+ *  \param[in] data The file data.
+ *  \param[in] size The data size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL No data.
+ *  \exception EAGAIN The output buffer is full, wait for eh_drain.
+ *  \exception EPIPE The session is closing.
+ */
+extern int echo_session_chunk( echo_session_t *session, const char *data,
+        size_t size, int *err );
+
+/*! \fn int echo_session_end( echo_session_t *session, int *err )
+ *  \brief Queues the end of the file being transferred.
+ *  \param[in] session The session.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EAGAIN The output buffer is full, wait for eh_drain.
+ *  \exception EPIPE The session is closing.
+ */
+extern int echo_session_end( echo_session_t *session, int *err );
+
+/*! \fn size_t echo_session_pending( const echo_session_t *session )
+ *  \brief Counts the bytes queued but not written yet.
+ *  \param[in] session The session.
+ *  \return The number of bytes waiting.
+ */
+extern size_t echo_session_pending( const echo_session_t *session );
+
+/*! \fn const char *echo_session_uname( const echo_session_t *session )
+ *  \brief Gets the username of a session.
+ *  \param[in] session The session.
+ *  \return The username, empty before echo_session_login.
+ */
+extern const char *echo_session_uname( const echo_session_t *session );
+
+/*! \fn void echo_session_close( echo_session_t *session )
+ *  \brief Closes a session once its queued frames are written. The
+ *  session keeps receiving until the server hangs up, then eh_close is
+ *  called.
+ *  \param[in] session The session to be closed.
+ */
+extern void echo_session_close( echo_session_t *session );
+
+#endif /* ECHOCLIENT_H */
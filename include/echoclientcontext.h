@@ -6,13 +6,21 @@
  */
 
 #include "tcpcontext.h"
+#include "echoframe.h"
+#include "echocompress.h"
+#include "echointern.h"
 #define MAX_LENGTH 64
 
 /*! Echo client context */
 typedef struct
 {
     char eec_uname[ MAX_LENGTH ];   /*!< Client's username */
+    const echo_name_t *eec_name;    /*!< Shared copy of it, if interned */
     tcp_context_t *eec_tcp;         /*!< Client's TCP context */
+    int eec_features;               /*!< Negotiated ECHO_FEATURE_* bits */
+    echo_compress_t *eec_zctx;      /*!< Compression streams, if any */
+    char *eec_zbuf;                 /*!< Compression scratch buffers */
+    echo_frame_reader_t *eec_reader;    /*!< Read-ahead, if any */
 } echo_client_context_t;
 
 /*! \fn void echo_client_context_strerror( int errnum, char *buf, size_t buflen )
@@ -27,7 +35,8 @@ extern void echo_client_context_strerror( int errrnum, char *buf,
 /*! \fn echo_client_context_t *echo_client_context_create( tcp_context_t *ctx, const char *uname, int *err )
  *  \brief Creates a client context.
  *  \param[in] ctx The tcp context used for client communications.
- *  \param[in] uname The username associated with the client context.
+ *  \param[in] uname The username associated with the client context,
+ *  shorter than MAX_LENGTH.
  *  \param[out] err The error code returned in case of failure.
  *  \return On success a new echo client context is returned. Otherwise NULL
  *  is returned and err parameter is set appropriately.
@@ -37,6 +46,140 @@ extern void echo_client_context_strerror( int errrnum, char *buf,
 extern echo_client_context_t *echo_client_context_create( 
         tcp_context_t *ctx, const char *uname, int *err );
 
+/*! \fn int echo_client_context_set_features( echo_client_context_t *eec, int features, int *err )
+ *  \brief Enables the features negotiated for the client's connection.
+ *  \param[in] eec The client context.
+ *  \param[in] features The negotiated ECHO_FEATURE_* bits.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ *  \exception ENOTSUP Feature not built in.
+ */
+extern int echo_client_context_set_features( echo_client_context_t *eec,
+        int features, int *err );
+
+/*! \fn ssize_t echo_client_context_send( echo_client_context_t *eec, int type, const char *buffer, size_t size, int *err )
+ *  \brief Sends a frame over the client's connection, compressing it with
+ *  the connection's stream when compression was negotiated.
+ *  \param[in] eec The client context.
+ *  \param[in] type The frame type.
+ *  \param[in] buffer The frame payload.
+ *  \param[in] size The payload size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the payload size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE Payload larger than ECHO_FRAME_MAX.
+ */
+extern ssize_t echo_client_context_send( echo_client_context_t *eec,
+        int type, const char *buffer, size_t size, int *err );
+
+/*! \fn ssize_t echo_client_context_sendv( echo_client_context_t *eec, int type, const struct iovec *parts, int count, int *err )
+ *  \brief Sends a frame gathered from several parts over the client's
+ *  connection, as echo_client_context_send does. The parts are copied
+ *  into one buffer only when the connection's stream compresses them.
+ *  \param[in] eec The client context.
+ *  \param[in] type The frame type.
+ *  \param[in] parts The payload parts, in order.
+ *  \param[in] count The number of parts, at most ECHO_FRAME_PARTS.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the payload size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE Payload larger than ECHO_FRAME_MAX.
+ *  \exception ENOMEM No memory available.
+ */
+extern ssize_t echo_client_context_sendv( echo_client_context_t *eec,
+        int type, const struct iovec *parts, int count, int *err );
+
+/*! \fn ssize_t echo_client_context_recv( echo_client_context_t *eec, echo_frame_t *frame, char *buffer, size_t size, int *err )
+ *  \brief Receives a frame over the client's connection and decompresses
+ *  its payload if needed. The frame length is that of the plain payload.
+ *  \param[in] eec The client context.
+ *  \param[out] frame The received frame header.
+ *  \param[out] buffer The buffer that holds the payload.
+ *  \param[in] size Maximum size of buffer.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the number of bytes consumed from the wire is
+ *  returned. Zero is returned when the peer closes the connection.
+ *  Otherwise -1 is returned and err parameter is set appropriately.
+ *  \exception EINVAL Compressed frame on a plain connection.
+ *  \exception EMSGSIZE Payload does not fit in buffer.
+ */
+extern ssize_t echo_client_context_recv( echo_client_context_t *eec,
+        echo_frame_t *frame, char *buffer, size_t size, int *err );
+
+/*! \fn int echo_client_context_recv_header( echo_client_context_t *eec, echo_frame_t *frame, int *err )
+ *  \brief Receives the header of the next frame alone, see
+ *  echo_frame_recv_header.
+ *  \param[in] eec The client context.
+ *  \param[out] frame The received frame header, with the wire length.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 1 is returned. Zero is returned when the peer closes
+ *  the connection. Otherwise -1 is returned and err parameter is set
+ *  appropriately.
+ *  \exception ECONNRESET Connection closed in the middle of the header.
+ */
+extern int echo_client_context_recv_header( echo_client_context_t *eec,
+        echo_frame_t *frame, int *err );
+
+/*! \fn int echo_client_context_recv_payload( echo_client_context_t *eec, echo_frame_t *frame, char *buffer, size_t size, int *err )
+ *  \brief Receives and decompresses the payload of a frame whose header was
+ *  received. The frame length becomes that of the plain payload.
+ *  \param[in] eec The client context.
+ *  \param[in,out] frame The frame header.
+ *  \param[out] buffer The buffer that holds the payload.
+ *  \param[in] size Maximum size of buffer.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Compressed frame on a plain connection.
+ *  \exception EMSGSIZE Payload does not fit in buffer.
+ *  \exception ECONNRESET Connection closed in the middle of the payload.
+ */
+extern int echo_client_context_recv_payload( echo_client_context_t *eec,
+        echo_frame_t *frame, char *buffer, size_t size, int *err );
+
+/*! \fn ssize_t echo_client_context_pack( echo_client_context_t *eec, int type, const char *buffer, size_t size, char *out, size_t outlen, int *err )
+ *  \brief Encodes a whole frame into a buffer, compressing it like
+ *  echo_client_context_send would, so that several frames can be written
+ *  with a single call.
+ *  \param[in] eec The client context.
+ *  \param[in] type The frame type.
+ *  \param[in] buffer The frame payload.
+ *  \param[in] size The payload size in bytes.
+ *  \param[out] out The buffer that holds the encoded frame.
+ *  \param[in] outlen Maximum size of out.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the encoded size, header included, is returned.
+ *  Otherwise -1 is returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE The frame does not fit in out.
+ */
+extern ssize_t echo_client_context_pack( echo_client_context_t *eec,
+        int type, const char *buffer, size_t size, char *out,
+        size_t outlen, int *err );
+
+/*! \fn ssize_t echo_client_context_unpack( echo_client_context_t *eec, const char *wire, size_t len, echo_frame_t *frame, char *buffer, size_t size, int *err )
+ *  \brief Decodes the first frame held by a buffer of received bytes.
+ *  \param[in] eec The client context.
+ *  \param[in] wire The received bytes.
+ *  \param[in] len The number of received bytes.
+ *  \param[out] frame The decoded frame header.
+ *  \param[out] buffer The buffer that holds the plain payload.
+ *  \param[in] size Maximum size of buffer.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the number of bytes consumed from wire is returned.
+ *  Zero is returned when wire does not hold a whole frame yet. Otherwise -1
+ *  is returned and err parameter is set appropriately.
+ *  \exception EINVAL Compressed frame on a plain connection.
+ *  \exception EMSGSIZE Payload does not fit in buffer.
+ */
+extern ssize_t echo_client_context_unpack( echo_client_context_t *eec,
+        const char *wire, size_t len, echo_frame_t *frame, char *buffer,
+        size_t size, int *err );
+
 /*! \fn void echo_client_context_destroy( echo_client_context_t *eec )
  *  \brief Destroys an echo client context.
  *  \param[in] eec The context to be destroyed.
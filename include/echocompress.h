@@ -0,0 +1,110 @@
+#ifndef ECHOCOMPRESS_H
+#define ECHOCOMPRESS_H
+
+/*! \file echocompress.h
+ *  \brief Contains definitions for the per-connection compression streams.
+ */
+
+#include <stdlib.h>
+#include <sys/types.h>
+#define ECHO_COMPRESS_MIN 128
+
+/*! Opaque compression context holding a deflate and an inflate stream */
+typedef struct echo_compress echo_compress_t;
+
+/*! \fn void echo_compress_strerror( int errnum, char *buf, size_t buflen )
+ *  \brief Outputs an error associated with compression.
+ *  \param[in] errnum The error code number.
+ *  \param[out] buf The buffer that holds the error message.
+ *  \param[in] buflen The length of the buffer.
+ */
+extern void echo_compress_strerror( int errnum, char *buf, size_t buflen );
+
+/*! \fn int echo_compress_available( void )
+ *  \brief Tells whether the build supports compression.
+ *  \return Non-zero if compression is available, zero otherwise.
+ */
+extern int echo_compress_available( void );
+
+/*! \fn echo_compress_t *echo_compress_create( int *err )
+ *  \brief Creates a compression context for one connection.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new context is returned. Otherwise NULL is
+ *  returned and err parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ *  \exception ENOTSUP Compression not built in.
+ */
+extern echo_compress_t *echo_compress_create( int *err );
+
+/*! \fn ssize_t echo_compress_deflate( echo_compress_t *z, const char *in, size_t inlen, char *out, size_t outlen, int *err )
+ *  \brief Compresses a message with the connection's deflate stream.
+ *  The output only decompresses in order, with the peer's inflate stream.
+ *  \param[in] z The compression context.
+ *  \param[in] in The message to be compressed.
+ *  \param[in] inlen The message size in bytes.
+ *  \param[out] out The buffer that holds the compressed message.
+ *  \param[in] outlen Maximum size of out.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the compressed size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE Output does not fit in out.
+ */
+extern ssize_t echo_compress_deflate( echo_compress_t *z, const char *in,
+        size_t inlen, char *out, size_t outlen, int *err );
+
+/*! \fn ssize_t echo_compress_inflate( echo_compress_t *z, const char *in, size_t inlen, char *out, size_t outlen, int *err )
+ *  \brief Decompresses a message with the connection's inflate stream.
+ *  \param[in] z The compression context.
+ *  \param[in] in The compressed message.
+ *  \param[in] inlen The compressed size in bytes.
+ *  \param[out] out The buffer that holds the message.
+ *  \param[in] outlen Maximum size of out.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the message size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument or corrupted stream.
+ *  \exception EMSGSIZE Output does not fit in out.
+ */
+extern ssize_t echo_compress_inflate( echo_compress_t *z, const char *in,
+        size_t inlen, char *out, size_t outlen, int *err );
+
+/*! \fn ssize_t echo_compress_block_deflate( const char *in, size_t inlen, char *out, size_t outlen, int *err )
+ *  \brief Compresses a message as a standalone block. The block carries no
+ *  stream history so it can be shared among any number of recipients.
+ *  \param[in] in The message to be compressed.
+ *  \param[in] inlen The message size in bytes.
+ *  \param[out] out The buffer that holds the compressed block.
+ *  \param[in] outlen Maximum size of out.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the compressed size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EMSGSIZE Output does not fit in out.
+ *  \exception ENOTSUP Compression not built in.
+ */
+extern ssize_t echo_compress_block_deflate( const char *in, size_t inlen,
+        char *out, size_t outlen, int *err );
+
+/*! \fn ssize_t echo_compress_block_inflate( const char *in, size_t inlen, char *out, size_t outlen, int *err )
+ *  \brief Decompresses a standalone block.
+ *  \param[in] in The compressed block.
+ *  \param[in] inlen The compressed size in bytes.
+ *  \param[out] out The buffer that holds the message.
+ *  \param[in] outlen Maximum size of out.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the message size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Corrupted block.
+ *  \exception EMSGSIZE Output does not fit in out.
+ *  \exception ENOTSUP Compression not built in.
+ */
+extern ssize_t echo_compress_block_inflate( const char *in, size_t inlen,
+        char *out, size_t outlen, int *err );
+
+/*! \fn void echo_compress_destroy( echo_compress_t *z )
+ *  \brief Destroys a compression context.
+ *  \param[in] z The context to be destroyed.
+ */
+extern void echo_compress_destroy( echo_compress_t *z );
+
+#endif /* ECHOCOMPRESS_H */
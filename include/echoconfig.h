@@ -0,0 +1,49 @@
+#ifndef ECHOCONFIG_H
+#define ECHOCONFIG_H
+
+/*! \file echoconfig.h
+ *  \brief Contains definitions for configuration files, which hold the
+ *  long options of a program one per line.
+ *
+ *  A line is a name followed by its value, with an optional "=" between
+ *  them, or a name alone for a flag. Blank lines and those starting with
+ *  "#" are skipped. Each line becomes one argument, "--name=value" or
+ *  "--name", and those read are put ahead of the command line's, which
+ *  therefore win.
+ */
+
+#include <stddef.h>
+#define ECHO_CONFIG_LINE    1024
+
+/*! Options read from a file, followed by those of the command line */
+typedef struct
+{
+    int ec_argc;        /*!< Number of arguments */
+    char **ec_argv;     /*!< Arguments, terminated by NULL */
+    int ec_read;        /*!< Arguments read, after the program */
+} echo_config_t;
+
+/*! \fn echo_config_t *echo_config_load( const char *path, int argc, char *argv[ ], size_t *line, int *err )
+ *  \brief Reads a configuration file into arguments for getopt_long.
+ *  \param[in] path The path of the file.
+ *  \param[in] argc The number of arguments of the command line.
+ *  \param[in] argv The arguments of the command line, the program first.
+ *  \param[out] line The line a syntax error was found on.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the arguments are returned, argv[ 0 ] first, then
+ *  those of the file, then the rest of argv. Otherwise NULL is returned
+ *  and err parameter is set appropriately.
+ *  \exception EINVAL A line is not an option, or is too long; line is set.
+ *  \exception ENOMEM No memory available.
+ *  \exception ENOENT No file at path, and the other errors of fopen.
+ */
+extern echo_config_t *echo_config_load( const char *path, int argc,
+        char *argv[ ], size_t *line, int *err );
+
+/*! \fn void echo_config_destroy( echo_config_t *config )
+ *  \brief Frees the arguments read, not those of the command line.
+ *  \param[in] config The arguments.
+ */
+extern void echo_config_destroy( echo_config_t *config );
+
+#endif /* ECHOCONFIG_H */
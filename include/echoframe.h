@@ -0,0 +1,264 @@
+#ifndef ECHOFRAME_H
+#define ECHOFRAME_H
+
+/*! \file echoframe.h
+ *  \brief Contains definitions for the length prefixed wire frames.
+ */
+
+#include <stdint.h>
+#include "tcpcontext.h"
+#define ECHO_FRAME_HEADER   8
+#define ECHO_FRAME_MAX      65536
+#define ECHO_FRAME_PARTS    8
+#define ECHO_FRAME_ID       4
+#define ECHO_FRAME_CHUNK_SIZE 16384
+#define ECHO_FRAME_TEXT_MAX 2047
+
+/*! Frame types */
+enum
+{
+    ECHO_FRAME_HELLO = 1,   /*!< Login request carrying the username */
+    ECHO_FRAME_ACCEPT,      /*!< Login accepted, flags hold the features */
+    ECHO_FRAME_REJECT,      /*!< Login rejected */
+    ECHO_FRAME_CHAT,        /*!< Chat text sent by a client */
+    ECHO_FRAME_TEXT,        /*!< Text to be displayed by a client */
+    ECHO_FRAME_PEER,        /*!< Peer link handshake carrying a node ID */
+    ECHO_FRAME_RELAY,       /*!< Message relayed between peers */
+    ECHO_FRAME_CONTROL,     /*!< Control message sent to one peer */
+    ECHO_FRAME_DIRECT,      /*!< Private message, recipient then text */
+    ECHO_FRAME_ERROR,       /*!< Error to be displayed by a client */
+    ECHO_FRAME_OFFER,       /*!< File offered, the name from a client, the
+                                 ID, sender, NUL and name to members */
+    ECHO_FRAME_CHUNK,       /*!< File data, after the ID to members */
+    ECHO_FRAME_END          /*!< File done, the ID and a status byte to
+                                 members, zero when complete */
+};
+
+/*! Frame flags */
+enum
+{
+    ECHO_FRAME_DEFLATE_STREAM = 0x01, /*!< Compressed with the link stream */
+    ECHO_FRAME_DEFLATE_BLOCK = 0x02   /*!< Compressed as a standalone block */
+};
+
+/*! Features negotiated by the HELLO and ACCEPT frames */
+enum
+{
+    ECHO_FEATURE_DEFLATE = 0x01 /*!< Per-connection deflate compression */
+};
+
+/*! Frame header */
+typedef struct
+{
+    uint32_t ef_length; /*!< Payload length in bytes */
+    uint8_t ef_type;    /*!< Frame type */
+    uint8_t ef_flags;   /*!< Frame flags */
+} echo_frame_t;
+
+/*! Read-ahead of a connection, whose frames are parsed out of whatever
+ *  one recv brought in instead of being read with a call for the header and
+ *  one for the payload each */
+typedef struct
+{
+    char *efr_buffer;               /*!< Bytes read ahead */
+    size_t efr_size;                /*!< Size of the buffer */
+    size_t efr_start;               /*!< First byte not consumed */
+    size_t efr_end;                 /*!< One past the last byte read */
+    unsigned long long efr_calls;   /*!< recv calls made */
+    unsigned long long efr_frames;  /*!< Headers parsed */
+} echo_frame_reader_t;
+
+/*! \fn void echo_frame_encode( const echo_frame_t *frame, unsigned char *buf )
+ *  \brief Serializes a frame header in network byte order.
+ *  \param[in] frame The frame header to be serialized.
+ *  \param[out] buf The buffer of at least ECHO_FRAME_HEADER bytes.
+ */
+extern void echo_frame_encode( const echo_frame_t *frame,
+        unsigned char *buf );
+
+/*! \fn void echo_frame_decode( const unsigned char *buf, echo_frame_t *frame )
+ *  \brief Deserializes a frame header.
+ *  \param[in] buf The buffer holding ECHO_FRAME_HEADER bytes.
+ *  \param[out] frame The decoded frame header.
+ */
+extern void echo_frame_decode( const unsigned char *buf,
+        echo_frame_t *frame );
+
+/*! \fn ssize_t echo_frame_send( tcp_context_t *ctx, int type, int flags, const char *payload, size_t size, int *err )
+ *  \brief Sends a frame to a TCP context.
+ *  \param[in] ctx The context to which the frame is sent.
+ *  \param[in] type The frame type.
+ *  \param[in] flags The frame flags.
+ *  \param[in] payload The frame payload, may be NULL if size is zero.
+ *  \param[in] size The payload size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the payload size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE Payload larger than ECHO_FRAME_MAX.
+ */
+extern ssize_t echo_frame_send( tcp_context_t *ctx, int type, int flags,
+        const char *payload, size_t size, int *err );
+
+/*! \fn ssize_t echo_frame_sendv( tcp_context_t *ctx, int type, int flags, const struct iovec *parts, int count, int *err )
+ *  \brief Sends a frame whose payload is gathered from several parts, the
+ *  header and the parts going out in one vectored write.
+ *  \param[in] ctx The context to which the frame is sent.
+ *  \param[in] type The frame type.
+ *  \param[in] flags The frame flags.
+ *  \param[in] parts The payload parts, in order.
+ *  \param[in] count The number of parts, at most ECHO_FRAME_PARTS.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the payload size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE Payload larger than ECHO_FRAME_MAX.
+ */
+extern ssize_t echo_frame_sendv( tcp_context_t *ctx, int type, int flags,
+        const struct iovec *parts, int count, int *err );
+
+/*! \fn size_t echo_frame_length( const struct iovec *parts, int count )
+ *  \brief Adds up the length of payload parts.
+ *  \param[in] parts The parts.
+ *  \param[in] count The number of parts.
+ *  \return The payload length in bytes.
+ */
+extern size_t echo_frame_length( const struct iovec *parts, int count );
+
+/*! \fn size_t echo_frame_gather( char *buffer, const struct iovec *parts, int count )
+ *  \brief Copies payload parts one after the other, for the consumers
+ *  that need the payload in one piece.
+ *  \param[out] buffer The buffer, large enough for every part.
+ *  \param[in] parts The parts.
+ *  \param[in] count The number of parts.
+ *  \return The payload length in bytes.
+ */
+extern size_t echo_frame_gather( char *buffer, const struct iovec *parts,
+        int count );
+
+/*! \fn ssize_t echo_frame_sendfile( tcp_context_t *ctx, int type, const struct iovec *parts, int count, int fd, off_t offset, size_t size, int *err )
+ *  \brief Sends a frame whose payload is the given parts followed by a
+ *  range of a file, which the kernel copies to the socket with sendfile.
+ *  \param[in] ctx The context to which the frame is sent.
+ *  \param[in] type The frame type.
+ *  \param[in] parts The payload parts ahead of the file data.
+ *  \param[in] count The number of parts, at most ECHO_FRAME_PARTS.
+ *  \param[in] fd The file.
+ *  \param[in] offset The offset of the data in the file.
+ *  \param[in] size The size of the data in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the payload size is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE Payload larger than ECHO_FRAME_MAX.
+ *  \exception EIO The file is shorter than the range.
+ */
+extern ssize_t echo_frame_sendfile( tcp_context_t *ctx, int type,
+        const struct iovec *parts, int count, int fd, off_t offset,
+        size_t size, int *err );
+
+/*! \fn int echo_frame_recv_header( tcp_context_t *ctx, echo_frame_t *frame, int *err )
+ *  \brief Receives the header of a frame alone, leaving its payload on the
+ *  socket for echo_frame_recv_payload or to be moved elsewhere.
+ *  \param[in] ctx The context from which the header is received.
+ *  \param[out] frame The received frame header.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 1 is returned. Zero is returned when the peer closes
+ *  the connection between frames. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ECONNRESET Connection closed in the middle of the header.
+ */
+extern int echo_frame_recv_header( tcp_context_t *ctx, echo_frame_t *frame,
+        int *err );
+
+/*! \fn int echo_frame_recv_payload( tcp_context_t *ctx, const echo_frame_t *frame, char *buffer, size_t size, int *err )
+ *  \brief Receives the payload of a frame whose header was received.
+ *  \param[in] ctx The context from which the payload is received.
+ *  \param[in] frame The frame header.
+ *  \param[out] buffer The buffer that holds the payload.
+ *  \param[in] size Maximum size of buffer.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE Payload does not fit in buffer, it is left unread.
+ *  \exception ECONNRESET Connection closed in the middle of the payload.
+ */
+extern int echo_frame_recv_payload( tcp_context_t *ctx,
+        const echo_frame_t *frame, char *buffer, size_t size, int *err );
+
+/*! \fn ssize_t echo_frame_recv( tcp_context_t *ctx, echo_frame_t *frame, char *buffer, size_t size, int *err )
+ *  \brief Receives a whole frame from a TCP context.
+ *  \param[in] ctx The context from which the frame is received.
+ *  \param[out] frame The received frame header.
+ *  \param[out] buffer The buffer that holds the payload.
+ *  \param[in] size Maximum size of buffer.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the number of bytes consumed, header included, is
+ *  returned and the payload length is held by the frame. Zero is returned
+ *  when the peer closes the connection between frames. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE Payload does not fit in buffer.
+ *  \exception ECONNRESET Connection closed in the middle of a frame.
+ */
+extern ssize_t echo_frame_recv( tcp_context_t *ctx, echo_frame_t *frame,
+        char *buffer, size_t size, int *err );
+
+/*! \fn void echo_frame_reader_init( echo_frame_reader_t *reader, char *buffer, size_t size )
+ *  \brief Sets a reader up with an empty buffer.
+ *  \param[out] reader The reader.
+ *  \param[in] buffer The buffer the bytes are read ahead into.
+ *  \param[in] size The size of buffer, at least ECHO_FRAME_HEADER.
+ */
+extern void echo_frame_reader_init( echo_frame_reader_t *reader,
+        char *buffer, size_t size );
+
+/*! \fn int echo_frame_reader_header( echo_frame_reader_t *reader, tcp_context_t *ctx, echo_frame_t *frame, int *err )
+ *  \brief Parses the next frame header, reading only when fewer bytes
+ *  than a header are held, and then as many as the buffer takes.
+ *  \param[in,out] reader The reader of the context.
+ *  \param[in] ctx The context from which the bytes are received.
+ *  \param[out] frame The received frame header.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 1 is returned. Zero is returned when the peer closes
+ *  the connection between frames. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ECONNRESET Connection closed in the middle of the header.
+ */
+extern int echo_frame_reader_header( echo_frame_reader_t *reader,
+        tcp_context_t *ctx, echo_frame_t *frame, int *err );
+
+/*! \fn int echo_frame_reader_payload( echo_frame_reader_t *reader, tcp_context_t *ctx, const echo_frame_t *frame, char *buffer, size_t size, int *err )
+ *  \brief Receives the payload of a frame whose header was parsed. A
+ *  payload the reader cannot hold is received into buffer directly past
+ *  the bytes already read ahead.
+ *  \param[in,out] reader The reader of the context.
+ *  \param[in] ctx The context from which the bytes are received.
+ *  \param[in] frame The frame header.
+ *  \param[out] buffer The buffer that holds the payload.
+ *  \param[in] size Maximum size of buffer.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE Payload does not fit in buffer, it is left unread.
+ *  \exception ECONNRESET Connection closed in the middle of the payload.
+ */
+extern int echo_frame_reader_payload( echo_frame_reader_t *reader,
+        tcp_context_t *ctx, const echo_frame_t *frame, char *buffer,
+        size_t size, int *err );
+
+/*! \fn size_t echo_frame_reader_take( echo_frame_reader_t *reader, const char **data, size_t size )
+ *  \brief Consumes bytes already read ahead without reading more, for
+ *  payloads moved elsewhere than a buffer. The rest of them is still on
+ *  the socket.
+ *  \param[in,out] reader The reader.
+ *  \param[out] data The bytes, valid until the reader reads again.
+ *  \param[in] size The most bytes to be consumed.
+ *  \return The number of bytes consumed, at most size.
+ */
+extern size_t echo_frame_reader_take( echo_frame_reader_t *reader,
+        const char **data, size_t size );
+
+#endif /* ECHOFRAME_H */
@@ -0,0 +1,93 @@
+#ifndef ECHOINTERN_H
+#define ECHOINTERN_H
+
+/*! \file echointern.h
+ *  \brief Contains definitions for the username intern table, which keeps
+ *  one shared copy of each name along with what is derived from it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#define ECHO_INTERN_BUCKETS 64
+
+/*! Interned username, read-only for its holders */
+typedef struct echo_name
+{
+    struct echo_name *en_next;  /*!< Next name in the bucket */
+    size_t en_refs;             /*!< Holders, counted under the table lock */
+    uint32_t en_hash;           /*!< FNV-1a hash of the name */
+    size_t en_length;           /*!< Length of the name */
+    const char *en_says;        /*!< "name says:\n", ahead of chat lines */
+    size_t en_says_length;      /*!< Length of en_says */
+    char en_name[ ];            /*!< The name, followed by en_says */
+} echo_name_t;
+
+/*! Opaque intern table */
+typedef struct echo_intern echo_intern_t;
+
+/*! \fn uint32_t echo_intern_hash( const char *name, size_t length )
+ *  \brief Hashes a name the way the table and the server's index do.
+ *  \param[in] name The name.
+ *  \param[in] length The length of the name.
+ *  \return The FNV-1a hash of the name.
+ */
+extern uint32_t echo_intern_hash( const char *name, size_t length );
+
+/*! \fn echo_intern_t *echo_intern_create( int *err )
+ *  \brief Creates an empty intern table.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new table is returned. Otherwise NULL is returned
+ *  and err parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ */
+extern echo_intern_t *echo_intern_create( int *err );
+
+/*! \fn int echo_intern_reserve( echo_intern_t *table, size_t names, int *err )
+ *  \brief Sizes the table for a number of names at once, so that as many
+ *  logins do not rehash it under its lock.
+ *  \param[in] table The table.
+ *  \param[in] names The number of names expected.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_intern_reserve( echo_intern_t *table, size_t names,
+        int *err );
+
+/*! \fn const echo_name_t *echo_intern_get( echo_intern_t *table, const char *name, size_t length, int *err )
+ *  \brief Takes a hold of the shared copy of a name, adding it to the table
+ *  on first use. Safe from any thread.
+ *  \param[in] table The table.
+ *  \param[in] name The name, not necessarily terminated.
+ *  \param[in] length The length of the name.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the shared name is returned. Otherwise NULL is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
+ */
+extern const echo_name_t *echo_intern_get( echo_intern_t *table,
+        const char *name, size_t length, int *err );
+
+/*! \fn void echo_intern_put( echo_intern_t *table, const echo_name_t *name )
+ *  \brief Gives a hold back. The name is freed with the last one.
+ *  \param[in] table The table.
+ *  \param[in] name The name, as returned by echo_intern_get.
+ */
+extern void echo_intern_put( echo_intern_t *table, const echo_name_t *name );
+
+/*! \fn size_t echo_intern_count( echo_intern_t *table )
+ *  \brief Counts the names held.
+ *  \param[in] table The table.
+ *  \return The number of distinct names in the table.
+ */
+extern size_t echo_intern_count( echo_intern_t *table );
+
+/*! \fn void echo_intern_destroy( echo_intern_t *table )
+ *  \brief Destroys a table and every name still in it.
+ *  \param[in] table The table to be destroyed.
+ */
+extern void echo_intern_destroy( echo_intern_t *table );
+
+#endif /* ECHOINTERN_H */
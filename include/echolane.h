@@ -0,0 +1,137 @@
+#ifndef ECHOLANE_H
+#define ECHOLANE_H
+
+/*! \file echolane.h
+ *  \brief Contains definitions for priority lanes, the queues a single
+ *  consumer keeps pending frames in so that control and chat traffic are
+ *  not held up behind bulk data.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#define ECHO_LANE_QUANTUM   4096
+
+/*! Lanes, from the most to the least urgent */
+typedef enum
+{
+    ECHO_LANE_CONTROL,          /*!< Handshake replies and notices */
+    ECHO_LANE_INTERACTIVE,      /*!< Chat lines and private messages */
+    ECHO_LANE_BULK,             /*!< File data */
+    ECHO_LANE_MAX               /*!< Number of lanes */
+} echo_lane_t;
+
+/*! Lane link, embedded in the items queued */
+typedef struct echo_lane_node
+{
+    struct echo_lane_node *eln_next;    /*!< Next node in the lane */
+    echo_lane_t eln_lane;               /*!< Lane the node was pushed to */
+    size_t eln_size;                    /*!< Bytes the item weighs */
+    unsigned long long eln_queued;      /*!< When it was queued, see
+                                             echo_lane_clock */
+} echo_lane_node_t;
+
+/*! One lane, a FIFO with its scheduling credit and latency counters */
+typedef struct
+{
+    echo_lane_node_t *el_head;  /*!< Oldest node */
+    echo_lane_node_t *el_tail;  /*!< Newest node */
+    size_t el_depth;            /*!< Nodes pending */
+    size_t el_deficit;          /*!< Bytes the lane may still send */
+    atomic_ullong el_frames;    /*!< Nodes done */
+    atomic_ullong el_total;     /*!< Nanoseconds they spent queued */
+    atomic_ullong el_max;       /*!< Longest of them */
+} echo_lane_queue_t;
+
+/*! Lanes of one consumer, only touched by its thread apart from the
+ *  latency counters */
+typedef struct
+{
+    echo_lane_queue_t els_lane[ ECHO_LANE_MAX ];    /*!< The lanes */
+    int els_current;            /*!< Lane being served */
+    size_t els_pending;         /*!< Nodes pending in every lane */
+} echo_lanes_t;
+
+/*! Latency of one lane */
+typedef struct
+{
+    unsigned long long elu_frames;      /*!< Nodes done */
+    unsigned long long elu_total;       /*!< Nanoseconds spent queued */
+    unsigned long long elu_max;         /*!< Longest wait in nanoseconds */
+} echo_lane_usage_t;
+
+/*! \fn echo_lane_t echo_lane_of( int type )
+ *  \brief Gives the lane a frame type goes to unless told otherwise.
+ *  \param[in] type The frame type.
+ *  \return The lane.
+ */
+extern echo_lane_t echo_lane_of( int type );
+
+/*! \fn unsigned long long echo_lane_clock( void )
+ *  \brief Reads the monotonic clock nodes are stamped with.
+ *  \return The time in nanoseconds.
+ */
+extern unsigned long long echo_lane_clock( void );
+
+/*! \fn void echo_lanes_init( echo_lanes_t *lanes )
+ *  \brief Initializes empty lanes.
+ *  \param[out] lanes The lanes.
+ */
+extern void echo_lanes_init( echo_lanes_t *lanes );
+
+/*! \fn void echo_lanes_push( echo_lanes_t *lanes, echo_lane_t lane, echo_lane_node_t *node )
+ *  \brief Appends a node to a lane. Its size and queueing time are set by
+ *  the caller.
+ *  \param[in] lanes The lanes.
+ *  \param[in] lane The lane.
+ *  \param[in] node The node.
+ */
+extern void echo_lanes_push( echo_lanes_t *lanes, echo_lane_t lane,
+        echo_lane_node_t *node );
+
+/*! \fn echo_lane_node_t *echo_lanes_pop( echo_lanes_t *lanes )
+ *  \brief Takes the next node by deficit round robin. Each round a lane
+ *  may send its weight in quanta of ECHO_LANE_QUANTUM bytes, 8 for control,
+ *  4 for interactive and 1 for bulk, so that every lane keeps moving and
+ *  bulk gets what the others leave.
+ *  \param[in] lanes The lanes.
+ *  \return The node, or NULL if every lane is empty.
+ */
+extern echo_lane_node_t *echo_lanes_pop( echo_lanes_t *lanes );
+
+/*! \fn void echo_lanes_done( echo_lanes_t *lanes, const echo_lane_node_t *node )
+ *  \brief Counts a popped node as written, with the time since it was
+ *  queued.
+ *  \param[in] lanes The lanes.
+ *  \param[in] node The node.
+ */
+extern void echo_lanes_done( echo_lanes_t *lanes,
+        const echo_lane_node_t *node );
+
+/*! \fn size_t echo_lanes_pending( const echo_lanes_t *lanes )
+ *  \brief Counts the nodes pending.
+ *  \param[in] lanes The lanes.
+ *  \return The number of nodes in every lane.
+ */
+extern size_t echo_lanes_pending( const echo_lanes_t *lanes );
+
+/*! \fn void echo_lanes_usage( echo_lanes_t *lanes, echo_lane_t lane, echo_lane_usage_t *usage )
+ *  \brief Adds the latency of one lane to usage, which lets the lanes of
+ *  several consumers be summed. Safe from any thread.
+ *  \param[in] lanes The lanes.
+ *  \param[in] lane The lane.
+ *  \param[in,out] usage The latency added to.
+ */
+extern void echo_lanes_usage( echo_lanes_t *lanes, echo_lane_t lane,
+        echo_lane_usage_t *usage );
+
+/*! \fn void echo_lane_report( const echo_lane_usage_t *usage, const char *prefix, FILE *file )
+ *  \brief Writes the latency of every lane as "name=value" lines.
+ *  \param[in] usage The latency of each lane, ECHO_LANE_MAX of them.
+ *  \param[in] prefix The prefix of the names.
+ *  \param[in] file The stream written to.
+ */
+extern void echo_lane_report( const echo_lane_usage_t *usage,
+        const char *prefix, FILE *file );
+
+#endif /* ECHOLANE_H */
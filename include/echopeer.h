@@ -0,0 +1,163 @@
+#ifndef ECHOPEER_H
+#define ECHOPEER_H
+
+/*! \file echopeer.h
+ *  \brief Contains definitions for the peer links which federate several
+ *  servers into one chat.
+ */
+
+#include <stdint.h>
+#include "echoframe.h"
+#define ESELFPEER           3000
+#define ECHO_PEER_RELAY     12
+#define ECHO_PEER_WINDOW    64
+#define ECHO_PEER_ORIGINS   64
+#define ECHO_PEER_BACKLOG   ( 4 * 1024 * 1024 )
+#define ECHO_PEER_RETRY     1
+
+/*! Opaque set of peer links of one node */
+typedef struct echo_peer_set echo_peer_set_t;
+
+/*! Called for every relayed message that reaches this node for the first
+ *  time, it should deliver the text to the local members only. */
+typedef void ( *echo_peer_deliver_t )( const char *text, size_t size,
+        void *arg );
+
+/*! Called for every control frame a peer sends to this node */
+typedef void ( *echo_peer_control_t )( uint32_t node, const char *payload,
+        size_t size, void *arg );
+
+/*! \fn void echo_peer_strerror( int errnum, char *buf, size_t buflen )
+ *  \brief Outputs a peer link error message.
+ *  \param[in] errnum The error code number.
+ *  \param[out] buf The buffer that holds the error message.
+ *  \param[in] buflen The length of the buffer.
+ */
+extern void echo_peer_strerror( int errnum, char *buf, size_t buflen );
+
+/*! \fn echo_peer_set_t *echo_peer_create( uint32_t node, echo_peer_deliver_t deliver, void *arg, int *err )
+ *  \brief Creates the peer links of a node, initially without any link.
+ *  \param[in] node The node ID, unique among the federated servers.
+ *  \param[in] deliver The function delivering relayed messages locally.
+ *  \param[in] arg The argument handed to deliver.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new peer set is returned. Otherwise NULL is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
+ */
+extern echo_peer_set_t *echo_peer_create( uint32_t node,
+        echo_peer_deliver_t deliver, void *arg, int *err );
+
+/*! \fn int echo_peer_connect( echo_peer_set_t *set, const char *host, int port, int *err )
+ *  \brief Keeps a link to another server, which is connected in the
+ *  background and reconnected whenever it drops.
+ *  \param[in] set The peer set.
+ *  \param[in] host The peer's hostname.
+ *  \param[in] port The peer's port number.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ *  \exception EAGAIN The link thread could not be started.
+ */
+extern int echo_peer_connect( echo_peer_set_t *set, const char *host,
+        int port, int *err );
+
+/*! \fn int echo_peer_attach( echo_peer_set_t *set, tcp_context_t *ctx, const char *hello, size_t size, int *err )
+ *  \brief Takes over a connection whose first frame was ECHO_FRAME_PEER,
+ *  answers it and relays over it until it drops.
+ *  \param[in] set The peer set.
+ *  \param[in] ctx The connection, owned by the set on success.
+ *  \param[in] hello The payload of the ECHO_FRAME_PEER frame.
+ *  \param[in] size The payload size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Malformed handshake.
+ *  \exception ESELFPEER The peer has this node's ID.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_peer_attach( echo_peer_set_t *set, tcp_context_t *ctx,
+        const char *hello, size_t size, int *err );
+
+/*! \fn int echo_peer_broadcast( echo_peer_set_t *set, const char *text, size_t size, int *err )
+ *  \brief Relays a message broadcast by a local member to every peer. The
+ *  frames are queued and each link writes what it holds in one call.
+ *  \param[in] set The peer set.
+ *  \param[in] text The message text.
+ *  \param[in] size The message size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE Message too large for a relay frame.
+ */
+extern int echo_peer_broadcast( echo_peer_set_t *set, const char *text,
+        size_t size, int *err );
+
+/*! \fn int echo_peer_broadcastv( echo_peer_set_t *set, const struct iovec *parts, int count, int *err )
+ *  \brief Relays a message gathered from several parts to every peer, as
+ *  echo_peer_broadcast does. The parts are copied straight into the queue
+ *  of each link.
+ *  \param[in] set The peer set.
+ *  \param[in] parts The message parts, in order.
+ *  \param[in] count The number of parts.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception EMSGSIZE Message too large for a relay frame.
+ */
+extern int echo_peer_broadcastv( echo_peer_set_t *set,
+        const struct iovec *parts, int count, int *err );
+
+/*! \fn size_t echo_peer_links( echo_peer_set_t *set )
+ *  \brief Counts the links that completed their handshake.
+ *  \param[in] set The peer set.
+ *  \return The number of established links.
+ */
+extern size_t echo_peer_links( echo_peer_set_t *set );
+
+/*! \fn void echo_peer_set_control( echo_peer_set_t *set, echo_peer_control_t control, void *arg )
+ *  \brief Sets the function receiving the control frames of the peers.
+ *  \param[in] set The peer set.
+ *  \param[in] control The function called from the link threads.
+ *  \param[in] arg The argument handed to control.
+ */
+extern void echo_peer_set_control( echo_peer_set_t *set,
+        echo_peer_control_t control, void *arg );
+
+/*! \fn int echo_peer_send( echo_peer_set_t *set, uint32_t node, const char *payload, size_t size, int *err )
+ *  \brief Queues a control frame on the link to one node.
+ *  \param[in] set The peer set.
+ *  \param[in] node The ID of the receiving node.
+ *  \param[in] payload The frame payload.
+ *  \param[in] size The payload size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception ENOTCONN No link to the node is up.
+ *  \exception EMSGSIZE Payload larger than ECHO_FRAME_MAX.
+ */
+extern int echo_peer_send( echo_peer_set_t *set, uint32_t node,
+        const char *payload, size_t size, int *err );
+
+/*! \fn size_t echo_peer_nodes( echo_peer_set_t *set, uint32_t *nodes, size_t max, unsigned long *generation )
+ *  \brief Lists the nodes this node has a link up with.
+ *  \param[in] set The peer set.
+ *  \param[out] nodes The array receiving the node IDs.
+ *  \param[in] max The capacity of nodes.
+ *  \param[out] generation A number that changes whenever a link goes up
+ *  or down.
+ *  \return The number of node IDs stored in nodes.
+ */
+extern size_t echo_peer_nodes( echo_peer_set_t *set, uint32_t *nodes,
+        size_t max, unsigned long *generation );
+
+/*! \fn void echo_peer_destroy( echo_peer_set_t *set )
+ *  \brief Closes every link and destroys the peer set.
+ *  \param[in] set The peer set to be destroyed.
+ */
+extern void echo_peer_destroy( echo_peer_set_t *set );
+
+#endif /* ECHOPEER_H */
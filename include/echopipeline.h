@@ -0,0 +1,184 @@
+#ifndef ECHOPIPELINE_H
+#define ECHOPIPELINE_H
+
+/*! \file echopipeline.h
+ *  \brief Contains definitions for the writer stage of the staged server,
+ *  threads that each own a subset of the client sockets and batch what is
+ *  written to them.
+ */
+
+#include "echoclientcontext.h"
+#include "echolane.h"
+#include <stdio.h>
+#define ECHO_PIPELINE_WRITERS   64
+#define ECHO_PIPELINE_BATCH     64
+#define ECHO_PIPELINE_BUFFER    ( 4 * ECHO_FRAME_MAX )
+
+/*! Activity of one writer */
+typedef struct
+{
+    size_t ew_members;          /*!< Clients owned */
+    size_t ew_depth;            /*!< Deliveries queued */
+    size_t ew_peak;             /*!< Most deliveries ever queued */
+    unsigned long long ew_frames;   /*!< Frames written */
+    unsigned long long ew_flushes;  /*!< Writes issued for them */
+} echo_writer_usage_t;
+
+/*! Opaque writer stage */
+typedef struct echo_pipeline echo_pipeline_t;
+
+/*! \fn echo_pipeline_t *echo_pipeline_create( size_t writers, int *err )
+ *  \brief Starts the writer threads.
+ *  \param[in] writers The number of writers, at most ECHO_PIPELINE_WRITERS.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new pipeline is returned. Otherwise NULL is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
+ *  \exception EAGAIN No thread could be started.
+ */
+extern echo_pipeline_t *echo_pipeline_create( size_t writers, int *err );
+
+/*! \fn int echo_pipeline_attach( echo_pipeline_t *pipeline, echo_client_context_t *client, int *err )
+ *  \brief Hands the writing side of a client over to its writer. Nothing
+ *  else may write to the client from then on.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] client The client.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_pipeline_attach( echo_pipeline_t *pipeline,
+        echo_client_context_t *client, int *err );
+
+/*! \fn void echo_pipeline_detach( echo_pipeline_t *pipeline, echo_client_context_t *client )
+ *  \brief Takes a client back once what is queued for it was written. The
+ *  writer destroys the client context.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] client The attached client.
+ */
+extern void echo_pipeline_detach( echo_pipeline_t *pipeline,
+        echo_client_context_t *client );
+
+/*! \fn int echo_pipeline_send( echo_pipeline_t *pipeline, const char *buffer, size_t size, int *err )
+ *  \brief Queues a text frame for every attached client. The text is
+ *  copied once and shared by the writers.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] buffer The text.
+ *  \param[in] size The text size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE The text does not fit in a frame.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_pipeline_send( echo_pipeline_t *pipeline,
+        const char *buffer, size_t size, int *err );
+
+/*! \fn int echo_pipeline_sendv( echo_pipeline_t *pipeline, int type, echo_lane_t lane, const struct iovec *parts, int count, int *err )
+ *  \brief Queues a frame gathered from several parts for every attached
+ *  client, as echo_pipeline_send does.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] type The frame type.
+ *  \param[in] lane The lane the frame waits in.
+ *  \param[in] parts The text parts, in order.
+ *  \param[in] count The number of parts.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE The text does not fit in a frame.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_pipeline_sendv( echo_pipeline_t *pipeline, int type,
+        echo_lane_t lane, const struct iovec *parts, int count, int *err );
+
+/*! \fn int echo_pipeline_sendto( echo_pipeline_t *pipeline, echo_client_context_t *client, int type, const char *buffer, size_t size, int *err )
+ *  \brief Queues a frame for one attached client, in the lane of its
+ *  type.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] client The client.
+ *  \param[in] type The frame type.
+ *  \param[in] buffer The payload.
+ *  \param[in] size The payload size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE The payload does not fit in a frame.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_pipeline_sendto( echo_pipeline_t *pipeline,
+        echo_client_context_t *client, int type, const char *buffer,
+        size_t size, int *err );
+
+/*! \fn int echo_pipeline_sendtov( echo_pipeline_t *pipeline, echo_client_context_t *client, int type, const struct iovec *parts, int count, int *err )
+ *  \brief Queues a frame gathered from several parts for one attached
+ *  client, as echo_pipeline_sendto does.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] client The client.
+ *  \param[in] type The frame type.
+ *  \param[in] parts The payload parts, in order.
+ *  \param[in] count The number of parts.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE The payload does not fit in a frame.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_pipeline_sendtov( echo_pipeline_t *pipeline,
+        echo_client_context_t *client, int type, const struct iovec *parts,
+        int count, int *err );
+
+/*! \fn int echo_pipeline_close( echo_pipeline_t *pipeline, echo_client_context_t *client, int *err )
+ *  \brief Shuts a client's socket down once what is queued for it was
+ *  written, its reader then sees the connection end.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] client The client.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_pipeline_close( echo_pipeline_t *pipeline,
+        echo_client_context_t *client, int *err );
+
+/*! \fn size_t echo_pipeline_writers( const echo_pipeline_t *pipeline )
+ *  \brief Gives the number of writers.
+ *  \param[in] pipeline The pipeline.
+ *  \return The number of writers.
+ */
+extern size_t echo_pipeline_writers( const echo_pipeline_t *pipeline );
+
+/*! \fn void echo_pipeline_usage( echo_pipeline_t *pipeline, size_t writer, echo_writer_usage_t *usage )
+ *  \brief Reads the activity of one writer.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] writer The writer, below echo_pipeline_writers.
+ *  \param[out] usage The activity.
+ */
+extern void echo_pipeline_usage( echo_pipeline_t *pipeline, size_t writer,
+        echo_writer_usage_t *usage );
+
+/*! \fn void echo_pipeline_lanes( echo_pipeline_t *pipeline, echo_lane_usage_t *usage )
+ *  \brief Reads the latency of each lane, summed over the writers.
+ *  \param[in] pipeline The pipeline.
+ *  \param[out] usage The latency of each lane, ECHO_LANE_MAX of them.
+ */
+extern void echo_pipeline_lanes( echo_pipeline_t *pipeline,
+        echo_lane_usage_t *usage );
+
+/*! \fn void echo_pipeline_report( echo_pipeline_t *pipeline, FILE *file )
+ *  \brief Writes the activity of every writer and the latency of each lane
+ *  as "name=value" lines.
+ *  \param[in] pipeline The pipeline.
+ *  \param[in] file The stream written to.
+ */
+extern void echo_pipeline_report( echo_pipeline_t *pipeline, FILE *file );
+
+/*! \fn void echo_pipeline_destroy( echo_pipeline_t *pipeline )
+ *  \brief Writes out what is queued and stops the writers. Clients still
+ *  attached are left to the caller.
+ *  \param[in] pipeline The pipeline to be destroyed.
+ */
+extern void echo_pipeline_destroy( echo_pipeline_t *pipeline );
+
+#endif /* ECHOPIPELINE_H */
@@ -0,0 +1,118 @@
+#ifndef ECHOPOOL_H
+#define ECHOPOOL_H
+
+/*! \file echopool.h
+ *  \brief Contains definitions for the work-stealing task pool and the
+ *  serial executors that keep the tasks of one connection in order.
+ */
+
+#include "echoqueue.h"
+#include <stdio.h>
+#define ECHO_POOL_WORKERS   64
+#define ECHO_POOL_DEQUE     4096
+#define ECHO_SERIAL_BUDGET  16
+
+/*! Unit of work, embedded in the caller's own structure */
+typedef struct echo_task
+{
+    echo_queue_node_t et_node;                  /*!< Link while queued */
+    void ( *et_run )( struct echo_task *task ); /*!< Work, may free task */
+} echo_task_t;
+
+/*! Activity of one worker */
+typedef struct
+{
+    unsigned long long ew_tasks;    /*!< Tasks run */
+    unsigned long long ew_steals;   /*!< Tasks taken from other workers */
+    unsigned long long ew_sleeps;   /*!< Times the worker went idle */
+} echo_worker_usage_t;
+
+/*! Opaque task pool */
+typedef struct echo_pool echo_pool_t;
+
+/*! Opaque serial executor */
+typedef struct echo_serial echo_serial_t;
+
+/*! \fn echo_pool_t *echo_pool_create( size_t workers, int *err )
+ *  \brief Starts the worker threads. Each has a deque of its own that other
+ *  workers steal from once they run out of work.
+ *  \param[in] workers The number of workers, at most ECHO_POOL_WORKERS.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new pool is returned. Otherwise NULL is returned and
+ *  err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
+ *  \exception EAGAIN No thread could be started.
+ */
+extern echo_pool_t *echo_pool_create( size_t workers, int *err );
+
+/*! \fn void echo_pool_submit( echo_pool_t *pool, echo_task_t *task )
+ *  \brief Queues a task. From a worker it goes on the worker's own deque,
+ *  from any other thread to a worker picked in turn.
+ *  \param[in] pool The pool.
+ *  \param[in] task The task, owned by the pool until it runs.
+ */
+extern void echo_pool_submit( echo_pool_t *pool, echo_task_t *task );
+
+/*! \fn size_t echo_pool_workers( const echo_pool_t *pool )
+ *  \brief Gives the number of workers.
+ *  \param[in] pool The pool.
+ *  \return The number of workers.
+ */
+extern size_t echo_pool_workers( const echo_pool_t *pool );
+
+/*! \fn void echo_pool_usage( echo_pool_t *pool, size_t worker, echo_worker_usage_t *usage )
+ *  \brief Reads the activity of one worker.
+ *  \param[in] pool The pool.
+ *  \param[in] worker The worker, below echo_pool_workers.
+ *  \param[out] usage The activity.
+ */
+extern void echo_pool_usage( echo_pool_t *pool, size_t worker,
+        echo_worker_usage_t *usage );
+
+/*! \fn void echo_pool_report( echo_pool_t *pool, FILE *file )
+ *  \brief Writes the activity of every worker as "name=value" lines.
+ *  \param[in] pool The pool.
+ *  \param[in] file The stream written to.
+ */
+extern void echo_pool_report( echo_pool_t *pool, FILE *file );
+
+/*! \fn void echo_pool_destroy( echo_pool_t *pool )
+ *  \brief Runs what is queued and stops the workers.
+ *  \param[in] pool The pool to be destroyed.
+ */
+extern void echo_pool_destroy( echo_pool_t *pool );
+
+/*! \fn echo_serial_t *echo_serial_create( echo_pool_t *pool, int *err )
+ *  \brief Creates a serial executor, its tasks run on the pool one at a
+ *  time and in the order they were submitted.
+ *  \param[in] pool The pool.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new executor is returned. Otherwise NULL is
+ *  returned and err parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ */
+extern echo_serial_t *echo_serial_create( echo_pool_t *pool, int *err );
+
+/*! \fn void echo_serial_submit( echo_serial_t *serial, echo_task_t *task )
+ *  \brief Queues a task behind those already submitted to the executor.
+ *  \param[in] serial The executor.
+ *  \param[in] task The task, owned by the executor until it runs.
+ */
+extern void echo_serial_submit( echo_serial_t *serial, echo_task_t *task );
+
+/*! \fn void echo_serial_wait( echo_serial_t *serial )
+ *  \brief Waits for the tasks submitted to an executor so far to run. Must
+ *  not be called from one of its own tasks.
+ *  \param[in] serial The executor.
+ */
+extern void echo_serial_wait( echo_serial_t *serial );
+
+/*! \fn void echo_serial_destroy( echo_serial_t *serial )
+ *  \brief Waits for the tasks submitted to an executor to run, then
+ *  destroys it. Must not be called from one of its own tasks.
+ *  \param[in] serial The executor to be destroyed.
+ */
+extern void echo_serial_destroy( echo_serial_t *serial );
+
+#endif /* ECHOPOOL_H */
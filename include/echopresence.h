@@ -0,0 +1,84 @@
+#ifndef ECHOPRESENCE_H
+#define ECHOPRESENCE_H
+
+/*! \file echopresence.h
+ *  \brief Contains definitions for the presence directory, which keeps
+ *  usernames unique across federated nodes.
+ */
+
+#include "echopeer.h"
+#include "echoservercontext.h"
+#define ECHO_PRESENCE_TTL       30
+#define ECHO_PRESENCE_RENEW     10
+#define ECHO_PRESENCE_CACHE     5
+#define ECHO_PRESENCE_VNODES    64
+#define ECHO_PRESENCE_BUCKETS   256
+#define ECHO_PRESENCE_NODES     64
+
+/*! Opaque presence directory of one node */
+typedef struct echo_presence echo_presence_t;
+
+/*! Called when the owner of a username denies a login that was accepted
+ *  optimistically, the local member holding it must be disconnected. */
+typedef void ( *echo_presence_revoke_t )( const char *uname, void *arg );
+
+/*! \fn uint32_t echo_presence_hash_owner( const uint32_t *nodes, size_t count, const char *uname )
+ *  \brief Maps a username to the node owning it on a consistent hash ring,
+ *  so that a node joining or leaving only moves the names it owns.
+ *  \param[in] nodes The IDs of the nodes on the ring.
+ *  \param[in] count The number of nodes, at least one.
+ *  \param[in] uname The username.
+ *  \return The ID of the owning node.
+ */
+extern uint32_t echo_presence_hash_owner( const uint32_t *nodes,
+        size_t count, const char *uname );
+
+/*! \fn echo_presence_t *echo_presence_create( echo_peer_set_t *peers, uint32_t node, echo_presence_revoke_t revoke, void *arg, int *err )
+ *  \brief Creates the presence directory of a node. Its messages travel
+ *  over the peer links, which are expected to join every pair of nodes.
+ *  \param[in] peers The node's peer links.
+ *  \param[in] node The node ID.
+ *  \param[in] revoke The function disconnecting members denied late.
+ *  \param[in] arg The argument handed to revoke.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new directory is returned. Otherwise NULL is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
+ *  \exception EAGAIN The renewal thread could not be started.
+ */
+extern echo_presence_t *echo_presence_create( echo_peer_set_t *peers,
+        uint32_t node, echo_presence_revoke_t revoke, void *arg, int *err );
+
+/*! \fn int echo_presence_claim( echo_presence_t *presence, const char *uname, int *err )
+ *  \brief Claims a username for a local member without waiting for its
+ *  owner. The login is refused right away when this node owns the name or
+ *  has cached a live lease of another node, otherwise it is accepted and
+ *  the owner is asked in the background.
+ *  \param[in] presence The presence directory.
+ *  \param[in] uname The username.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EDUPLICATE Username held on another node.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_presence_claim( echo_presence_t *presence,
+        const char *uname, int *err );
+
+/*! \fn void echo_presence_release( echo_presence_t *presence, const char *uname )
+ *  \brief Releases the username of a local member that logged out.
+ *  \param[in] presence The presence directory.
+ *  \param[in] uname The username.
+ */
+extern void echo_presence_release( echo_presence_t *presence,
+        const char *uname );
+
+/*! \fn void echo_presence_destroy( echo_presence_t *presence )
+ *  \brief Destroys a presence directory, which must be done before the
+ *  peer links it uses are destroyed.
+ *  \param[in] presence The directory to be destroyed.
+ */
+extern void echo_presence_destroy( echo_presence_t *presence );
+
+#endif /* ECHOPRESENCE_H */
@@ -0,0 +1,73 @@
+#ifndef ECHOQUEUE_H
+#define ECHOQUEUE_H
+
+/*! \file echoqueue.h
+ *  \brief Contains definitions for a lock-free multi-producer single-consumer
+ *  queue of intrusive nodes, with an eventfd to wake the consumer.
+ */
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*! Queue link, embedded in the items queued */
+typedef struct echo_queue_node
+{
+    struct echo_queue_node *_Atomic eqn_next;   /*!< Next node in the queue */
+} echo_queue_node_t;
+
+/*! Opaque queue */
+typedef struct echo_queue echo_queue_t;
+
+/*! \fn echo_queue_t *echo_queue_create( int *err )
+ *  \brief Creates an empty queue.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new queue is returned. Otherwise NULL is returned
+ *  and err parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ */
+extern echo_queue_t *echo_queue_create( int *err );
+
+/*! \fn void echo_queue_push( echo_queue_t *queue, echo_queue_node_t *node )
+ *  \brief Appends a node, from any thread. Nodes pushed by one thread are
+ *  popped in the order they were pushed. The consumer is woken when it
+ *  waits.
+ *  \param[in] queue The queue.
+ *  \param[in] node The node, owned by the queue until it is popped.
+ */
+extern void echo_queue_push( echo_queue_t *queue, echo_queue_node_t *node );
+
+/*! \fn echo_queue_node_t *echo_queue_pop( echo_queue_t *queue )
+ *  \brief Takes the oldest node without blocking, from the consumer thread
+ *  only.
+ *  \param[in] queue The queue.
+ *  \return The node, or NULL when the queue is empty or a push is halfway
+ *  through.
+ */
+extern echo_queue_node_t *echo_queue_pop( echo_queue_t *queue );
+
+/*! \fn echo_queue_node_t *echo_queue_wait( echo_queue_t *queue, int timeout )
+ *  \brief Takes the oldest node, sleeping on the eventfd while the queue is
+ *  empty. The eventfd is made on the first wait. Consumer thread only.
+ *  \param[in] queue The queue.
+ *  \param[in] timeout The longest wait in milliseconds, -1 for no limit.
+ *  \return The node, or NULL when nothing arrived in time.
+ */
+extern echo_queue_node_t *echo_queue_wait( echo_queue_t *queue,
+        int timeout );
+
+/*! \fn size_t echo_queue_depth( const echo_queue_t *queue, size_t *peak )
+ *  \brief Counts the nodes pushed and not popped yet, from any thread.
+ *  \param[in] queue The queue.
+ *  \param[out] peak The deepest the queue was seen by the consumer, if not
+ *  NULL.
+ *  \return The number of nodes queued.
+ */
+extern size_t echo_queue_depth( const echo_queue_t *queue, size_t *peak );
+
+/*! \fn void echo_queue_destroy( echo_queue_t *queue )
+ *  \brief Destroys a queue. Nodes still queued are not freed.
+ *  \param[in] queue The queue to be destroyed.
+ */
+extern void echo_queue_destroy( echo_queue_t *queue );
+
+#endif /* ECHOQUEUE_H */
@@ -9,12 +9,17 @@
 #include "bagarray.h"
 #include "echoclientcontext.h"
 #define EDUPLICATE 14321
+#define ECHO_INDEX_BUCKETS 64
+
+/*! Opaque username index of the clients */
+typedef struct echo_server_index echo_server_index_t;
 
 /*! Echo server context */
 typedef struct
 {
-    tcp_context_t *esc_tcp; /*!< Echo server's TCP context */
-    bag_array_t *esc_bag;   /*!< Echo server's bag of clients */
+    tcp_context_t *esc_tcp;         /*!< Echo server's TCP context */
+    bag_array_t *esc_bag;           /*!< Echo server's bag of clients */
+    echo_server_index_t *esc_index; /*!< Clients by username */
 } echo_server_context_t;
 
 /*! \fn void echo_server_context_strerror( int errnum, char *buf, size_t buflen )
@@ -38,8 +43,23 @@ extern void echo_server_context_strerror( int errnum, char *buf,
 extern echo_server_context_t *echo_server_context_create(
         tcp_context_t *ctx, int *err );
 
+/*! \fn int echo_server_context_reserve( echo_server_context_t *ctx, size_t clients, int *err )
+ *  \brief Sizes the bag and the username index for a number of clients at
+ *  once, so that as many logins do not reallocate or rehash.
+ *  \param[in] ctx The server context.
+ *  \param[in] clients The number of clients expected.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
+ */
+extern int echo_server_context_reserve( echo_server_context_t *ctx,
+        size_t clients, int *err );
+
 /*! \fn int echo_server_context_insert( echo_server_context_t *ctx, echo_client_context_t *client, int *err )
- *  \brief Inserts a client context into the server context's bag.
+ *  \brief Inserts a client context into the server context's bag and
+ *  indexes it by username.
  *  \param[in] ctx The context to which insert the client.
  *  \param[in] client The client context to be inserted.
  *  \param[out] err The error code returned in case of failure.
@@ -47,6 +67,7 @@ extern echo_server_context_t *echo_server_context_create(
  *  parameter is set appropriately.
  *  \exception EDUPLICATE Duplicate context insertion.
  *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOMEM No memory available.
  */
 extern int echo_server_context_insert( echo_server_context_t *ctx,
         echo_client_context_t *client, int *err );
@@ -59,20 +80,91 @@ extern int echo_server_context_insert( echo_server_context_t *ctx,
  *  \return On success the client removed from the bag is returned.
  *  Otherwise NULL is returned and err parameter is set appropriately.
  *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOTFOUND Client not in the bag.
  */
 extern tcp_context_t *echo_server_context_remove( echo_server_context_t *ctx,
         echo_client_context_t *client, int *err );
 
+/*! \fn echo_client_context_t *echo_server_context_find( echo_server_context_t *ctx, const char *uname, int *err )
+ *  \brief Looks a client up by username in constant time.
+ *  \param[in] ctx The server context.
+ *  \param[in] uname The username.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the client is returned. Otherwise NULL is returned
+ *  and err parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOTFOUND No client has the username.
+ */
+extern echo_client_context_t *echo_server_context_find(
+        echo_server_context_t *ctx, const char *uname, int *err );
+
+/*! \fn int echo_server_context_sendto( echo_server_context_t *ctx, const char *uname, const char *buffer, size_t size, int *err )
+ *  \brief Sends a message to one client only, through the client's own
+ *  compression stream.
+ *  \param[in] ctx The server context.
+ *  \param[in] uname The username of the recipient.
+ *  \param[in] buffer The message.
+ *  \param[in] size The message size in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ *  \exception ENOTFOUND The recipient is not online.
+ */
+extern int echo_server_context_sendto( echo_server_context_t *ctx,
+        const char *uname, const char *buffer, size_t size, int *err );
+
 /*! \fn int echo_server_context_sendall( echo_server_context_t *ctx, const char *buffer, size_t size, int *err )
- *  \brief Sends a message to all clients.
+ *  \brief Sends a message to all clients. Messages of at least
+ *  ECHO_COMPRESS_MIN bytes are compressed once and the compressed block is
+ *  shared among the clients that negotiated compression.
  *  \param[in] ctx The TCP context used for server communication.
  *  \param[in] buffer The message to be echoed to all clients.
  *  \param[in] size The message size in bytes.
  *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
  */
 extern int echo_server_context_sendall( echo_server_context_t *ctx,
         const char *buffer, size_t size, int *err );
 
+/*! \fn int echo_server_context_sendallv( echo_server_context_t *ctx, int type, const struct iovec *parts, int count, int *err )
+ *  \brief Sends a frame gathered from several parts to all clients, as
+ *  echo_server_context_sendall does. Clients without compression get the
+ *  parts in one vectored write each, without the message being copied.
+ *  A client that cannot be sent to does not keep the frame from the rest.
+ *  \param[in] ctx The server context.
+ *  \param[in] type The frame type.
+ *  \param[in] parts The message parts, in order.
+ *  \param[in] count The number of parts, at most ECHO_FRAME_PARTS.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set to the first failure, every client was still tried.
+ *  \exception EMSGSIZE The message does not fit in a frame.
+ *  \exception EPIPE A client's connection is closed.
+ */
+extern int echo_server_context_sendallv( echo_server_context_t *ctx,
+        int type, const struct iovec *parts, int count, int *err );
+
+/*! \fn int echo_server_context_sendfile( echo_server_context_t *ctx, int type, const struct iovec *parts, int count, int fd, off_t offset, size_t size, int *err )
+ *  \brief Sends a frame made of a few parts and a range of a file to all
+ *  clients, see echo_frame_sendfile. The frame is never compressed.
+ *  \param[in] ctx The server context.
+ *  \param[in] type The frame type.
+ *  \param[in] parts The payload parts ahead of the file data.
+ *  \param[in] count The number of parts, at most ECHO_FRAME_PARTS.
+ *  \param[in] fd The file.
+ *  \param[in] offset The offset of the data in the file.
+ *  \param[in] size The size of the data in bytes.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EMSGSIZE The frame does not fit in ECHO_FRAME_MAX.
+ */
+extern int echo_server_context_sendfile( echo_server_context_t *ctx,
+        int type, const struct iovec *parts, int count, int fd,
+        off_t offset, size_t size, int *err );
+
 /*! \fn void echo_server_context_destroy( echo_server_context_t *ctx )
  *  \brief Destroys an echo server context.
  *  \param[in] ctx The server context to be destroyed.
@@ -0,0 +1,59 @@
+#ifndef ECHOSTATS_H
+#define ECHOSTATS_H
+
+/*! \file echostats.h
+ *  \brief Contains definitions for the process wide statistics counters.
+ */
+
+#include <stdio.h>
+
+/*! Statistics counters */
+typedef enum
+{
+    ECHO_STAT_DEFLATE_IN,       /*!< Bytes fed to the compressor */
+    ECHO_STAT_DEFLATE_OUT,      /*!< Bytes produced by the compressor */
+    ECHO_STAT_INFLATE_IN,       /*!< Bytes fed to the decompressor */
+    ECHO_STAT_INFLATE_OUT,      /*!< Bytes produced by the decompressor */
+    ECHO_STAT_SHARED_BLOCKS,    /*!< Sends that reused a shared block */
+    ECHO_STAT_ERR_EAGAIN,       /*!< Socket calls that would block */
+    ECHO_STAT_ERR_EINTR,        /*!< Socket calls retried after a signal */
+    ECHO_STAT_ERR_ECONNRESET,   /*!< Connections reset or broken */
+    ECHO_STAT_ERR_OTHER,        /*!< Any other socket error */
+    ECHO_STAT_RELAY_OUT,        /*!< Frames queued to peer links */
+    ECHO_STAT_RELAY_IN,         /*!< Relayed messages delivered locally */
+    ECHO_STAT_RELAY_DUP,        /*!< Relayed messages already seen */
+    ECHO_STAT_PEER_WRITES,      /*!< Writes made by peer links */
+    ECHO_STAT_PRESENCE_LOCAL,   /*!< Logins decided without a round trip */
+    ECHO_STAT_PRESENCE_CLAIMS,  /*!< Logins confirmed by a remote owner */
+    ECHO_STAT_PRESENCE_REVOKED, /*!< Logins revoked after the fact */
+    ECHO_STAT_DIRECT_SENT,      /*!< Private messages delivered */
+    ECHO_STAT_DIRECT_OFFLINE,   /*!< Private messages to absent users */
+    ECHO_STAT_ACCEPTS,          /*!< Connections accepted in batches */
+    ECHO_STAT_ACCEPT_BATCHES,   /*!< Batches of accepted connections */
+    ECHO_STAT_ACCEPT_SHED,      /*!< Connections dropped without fds */
+    ECHO_STAT_MAX               /*!< Number of counters */
+} echo_stat_t;
+
+/*! \fn void echo_stats_add( echo_stat_t stat, unsigned long long value )
+ *  \brief Adds a value to a statistics counter. Each thread updates its
+ *  own copy of the counters without locks or atomic read-modify-writes.
+ *  \param[in] stat The counter to be incremented.
+ *  \param[in] value The amount added to the counter.
+ */
+extern void echo_stats_add( echo_stat_t stat, unsigned long long value );
+
+/*! \fn unsigned long long echo_stats_get( echo_stat_t stat )
+ *  \brief Gets the current value of a statistics counter, summed over
+ *  every thread.
+ *  \param[in] stat The counter to be read.
+ *  \return The value of the counter.
+ */
+extern unsigned long long echo_stats_get( echo_stat_t stat );
+
+/*! \fn void echo_stats_dump( FILE *stream )
+ *  \brief Writes every counter and the derived ratios to a stream.
+ *  \param[in] stream The stream to which the statistics are written.
+ */
+extern void echo_stats_dump( FILE *stream );
+
+#endif /* ECHOSTATS_H */
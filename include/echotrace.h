@@ -0,0 +1,123 @@
+#ifndef ECHOTRACE_H
+#define ECHOTRACE_H
+
+/*! \file echotrace.h
+ *  \brief Contains definitions for trace points, built in with configure's
+ *  --enable-tracing and compiled out otherwise.
+ *
+ *  Each thread records into a ring of its own, ECHO_TRACE_RING entries
+ *  that the oldest are overwritten in, without locks or system calls. The
+ *  rings are dumped to a binary file on a signal or on demand, and that file
+ *  converted to Chrome trace JSON. Every trace point is also a marker for
+ *  perf and bpftrace: a USDT probe "echo:EVENT" where sys/sdt.h is found,
+ *  otherwise a uprobe on echo_trace_record, which is never inlined.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#define ECHO_TRACE_VERSION  1
+#define ECHO_TRACE_RING     2048
+
+/*! Trace points, with what their three arguments hold */
+typedef enum
+{
+    ECHO_TRACE_ACCEPT = 1,      /*!< Connection accepted: fd, batch size */
+    ECHO_TRACE_HANDSHAKE,       /*!< First frame read: fd, type, flags */
+    ECHO_TRACE_RECV,            /*!< Frame read: connection, type, length */
+    ECHO_TRACE_ENQUEUE,         /*!< Queued for the outbox: type, lane,
+                                     bytes */
+    ECHO_TRACE_FLUSH,           /*!< Sent to the members: type, lane,
+                                     bytes */
+    ECHO_TRACE_DISCONNECT,      /*!< Connection done: connection, fd */
+    ECHO_TRACE_MAX              /*!< One past the last trace point */
+} echo_trace_event_t;
+
+/*! Entry of a ring and of a dump */
+typedef struct
+{
+    uint64_t ete_time;          /*!< Monotonic clock in nanoseconds */
+    uint32_t ete_thread;        /*!< Kernel thread ID */
+    uint16_t ete_event;         /*!< Trace point */
+    uint16_t ete_reserved;      /*!< Zero */
+    uint32_t ete_args[ 3 ];     /*!< Arguments of the trace point */
+    uint32_t ete_padding;       /*!< Zero */
+} echo_trace_entry_t;
+
+/*! ECHO_TRACE( EVENT, a, b, c ) records trace point ECHO_TRACE_EVENT.
+ *  Without tracing nothing at all is left of it, its arguments included,
+ *  so they must not have side effects. */
+#ifdef ECHO_TRACING
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define ECHO_TRACE( event, a, b, c ) \
+    do \
+    { \
+        STAP_PROBE3( echo, event, ( a ), ( b ), ( c ) ); \
+        echo_trace_record( ECHO_TRACE_##event, ( a ), ( b ), ( c ) ); \
+    } \
+    while( 0 )
+#else
+#define ECHO_TRACE( event, a, b, c ) \
+    echo_trace_record( ECHO_TRACE_##event, ( a ), ( b ), ( c ) )
+#endif
+#else
+#define ECHO_TRACE( event, a, b, c ) ( ( void )0 )
+#endif
+
+/*! \fn void echo_trace_record( echo_trace_event_t event, uint32_t a, uint32_t b, uint32_t c )
+ *  \brief Records an entry in the ring of the calling thread, which takes
+ *  a ring the first time. Rings of threads that exited are taken again.
+ *  Called by ECHO_TRACE rather than directly.
+ *  \param[in] event The trace point.
+ *  \param[in] a The first argument.
+ *  \param[in] b The second argument.
+ *  \param[in] c The third argument.
+ */
+extern void echo_trace_record( echo_trace_event_t event, uint32_t a,
+        uint32_t b, uint32_t c );
+
+/*! \fn size_t echo_trace_rings( void )
+ *  \brief Counts the rings made so far, at most one per live thread.
+ *  \return The number of rings.
+ */
+extern size_t echo_trace_rings( void );
+
+/*! \fn int echo_trace_dump( const char *path, int *err )
+ *  \brief Writes every ring to a binary file: "ETRC", the version and the
+ *  entry size on 32 bits, then the entries of each ring oldest first, all
+ *  in host byte order. Only async-signal-safe calls are made. The
+ *  entries being overwritten while it runs may come out mixed.
+ *  \param[in] path The path of the file, truncated if it exists.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ */
+extern int echo_trace_dump( const char *path, int *err );
+
+/*! \fn int echo_trace_install( int signum, const char *path, int *err )
+ *  \brief Dumps the rings to path whenever signum is received.
+ *  \param[in] signum The signal.
+ *  \param[in] path The path of the dump.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success 0 is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid signal, or path longer than PATH_MAX.
+ */
+extern int echo_trace_install( int signum, const char *path, int *err );
+
+/*! \fn long echo_trace_export( FILE *in, FILE *out, int *err )
+ *  \brief Converts a dump to the Chrome trace event format, which
+ *  chrome://tracing and Perfetto open. Trace points are instant events on
+ *  the thread that recorded them, stamped in microseconds.
+ *  \param[in] in The dump.
+ *  \param[in] out The stream the JSON is written to.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the number of entries is returned. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EINVAL Not a dump, or of another version.
+ *  \exception EIO The dump ends in the middle of an entry.
+ */
+extern long echo_trace_export( FILE *in, FILE *out, int *err );
+
+#endif /* ECHOTRACE_H */
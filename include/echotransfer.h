@@ -0,0 +1,106 @@
+#ifndef ECHOTRANSFER_H
+#define ECHOTRANSFER_H
+
+/*! \file echotransfer.h
+ *  \brief Contains definitions for file transfers spooled by the server,
+ *  whose data goes from the sender's socket to a temporary file and on to
+ *  the members' sockets without being read by the server.
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/*! File being received from one member */
+typedef struct
+{
+    atomic_int et_refs;     /*!< Holders, the sender and queued chunks */
+    uint32_t et_id;         /*!< ID relayed ahead of every chunk */
+    int et_spool;           /*!< Unlinked temporary file */
+    int et_pipe[ 2 ];       /*!< Pipe the data is spliced through */
+    off_t et_length;        /*!< Bytes spooled so far */
+} echo_transfer_t;
+
+/*! \fn echo_transfer_t *echo_transfer_create( const char *dir, uint32_t id, int *err )
+ *  \brief Creates a transfer and its spool file, which has no name and is
+ *  gone once the last holder lets go.
+ *  \param[in] dir The directory the spool file is created in.
+ *  \param[in] id The ID of the transfer.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success a new transfer held once is returned. Otherwise NULL
+ *  is returned and err parameter is set appropriately.
+ *  \exception ENOMEM No memory available.
+ *  \exception EMFILE Too many open files.
+ */
+extern echo_transfer_t *echo_transfer_create( const char *dir, uint32_t id,
+        int *err );
+
+/*! \fn off_t echo_transfer_spool( echo_transfer_t *transfer, int socket, size_t size, int *err )
+ *  \brief Appends data waiting on a socket to the spool file, spliced
+ *  through the kernel when the socket allows it. Called by the sender's
+ *  thread only.
+ *  \param[in] transfer The transfer.
+ *  \param[in] socket The socket the data is read from.
+ *  \param[in] size The number of bytes to be moved.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the offset the data was stored at is returned.
+ *  Otherwise -1 is returned and err parameter is set appropriately.
+ *  \exception ECONNRESET Connection closed before size bytes came.
+ *  \exception ENOSPC No room left for the spool file.
+ */
+extern off_t echo_transfer_spool( echo_transfer_t *transfer, int socket,
+        size_t size, int *err );
+
+/*! \fn off_t echo_transfer_write( echo_transfer_t *transfer, const char *data, size_t size, int *err )
+ *  \brief Appends data already read from the socket to the spool file.
+ *  Called by the sender's thread only.
+ *  \param[in] transfer The transfer.
+ *  \param[in] data The data.
+ *  \param[in] size The number of bytes to be written.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the offset the data was stored at is returned.
+ *  Otherwise -1 is returned and err parameter is set appropriately.
+ *  \exception ENOSPC No room left for the spool file.
+ */
+extern off_t echo_transfer_write( echo_transfer_t *transfer,
+        const char *data, size_t size, int *err );
+
+/*! \fn int echo_transfer_read( echo_transfer_t *transfer, off_t offset, char *buffer, size_t size, int *err )
+ *  \brief Reads spooled data back, for consumers that need it in memory.
+ *  \param[in] transfer The transfer.
+ *  \param[in] offset The offset of the data.
+ *  \param[out] buffer The buffer that holds the data.
+ *  \param[in] size The number of bytes to be read.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EIO The range was not spooled.
+ */
+extern int echo_transfer_read( echo_transfer_t *transfer, off_t offset,
+        char *buffer, size_t size, int *err );
+
+/*! \fn void echo_transfer_discard( echo_transfer_t *transfer, off_t offset, size_t size )
+ *  \brief Gives back the disk space of data relayed to every member, so
+ *  that a transfer only holds what is still on its way.
+ *  \param[in] transfer The transfer.
+ *  \param[in] offset The offset of the data.
+ *  \param[in] size The size of the data in bytes.
+ */
+extern void echo_transfer_discard( echo_transfer_t *transfer, off_t offset,
+        size_t size );
+
+/*! \fn echo_transfer_t *echo_transfer_hold( echo_transfer_t *transfer )
+ *  \brief Takes one more hold of a transfer.
+ *  \param[in] transfer The transfer.
+ *  \return The transfer.
+ */
+extern echo_transfer_t *echo_transfer_hold( echo_transfer_t *transfer );
+
+/*! \fn void echo_transfer_put( echo_transfer_t *transfer )
+ *  \brief Gives a hold back. The transfer and its spool file are destroyed
+ *  with the last one.
+ *  \param[in] transfer The transfer.
+ */
+extern void echo_transfer_put( echo_transfer_t *transfer );
+
+#endif /* ECHOTRANSFER_H */
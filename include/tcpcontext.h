@@ -10,15 +10,43 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
+#define EHOSTNOTFOUND   2000
+#define TCP_RESOLVE_TTL 60
+#define TCP_ACCEPT_NONBLOCK 0x01
+
+/*! Named socket tuning profiles */
+enum
+{
+    TCP_PROFILE_DEFAULT,    /*!< Kernel defaults */
+    TCP_PROFILE_LATENCY,    /*!< Small messages out at once */
+    TCP_PROFILE_THROUGHPUT  /*!< Large buffers, bulk transfers */
+};
+
+/*! Socket options applied on listen and accept, zero leaves an option at
+ *  the kernel's default. */
+typedef struct
+{
+    int tp_nodelay;         /*!< TCP_NODELAY, Nagle's algorithm off */
+    int tp_quickack;        /*!< TCP_QUICKACK, delayed ACKs off */
+    int tp_sndbuf;          /*!< SO_SNDBUF in bytes */
+    int tp_rcvbuf;          /*!< SO_RCVBUF in bytes */
+    int tp_defer_accept;    /*!< TCP_DEFER_ACCEPT in seconds */
+    int tp_fastopen;        /*!< TCP_FASTOPEN queue length */
+    int tp_busy_poll;       /*!< SO_BUSY_POLL in microseconds */
+    int tp_notsent_lowat;   /*!< TCP_NOTSENT_LOWAT in bytes */
+} tcp_profile_t;
 
 /*! TCP context for client-server communications */
 typedef struct
 {
-    struct sockaddr_in tc_addr; /*!< TCP address */
-    int tc_socket;              /*!< TCP socket  */
+    struct sockaddr_storage tc_addr;    /*!< TCP address, IPv4 or IPv6 */
+    socklen_t tc_addrlen;               /*!< TCP address length */
+    int tc_socket;                      /*!< TCP socket  */
+    tcp_profile_t tc_profile;           /*!< Socket tuning */
 } tcp_context_t;
 
 /*! \fn void tcp_context_strerror( int errnum, char *buf, size_t buflen )
@@ -29,22 +57,44 @@ typedef struct
  */
 extern void tcp_context_strerror( int errnum, char *buf, size_t buflen );
 
+/*! \fn void tcp_profile_get( int name, tcp_profile_t *profile )
+ *  \brief Fills a profile with the options of a named profile.
+ *  \param[in] name TCP_PROFILE_DEFAULT, TCP_PROFILE_LATENCY or
+ *  TCP_PROFILE_THROUGHPUT.
+ *  \param[out] profile The profile.
+ */
+extern void tcp_profile_get( int name, tcp_profile_t *profile );
+
+/*! \fn int tcp_profile_parse( const char *spec, tcp_profile_t *profile, int *err )
+ *  \brief Parses a profile such as "latency", "throughput,sndbuf=1048576"
+ *  or "nodelay=1,busy_poll=50": an optional profile name followed by
+ *  comma separated option=value overrides.
+ *  \param[in] spec The profile specification.
+ *  \param[out] profile The profile.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Unknown name or option, or invalid value.
+ */
+extern int tcp_profile_parse( const char *spec, tcp_profile_t *profile,
+        int *err );
+
 /*! \fn tcp_context_t *tcp_context_create( int *err )
- *  \brief Creates a TCP connection context.
+ *  \brief Creates a TCP connection context. The socket itself is created
+ *  by tcp_context_connect or tcp_context_bind once the address family is
+ *  known.
  *  \param[out] err The error code returned in case of failure.
  *  \return On success a new context is returned. Otherwise NULL is returned
  *  and err parameter is set appropriately.
  *  \exception ENOMEM Not enough memory to allocate a context.
- *  \exception EACCESS Permission to create context is denied.
- *  \exception EMFILE The per-process limit on the number of open file
- *  descriptors has been reached.
- *  \exception ENFILE The system-wide limit on the total number of open
- *  files has been reached.
  */
 extern tcp_context_t *tcp_context_create( int *err );
 
-/*! \fn int *tcp_context_connect( tcp_context_t *ctx, const char *host, int port, int *err )
- *  \brief Connects a context to a hostname and port number.
+/*! \fn int tcp_context_connect( tcp_context_t *ctx, const char *host, int port, int *err )
+ *  \brief Connects a context to a hostname and port number. Every address
+ *  the host resolves to, IPv4 or IPv6, is tried in turn. Resolutions are
+ *  cached for TCP_RESOLVE_TTL seconds so repeated connections to the same
+ *  host skip the lookup.
  *  \param[in] ctx The context to be connected.
  *  \param[in] host The target hostname for connection.
  *  \param[in] port The target port number for connection.
@@ -52,6 +102,7 @@ extern tcp_context_t *tcp_context_create( int *err );
  *  \return On success zero is returned. Otherwise -1 is returned and err
  *  parameter is set appropriately.
  *  \exception EADDRINUSE Local addresss already in use.
+ *  \exception EHOSTNOTFOUND The host name could not be resolved.
  *  \exception ECONNREFUSED No-one listening on the remote address.
  *  \exception EFAULT The socket structure address is outside the user's
  *  address space.
@@ -61,8 +112,76 @@ extern tcp_context_t *tcp_context_create( int *err );
 extern int tcp_context_connect( tcp_context_t *ctx,
         const char *host, int port, int *err );
 
+/*! \fn int tcp_context_connect_start( tcp_context_t *ctx, const char *host, int port, int *err )
+ *  \brief Starts connecting a context without blocking. The context's
+ *  socket is left non-blocking.
+ *  \param[in] ctx The context to be connected.
+ *  \param[in] host The target hostname for connection.
+ *  \param[in] port The target port number for connection.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return Zero is returned if the connection completed at once. Otherwise
+ *  -1 is returned and err parameter is set appropriately; EINPROGRESS means
+ *  the socket becomes writable once tcp_context_connect_finish can tell
+ *  the outcome.
+ *  \exception EINPROGRESS Connection in progress.
+ *  \exception EHOSTNOTFOUND The host name could not be resolved.
+ *  \exception ECONNREFUSED No-one listening on the remote address.
+ */
+extern int tcp_context_connect_start( tcp_context_t *ctx, const char *host,
+        int port, int *err );
+
+/*! \fn int tcp_context_connect_finish( tcp_context_t *ctx, int *err )
+ *  \brief Tells the outcome of a connection started by
+ *  tcp_context_connect_start once its socket is writable.
+ *  \param[in] ctx The context being connected.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception ECONNREFUSED No-one listening on the remote address.
+ *  \exception ETIMEDOUT Timeout while attempting connection.
+ */
+extern int tcp_context_connect_finish( tcp_context_t *ctx, int *err );
+
+/*! \fn int tcp_context_transient( int errnum )
+ *  \brief Tells whether an error code only means the call should be made
+ *  again later, as opposed to the connection being unusable.
+ *  \param[in] errnum The error code number.
+ *  \return Non-zero for EAGAIN, EWOULDBLOCK and EINTR, zero otherwise.
+ */
+extern int tcp_context_transient( int errnum );
+
+/*! \fn int tcp_context_set_blocking( tcp_context_t *ctx, int blocking, int *err )
+ *  \brief Switches a context between blocking and non-blocking I/O.
+ *  \param[in] ctx The context to be switched.
+ *  \param[in] blocking Non-zero for blocking I/O, zero otherwise.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ */
+extern int tcp_context_set_blocking( tcp_context_t *ctx, int blocking,
+        int *err );
+
+/*! \fn int tcp_context_set_profile( tcp_context_t *ctx, const tcp_profile_t *profile, int *err )
+ *  \brief Sets the socket tuning of a context. A listening context applies
+ *  it when tcp_context_listen is called and hands it down to the contexts
+ *  it accepts, a connected context applies it at once. Options the kernel
+ *  refuses, such as busy polling without privileges, are skipped.
+ *  \param[in] ctx The context.
+ *  \param[in] profile The profile.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success zero is returned. Otherwise -1 is returned and err
+ *  parameter is set appropriately.
+ *  \exception EINVAL Invalid argument provided.
+ */
+extern int tcp_context_set_profile( tcp_context_t *ctx,
+        const tcp_profile_t *profile, int *err );
+
 /*! \fn int tcp_context_bind( tcp_context_t *ctx, int port, int *err )
- *  \brief Binds a context to a port number.
+ *  \brief Binds a context to a port number on every local address. The
+ *  socket is dual-stack, so IPv4 and IPv6 clients are both accepted, unless
+ *  creating, configuring or binding it fails, as when the host lacks IPv6,
+ *  in which case it is IPv4 only.
  *  \param[in] ctx The context to be bound.
  *  \param[in] port The port number in which to bind the context.
  *  \param[out] err The error code returned in case of failure.
@@ -80,7 +199,8 @@ extern int tcp_context_connect( tcp_context_t *ctx,
 extern int tcp_context_bind( tcp_context_t *ctx, int port, int *err );
 
 /*! \fn int tcp_context_listen( tcp_context_t *ctx, int backlog, int *err )
- *  \brief Puts a context to listen for incoming connections.
+ *  \brief Puts a context to listen for incoming connections. A dual-stack
+ *  socket that cannot listen is bound again on IPv4 to the same port.
  *  \param[in] ctx The context which listens.
  *  \param[in] backlog The maximum length to which the queue of pending
  *  connections may grow.
@@ -97,8 +217,6 @@ extern int tcp_context_listen( tcp_context_t *ctx, int backlog, int *err );
  *  \return On success a new context of the incoming connection is returned.
  *  Otherwise NULL is returned and err parameter is set appropriately.
  *  \exception ECONNABORTED A connection has been aborted.
- *  \exception EINTR The system call was interrupted by a signal that was
- *  caught vefore a valid connection arrived.
  *  \exception EINVAL Context socket is not listening for connections.
  *  \exception EMFILE The per-process limit on the number of file
  *  descriptors has been reached.
@@ -109,16 +227,40 @@ extern int tcp_context_listen( tcp_context_t *ctx, int backlog, int *err );
 extern tcp_context_t *tcp_context_accept( const tcp_context_t *ctx,
         int *err );
 
+/*! \fn ssize_t tcp_context_accept_batch( const tcp_context_t *ctx, tcp_context_t **clients, size_t max, int flags, int *err )
+ *  \brief Drains up to max connections from the queue of a non-blocking
+ *  listening context. The accepted sockets are closed on exec. When the
+ *  process runs out of descriptors a reserved one is given up for an
+ *  instant to accept and drop the oldest pending connection, so that the
+ *  listener does not stay readable forever.
+ *  \param[in] ctx The listening context.
+ *  \param[out] clients The array receiving the accepted contexts.
+ *  \param[in] max The capacity of clients.
+ *  \param[in] flags TCP_ACCEPT_NONBLOCK for non-blocking sockets.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return The number of contexts accepted, at least one. Otherwise -1 is
+ *  returned and err parameter is set appropriately.
+ *  \exception EAGAIN The queue is empty.
+ *  \exception EMFILE Out of descriptors, a pending connection may have
+ *  been dropped.
+ *  \exception ENOMEM No memory available.
+ *  \exception EINVAL Context socket is not listening for connections.
+ */
+extern ssize_t tcp_context_accept_batch( const tcp_context_t *ctx,
+        tcp_context_t **clients, size_t max, int flags, int *err );
+
 /*! \fn ssize_t tcp_context_send( tcp_context_t *ctx, const char *buffer, size_t size, int *err )
- *  \brief Sends a message to another TCP context.
+ *  \brief Sends a message to another TCP context. A call interrupted by a
+ *  signal is retried, and a broken connection is reported as an error
+ *  instead of raising SIGPIPE.
  *  \param[in] ctx The context to which the message is sent.
  *  \param[in] buffer The message buffer.
  *  \param[in] size The size (in bytes) of the buffer.
  *  \param[out] err The error code returned in case of failure.
  *  \return On success the total number of bytes sent is returned. Otherwise
  *  -1 is returned and err parameter is set appropriately.
+ *  \exception EAGAIN The socket is non-blocking and its buffer is full.
  *  \exception ECONNRESET Connection reset by peer.
- *  \exception EINTR A signal occurred before any data was transmitted.
  *  \exception ENOMEM No memory available.
  *  \exception ENOTCONN The socket is not connected, and no target has been
  *  give.
@@ -127,16 +269,33 @@ extern tcp_context_t *tcp_context_accept( const tcp_context_t *ctx,
 extern ssize_t tcp_context_send( tcp_context_t *ctx, const char *buffer,
         size_t size, int *err );
 
+/*! \fn ssize_t tcp_context_sendv( tcp_context_t *ctx, const struct iovec *iov, int iovcnt, int *err )
+ *  \brief Sends a scattered message to another TCP context.
+ *  \param[in] ctx The context to which the message is sent.
+ *  \param[in] iov The buffers that make up the message.
+ *  \param[in] iovcnt The number of buffers.
+ *  \param[out] err The error code returned in case of failure.
+ *  \return On success the total number of bytes sent is returned. Otherwise
+ *  -1 is returned and err parameter is set appropriately.
+ *  \exception EAGAIN The socket is non-blocking and its buffer is full.
+ *  \exception ECONNRESET Connection reset by peer.
+ *  \exception ENOMEM No memory available.
+ *  \exception EPIPE The local context has been shutdown or destroyed.
+ */
+extern ssize_t tcp_context_sendv( tcp_context_t *ctx,
+        const struct iovec *iov, int iovcnt, int *err );
+
 /*! \fn ssize_t tcp_context_recv( tcp_context_t *ctx, char *buffer, size_t size, int *err )
- *  \brief Receives a message from another TCP context.
+ *  \brief Receives a message from another TCP context. A call interrupted
+ *  by a signal is retried.
  *  \param[in] ctx The context from which the message is received.
  *  \param[out] buffer The buffer containing the received message.
  *  \param[in] size Maximum size of buffer.
  *  \param[out] err The error code returned in case of failure.
  *  \return On success the total number of bytes received is returned.
  *  Otherwise -1 is returned and err parameter is set appropriately.
+ *  \exception EAGAIN The socket is non-blocking and no data is pending.
  *  \exception ECONNRESET Connection reset by peer.
- *  \exception EINTR A signal occurred before any data was received.
  *  \exception ENOMEM No memory available.
  *  \exception ENOTCONN The socket is not connected, and no target has been
  *  give.
@@ -151,4 +310,9 @@ extern ssize_t tcp_context_recv( tcp_context_t *ctx, char *buffer,
  */
 extern void tcp_context_destroy( tcp_context_t *ctx );
 
+/*! \fn void tcp_context_flush_cache( void )
+ *  \brief Forgets every cached host name resolution.
+ */
+extern void tcp_context_flush_cache( void );
+
 #endif /* TCPCONTEXT_H */
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Sends one command to the admin socket of a server and prints the reply,
+ * exiting with failure when it ends with ERROR. */
+int main( int argc, char *argv[ ] )
+{
+    char command[ 512 ], line[ 1024 ];
+    struct sockaddr_un addr;
+    size_t length;
+    FILE *stream;
+    int fd, i;
+
+    if( argc < 3 )
+    {
+        fprintf( stderr, "USAGE: %s SOCKET COMMAND [ARG]...\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    for( length = 0, command[ 0 ] = '\0', i = 2; i < argc; i++ )
+    {
+        length += strlen( argv[ i ] ) + 1;
+
+        if( length >= sizeof( command ) )
+        {
+            fprintf( stderr, "%s: command too long.\n", argv[ 0 ] );
+            return EXIT_FAILURE;
+        }
+
+        strcat( command, argv[ i ] );
+        strcat( command, i + 1 < argc ? " " : "\n" );
+    }
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+
+    if( strlen( argv[ 1 ] ) >= sizeof( addr.sun_path ) )
+    {
+        fprintf( stderr, "%s: %s: path too long.\n", argv[ 0 ], argv[ 1 ] );
+        return EXIT_FAILURE;
+    }
+
+    strcpy( addr.sun_path, argv[ 1 ] );
+
+    if( ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) == -1 )
+    {
+        perror( "socket" );
+        return EXIT_FAILURE;
+    }
+
+    if( connect( fd, ( struct sockaddr* )&addr, sizeof( addr ) ) == -1 )
+    {
+        perror( "connect" );
+        close( fd );
+        return EXIT_FAILURE;
+    }
+
+    if( ( stream = fdopen( fd, "r+" ) ) == NULL )
+    {
+        perror( "fdopen" );
+        close( fd );
+        return EXIT_FAILURE;
+    }
+
+    if( fputs( command, stream ) == EOF || fflush( stream ) == EOF )
+    {
+        perror( "send" );
+        fclose( stream );
+        return EXIT_FAILURE;
+    }
+
+    while( fgets( line, sizeof( line ), stream ) != NULL )
+    {
+        if( strcmp( line, "OK\n" ) == 0 )
+        {
+            fclose( stream );
+            return EXIT_SUCCESS;
+        }
+
+        if( strncmp( line, "ERROR", 5 ) == 0 )
+        {
+            fprintf( stderr, "%s", line );
+            fclose( stream );
+            return EXIT_FAILURE;
+        }
+
+        fputs( line, stdout );
+    }
+
+    fprintf( stderr, "%s: connection closed before the reply ended.\n",
+            argv[ 0 ] );
+    fclose( stream );
+
+    return EXIT_FAILURE;
+}
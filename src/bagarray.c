@@ -2,6 +2,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdint.h>
 
 void bag_array_strerror( int errnum, char *buf, size_t buflen )
 {
@@ -30,6 +31,33 @@ bag_array_t *bag_array_create( int *err )
     return bag;
 }
 
+int bag_array_reserve( bag_array_t *bag, ssize_t capacity, int *err )
+{
+    void **tmp;
+
+    if( bag == NULL || capacity < 0 ||
+            ( size_t )capacity > SIZE_MAX / sizeof( void* ) )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( capacity <= bag->b_capacity )
+        return 0;
+
+    if( ( tmp = realloc( bag->b_array, capacity * sizeof( void* ) ) ) ==
+            NULL )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    bag->b_array = tmp;
+    bag->b_capacity = capacity;
+
+    return 0;
+}
+
 ssize_t bag_array_find_first( bag_array_t *bag, void *key, ssize_t *index,
        int ( *cmp )( const void*, const void* ), int *err )
 {
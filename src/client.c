@@ -1,31 +1,134 @@
-#include "echoclientcontext.h"
-#include <pthread.h>
+#include "echoclient.h"
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
 
-#define USERNAME    1
-#define HOSTNAME    2
-#define PORT        3
+#define USERNAME    0
+#define HOSTNAME    1
+#define PORT        2
 
-static void *read_thread( void *arg );
+#define MESSAGE_MAX ECHO_FRAME_TEXT_MAX
+#define INPUT_SIZE  65536
+
+/* File received from another member */
+struct download
+{
+    uint32_t d_id;
+    FILE *d_file;
+    char d_path[ 320 ];
+    struct download *d_next;
+};
+
+/* Input fed to the session, from stdin or a pipe */
+struct feeder
+{
+    echo_client_loop_t *f_loop;
+    echo_session_t *f_session;
+    const char *f_prompt;
+    int f_fd;
+    int f_ready;        /* login accepted */
+    int f_pollable;     /* input can be watched by the loop */
+    int f_watching;
+    int f_eof;
+    int f_status;
+    char f_input[ INPUT_SIZE ];
+    size_t f_inlen;
+    int f_file;         /* file being sent, -1 when none */
+    int f_sent;         /* all of it queued, the end is left */
+    char f_chunk[ ECHO_FRAME_CHUNK_SIZE ];
+    size_t f_chunklen;
+    struct download *f_downloads;
+};
+
+static void on_login( echo_session_t *session, int accepted, void *arg );
+static void on_message( echo_session_t *session, int type,
+        const char *payload, size_t size, void *arg );
+static void on_drain( echo_session_t *session, void *arg );
+static void on_close( echo_session_t *session, int err, void *arg );
+static void on_input( int fd, void *arg );
+static void feed( struct feeder *feeder, int readable );
+static int send_lines( struct feeder *feeder );
+static int send_line( struct feeder *feeder, const char *line,
+        size_t length, int *err );
+static int send_file( struct feeder *feeder );
+static int start_file( struct feeder *feeder, const char *path,
+        size_t length, int *err );
+static void receive( struct feeder *feeder, int type, const char *payload,
+        size_t size );
+static uint32_t get_id( const char *payload );
+static void unwatch( struct feeder *feeder );
 FILE *logfile;
 
 int main( int argc, char *argv[ ] )
 {
-    char buffer[ 256 ], filename[ 256 ];
-    echo_client_context_t *client;
-    tcp_context_t *ctx;
-    pthread_t thread;
-    int err;
+    static const struct option options[ ] =
+    {
+        { "compress", no_argument, NULL, 'z' },
+        { "pipe", required_argument, NULL, 'p' },
+        { NULL, 0, NULL, 0 }
+    };
+    static const echo_session_handler_t handler =
+    {
+        on_login, on_message, on_drain, on_close
+    };
+    char filename[ 256 ];
+    struct download *download;
+    struct feeder *feeder;
+    const char *pipename;
+    echo_client_loop_t *loop;
+    int opt, features, status, err;
+    char **args;
+
+    features = 0;
+    pipename = NULL;
+
+    while( ( opt = getopt_long( argc, argv, "zp:", options,
+                    NULL ) ) != -1 )
+    {
+        if( opt == 'z' )
+        {
+            features |= ECHO_FEATURE_DEFLATE;
+        }
+        else if( opt == 'p' )
+        {
+            pipename = optarg;
+        }
+        else
+        {
+            optind = argc;
+            break;
+        }
+    }
+
+    if( argc - optind != 3 )
+    {
+        fprintf( stderr, "USAGE: %s [-z] [--pipe FILE] USERNAME HOSTNAME "
+                "PORT\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    args = argv + optind;
 
-    if( argc != 4 )
+    if( ( feeder = calloc( 1, sizeof( struct feeder ) ) ) == NULL )
     {
-        fprintf( stderr, "USAGE: %s USERNAME HOSTNAME PORT\n", argv[ 0 ] );
+        perror( "calloc" );
         return EXIT_FAILURE;
     }
 
-    strcpy( filename, argv[ USERNAME ] );
-    strcat( filename, ".log" );
+    feeder->f_fd = STDIN_FILENO;
+    feeder->f_file = -1;
+    feeder->f_prompt = pipename == NULL ? args[ USERNAME ] : NULL;
+
+    if( pipename != NULL && strcmp( pipename, "-" ) != 0 &&
+            ( feeder->f_fd = open( pipename, O_RDONLY ) ) == -1 )
+    {
+        perror( "open" );
+        return EXIT_FAILURE;
+    }
+
+    snprintf( filename, sizeof( filename ), "%s.log", args[ USERNAME ] );
 
     if( ( logfile = fopen( filename, "a+" ) ) == NULL )
     {
@@ -33,91 +136,448 @@ int main( int argc, char *argv[ ] )
         return EXIT_FAILURE;
     }
 
-    if( ( ctx = tcp_context_create( &err ) ) == NULL )
+    if( ( loop = echo_client_loop_create( 2, &err ) ) == NULL )
     {
         char buf[ 256 ];
         tcp_context_strerror( err, buf, 256 );
-        fprintf( stderr, "tcp_context_create: %s.\n", buf );
+        fprintf( stderr, "echo_client_loop_create: %s.\n", buf );
         return EXIT_FAILURE;
     }
 
-    if( tcp_context_connect( ctx, argv[ HOSTNAME ],
-                atoi( argv[ PORT ] ), &err ) == -1 )
+    feeder->f_loop = loop;
+    feeder->f_session = echo_client_loop_connect( loop, args[ HOSTNAME ],
+            atoi( args[ PORT ] ), &handler, feeder, &err );
+
+    if( feeder->f_session == NULL ||
+            echo_session_login( feeder->f_session, args[ USERNAME ],
+                features, &err ) == -1 )
     {
         char buf[ 256 ];
         tcp_context_strerror( err, buf, 256 );
-        fprintf( stderr, "tcp_context_connect: %s.\n", buf );
+        fprintf( stderr, "echo_client_loop_connect: %s.\n", buf );
+        echo_client_loop_destroy( loop );
         return EXIT_FAILURE;
     }
 
-    tcp_context_send( ctx, argv[ USERNAME ], strlen( argv[ USERNAME ] ),
-            &err );
-
-    if( tcp_context_recv( ctx, buffer, 256, &err ) > 0 )
+    while( echo_client_loop_sessions( loop ) > 0 )
     {
-        if( strcmp( buffer, "FAILED" ) == 0 )
+        if( echo_client_loop_run( loop, -1, &err ) == -1 )
         {
-            printf( "Username already taken\n" );
-            return EXIT_FAILURE;
+            feeder->f_status = EXIT_FAILURE;
+            break;
         }
     }
 
-    client = echo_client_context_create( ctx, argv[ USERNAME ], &err );
+    status = feeder->f_status;
+    echo_client_loop_destroy( loop );
 
-    if( client == NULL )
+    while( ( download = feeder->f_downloads ) != NULL )
     {
-        char buf[ 256 ];
-        tcp_context_strerror( err, buf, 256 );
-        fprintf( stderr, "echo_client_context_create: %s.\n", buf );
-        tcp_context_destroy( ctx );
-        return EXIT_FAILURE;
+        feeder->f_downloads = download->d_next;
+        fclose( download->d_file );
+        free( download );
     }
 
-    err = pthread_create( &thread, NULL, read_thread, client );
+    fclose( logfile );
+    free( feeder );
 
-    if( err != 0 )
+    return status;
+}
+
+void on_login( echo_session_t *session, int accepted, void *arg )
+{
+    struct feeder *feeder;
+    int err;
+
+    ( void )session;
+    feeder = ( struct feeder* )arg;
+
+    if( !accepted )
     {
-        perror( "pthread_create" );
-        echo_client_context_destroy( client );
-        return EXIT_FAILURE;
+        printf( "Username already taken\n" );
+        feeder->f_status = EXIT_FAILURE;
+        return;
+    }
+
+    /* Regular files cannot be polled, they are read whenever the session
+     * has written everything it was given. */
+    feeder->f_ready = 1;
+    feeder->f_pollable = echo_client_loop_watch( feeder->f_loop,
+            feeder->f_fd, on_input, feeder, &err ) == 0;
+    feeder->f_watching = feeder->f_pollable;
+
+    if( feeder->f_prompt != NULL )
+    {
+        printf( "%s> ", feeder->f_prompt );
+        fflush( stdout );
+    }
+
+    if( !feeder->f_pollable )
+        feed( feeder, 0 );
+}
+
+void on_message( echo_session_t *session, int type, const char *payload,
+        size_t size, void *arg )
+{
+    ( void )session;
+
+    if( type == ECHO_FRAME_OFFER || type == ECHO_FRAME_CHUNK ||
+            type == ECHO_FRAME_END )
+    {
+        receive( ( struct feeder* )arg, type, payload, size );
+    }
+    else if( type == ECHO_FRAME_TEXT )
+    {
+        fwrite( payload, 1, size, logfile );
+        fflush( logfile );
+    }
+    else if( type == ECHO_FRAME_ERROR )
+    {
+        fwrite( payload, 1, size, stdout );
+        fflush( stdout );
+    }
+}
+
+void on_drain( echo_session_t *session, void *arg )
+{
+    struct feeder *feeder;
+
+    ( void )session;
+    feeder = ( struct feeder* )arg;
+
+    if( feeder->f_ready )
+        feed( feeder, 0 );
+}
+
+void on_close( echo_session_t *session, int err, void *arg )
+{
+    struct feeder *feeder;
+
+    ( void )session;
+    feeder = ( struct feeder* )arg;
+
+    if( err != 0 && err != EACCES )
+        feeder->f_status = EXIT_FAILURE;
+
+    unwatch( feeder );
+    feeder->f_session = NULL;
+}
+
+void on_input( int fd, void *arg )
+{
+    ( void )fd;
+    feed( ( struct feeder* )arg, 1 );
+}
+
+/* Moves input into the session until either runs dry. While the session's
+ * output is full the input is left alone, which paces a pipe to the speed
+ * of the connection. */
+void feed( struct feeder *feeder, int readable )
+{
+    ssize_t bytes;
+    int err;
+
+    while( feeder->f_session != NULL )
+    {
+        if( send_lines( feeder ) == -1 )
+        {
+            unwatch( feeder );
+            return;
+        }
+
+        /* The file goes out while the session takes it, without holding
+         * up the input. */
+        send_file( feeder );
+
+        if( feeder->f_eof )
+        {
+            if( feeder->f_file == -1 )
+                echo_session_close( feeder->f_session );
+
+            return;
+        }
+
+        if( feeder->f_pollable && !readable )
+        {
+            if( !feeder->f_watching )
+            {
+                feeder->f_watching = echo_client_loop_watch( feeder->f_loop,
+                        feeder->f_fd, on_input, feeder, &err ) == 0;
+            }
+
+            return;
+        }
+
+        bytes = read( feeder->f_fd, feeder->f_input + feeder->f_inlen,
+                INPUT_SIZE - feeder->f_inlen );
+
+        if( bytes <= 0 )
+        {
+            feeder->f_eof = 1;
+            unwatch( feeder );
+        }
+        else
+        {
+            feeder->f_inlen += bytes;
+        }
+
+        if( feeder->f_prompt != NULL && !feeder->f_eof )
+        {
+            printf( "%s> ", feeder->f_prompt );
+            fflush( stdout );
+        }
+
+        readable = 0;
     }
+}
+
+/* Sends every complete line of the input, lines longer than a message are
+ * split. Returns -1 when the session cannot take more for now. */
+int send_lines( struct feeder *feeder )
+{
+    size_t start, length;
+    char *newline;
+    int retval, err;
+
+    start = 0;
+    retval = 0;
 
-    while( !feof( stdin ) )
+    while( start < feeder->f_inlen )
     {
-        printf( "%s> ", argv[ USERNAME ] );
+        newline = memchr( feeder->f_input + start, '\n',
+                feeder->f_inlen - start );
 
-        fgets( buffer, 256, stdin );
-        buffer[ strlen( buffer )-1 ] = '\0';
+        if( newline != NULL )
+        {
+            length = newline - ( feeder->f_input + start );
+        }
+        else if( feeder->f_eof || feeder->f_inlen - start >= MESSAGE_MAX )
+        {
+            length = feeder->f_inlen - start;
+        }
+        else
+        {
+            break;
+        }
 
-        if( !feof( stdin ) )
+        if( length > MESSAGE_MAX )
         {
-            tcp_context_send( ctx, buffer, strlen( buffer ), &err );
+            length = MESSAGE_MAX;
+            newline = NULL;
         }
+
+        if( length > 0 && send_line( feeder, feeder->f_input + start,
+                    length, &err ) == -1 )
+        {
+            retval = -1;
+            break;
+        }
+
+        start += length + ( newline != NULL );
     }
 
-    echo_client_context_destroy( client );
-    fclose( logfile );
+    memmove( feeder->f_input, feeder->f_input + start,
+            feeder->f_inlen - start );
+    feeder->f_inlen -= start;
 
-    return EXIT_SUCCESS;
+    return retval;
 }
 
-void *read_thread( void *arg )
+/* "/msg NAME TEXT" sends TEXT to NAME alone, "/send PATH" sends a file
+ * and any other line goes to the room. */
+int send_line( struct feeder *feeder, const char *line, size_t length,
+        int *err )
+{
+    const char *name, *end, *stop;
+    echo_session_t *session;
+    char to[ MAX_LENGTH ];
+
+    session = feeder->f_session;
+
+    if( length > 6 && memcmp( line, "/send ", 6 ) == 0 )
+        return start_file( feeder, line + 6, length - 6, err );
+
+    if( length < 4 || memcmp( line, "/msg", 4 ) != 0 ||
+            ( length > 4 && line[ 4 ] != ' ' ) )
+        return echo_session_send( session, line, length, err );
+
+    stop = line + length;
+
+    for( name = line + 4; name < stop && *name == ' '; name++ );
+    for( end = name; end < stop && *end != ' '; end++ );
+
+    if( end == name || end - name >= MAX_LENGTH || end + 1 >= stop )
+    {
+        fprintf( stderr, "USAGE: /msg USERNAME MESSAGE\n" );
+        return 0;
+    }
+
+    memcpy( to, name, end - name );
+    to[ end - name ] = '\0';
+
+    return echo_session_direct( session, to, end + 1, stop - end - 1, err );
+}
+
+/* Queues chunks until the session is full, then the end. Returns -1 when
+ * the session cannot take more for now. */
+int send_file( struct feeder *feeder )
 {
-    echo_client_context_t *client;
-    char buffer[ 4096 ];
     ssize_t bytes;
     int err;
 
-    pthread_detach( pthread_self( ) );
-    client = ( echo_client_context_t* )arg;
+    while( feeder->f_file != -1 )
+    {
+        if( feeder->f_chunklen == 0 && !feeder->f_sent )
+        {
+            if( ( bytes = read( feeder->f_file, feeder->f_chunk,
+                            ECHO_FRAME_CHUNK_SIZE ) ) > 0 )
+                feeder->f_chunklen = bytes;
+            else
+                feeder->f_sent = 1;
+        }
+
+        if( feeder->f_chunklen > 0 )
+        {
+            if( echo_session_chunk( feeder->f_session, feeder->f_chunk,
+                        feeder->f_chunklen, &err ) == -1 && err == EAGAIN )
+                return -1;
+
+            feeder->f_chunklen = 0;
+            continue;
+        }
+
+        if( echo_session_end( feeder->f_session, &err ) == -1 &&
+                err == EAGAIN )
+            return -1;
+
+        close( feeder->f_file );
+        feeder->f_file = -1;
+    }
+
+    return 0;
+}
+
+/* The file is offered under its base name. */
+int start_file( struct feeder *feeder, const char *path, size_t length,
+        int *err )
+{
+    char name[ 256 ];
+    const char *base;
+    int fd;
 
-    while( ( bytes = tcp_context_recv( client->eec_tcp, buffer, 4096,
-                    &err ) ) > 0 )
+    if( feeder->f_file != -1 || length >= sizeof( name ) )
     {
-        fputs( buffer, logfile );
-        fflush( logfile );
-        memset( buffer, 0, 4096 );
+        fprintf( stderr, "USAGE: /send PATH, one file at a time\n" );
+        return 0;
+    }
+
+    memcpy( name, path, length );
+    name[ length ] = '\0';
+
+    if( ( fd = open( name, O_RDONLY ) ) == -1 )
+    {
+        perror( name );
+        return 0;
+    }
+
+    base = strrchr( name, '/' ) != NULL ? strrchr( name, '/' ) + 1 : name;
+
+    if( echo_session_offer( feeder->f_session, base, err ) == -1 )
+    {
+        close( fd );
+        return -1;
+    }
+
+    feeder->f_file = fd;
+    feeder->f_sent = 0;
+    feeder->f_chunklen = 0;
+
+    return 0;
+}
+
+/* Files from others are saved as USERNAME.ID.NAME, those we send come back
+ * like chat lines do and are left alone. */
+void receive( struct feeder *feeder, int type, const char *payload,
+        size_t size )
+{
+    struct download *download, **link;
+    const char *sender, *name, *base;
+    size_t length;
+    uint32_t id;
+
+    if( size < ECHO_FRAME_ID )
+        return;
+
+    id = get_id( payload );
+
+    for( link = &feeder->f_downloads; *link != NULL &&
+            ( *link )->d_id != id; link = &( *link )->d_next );
+
+    if( type == ECHO_FRAME_OFFER )
+    {
+        sender = payload + ECHO_FRAME_ID;
+
+        if( *link != NULL || memchr( sender, '\0', size - ECHO_FRAME_ID ) ==
+                NULL || strcmp( sender, echo_session_uname(
+                        feeder->f_session ) ) == 0 ||
+                ( download = malloc( sizeof( struct download ) ) ) == NULL )
+            return;
+
+        name = sender + strlen( sender ) + 1;
+        length = size - ( name - payload );
+
+        for( base = name + length; base > name && base[ -1 ] != '/';
+                base-- );
+
+        snprintf( download->d_path, sizeof( download->d_path ),
+                "%s.%u.%.*s", echo_session_uname( feeder->f_session ),
+                ( unsigned )id, ( int )( length - ( base - name ) ), base );
+
+        if( ( download->d_file = fopen( download->d_path, "w" ) ) == NULL )
+        {
+            free( download );
+            return;
+        }
+
+        download->d_id = id;
+        download->d_next = feeder->f_downloads;
+        feeder->f_downloads = download;
+        return;
     }
 
-    return NULL;
+    if( ( download = *link ) == NULL )
+        return;
+
+    if( type == ECHO_FRAME_CHUNK )
+    {
+        fwrite( payload + ECHO_FRAME_ID, 1, size - ECHO_FRAME_ID,
+                download->d_file );
+        return;
+    }
+
+    fclose( download->d_file );
+    fprintf( logfile, "%s %s\n", download->d_path, size > ECHO_FRAME_ID &&
+            payload[ ECHO_FRAME_ID ] == 0 ? "saved" : "incomplete" );
+    fflush( logfile );
+    *link = download->d_next;
+    free( download );
+}
+
+uint32_t get_id( const char *payload )
+{
+    const unsigned char *bytes;
+
+    bytes = ( const unsigned char* )payload;
+
+    return ( uint32_t )bytes[ 0 ] << 24 | ( uint32_t )bytes[ 1 ] << 16 |
+        ( uint32_t )bytes[ 2 ] << 8 | bytes[ 3 ];
+}
+
+void unwatch( struct feeder *feeder )
+{
+    if( feeder->f_watching )
+    {
+        echo_client_loop_unwatch( feeder->f_loop, feeder->f_fd );
+        feeder->f_watching = 0;
+    }
 }
@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+#include "echoadmin.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define TRIES       8
+
+struct echo_admin
+{
+    int ea_listener;
+    int ea_stop[ 2 ];           /* Written to end the thread */
+    int ea_running;
+    pthread_t ea_thread;
+    echo_admin_handler_t ea_handler;
+    void *ea_arg;
+    struct sockaddr_un ea_addr;
+    echo_admin_session_t ea_slots[ ECHO_ADMIN_SLOTS ];
+};
+
+static void *admin_thread( void *arg );
+static void converse( echo_admin_t *admin, int client );
+static void run( echo_admin_t *admin, int client, char *line );
+static int replace_stale( const struct sockaddr_un *addr, int *err );
+static int send_all( int fd, const char *buffer, size_t size );
+
+echo_admin_t *echo_admin_create( const char *path,
+        echo_admin_handler_t handler, void *arg, int *err )
+{
+    echo_admin_t *admin;
+    size_t i;
+
+    if( path == NULL || handler == NULL ||
+            strlen( path ) >= sizeof( admin->ea_addr.sun_path ) )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( admin = calloc( 1, sizeof( echo_admin_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    admin->ea_addr.sun_family = AF_UNIX;
+    strcpy( admin->ea_addr.sun_path, path );
+    admin->ea_handler = handler;
+    admin->ea_arg = arg;
+
+    for( i = 0; i < ECHO_ADMIN_SLOTS; i++ )
+    {
+        atomic_init( &admin->ea_slots[ i ].eas_fd, -1 );
+    }
+
+    if( replace_stale( &admin->ea_addr, err ) == -1 )
+    {
+        free( admin );
+        return NULL;
+    }
+
+    if( ( admin->ea_listener = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC,
+                    0 ) ) == -1 )
+    {
+        *err = errno;
+        free( admin );
+        return NULL;
+    }
+
+    /* Nobody can connect before listen, the mode is set in between. */
+    if( bind( admin->ea_listener, ( struct sockaddr* )&admin->ea_addr,
+                sizeof( admin->ea_addr ) ) == -1 ||
+            chmod( path, S_IRUSR | S_IWUSR ) == -1 ||
+            listen( admin->ea_listener, 4 ) == -1 ||
+            pipe2( admin->ea_stop, O_CLOEXEC ) == -1 )
+    {
+        *err = errno;
+        close( admin->ea_listener );
+        unlink( path );
+        free( admin );
+        return NULL;
+    }
+
+    if( ( errno = pthread_create( &admin->ea_thread, NULL, admin_thread,
+                    admin ) ) != 0 )
+    {
+        *err = errno;
+        close( admin->ea_stop[ 0 ] );
+        close( admin->ea_stop[ 1 ] );
+        close( admin->ea_listener );
+        unlink( path );
+        free( admin );
+        return NULL;
+    }
+
+    admin->ea_running = 1;
+
+    return admin;
+}
+
+/* The slot is claimed with a compare and swap, then filled between two
+ * increments of its sequence count. */
+echo_admin_session_t *echo_admin_open( echo_admin_t *admin, uint32_t id,
+        int fd, const char *name )
+{
+    uint64_t words[ ECHO_ADMIN_NAME / 8 ];
+    echo_admin_session_t *session;
+    unsigned int sequence;
+    size_t i;
+    int expected;
+
+    for( i = 0; i < ECHO_ADMIN_SLOTS; i++ )
+    {
+        expected = 0;
+
+        if( atomic_compare_exchange_strong( &admin->ea_slots[ i ].eas_used,
+                    &expected, 1 ) )
+            break;
+    }
+
+    if( i == ECHO_ADMIN_SLOTS )
+        return NULL;
+
+    session = &admin->ea_slots[ i ];
+    memset( words, 0, sizeof( words ) );
+    strncpy( ( char* )words, name, ECHO_ADMIN_NAME - 1 );
+
+    sequence = atomic_load_explicit( &session->eas_sequence,
+            memory_order_relaxed );
+    atomic_store_explicit( &session->eas_sequence, sequence + 1,
+            memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+
+    atomic_store_explicit( &session->eas_id, id, memory_order_relaxed );
+    atomic_store_explicit( &session->eas_fd, fd, memory_order_relaxed );
+    atomic_store_explicit( &session->eas_since, time( NULL ),
+            memory_order_relaxed );
+    atomic_store_explicit( &session->eas_frames, 0, memory_order_relaxed );
+    atomic_store_explicit( &session->eas_bytes, 0, memory_order_relaxed );
+
+    for( i = 0; i < ECHO_ADMIN_NAME / 8; i++ )
+    {
+        atomic_store_explicit( &session->eas_name[ i ], words[ i ],
+                memory_order_relaxed );
+    }
+
+    atomic_store_explicit( &session->eas_sequence, sequence + 2,
+            memory_order_release );
+
+    return session;
+}
+
+/* Only the owner writes them, a load and a store are enough. */
+void echo_admin_count( echo_admin_session_t *session, size_t bytes )
+{
+    if( session == NULL )
+        return;
+
+    atomic_store_explicit( &session->eas_frames, atomic_load_explicit(
+                &session->eas_frames, memory_order_relaxed ) + 1,
+            memory_order_relaxed );
+    atomic_store_explicit( &session->eas_bytes, atomic_load_explicit(
+                &session->eas_bytes, memory_order_relaxed ) + bytes,
+            memory_order_relaxed );
+}
+
+void echo_admin_close( echo_admin_session_t *session )
+{
+    unsigned int sequence;
+
+    if( session == NULL )
+        return;
+
+    sequence = atomic_load_explicit( &session->eas_sequence,
+            memory_order_relaxed );
+    atomic_store_explicit( &session->eas_sequence, sequence + 1,
+            memory_order_relaxed );
+    atomic_thread_fence( memory_order_release );
+    atomic_store_explicit( &session->eas_fd, -1, memory_order_relaxed );
+    atomic_store_explicit( &session->eas_sequence, sequence + 2,
+            memory_order_release );
+    atomic_store_explicit( &session->eas_used, 0, memory_order_release );
+}
+
+int echo_admin_view( const echo_admin_session_t *session,
+        echo_admin_view_t *view )
+{
+    uint64_t words[ ECHO_ADMIN_NAME / 8 ];
+    unsigned int before;
+    int tries, i;
+
+    for( tries = 0; tries < TRIES; tries++ )
+    {
+        before = atomic_load_explicit( &session->eas_sequence,
+                memory_order_acquire );
+
+        if( before & 1 )
+            continue;
+
+        view->eav_id = atomic_load_explicit( &session->eas_id,
+                memory_order_relaxed );
+        view->eav_fd = atomic_load_explicit( &session->eas_fd,
+                memory_order_relaxed );
+        view->eav_since = atomic_load_explicit( &session->eas_since,
+                memory_order_relaxed );
+        view->eav_frames = atomic_load_explicit( &session->eas_frames,
+                memory_order_relaxed );
+        view->eav_bytes = atomic_load_explicit( &session->eas_bytes,
+                memory_order_relaxed );
+
+        for( i = 0; i < ECHO_ADMIN_NAME / 8; i++ )
+        {
+            words[ i ] = atomic_load_explicit( &session->eas_name[ i ],
+                    memory_order_relaxed );
+        }
+
+        atomic_thread_fence( memory_order_acquire );
+
+        if( atomic_load_explicit( &session->eas_sequence,
+                    memory_order_relaxed ) != before )
+            continue;
+
+        if( view->eav_fd == -1 )
+            return 0;
+
+        memcpy( view->eav_name, words, ECHO_ADMIN_NAME );
+        view->eav_name[ ECHO_ADMIN_NAME - 1 ] = '\0';
+        view->eav_sequence = before;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+int echo_admin_same( const echo_admin_session_t *session,
+        const echo_admin_view_t *view )
+{
+    return atomic_load_explicit( &session->eas_sequence,
+            memory_order_acquire ) == view->eav_sequence;
+}
+
+echo_admin_session_t *echo_admin_slot( echo_admin_t *admin, size_t i )
+{
+    return &admin->ea_slots[ i ];
+}
+
+void echo_admin_stop( echo_admin_t *admin )
+{
+    if( !admin->ea_running )
+        return;
+
+    while( write( admin->ea_stop[ 1 ], "", 1 ) == -1 && errno == EINTR )
+        ;
+
+    pthread_join( admin->ea_thread, NULL );
+    close( admin->ea_stop[ 0 ] );
+    close( admin->ea_stop[ 1 ] );
+    close( admin->ea_listener );
+    unlink( admin->ea_addr.sun_path );
+    admin->ea_running = 0;
+}
+
+void echo_admin_destroy( echo_admin_t *admin )
+{
+    echo_admin_stop( admin );
+    free( admin );
+}
+
+/* One connection at a time, an operator's tool does not need more. */
+void *admin_thread( void *arg )
+{
+    struct pollfd pfds[ 2 ];
+    echo_admin_t *admin;
+    int client;
+
+    admin = ( echo_admin_t* )arg;
+    pfds[ 0 ].fd = admin->ea_stop[ 0 ];
+    pfds[ 0 ].events = POLLIN;
+    pfds[ 1 ].fd = admin->ea_listener;
+    pfds[ 1 ].events = POLLIN;
+
+    for( ;; )
+    {
+        if( poll( pfds, 2, -1 ) == -1 )
+            continue;
+
+        if( pfds[ 0 ].revents != 0 )
+            break;
+
+        if( ( client = accept4( admin->ea_listener, NULL, NULL,
+                        SOCK_CLOEXEC ) ) == -1 )
+            continue;
+
+        converse( admin, client );
+        close( client );
+    }
+
+    return NULL;
+}
+
+/* A connection left idle for ECHO_ADMIN_IDLE milliseconds is closed, so
+ * that a forgotten one does not lock the others out. */
+void converse( echo_admin_t *admin, int client )
+{
+    static const char too_long[ ] = "ERROR line too long\n";
+    char line[ ECHO_ADMIN_LINE ], *end;
+    struct pollfd pfds[ 2 ];
+    size_t used, length;
+    ssize_t bytes;
+
+    pfds[ 0 ].fd = admin->ea_stop[ 0 ];
+    pfds[ 0 ].events = POLLIN;
+    pfds[ 1 ].fd = client;
+    pfds[ 1 ].events = POLLIN;
+    used = 0;
+
+    for( ;; )
+    {
+        if( poll( pfds, 2, ECHO_ADMIN_IDLE ) <= 0 || pfds[ 0 ].revents != 0 )
+            return;
+
+        if( ( bytes = recv( client, line + used, sizeof( line ) - used,
+                        0 ) ) <= 0 )
+            return;
+
+        used += bytes;
+
+        while( ( end = memchr( line, '\n', used ) ) != NULL )
+        {
+            *end = '\0';
+            length = end - line + 1;
+
+            if( end > line && end[ -1 ] == '\r' )
+                end[ -1 ] = '\0';
+
+            run( admin, client, line );
+            memmove( line, line + length, used - length );
+            used -= length;
+        }
+
+        if( used == sizeof( line ) )
+        {
+            send_all( client, too_long, strlen( too_long ) );
+            return;
+        }
+    }
+}
+
+/* The reply is built in memory and written at once. */
+void run( echo_admin_t *admin, int client, char *line )
+{
+    char *argv[ ECHO_ADMIN_ARGS + 1 ], *saved, *text;
+    const char *reason;
+    size_t size;
+    FILE *out;
+    int argc;
+
+    for( argc = 0, argv[ 0 ] = strtok_r( line, " \t", &saved );
+            argv[ argc ] != NULL && argc < ECHO_ADMIN_ARGS; )
+    {
+        argv[ ++argc ] = strtok_r( NULL, " \t", &saved );
+    }
+
+    if( argc == 0 )
+        return;
+
+    if( ( out = open_memstream( &text, &size ) ) == NULL )
+        return;
+
+    if( argv[ argc ] != NULL )
+    {
+        fprintf( out, "ERROR too many arguments\n" );
+    }
+    else if( ( reason = admin->ea_handler( argc, argv, out,
+                    admin->ea_arg ) ) != NULL )
+    {
+        fprintf( out, "ERROR %s\n", reason );
+    }
+    else
+    {
+        fprintf( out, "OK\n" );
+    }
+
+    fclose( out );
+    send_all( client, text, size );
+    free( text );
+}
+
+/* A socket nobody listens on any more is left by a server that died, one
+ * that answers belongs to a running server. */
+int replace_stale( const struct sockaddr_un *addr, int *err )
+{
+    struct stat info;
+    int fd, retval;
+
+    if( lstat( addr->sun_path, &info ) == -1 )
+        return 0;
+
+    if( !S_ISSOCK( info.st_mode ) )
+    {
+        *err = EEXIST;
+        return -1;
+    }
+
+    if( ( fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) == -1 )
+    {
+        *err = errno;
+        return -1;
+    }
+
+    retval = connect( fd, ( const struct sockaddr* )addr, sizeof( *addr ) );
+    close( fd );
+
+    if( retval == 0 )
+    {
+        *err = EADDRINUSE;
+        return -1;
+    }
+
+    unlink( addr->sun_path );
+
+    return 0;
+}
+
+int send_all( int fd, const char *buffer, size_t size )
+{
+    ssize_t bytes;
+
+    for( ; size > 0; buffer += bytes, size -= bytes )
+    {
+        if( ( bytes = send( fd, buffer, size, MSG_NOSIGNAL ) ) == -1 )
+        {
+            if( errno == EINTR )
+            {
+                bytes = 0;
+                continue;
+            }
+
+            return -1;
+        }
+    }
+
+    return 0;
+}
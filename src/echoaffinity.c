@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include "echoaffinity.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+
+struct cpu
+{
+    int c_cpu;
+    int c_node;
+    size_t c_live;      /* placed threads still running */
+    size_t c_placed;    /* placed threads overall */
+};
+
+struct echo_affinity
+{
+    pthread_mutex_t ea_lock;
+    struct cpu *ea_cpus;
+    size_t ea_count;
+};
+
+static int parse_list( const char *list, const cpu_set_t *allowed,
+        cpu_set_t *set );
+static int cpu_node( int cpu );
+
+echo_affinity_t *echo_affinity_create( const char *list, int *err )
+{
+    echo_affinity_t *affinity;
+    cpu_set_t allowed, set;
+    size_t count;
+    int cpu;
+
+    if( sched_getaffinity( 0, sizeof( allowed ), &allowed ) == -1 )
+    {
+        *err = errno;
+        return NULL;
+    }
+
+    if( list == NULL )
+    {
+        set = allowed;
+    }
+    else if( parse_list( list, &allowed, &set ) == -1 )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( count = CPU_COUNT( &set ) ) == 0 )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( affinity = malloc( sizeof( echo_affinity_t ) ) ) == NULL ||
+            ( affinity->ea_cpus = calloc( count,
+                                          sizeof( struct cpu ) ) ) == NULL )
+    {
+        free( affinity );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    pthread_mutex_init( &affinity->ea_lock, NULL );
+    affinity->ea_count = 0;
+
+    for( cpu = 0; cpu < ECHO_AFFINITY_CPUS && cpu < CPU_SETSIZE; cpu++ )
+    {
+        if( !CPU_ISSET( cpu, &set ) )
+            continue;
+
+        affinity->ea_cpus[ affinity->ea_count ].c_cpu = cpu;
+        affinity->ea_cpus[ affinity->ea_count ].c_node = cpu_node( cpu );
+        affinity->ea_count++;
+    }
+
+    return affinity;
+}
+
+size_t echo_affinity_cpus( const echo_affinity_t *affinity )
+{
+    return affinity->ea_count;
+}
+
+int echo_affinity_node( const echo_affinity_t *affinity, int cpu )
+{
+    size_t i;
+
+    for( i = 0; i < affinity->ea_count; i++ )
+    {
+        if( affinity->ea_cpus[ i ].c_cpu == cpu )
+            return affinity->ea_cpus[ i ].c_node;
+    }
+
+    return -1;
+}
+
+int echo_affinity_place( echo_affinity_t *affinity, pthread_attr_t *attr,
+        int *err )
+{
+    struct cpu *least;
+    cpu_set_t set;
+    size_t i;
+
+    if( affinity == NULL || attr == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock( &affinity->ea_lock );
+    least = &affinity->ea_cpus[ 0 ];
+
+    for( i = 1; i < affinity->ea_count; i++ )
+    {
+        if( affinity->ea_cpus[ i ].c_live < least->c_live )
+            least = &affinity->ea_cpus[ i ];
+    }
+
+    CPU_ZERO( &set );
+    CPU_SET( least->c_cpu, &set );
+
+    if( ( *err = pthread_attr_setaffinity_np( attr, sizeof( set ),
+                    &set ) ) != 0 )
+    {
+        pthread_mutex_unlock( &affinity->ea_lock );
+        return -1;
+    }
+
+    least->c_live++;
+    least->c_placed++;
+    pthread_mutex_unlock( &affinity->ea_lock );
+
+    return least->c_cpu;
+}
+
+void echo_affinity_leave( echo_affinity_t *affinity, int cpu )
+{
+    size_t i;
+
+    pthread_mutex_lock( &affinity->ea_lock );
+
+    for( i = 0; i < affinity->ea_count; i++ )
+    {
+        if( affinity->ea_cpus[ i ].c_cpu == cpu &&
+                affinity->ea_cpus[ i ].c_live > 0 )
+        {
+            affinity->ea_cpus[ i ].c_live--;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &affinity->ea_lock );
+}
+
+int echo_affinity_current( void )
+{
+    return sched_getcpu( );
+}
+
+void echo_affinity_report( echo_affinity_t *affinity, FILE *file )
+{
+    size_t i;
+
+    pthread_mutex_lock( &affinity->ea_lock );
+
+    for( i = 0; i < affinity->ea_count; i++ )
+    {
+        fprintf( file, "cpu %d node %d threads %zu placed %zu\n",
+                affinity->ea_cpus[ i ].c_cpu, affinity->ea_cpus[ i ].c_node,
+                affinity->ea_cpus[ i ].c_live,
+                affinity->ea_cpus[ i ].c_placed );
+    }
+
+    pthread_mutex_unlock( &affinity->ea_lock );
+}
+
+void echo_affinity_destroy( echo_affinity_t *affinity )
+{
+    pthread_mutex_destroy( &affinity->ea_lock );
+    free( affinity->ea_cpus );
+    free( affinity );
+}
+
+/* Comma separated CPUs and ranges, every one of them allowed. */
+int parse_list( const char *list, const cpu_set_t *allowed, cpu_set_t *set )
+{
+    unsigned long first, last;
+    char *end;
+
+    CPU_ZERO( set );
+
+    do
+    {
+        errno = 0;
+        first = strtoul( list, &end, 10 );
+        last = first;
+
+        if( end == list || errno != 0 )
+            return -1;
+
+        if( *end == '-' )
+        {
+            list = end + 1;
+            last = strtoul( list, &end, 10 );
+
+            if( end == list || errno != 0 || last < first )
+                return -1;
+        }
+
+        if( last >= ECHO_AFFINITY_CPUS || last >= CPU_SETSIZE )
+            return -1;
+
+        for( ; first <= last; first++ )
+        {
+            if( !CPU_ISSET( first, allowed ) )
+                return -1;
+
+            CPU_SET( first, set );
+        }
+
+        list = end + 1;
+    }
+    while( *end == ',' );
+
+    return *end == '\0' ? 0 : -1;
+}
+
+/* sysfs lists a nodeN entry in the directory of every CPU of node N. */
+int cpu_node( int cpu )
+{
+    char path[ 64 ];
+    struct dirent *entry;
+    DIR *dir;
+    int node;
+
+    sprintf( path, "/sys/devices/system/cpu/cpu%d", cpu );
+    node = 0;
+
+    if( ( dir = opendir( path ) ) == NULL )
+        return node;
+
+    while( ( entry = readdir( dir ) ) != NULL )
+    {
+        if( strncmp( entry->d_name, "node", 4 ) == 0 &&
+                sscanf( entry->d_name + 4, "%d", &node ) == 1 )
+            break;
+    }
+
+    closedir( dir );
+
+    return node;
+}
@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include "echoarena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define CACHE_LINE  64
+
+/* Free chunks are kept as a stack of indices, the most recently returned
+ * chunk is handed out first while its pages are still warm. */
+struct echo_arena
+{
+    pthread_mutex_t ea_lock;
+    char *ea_base;
+    size_t ea_length;           /* bytes mapped */
+    size_t ea_size;
+    size_t ea_chunks;
+    uint32_t *ea_free;
+    size_t ea_nfree;
+    size_t ea_peak;
+    size_t ea_misses;
+    int ea_backing;
+};
+
+static char *map( size_t length, int flags, int *backing );
+
+echo_arena_t *echo_arena_create( size_t size, size_t chunks, int flags,
+        int *err )
+{
+    echo_arena_t *arena;
+    size_t i;
+
+    if( size == 0 || chunks == 0 || chunks > UINT32_MAX ||
+            size > SIZE_MAX / chunks - ECHO_ARENA_HUGE )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( arena = malloc( sizeof( echo_arena_t ) ) ) == NULL ||
+            ( arena->ea_free = malloc( chunks * sizeof( uint32_t ) ) ) ==
+            NULL )
+    {
+        free( arena );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    arena->ea_size = ( size + CACHE_LINE - 1 ) &
+        ~( size_t )( CACHE_LINE - 1 );
+    arena->ea_chunks = chunks;
+    arena->ea_length = ( arena->ea_size * chunks + ECHO_ARENA_HUGE - 1 ) &
+        ~( size_t )( ECHO_ARENA_HUGE - 1 );
+
+    if( ( arena->ea_base = map( arena->ea_length, flags,
+                    &arena->ea_backing ) ) == NULL )
+    {
+        free( arena->ea_free );
+        free( arena );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    for( i = 0; i < chunks; i++ )
+    {
+        arena->ea_free[ i ] = chunks - 1 - i;
+    }
+
+    pthread_mutex_init( &arena->ea_lock, NULL );
+    arena->ea_nfree = chunks;
+    arena->ea_peak = 0;
+    arena->ea_misses = 0;
+
+    return arena;
+}
+
+/* Chunks go out from the start of the mapping, see the free stack. The
+ * kernel populates the range in one call where it can, otherwise each page
+ * is written to. */
+size_t echo_arena_prefault( echo_arena_t *arena, size_t chunks )
+{
+    size_t length, page, i;
+
+    if( chunks > arena->ea_chunks )
+        chunks = arena->ea_chunks;
+
+    page = sysconf( _SC_PAGESIZE );
+    length = ( arena->ea_size * chunks + page - 1 ) & ~( page - 1 );
+
+    if( length > arena->ea_length )
+        length = arena->ea_length;
+
+#ifdef MADV_POPULATE_WRITE
+    if( madvise( arena->ea_base, length, MADV_POPULATE_WRITE ) == 0 )
+        return length;
+#endif
+
+    for( i = 0; i < length; i += page )
+    {
+        ( ( volatile char* )arena->ea_base )[ i ] = 0;
+    }
+
+    return length;
+}
+
+void *echo_arena_get( echo_arena_t *arena, int *err )
+{
+    size_t index;
+
+    pthread_mutex_lock( &arena->ea_lock );
+
+    if( arena->ea_nfree == 0 )
+    {
+        arena->ea_misses++;
+        pthread_mutex_unlock( &arena->ea_lock );
+        *err = ENOBUFS;
+        return NULL;
+    }
+
+    index = arena->ea_free[ --arena->ea_nfree ];
+
+    if( arena->ea_chunks - arena->ea_nfree > arena->ea_peak )
+        arena->ea_peak = arena->ea_chunks - arena->ea_nfree;
+
+    pthread_mutex_unlock( &arena->ea_lock );
+
+    return arena->ea_base + index * arena->ea_size;
+}
+
+void echo_arena_put( echo_arena_t *arena, void *chunk )
+{
+    pthread_mutex_lock( &arena->ea_lock );
+    arena->ea_free[ arena->ea_nfree++ ] =
+        ( ( char* )chunk - arena->ea_base ) / arena->ea_size;
+    pthread_mutex_unlock( &arena->ea_lock );
+}
+
+int echo_arena_owns( const echo_arena_t *arena, const void *chunk )
+{
+    return ( const char* )chunk >= arena->ea_base &&
+        ( const char* )chunk < arena->ea_base +
+        arena->ea_size * arena->ea_chunks;
+}
+
+void echo_arena_usage( echo_arena_t *arena, echo_arena_usage_t *usage )
+{
+    pthread_mutex_lock( &arena->ea_lock );
+    usage->eu_chunks = arena->ea_chunks;
+    usage->eu_size = arena->ea_size;
+    usage->eu_used = arena->ea_chunks - arena->ea_nfree;
+    usage->eu_peak = arena->ea_peak;
+    usage->eu_misses = arena->ea_misses;
+    usage->eu_backing = arena->ea_backing;
+    pthread_mutex_unlock( &arena->ea_lock );
+}
+
+void echo_arena_report( echo_arena_t *arena, FILE *file )
+{
+    static const char *backings[ ] = { "pages", "transparent", "reserved" };
+    echo_arena_usage_t usage;
+
+    echo_arena_usage( arena, &usage );
+    fprintf( file, "arena_chunks=%zu\narena_chunk_size=%zu\n"
+            "arena_used=%zu\narena_peak=%zu\narena_misses=%zu\n"
+            "arena_utilization=%.2f\narena_backing=%s\n", usage.eu_chunks,
+            usage.eu_size, usage.eu_used, usage.eu_peak, usage.eu_misses,
+            ( double )usage.eu_peak / usage.eu_chunks,
+            backings[ usage.eu_backing ] );
+}
+
+void echo_arena_destroy( echo_arena_t *arena )
+{
+    munmap( arena->ea_base, arena->ea_length );
+    pthread_mutex_destroy( &arena->ea_lock );
+    free( arena->ea_free );
+    free( arena );
+}
+
+/* Reserved huge pages fail outright when none are left, transparent ones
+ * are only advice and the kernel may still hand out regular pages. The
+ * region is aligned on a huge page so that none of it is left over. */
+char *map( size_t length, int flags, int *backing )
+{
+    char *base, *aligned;
+
+    if( flags & ECHO_ARENA_HUGETLB )
+    {
+        base = mmap( NULL, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+
+        if( base != MAP_FAILED )
+        {
+            *backing = ECHO_ARENA_RESERVED;
+            return base;
+        }
+    }
+
+    base = mmap( NULL, length + ECHO_ARENA_HUGE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+    if( base == MAP_FAILED )
+        return NULL;
+
+    aligned = ( char* )( ( ( uintptr_t )base + ECHO_ARENA_HUGE - 1 ) &
+            ~( uintptr_t )( ECHO_ARENA_HUGE - 1 ) );
+
+    if( aligned > base )
+        munmap( base, aligned - base );
+
+    munmap( aligned + length, base + ECHO_ARENA_HUGE - aligned );
+    *backing = ECHO_ARENA_PAGES;
+
+    if( ( flags & ( ECHO_ARENA_HUGETLB | ECHO_ARENA_THP ) ) &&
+            madvise( aligned, length, MADV_HUGEPAGE ) == 0 )
+        *backing = ECHO_ARENA_TRANSPARENT;
+
+    return aligned;
+}
@@ -0,0 +1,343 @@
+#include "echocapture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Records are padded to ALIGN bytes in the ring and start with a state
+ * word: zero until the record is complete, then its padded size. A record
+ * never wraps, the end of the ring is skipped with a SKIP word instead. */
+#define ALIGN       8
+#define WORD        sizeof( uint32_t )
+#define SKIP        0x80000000u
+
+/* Producers reserve space by moving the head and publish a record with
+ * its state word, the writer thread follows at the tail and clears what it
+ * wrote so that stale bytes never pass for a state word. */
+struct echo_capture
+{
+    char *ec_ring;
+    size_t ec_size;
+    atomic_size_t ec_head;
+    atomic_size_t ec_tail;
+    atomic_ullong ec_dropped;
+    atomic_int ec_stop;
+    unsigned long long ec_start;
+    FILE *ec_file;
+    pthread_t ec_thread;
+};
+
+static void *writer_thread( void *arg );
+static void drain( echo_capture_t *capture );
+static _Atomic uint32_t *word( echo_capture_t *capture, size_t position );
+static unsigned long long now( clockid_t clock );
+static void put_u32( unsigned char *buffer, uint32_t value );
+static void put_u64( unsigned char *buffer, unsigned long long value );
+static uint32_t get_u32( const unsigned char *buffer );
+static unsigned long long get_u64( const unsigned char *buffer );
+
+echo_capture_t *echo_capture_create( const char *path, size_t size,
+        int *err )
+{
+    unsigned char preamble[ ECHO_CAPTURE_PREAMBLE ];
+    echo_capture_t *capture;
+
+    if( path == NULL || size < 4096 || ( size & ( size - 1 ) ) != 0 )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( capture = malloc( sizeof( echo_capture_t ) ) ) == NULL ||
+            ( capture->ec_ring = calloc( 1, size ) ) == NULL )
+    {
+        free( capture );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    if( ( capture->ec_file = fopen( path, "wb" ) ) == NULL )
+    {
+        *err = errno;
+        free( capture->ec_ring );
+        free( capture );
+        return NULL;
+    }
+
+    memcpy( preamble, "ECAP", 4 );
+    put_u32( preamble + 4, ECHO_CAPTURE_VERSION );
+    put_u64( preamble + 8, now( CLOCK_REALTIME ) );
+    fwrite( preamble, 1, sizeof( preamble ), capture->ec_file );
+
+    capture->ec_size = size;
+    atomic_init( &capture->ec_head, 0 );
+    atomic_init( &capture->ec_tail, 0 );
+    atomic_init( &capture->ec_dropped, 0 );
+    atomic_init( &capture->ec_stop, 0 );
+    capture->ec_start = now( CLOCK_MONOTONIC );
+
+    if( pthread_create( &capture->ec_thread, NULL, writer_thread,
+                capture ) != 0 )
+    {
+        fclose( capture->ec_file );
+        free( capture->ec_ring );
+        free( capture );
+        *err = EAGAIN;
+        return NULL;
+    }
+
+    return capture;
+}
+
+int echo_capture_record( echo_capture_t *capture, uint32_t connection,
+        int type, int flags, const char *payload, size_t length, int *err )
+{
+    size_t head, tail, need, pad, position;
+    unsigned char *record;
+
+    need = ( WORD + ECHO_CAPTURE_HEADER + ( payload != NULL ? length : 0 ) +
+            ALIGN - 1 ) & ~( size_t )( ALIGN - 1 );
+
+    if( atomic_load_explicit( &capture->ec_stop, memory_order_relaxed ) )
+    {
+        *err = ENOBUFS;
+        return -1;
+    }
+
+    /* The tail is read first: read after the head it may have moved past
+     * it, and the ring would look full. */
+    do
+    {
+        tail = atomic_load_explicit( &capture->ec_tail,
+                memory_order_acquire );
+        head = atomic_load_explicit( &capture->ec_head,
+                memory_order_relaxed );
+        position = head & ( capture->ec_size - 1 );
+        pad = capture->ec_size - position < need ?
+            capture->ec_size - position : 0;
+
+        if( need > capture->ec_size / 2 ||
+                head + pad + need - tail > capture->ec_size )
+        {
+            atomic_fetch_add_explicit( &capture->ec_dropped, 1,
+                    memory_order_relaxed );
+            *err = ENOBUFS;
+            return -1;
+        }
+    }
+    while( !atomic_compare_exchange_weak_explicit( &capture->ec_head, &head,
+                head + pad + need, memory_order_relaxed,
+                memory_order_relaxed ) );
+
+    if( pad > 0 )
+    {
+        atomic_store_explicit( word( capture, position ), pad | SKIP,
+                memory_order_release );
+        position = 0;
+    }
+
+    record = ( unsigned char* )capture->ec_ring + position + WORD;
+    put_u64( record, now( CLOCK_MONOTONIC ) - capture->ec_start );
+    put_u32( record + 8, connection );
+    put_u32( record + 12, length );
+    record[ 16 ] = type;
+    record[ 17 ] = flags | ( payload == NULL ? ECHO_CAPTURE_ELIDED : 0 );
+
+    if( payload != NULL )
+        memcpy( record + ECHO_CAPTURE_HEADER, payload, length );
+
+    atomic_store_explicit( word( capture, position ), need,
+            memory_order_release );
+
+    return 0;
+}
+
+unsigned long long echo_capture_dropped( echo_capture_t *capture )
+{
+    return atomic_load_explicit( &capture->ec_dropped, memory_order_relaxed );
+}
+
+void echo_capture_close( echo_capture_t *capture )
+{
+    if( capture->ec_file == NULL )
+        return;
+
+    atomic_store( &capture->ec_stop, 1 );
+    pthread_join( capture->ec_thread, NULL );
+    drain( capture );
+    fclose( capture->ec_file );
+    capture->ec_file = NULL;
+}
+
+void echo_capture_destroy( echo_capture_t *capture )
+{
+    if( capture == NULL )
+        return;
+
+    echo_capture_close( capture );
+    free( capture->ec_ring );
+    free( capture );
+}
+
+FILE *echo_capture_open( const char *path, int *err )
+{
+    unsigned char preamble[ ECHO_CAPTURE_PREAMBLE ];
+    FILE *file;
+
+    if( ( file = fopen( path, "rb" ) ) == NULL )
+    {
+        *err = errno;
+        return NULL;
+    }
+
+    if( fread( preamble, 1, sizeof( preamble ), file ) != sizeof( preamble ) ||
+            memcmp( preamble, "ECAP", 4 ) != 0 ||
+            get_u32( preamble + 4 ) != ECHO_CAPTURE_VERSION )
+    {
+        fclose( file );
+        *err = EINVAL;
+        return NULL;
+    }
+
+    return file;
+}
+
+int echo_capture_read( FILE *file, echo_capture_record_t *record,
+        char *buffer, size_t size, int *err )
+{
+    unsigned char header[ ECHO_CAPTURE_HEADER ];
+    size_t bytes;
+
+    if( ( bytes = fread( header, 1, sizeof( header ), file ) ) == 0 &&
+            feof( file ) )
+        return 0;
+
+    if( bytes != sizeof( header ) )
+    {
+        *err = EIO;
+        return -1;
+    }
+
+    record->ecr_time = get_u64( header );
+    record->ecr_connection = get_u32( header + 8 );
+    record->ecr_length = get_u32( header + 12 );
+    record->ecr_type = header[ 16 ];
+    record->ecr_flags = header[ 17 ];
+
+    if( record->ecr_flags & ECHO_CAPTURE_ELIDED )
+        return 1;
+
+    if( record->ecr_length > size )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    if( fread( buffer, 1, record->ecr_length, file ) != record->ecr_length )
+    {
+        *err = EIO;
+        return -1;
+    }
+
+    return 1;
+}
+
+/* Producers never wait on the file: the ring is emptied every
+ * ECHO_CAPTURE_PERIOD milliseconds, and what does not fit meanwhile is
+ * dropped. */
+void *writer_thread( void *arg )
+{
+    struct timespec period;
+    echo_capture_t *capture;
+
+    capture = ( echo_capture_t* )arg;
+    period.tv_sec = 0;
+    period.tv_nsec = ECHO_CAPTURE_PERIOD * 1000000L;
+
+    while( !atomic_load( &capture->ec_stop ) )
+    {
+        drain( capture );
+        fflush( capture->ec_file );
+        nanosleep( &period, NULL );
+    }
+
+    return NULL;
+}
+
+/* Stops at the first record still being written, the records behind it
+ * wait for the next round. */
+void drain( echo_capture_t *capture )
+{
+    size_t tail, head, position, used;
+    const unsigned char *record;
+    uint32_t state;
+
+    tail = atomic_load_explicit( &capture->ec_tail, memory_order_relaxed );
+    head = atomic_load_explicit( &capture->ec_head, memory_order_relaxed );
+
+    while( tail != head )
+    {
+        position = tail & ( capture->ec_size - 1 );
+
+        if( ( state = atomic_load_explicit( word( capture, position ),
+                        memory_order_acquire ) ) == 0 )
+            break;
+
+        used = state & ~SKIP;
+
+        if( !( state & SKIP ) )
+        {
+            record = ( unsigned char* )capture->ec_ring + position + WORD;
+            fwrite( record, 1, ECHO_CAPTURE_HEADER +
+                    ( record[ 17 ] & ECHO_CAPTURE_ELIDED ? 0 :
+                      get_u32( record + 12 ) ), capture->ec_file );
+        }
+
+        memset( capture->ec_ring + position, 0, used );
+        tail += used;
+        atomic_store_explicit( &capture->ec_tail, tail,
+                memory_order_release );
+    }
+}
+
+_Atomic uint32_t *word( echo_capture_t *capture, size_t position )
+{
+    return ( _Atomic uint32_t* )( capture->ec_ring + position );
+}
+
+unsigned long long now( clockid_t clock )
+{
+    struct timespec ts;
+
+    clock_gettime( clock, &ts );
+
+    return ( unsigned long long )ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void put_u32( unsigned char *buffer, uint32_t value )
+{
+    buffer[ 0 ] = value >> 24;
+    buffer[ 1 ] = value >> 16;
+    buffer[ 2 ] = value >> 8;
+    buffer[ 3 ] = value;
+}
+
+void put_u64( unsigned char *buffer, unsigned long long value )
+{
+    put_u32( buffer, value >> 32 );
+    put_u32( buffer + 4, value );
+}
+
+uint32_t get_u32( const unsigned char *buffer )
+{
+    return ( uint32_t )buffer[ 0 ] << 24 | ( uint32_t )buffer[ 1 ] << 16 |
+        ( uint32_t )buffer[ 2 ] << 8 | buffer[ 3 ];
+}
+
+unsigned long long get_u64( const unsigned char *buffer )
+{
+    return ( unsigned long long )get_u32( buffer ) << 32 |
+        get_u32( buffer + 4 );
+}
@@ -0,0 +1,986 @@
+#include "echoclient.h"
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+
+/* Kinds of objects registered with epoll, every one of them starts with
+ * its kind so that events can be told apart. */
+enum
+{
+    ITEM_SESSION,
+    ITEM_WATCH
+};
+
+enum
+{
+    SESSION_CONNECTING, /* waiting for the socket to become writable */
+    SESSION_CONNECTED,  /* connected, login not answered yet */
+    SESSION_READY,      /* login accepted */
+    SESSION_DEAD        /* closed, freed at the end of the iteration */
+};
+
+/* Buffer of ECHO_CLIENT_CHUNK bytes kept in the pool, or larger for the
+ * sessions with more pending */
+struct chunk
+{
+    struct chunk *c_next;
+    size_t c_len;
+    size_t c_size;
+    char c_data[ ];
+};
+
+struct watch
+{
+    int w_kind;
+    int w_fd;
+    void ( *w_callback )( int fd, void *arg );
+    void *w_arg;
+    struct watch *w_next;
+};
+
+struct echo_session
+{
+    int es_kind;
+    echo_client_loop_t *es_loop;
+    echo_client_context_t *es_eec;
+    echo_session_handler_t es_handler;
+    void *es_arg;
+    int es_state;
+    int es_login;               /* login queued */
+    int es_closing;             /* close once the output drains */
+    int es_shut;                /* write side shut down */
+    int es_pollout;             /* waiting for writability */
+    int es_dirty;               /* on the loop's dirty list */
+    struct chunk *es_out;       /* frames waiting to be written */
+    size_t es_sent;             /* bytes of es_out already written */
+    struct chunk *es_in;        /* partial frame left by the last read */
+    struct echo_session *es_next_dirty;
+    struct echo_session *es_prev;
+    struct echo_session *es_next;
+};
+
+struct echo_client_loop
+{
+    int el_epoll;
+    struct chunk *el_free;      /* buffer pool */
+    size_t el_nfree;
+    size_t el_keep;             /* pool size kept across releases */
+    struct echo_session *el_sessions;
+    size_t el_count;
+    struct echo_session *el_dirty;
+    struct echo_session *el_dead;
+    struct watch *el_watches;
+    struct watch *el_unwatched;
+    char el_read[ 2 * ECHO_CLIENT_FRAME ];
+    char el_plain[ ECHO_FRAME_MAX ];
+    char el_direct[ ECHO_FRAME_TEXT_MAX ];
+};
+
+static struct chunk *chunk_acquire( echo_client_loop_t *loop, size_t size );
+static void chunk_release( echo_client_loop_t *loop, struct chunk *chunk );
+static void mark_dirty( echo_session_t *session );
+static int session_reserve( echo_session_t *session, size_t size,
+        int *err );
+static int session_queue( echo_session_t *session, int type,
+        const char *payload, size_t size, int *err );
+static void session_read( echo_session_t *session );
+static void session_flush( echo_session_t *session );
+static void session_fail( echo_session_t *session, int err );
+static void session_detach( echo_session_t *session );
+static void flush_dirty( echo_client_loop_t *loop );
+static ssize_t next_frame( echo_session_t *session, const char *wire,
+        size_t len, echo_frame_t *frame, int *err );
+static int dispatch( echo_session_t *session, echo_frame_t *frame );
+
+echo_client_loop_t *echo_client_loop_create( size_t chunks, int *err )
+{
+    echo_client_loop_t *loop;
+    struct chunk *chunk;
+
+    if( ( loop = malloc( sizeof( echo_client_loop_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    memset( loop, 0, offsetof( echo_client_loop_t, el_read ) );
+    loop->el_keep = chunks;
+
+    if( ( loop->el_epoll = epoll_create1( EPOLL_CLOEXEC ) ) == -1 )
+    {
+        *err = errno;
+        free( loop );
+        return NULL;
+    }
+
+    while( loop->el_nfree < chunks )
+    {
+        if( ( chunk = malloc( sizeof( struct chunk ) +
+                        ECHO_CLIENT_CHUNK ) ) == NULL )
+        {
+            *err = ENOMEM;
+            echo_client_loop_destroy( loop );
+            return NULL;
+        }
+
+        chunk->c_size = ECHO_CLIENT_CHUNK;
+        chunk->c_next = loop->el_free;
+        loop->el_free = chunk;
+        loop->el_nfree++;
+    }
+
+    return loop;
+}
+
+int echo_client_loop_watch( echo_client_loop_t *loop, int fd,
+        void ( *callback )( int fd, void *arg ), void *arg, int *err )
+{
+    struct epoll_event event;
+    struct watch *watch;
+
+    if( loop == NULL || callback == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( watch = malloc( sizeof( struct watch ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    watch->w_kind = ITEM_WATCH;
+    watch->w_fd = fd;
+    watch->w_callback = callback;
+    watch->w_arg = arg;
+
+    event.events = EPOLLIN;
+    event.data.ptr = watch;
+
+    if( epoll_ctl( loop->el_epoll, EPOLL_CTL_ADD, fd, &event ) == -1 )
+    {
+        *err = errno;
+        free( watch );
+        return -1;
+    }
+
+    watch->w_next = loop->el_watches;
+    loop->el_watches = watch;
+
+    return 0;
+}
+
+void echo_client_loop_unwatch( echo_client_loop_t *loop, int fd )
+{
+    struct watch **link, *watch;
+
+    for( link = &loop->el_watches; *link != NULL; link = &( *link )->w_next )
+    {
+        if( ( *link )->w_fd == fd )
+        {
+            watch = *link;
+            *link = watch->w_next;
+            epoll_ctl( loop->el_epoll, EPOLL_CTL_DEL, fd, NULL );
+
+            /* The watch may still be referenced by pending events of this
+             * iteration, so it is only disarmed here. */
+            watch->w_callback = NULL;
+            watch->w_next = loop->el_unwatched;
+            loop->el_unwatched = watch;
+            return;
+        }
+    }
+}
+
+int echo_client_loop_run( echo_client_loop_t *loop, int timeout, int *err )
+{
+    struct epoll_event events[ ECHO_CLIENT_EVENTS ];
+    echo_session_t *session;
+    struct watch *watch;
+    int i, count;
+
+    if( loop == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    /* Frames queued outside the loop go out before waiting. */
+    flush_dirty( loop );
+
+    if( ( count = epoll_wait( loop->el_epoll, events, ECHO_CLIENT_EVENTS,
+                    timeout ) ) == -1 )
+    {
+        if( errno == EINTR )
+            return 0;
+
+        *err = errno;
+        return -1;
+    }
+
+    for( i = 0; i < count; i++ )
+    {
+        if( *( int* )events[ i ].data.ptr == ITEM_WATCH )
+        {
+            watch = events[ i ].data.ptr;
+
+            if( watch->w_callback != NULL )
+                watch->w_callback( watch->w_fd, watch->w_arg );
+
+            continue;
+        }
+
+        session = events[ i ].data.ptr;
+
+        if( session->es_state == SESSION_DEAD )
+            continue;
+
+        if( session->es_state == SESSION_CONNECTING )
+        {
+            if( !( events[ i ].events & ( EPOLLOUT | EPOLLERR |
+                            EPOLLHUP ) ) )
+                continue;
+
+            if( tcp_context_connect_finish( session->es_eec->eec_tcp,
+                        err ) == -1 )
+            {
+                session_fail( session, *err );
+                continue;
+            }
+
+            session->es_state = SESSION_CONNECTED;
+            mark_dirty( session );
+            continue;
+        }
+
+        if( events[ i ].events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) )
+            session_read( session );
+
+        if( ( events[ i ].events & EPOLLOUT ) &&
+                session->es_state != SESSION_DEAD )
+            mark_dirty( session );
+    }
+
+    /* Everything queued by the handlers during this iteration is written
+     * with one call per session. */
+    flush_dirty( loop );
+
+    while( ( session = loop->el_dead ) != NULL )
+    {
+        loop->el_dead = session->es_next_dirty;
+        free( session );
+    }
+
+    while( ( watch = loop->el_unwatched ) != NULL )
+    {
+        loop->el_unwatched = watch->w_next;
+        free( watch );
+    }
+
+    return count;
+}
+
+size_t echo_client_loop_sessions( const echo_client_loop_t *loop )
+{
+    return loop->el_count;
+}
+
+void echo_client_loop_destroy( echo_client_loop_t *loop )
+{
+    echo_session_t *session;
+    struct watch *watch;
+    struct chunk *chunk;
+
+    while( ( session = loop->el_dirty ) != NULL )
+    {
+        loop->el_dirty = session->es_next_dirty;
+        session->es_dirty = 0;
+
+        if( session->es_state == SESSION_DEAD )
+            free( session );
+    }
+
+    while( ( session = loop->el_sessions ) != NULL )
+    {
+        session->es_state = SESSION_DEAD;
+        session_detach( session );
+        free( session );
+    }
+
+    while( ( session = loop->el_dead ) != NULL )
+    {
+        loop->el_dead = session->es_next_dirty;
+        free( session );
+    }
+
+    while( loop->el_watches != NULL )
+    {
+        echo_client_loop_unwatch( loop, loop->el_watches->w_fd );
+    }
+
+    while( ( watch = loop->el_unwatched ) != NULL )
+    {
+        loop->el_unwatched = watch->w_next;
+        free( watch );
+    }
+
+    while( ( chunk = loop->el_free ) != NULL )
+    {
+        loop->el_free = chunk->c_next;
+        free( chunk );
+    }
+
+    close( loop->el_epoll );
+    free( loop );
+}
+
+echo_session_t *echo_client_loop_connect( echo_client_loop_t *loop,
+        const char *host, int port, const echo_session_handler_t *handler,
+        void *arg, int *err )
+{
+    struct epoll_event event;
+    echo_session_t *session;
+    tcp_context_t *ctx;
+    int connected;
+
+    if( loop == NULL || host == NULL || handler == NULL )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( session = malloc( sizeof( echo_session_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    memset( session, 0, sizeof( echo_session_t ) );
+
+    if( ( ctx = tcp_context_create( err ) ) == NULL )
+    {
+        free( session );
+        return NULL;
+    }
+
+    connected = tcp_context_connect_start( ctx, host, port, err ) == 0;
+
+    if( !connected && *err != EINPROGRESS )
+    {
+        tcp_context_destroy( ctx );
+        free( session );
+        return NULL;
+    }
+
+    if( ( session->es_eec = echo_client_context_create( ctx, "",
+                    err ) ) == NULL )
+    {
+        tcp_context_destroy( ctx );
+        free( session );
+        return NULL;
+    }
+
+    session->es_kind = ITEM_SESSION;
+    session->es_loop = loop;
+    session->es_handler = *handler;
+    session->es_arg = arg;
+    session->es_state = connected ? SESSION_CONNECTED : SESSION_CONNECTING;
+    session->es_pollout = !connected;
+
+    event.events = EPOLLIN | ( connected ? 0 : EPOLLOUT );
+    event.data.ptr = session;
+
+    if( epoll_ctl( loop->el_epoll, EPOLL_CTL_ADD, ctx->tc_socket,
+                &event ) == -1 )
+    {
+        *err = errno;
+        echo_client_context_destroy( session->es_eec );
+        free( session );
+        return NULL;
+    }
+
+    session->es_next = loop->el_sessions;
+
+    if( loop->el_sessions != NULL )
+        loop->el_sessions->es_prev = session;
+
+    loop->el_sessions = session;
+    loop->el_count++;
+
+    return session;
+}
+
+int echo_session_login( echo_session_t *session, const char *uname,
+        int features, int *err )
+{
+    echo_frame_t frame;
+    size_t length;
+
+    if( session == NULL || uname == NULL || session->es_login ||
+            ( length = strlen( uname ) ) >= MAX_LENGTH )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( session_reserve( session, ECHO_FRAME_HEADER + length, err ) == -1 )
+        return -1;
+
+    strcpy( session->es_eec->eec_uname, uname );
+
+    frame.ef_length = length;
+    frame.ef_type = ECHO_FRAME_HELLO;
+    frame.ef_flags = features;
+    echo_frame_encode( &frame, ( unsigned char* )session->es_out->c_data +
+            session->es_out->c_len );
+    memcpy( session->es_out->c_data + session->es_out->c_len +
+            ECHO_FRAME_HEADER, uname, length );
+    session->es_out->c_len += ECHO_FRAME_HEADER + length;
+    session->es_login = 1;
+    mark_dirty( session );
+
+    return 0;
+}
+
+int echo_session_send( echo_session_t *session, const char *text,
+        size_t size, int *err )
+{
+    if( session == NULL || text == NULL || size == 0 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( size > ECHO_FRAME_TEXT_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    return session_queue( session, ECHO_FRAME_CHAT, text, size, err );
+}
+
+int echo_session_direct( echo_session_t *session, const char *to,
+        const char *text, size_t size, int *err )
+{
+    char *payload;
+    size_t length;
+
+    if( session == NULL || to == NULL || text == NULL || size == 0 ||
+            ( length = strlen( to ) ) == 0 || length >= MAX_LENGTH )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( 1 + length + size > ECHO_FRAME_TEXT_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    /* The payload is laid out in the loop's buffer, the frame may be
+     * compressed as a whole. */
+    payload = session->es_loop->el_direct;
+    payload[ 0 ] = ( char )length;
+    memcpy( payload + 1, to, length );
+    memcpy( payload + 1 + length, text, size );
+
+    return session_queue( session, ECHO_FRAME_DIRECT, payload,
+            1 + length + size, err );
+}
+
+int echo_session_offer( echo_session_t *session, const char *name,
+        int *err )
+{
+    size_t length;
+
+    if( session == NULL || name == NULL || *name == '\0' )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( length = strlen( name ) ) > ECHO_FRAME_TEXT_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    return session_queue( session, ECHO_FRAME_OFFER, name, length, err );
+}
+
+int echo_session_chunk( echo_session_t *session, const char *data,
+        size_t size, int *err )
+{
+    if( session == NULL || data == NULL || size == 0 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    return session_queue( session, ECHO_FRAME_CHUNK, data, size, err );
+}
+
+int echo_session_end( echo_session_t *session, int *err )
+{
+    if( session == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    return session_queue( session, ECHO_FRAME_END, NULL, 0, err );
+}
+
+size_t echo_session_pending( const echo_session_t *session )
+{
+    return session->es_out == NULL ? 0 :
+        session->es_out->c_len - session->es_sent;
+}
+
+const char *echo_session_uname( const echo_session_t *session )
+{
+    return session->es_eec->eec_uname;
+}
+
+void echo_session_close( echo_session_t *session )
+{
+    if( session->es_state == SESSION_DEAD )
+        return;
+
+    session->es_closing = 1;
+    mark_dirty( session );
+}
+
+int session_queue( echo_session_t *session, int type,
+        const char *payload, size_t size, int *err )
+{
+    struct chunk *out;
+    ssize_t bytes;
+
+    if( !session->es_login )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( session->es_closing || session->es_state == SESSION_DEAD )
+    {
+        *err = EPIPE;
+        return -1;
+    }
+
+    if( session_reserve( session, ECHO_FRAME_HEADER + size + 64,
+                err ) == -1 )
+        return -1;
+
+    out = session->es_out;
+
+    if( ( bytes = echo_client_context_pack( session->es_eec, type, payload,
+                    size, out->c_data + out->c_len,
+                    out->c_size - out->c_len, err ) ) == -1 )
+        return -1;
+
+    out->c_len += bytes;
+    mark_dirty( session );
+
+    return 0;
+}
+
+/* Makes room for size more bytes of output. What is pending moves to the
+ * front of the buffer, or to a larger one at least twice the size, so a
+ * session holds about as much memory as it has queued. */
+int session_reserve( echo_session_t *session, size_t size, int *err )
+{
+    struct chunk *out, *grown;
+    size_t pending, want;
+
+    out = session->es_out;
+    pending = out == NULL ? 0 : out->c_len - session->es_sent;
+
+    if( pending + size > ECHO_CLIENT_FRAME )
+    {
+        *err = size > ECHO_CLIENT_FRAME ? EMSGSIZE : EAGAIN;
+        return -1;
+    }
+
+    if( out != NULL && out->c_size - out->c_len >= size )
+        return 0;
+
+    if( out != NULL && out->c_size >= pending + size )
+    {
+        memmove( out->c_data, out->c_data + session->es_sent, pending );
+        out->c_len = pending;
+        session->es_sent = 0;
+        return 0;
+    }
+
+    want = pending + size;
+
+    if( out != NULL && want < 2 * out->c_size )
+        want = 2 * out->c_size < ECHO_CLIENT_FRAME ? 2 * out->c_size :
+            ECHO_CLIENT_FRAME;
+
+    if( ( grown = chunk_acquire( session->es_loop, want ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    if( out != NULL )
+    {
+        memcpy( grown->c_data, out->c_data + session->es_sent, pending );
+        grown->c_len = pending;
+        chunk_release( session->es_loop, out );
+    }
+
+    session->es_out = grown;
+    session->es_sent = 0;
+
+    return 0;
+}
+
+struct chunk *chunk_acquire( echo_client_loop_t *loop, size_t size )
+{
+    struct chunk *chunk;
+
+    if( size <= ECHO_CLIENT_CHUNK && ( chunk = loop->el_free ) != NULL )
+    {
+        loop->el_free = chunk->c_next;
+        loop->el_nfree--;
+    }
+    else
+    {
+        if( size < ECHO_CLIENT_CHUNK )
+            size = ECHO_CLIENT_CHUNK;
+
+        if( ( chunk = malloc( sizeof( struct chunk ) + size ) ) == NULL )
+            return NULL;
+
+        chunk->c_size = size;
+    }
+
+    chunk->c_next = NULL;
+    chunk->c_len = 0;
+
+    return chunk;
+}
+
+void chunk_release( echo_client_loop_t *loop, struct chunk *chunk )
+{
+    if( chunk->c_size != ECHO_CLIENT_CHUNK ||
+            loop->el_nfree >= loop->el_keep )
+    {
+        free( chunk );
+        return;
+    }
+
+    chunk->c_next = loop->el_free;
+    loop->el_free = chunk;
+    loop->el_nfree++;
+}
+
+void mark_dirty( echo_session_t *session )
+{
+    if( session->es_dirty || session->es_state == SESSION_DEAD )
+        return;
+
+    session->es_dirty = 1;
+    session->es_next_dirty = session->es_loop->el_dirty;
+    session->es_loop->el_dirty = session;
+}
+
+void session_read( echo_session_t *session )
+{
+    echo_client_loop_t *loop;
+    echo_frame_t frame;
+    size_t held, start;
+    ssize_t bytes, used;
+    int err;
+
+    loop = session->es_loop;
+    held = 0;
+
+    /* A partial frame left by the previous read goes in front of the new
+     * bytes, so frames are always parsed from one contiguous buffer. */
+    if( session->es_in != NULL )
+    {
+        held = session->es_in->c_len;
+        memcpy( loop->el_read, session->es_in->c_data, held );
+        chunk_release( loop, session->es_in );
+        session->es_in = NULL;
+    }
+
+    bytes = tcp_context_recv( session->es_eec->eec_tcp,
+            loop->el_read + held, ECHO_CLIENT_FRAME, &err );
+
+    if( bytes == 0 )
+    {
+        session_fail( session, 0 );
+        return;
+    }
+
+    if( bytes == -1 )
+    {
+        if( !tcp_context_transient( err ) )
+        {
+            session_fail( session, err );
+            return;
+        }
+
+        bytes = 0;
+    }
+
+    held += bytes;
+    start = 0;
+    used = 0;
+
+    while( session->es_state != SESSION_DEAD &&
+            ( used = next_frame( session, loop->el_read + start,
+                    held - start, &frame, &err ) ) > 0 )
+    {
+        start += used;
+
+        if( dispatch( session, &frame ) == -1 )
+            return;
+    }
+
+    if( session->es_state == SESSION_DEAD )
+        return;
+
+    if( used == -1 )
+    {
+        session_fail( session, err );
+        return;
+    }
+
+    if( start < held )
+    {
+        if( ( session->es_in = chunk_acquire( loop,
+                        held - start ) ) == NULL )
+        {
+            session_fail( session, ENOMEM );
+            return;
+        }
+
+        session->es_in->c_len = held - start;
+        memcpy( session->es_in->c_data, loop->el_read + start,
+                held - start );
+    }
+}
+
+ssize_t next_frame( echo_session_t *session, const char *wire,
+        size_t len, echo_frame_t *frame, int *err )
+{
+    char *plain;
+
+    plain = session->es_loop->el_plain;
+
+    if( session->es_state == SESSION_READY )
+        return echo_client_context_unpack( session->es_eec, wire, len,
+                frame, plain, ECHO_FRAME_MAX, err );
+
+    /* The answer to the login carries the features in its flags, so its
+     * payload is never compressed. */
+    if( len < ECHO_FRAME_HEADER )
+        return 0;
+
+    echo_frame_decode( ( const unsigned char* )wire, frame );
+
+    if( frame->ef_length > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    if( len < ECHO_FRAME_HEADER + frame->ef_length )
+        return 0;
+
+    memcpy( plain, wire + ECHO_FRAME_HEADER, frame->ef_length );
+
+    return ECHO_FRAME_HEADER + frame->ef_length;
+}
+
+int dispatch( echo_session_t *session, echo_frame_t *frame )
+{
+    echo_client_loop_t *loop;
+    int err;
+
+    loop = session->es_loop;
+
+    if( session->es_state == SESSION_CONNECTED )
+    {
+        if( frame->ef_type == ECHO_FRAME_ACCEPT )
+        {
+            if( echo_client_context_set_features( session->es_eec,
+                        frame->ef_flags, &err ) == -1 )
+            {
+                session_fail( session, err );
+                return -1;
+            }
+
+            session->es_state = SESSION_READY;
+
+            if( session->es_handler.eh_login != NULL )
+                session->es_handler.eh_login( session, 1,
+                        session->es_arg );
+        }
+        else
+        {
+            if( session->es_handler.eh_login != NULL )
+                session->es_handler.eh_login( session, 0,
+                        session->es_arg );
+
+            session_fail( session, EACCES );
+            return -1;
+        }
+    }
+    else if( session->es_handler.eh_message != NULL )
+    {
+        session->es_handler.eh_message( session, frame->ef_type,
+                loop->el_plain, frame->ef_length, session->es_arg );
+    }
+
+    return 0;
+}
+
+void session_flush( echo_session_t *session )
+{
+    struct epoll_event event;
+    struct chunk *out;
+    ssize_t bytes;
+    int pollout, err;
+
+    if( session->es_state == SESSION_DEAD ||
+            session->es_state == SESSION_CONNECTING )
+        return;
+
+    out = session->es_out;
+
+    if( out != NULL && out->c_len > session->es_sent )
+    {
+        bytes = tcp_context_send( session->es_eec->eec_tcp,
+                out->c_data + session->es_sent,
+                out->c_len - session->es_sent, &err );
+
+        if( bytes == -1 && !tcp_context_transient( err ) )
+        {
+            session_fail( session, err );
+            return;
+        }
+
+        if( bytes > 0 )
+            session->es_sent += bytes;
+    }
+
+    if( out != NULL && session->es_sent == out->c_len )
+    {
+        chunk_release( session->es_loop, out );
+        session->es_out = NULL;
+        session->es_sent = 0;
+
+        if( session->es_handler.eh_drain != NULL )
+            session->es_handler.eh_drain( session, session->es_arg );
+
+        if( session->es_state == SESSION_DEAD )
+            return;
+    }
+
+    if( session->es_out == NULL && session->es_closing && !session->es_shut )
+    {
+        shutdown( session->es_eec->eec_tcp->tc_socket, SHUT_WR );
+        session->es_shut = 1;
+    }
+
+    pollout = session->es_out != NULL;
+
+    if( pollout != session->es_pollout )
+    {
+        event.events = EPOLLIN | ( pollout ? EPOLLOUT : 0 );
+        event.data.ptr = session;
+        epoll_ctl( session->es_loop->el_epoll, EPOLL_CTL_MOD,
+                session->es_eec->eec_tcp->tc_socket, &event );
+        session->es_pollout = pollout;
+    }
+}
+
+/* Ends a session, the memory is released at the end of the iteration
+ * since pending events may still point at it. */
+void session_fail( echo_session_t *session, int err )
+{
+    if( session->es_state == SESSION_DEAD )
+        return;
+
+    session->es_state = SESSION_DEAD;
+
+    if( session->es_handler.eh_close != NULL )
+        session->es_handler.eh_close( session, err, session->es_arg );
+
+    session_detach( session );
+
+    /* A session still on the dirty list joins the dead list when the
+     * list is flushed. */
+    if( !session->es_dirty )
+    {
+        session->es_next_dirty = session->es_loop->el_dead;
+        session->es_loop->el_dead = session;
+    }
+}
+
+void session_detach( echo_session_t *session )
+{
+    echo_client_loop_t *loop;
+
+    loop = session->es_loop;
+
+    epoll_ctl( loop->el_epoll, EPOLL_CTL_DEL,
+            session->es_eec->eec_tcp->tc_socket, NULL );
+
+    if( session->es_prev != NULL )
+    {
+        session->es_prev->es_next = session->es_next;
+    }
+    else
+    {
+        loop->el_sessions = session->es_next;
+    }
+
+    if( session->es_next != NULL )
+        session->es_next->es_prev = session->es_prev;
+
+    loop->el_count--;
+
+    if( session->es_out != NULL )
+        chunk_release( loop, session->es_out );
+
+    if( session->es_in != NULL )
+        chunk_release( loop, session->es_in );
+
+    echo_client_context_destroy( session->es_eec );
+    session->es_out = session->es_in = NULL;
+    session->es_eec = NULL;
+}
+
+void flush_dirty( echo_client_loop_t *loop )
+{
+    echo_session_t *session;
+
+    while( ( session = loop->el_dirty ) != NULL )
+    {
+        loop->el_dirty = session->es_next_dirty;
+        session->es_dirty = 0;
+
+        if( session->es_state == SESSION_DEAD )
+        {
+            session->es_next_dirty = loop->el_dead;
+            loop->el_dead = session;
+        }
+        else
+        {
+            session_flush( session );
+        }
+    }
+}
@@ -2,6 +2,11 @@
 #include <errno.h>
 #include "echoclientcontext.h"
 
+static int recv_payload( echo_client_context_t *eec, echo_frame_t *frame,
+        char *buffer, size_t size, int *err );
+static int decode_payload( echo_client_context_t *eec, echo_frame_t *frame,
+        const char *payload, char *buffer, size_t size, int *err );
+
 void echo_client_context_strerror( int errnum, char *buf, size_t buflen )
 {
     strerror_r( errnum, buf, buflen );
@@ -12,7 +17,7 @@ echo_client_context_t *echo_client_context_create( tcp_context_t *ctx,
 {
     echo_client_context_t *client;
 
-    if( ctx == NULL || uname == NULL )
+    if( ctx == NULL || uname == NULL || strlen( uname ) >= MAX_LENGTH )
     {
         *err = EINVAL;
         return NULL;
@@ -25,13 +30,336 @@ echo_client_context_t *echo_client_context_create( tcp_context_t *ctx,
     }
 
     strcpy( client->eec_uname, uname );
+    client->eec_name = NULL;
     client->eec_tcp = ctx;
+    client->eec_features = 0;
+    client->eec_zctx = NULL;
+    client->eec_zbuf = NULL;
+    client->eec_reader = NULL;
 
     return client;
 }
 
+int echo_client_context_set_features( echo_client_context_t *eec,
+        int features, int *err )
+{
+    if( eec == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( features & ECHO_FEATURE_DEFLATE ) && eec->eec_zctx == NULL )
+    {
+        /* One scratch buffer per direction, since the reading and the
+         * writing side of a connection may run on different threads. */
+        if( ( eec->eec_zbuf = malloc( 2 * ECHO_FRAME_MAX ) ) == NULL )
+        {
+            *err = ENOMEM;
+            return -1;
+        }
+
+        if( ( eec->eec_zctx = echo_compress_create( err ) ) == NULL )
+        {
+            free( eec->eec_zbuf );
+            eec->eec_zbuf = NULL;
+            return -1;
+        }
+    }
+
+    eec->eec_features = features;
+
+    return 0;
+}
+
+ssize_t echo_client_context_send( echo_client_context_t *eec, int type,
+        const char *buffer, size_t size, int *err )
+{
+    ssize_t bytes;
+
+    if( eec == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( eec->eec_zctx == NULL || size == 0 )
+        return echo_frame_send( eec->eec_tcp, type, 0, buffer, size, err );
+
+    if( ( bytes = echo_compress_deflate( eec->eec_zctx, buffer, size,
+                    eec->eec_zbuf, ECHO_FRAME_MAX, err ) ) == -1 )
+        return -1;
+
+    if( echo_frame_send( eec->eec_tcp, type, ECHO_FRAME_DEFLATE_STREAM,
+                eec->eec_zbuf, bytes, err ) == -1 )
+        return -1;
+
+    return size;
+}
+
+/* Plain connections take the parts as they are, only the deflate stream
+ * needs them in one piece. */
+ssize_t echo_client_context_sendv( echo_client_context_t *eec, int type,
+        const struct iovec *parts, int count, int *err )
+{
+    ssize_t retval;
+    size_t size;
+    char *plain;
+
+    if( eec == NULL || ( parts == NULL && count > 0 ) )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( eec->eec_zctx == NULL ||
+            ( size = echo_frame_length( parts, count ) ) == 0 )
+        return echo_frame_sendv( eec->eec_tcp, type, 0, parts, count, err );
+
+    if( size > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    if( ( plain = malloc( size ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    echo_frame_gather( plain, parts, count );
+    retval = echo_client_context_send( eec, type, plain, size, err );
+    free( plain );
+
+    return retval;
+}
+
+ssize_t echo_client_context_recv( echo_client_context_t *eec,
+        echo_frame_t *frame, char *buffer, size_t size, int *err )
+{
+    ssize_t retval;
+    size_t length;
+
+    if( eec == NULL || frame == NULL || buffer == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( retval = echo_client_context_recv_header( eec, frame,
+                    err ) ) <= 0 )
+        return retval;
+
+    length = frame->ef_length;
+
+    if( echo_client_context_recv_payload( eec, frame, buffer, size,
+                err ) == -1 )
+        return -1;
+
+    return ECHO_FRAME_HEADER + length;
+}
+
+int echo_client_context_recv_header( echo_client_context_t *eec,
+        echo_frame_t *frame, int *err )
+{
+    if( eec == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( eec->eec_reader != NULL )
+        return echo_frame_reader_header( eec->eec_reader, eec->eec_tcp,
+                frame, err );
+
+    return echo_frame_recv_header( eec->eec_tcp, frame, err );
+}
+
+int echo_client_context_recv_payload( echo_client_context_t *eec,
+        echo_frame_t *frame, char *buffer, size_t size, int *err )
+{
+    char *zbuf;
+
+    if( eec == NULL || frame == NULL || buffer == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( eec->eec_zctx == NULL )
+    {
+        if( recv_payload( eec, frame, buffer, size, err ) == -1 )
+            return -1;
+
+        if( frame->ef_flags != 0 )
+        {
+            *err = EINVAL;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    zbuf = eec->eec_zbuf + ECHO_FRAME_MAX;
+
+    if( recv_payload( eec, frame, zbuf, ECHO_FRAME_MAX, err ) == -1 )
+        return -1;
+
+    return decode_payload( eec, frame, zbuf, buffer, size, err );
+}
+
+ssize_t echo_client_context_pack( echo_client_context_t *eec, int type,
+        const char *buffer, size_t size, char *out, size_t outlen,
+        int *err )
+{
+    echo_frame_t frame;
+    ssize_t bytes;
+
+    if( eec == NULL || out == NULL || ( buffer == NULL && size > 0 ) ||
+            outlen < ECHO_FRAME_HEADER )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( size > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    frame.ef_type = type;
+
+    /* File data goes uncompressed, the server moves it without reading
+     * it. */
+    if( eec->eec_zctx == NULL || size == 0 || type == ECHO_FRAME_CHUNK )
+    {
+        if( size > outlen - ECHO_FRAME_HEADER )
+        {
+            *err = EMSGSIZE;
+            return -1;
+        }
+
+        if( size > 0 )
+            memcpy( out + ECHO_FRAME_HEADER, buffer, size );
+
+        frame.ef_flags = 0;
+        bytes = size;
+    }
+    else
+    {
+        if( ( bytes = echo_compress_deflate( eec->eec_zctx, buffer, size,
+                        out + ECHO_FRAME_HEADER, outlen - ECHO_FRAME_HEADER,
+                        err ) ) == -1 )
+            return -1;
+
+        frame.ef_flags = ECHO_FRAME_DEFLATE_STREAM;
+    }
+
+    frame.ef_length = bytes;
+    echo_frame_encode( &frame, ( unsigned char* )out );
+
+    return ECHO_FRAME_HEADER + bytes;
+}
+
+ssize_t echo_client_context_unpack( echo_client_context_t *eec,
+        const char *wire, size_t len, echo_frame_t *frame, char *buffer,
+        size_t size, int *err )
+{
+    ssize_t wirelen;
+
+    if( eec == NULL || wire == NULL || frame == NULL || buffer == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( len < ECHO_FRAME_HEADER )
+        return 0;
+
+    echo_frame_decode( ( const unsigned char* )wire, frame );
+
+    if( frame->ef_length > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    if( len < ECHO_FRAME_HEADER + frame->ef_length )
+        return 0;
+
+    wirelen = ECHO_FRAME_HEADER + frame->ef_length;
+
+    if( decode_payload( eec, frame, wire + ECHO_FRAME_HEADER, buffer, size,
+                err ) == -1 )
+        return -1;
+
+    return wirelen;
+}
+
 void echo_client_context_destroy( echo_client_context_t *eec )
 {
     tcp_context_destroy( eec->eec_tcp );
+
+    if( eec->eec_zctx != NULL )
+    {
+        echo_compress_destroy( eec->eec_zctx );
+        free( eec->eec_zbuf );
+    }
+
     free( eec );
 }
+
+int recv_payload( echo_client_context_t *eec, echo_frame_t *frame,
+        char *buffer, size_t size, int *err )
+{
+    if( eec->eec_reader != NULL )
+        return echo_frame_reader_payload( eec->eec_reader, eec->eec_tcp,
+                frame, buffer, size, err );
+
+    return echo_frame_recv_payload( eec->eec_tcp, frame, buffer, size, err );
+}
+
+int decode_payload( echo_client_context_t *eec, echo_frame_t *frame,
+        const char *payload, char *buffer, size_t size, int *err )
+{
+    ssize_t bytes;
+
+    if( frame->ef_flags != 0 && eec->eec_zctx == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( frame->ef_flags & ECHO_FRAME_DEFLATE_STREAM )
+    {
+        bytes = echo_compress_inflate( eec->eec_zctx, payload,
+                frame->ef_length, buffer, size, err );
+    }
+    else if( frame->ef_flags & ECHO_FRAME_DEFLATE_BLOCK )
+    {
+        bytes = echo_compress_block_inflate( payload, frame->ef_length,
+                buffer, size, err );
+    }
+    else if( frame->ef_length <= size )
+    {
+        if( payload != buffer )
+            memmove( buffer, payload, frame->ef_length );
+
+        bytes = frame->ef_length;
+    }
+    else
+    {
+        *err = EMSGSIZE;
+        bytes = -1;
+    }
+
+    if( bytes == -1 )
+        return -1;
+
+    frame->ef_length = bytes;
+    frame->ef_flags = 0;
+
+    return 0;
+}
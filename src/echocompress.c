@@ -0,0 +1,293 @@
+#include "echocompress.h"
+#include "echostats.h"
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+
+/* A sync flush always ends with an empty stored block, which both peers
+ * know about, so it is stripped on the wire and appended on inflate. */
+static const unsigned char g_tail[ 4 ] = { 0x00, 0x00, 0xff, 0xff };
+
+struct echo_compress
+{
+    z_stream ez_deflate;    /* outbound stream */
+    z_stream ez_inflate;    /* inbound stream */
+};
+
+static ssize_t run_deflate( z_stream *s, const char *in, size_t inlen,
+        char *out, size_t outlen, int flush, int *err );
+static ssize_t run_inflate( z_stream *s, const char *in, size_t inlen,
+        char *out, size_t outlen, int *err );
+#endif
+
+void echo_compress_strerror( int errnum, char *buf, size_t buflen )
+{
+    if( errnum == ENOTSUP )
+    {
+        strncpy( buf, "Compression not available", buflen );
+    }
+    else
+    {
+        strerror_r( errnum, buf, buflen );
+    }
+}
+
+#ifdef HAVE_LIBZ
+
+int echo_compress_available( void )
+{
+    return 1;
+}
+
+echo_compress_t *echo_compress_create( int *err )
+{
+    echo_compress_t *z;
+
+    if( ( z = malloc( sizeof( echo_compress_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    memset( z, 0, sizeof( echo_compress_t ) );
+
+    if( deflateInit2( &z->ez_deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                -MAX_WBITS, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+        free( z );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    if( inflateInit2( &z->ez_inflate, -MAX_WBITS ) != Z_OK )
+    {
+        deflateEnd( &z->ez_deflate );
+        free( z );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    return z;
+}
+
+ssize_t echo_compress_deflate( echo_compress_t *z, const char *in,
+        size_t inlen, char *out, size_t outlen, int *err )
+{
+    ssize_t bytes;
+
+    if( z == NULL || in == NULL || out == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    bytes = run_deflate( &z->ez_deflate, in, inlen, out, outlen,
+            Z_SYNC_FLUSH, err );
+
+    if( bytes == -1 )
+        return -1;
+
+    if( bytes >= 4 && memcmp( out + bytes - 4, g_tail, 4 ) == 0 )
+        bytes -= 4;
+
+    echo_stats_add( ECHO_STAT_DEFLATE_IN, inlen );
+    echo_stats_add( ECHO_STAT_DEFLATE_OUT, bytes );
+
+    return bytes;
+}
+
+ssize_t echo_compress_inflate( echo_compress_t *z, const char *in,
+        size_t inlen, char *out, size_t outlen, int *err )
+{
+    ssize_t bytes, tail;
+
+    if( z == NULL || in == NULL || out == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( bytes = run_inflate( &z->ez_inflate, in, inlen, out, outlen,
+                    err ) ) == -1 )
+        return -1;
+
+    if( ( tail = run_inflate( &z->ez_inflate, ( const char* )g_tail, 4,
+                    out + bytes, outlen - bytes, err ) ) == -1 )
+        return -1;
+
+    echo_stats_add( ECHO_STAT_INFLATE_IN, inlen );
+    echo_stats_add( ECHO_STAT_INFLATE_OUT, bytes + tail );
+
+    return bytes + tail;
+}
+
+ssize_t echo_compress_block_deflate( const char *in, size_t inlen,
+        char *out, size_t outlen, int *err )
+{
+    z_stream s;
+    ssize_t bytes;
+
+    memset( &s, 0, sizeof( s ) );
+
+    if( deflateInit2( &s, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    bytes = run_deflate( &s, in, inlen, out, outlen, Z_FINISH, err );
+    deflateEnd( &s );
+
+    if( bytes != -1 )
+    {
+        echo_stats_add( ECHO_STAT_DEFLATE_IN, inlen );
+        echo_stats_add( ECHO_STAT_DEFLATE_OUT, bytes );
+    }
+
+    return bytes;
+}
+
+ssize_t echo_compress_block_inflate( const char *in, size_t inlen,
+        char *out, size_t outlen, int *err )
+{
+    z_stream s;
+    ssize_t bytes;
+
+    memset( &s, 0, sizeof( s ) );
+
+    if( inflateInit2( &s, -MAX_WBITS ) != Z_OK )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    bytes = run_inflate( &s, in, inlen, out, outlen, err );
+    inflateEnd( &s );
+
+    if( bytes != -1 )
+    {
+        echo_stats_add( ECHO_STAT_INFLATE_IN, inlen );
+        echo_stats_add( ECHO_STAT_INFLATE_OUT, bytes );
+    }
+
+    return bytes;
+}
+
+void echo_compress_destroy( echo_compress_t *z )
+{
+    deflateEnd( &z->ez_deflate );
+    inflateEnd( &z->ez_inflate );
+    free( z );
+}
+
+ssize_t run_deflate( z_stream *s, const char *in, size_t inlen, char *out,
+        size_t outlen, int flush, int *err )
+{
+    int retval;
+
+    s->next_in = ( Bytef* )in;
+    s->avail_in = inlen;
+    s->next_out = ( Bytef* )out;
+    s->avail_out = outlen;
+
+    retval = deflate( s, flush );
+
+    if( retval == Z_STREAM_ERROR )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    /* Running out of room leaves the stream mid-message, so the caller
+     * has to give up on the connection. */
+    if( s->avail_in > 0 || s->avail_out == 0 ||
+            ( flush == Z_FINISH && retval != Z_STREAM_END ) )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    return outlen - s->avail_out;
+}
+
+ssize_t run_inflate( z_stream *s, const char *in, size_t inlen, char *out,
+        size_t outlen, int *err )
+{
+    int retval;
+
+    s->next_in = ( Bytef* )in;
+    s->avail_in = inlen;
+    s->next_out = ( Bytef* )out;
+    s->avail_out = outlen;
+
+    retval = inflate( s, Z_SYNC_FLUSH );
+
+    if( retval != Z_OK && retval != Z_STREAM_END && retval != Z_BUF_ERROR )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( s->avail_in > 0 )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    return outlen - s->avail_out;
+}
+
+#else
+
+int echo_compress_available( void )
+{
+    return 0;
+}
+
+echo_compress_t *echo_compress_create( int *err )
+{
+    *err = ENOTSUP;
+    return NULL;
+}
+
+ssize_t echo_compress_deflate( echo_compress_t *z, const char *in,
+        size_t inlen, char *out, size_t outlen, int *err )
+{
+    ( void )z; ( void )in; ( void )inlen; ( void )out; ( void )outlen;
+    *err = ENOTSUP;
+    return -1;
+}
+
+ssize_t echo_compress_inflate( echo_compress_t *z, const char *in,
+        size_t inlen, char *out, size_t outlen, int *err )
+{
+    ( void )z; ( void )in; ( void )inlen; ( void )out; ( void )outlen;
+    *err = ENOTSUP;
+    return -1;
+}
+
+ssize_t echo_compress_block_deflate( const char *in, size_t inlen,
+        char *out, size_t outlen, int *err )
+{
+    ( void )in; ( void )inlen; ( void )out; ( void )outlen;
+    *err = ENOTSUP;
+    return -1;
+}
+
+ssize_t echo_compress_block_inflate( const char *in, size_t inlen,
+        char *out, size_t outlen, int *err )
+{
+    ( void )in; ( void )inlen; ( void )out; ( void )outlen;
+    *err = ENOTSUP;
+    return -1;
+}
+
+void echo_compress_destroy( echo_compress_t *z )
+{
+    ( void )z;
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "echoconfig.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+static char *parse( char *line, int *err );
+static int append( echo_config_t *config, size_t *capacity, char *arg );
+
+echo_config_t *echo_config_load( const char *path, int argc,
+        char *argv[ ], size_t *line, int *err )
+{
+    char buffer[ ECHO_CONFIG_LINE ], *arg;
+    echo_config_t *config;
+    size_t capacity;
+    FILE *file;
+    int i;
+
+    if( path == NULL || argc < 1 || argv == NULL )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( config = calloc( 1, sizeof( echo_config_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    if( ( file = fopen( path, "r" ) ) == NULL )
+    {
+        *err = errno;
+        free( config );
+        return NULL;
+    }
+
+    capacity = 0;
+    *line = 0;
+    *err = 0;
+
+    if( append( config, &capacity, argv[ 0 ] ) == -1 )
+        *err = ENOMEM;
+
+    while( *err == 0 && fgets( buffer, sizeof( buffer ), file ) != NULL )
+    {
+        ( *line )++;
+
+        if( strchr( buffer, '\n' ) == NULL && !feof( file ) )
+        {
+            *err = EINVAL;
+        }
+        else if( ( arg = parse( buffer, err ) ) != NULL &&
+                append( config, &capacity, arg ) == -1 )
+        {
+            free( arg );
+            *err = ENOMEM;
+        }
+    }
+
+    if( *err == 0 && ferror( file ) )
+        *err = EIO;
+
+    fclose( file );
+    config->ec_read = config->ec_argc - 1;
+
+    for( i = 1; *err == 0 && i < argc; i++ )
+    {
+        if( append( config, &capacity, argv[ i ] ) == -1 )
+            *err = ENOMEM;
+    }
+
+    if( *err != 0 )
+    {
+        echo_config_destroy( config );
+        return NULL;
+    }
+
+    return config;
+}
+
+void echo_config_destroy( echo_config_t *config )
+{
+    int i;
+
+    for( i = 1; i <= config->ec_read; i++ )
+    {
+        free( config->ec_argv[ i ] );
+    }
+
+    free( config->ec_argv );
+    free( config );
+}
+
+/* Gives the line as one argument, or NULL with err left at 0 when there is
+ * nothing on it. */
+char *parse( char *line, int *err )
+{
+    char *name, *value, *end, *arg;
+    size_t length;
+
+    for( name = line; isspace( ( unsigned char )*name ); name++ );
+
+    if( *name == '\0' || *name == '#' )
+        return NULL;
+
+    for( end = name; isalnum( ( unsigned char )*end ) || *end == '-'; end++ );
+
+    if( end == name || *name == '-' ||
+            ( *end != '\0' && *end != '=' &&
+              !isspace( ( unsigned char )*end ) ) )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    length = end - name;
+
+    for( value = end; isspace( ( unsigned char )*value ); value++ );
+
+    if( *value == '=' )
+        for( value++; isspace( ( unsigned char )*value ); value++ );
+
+    for( end = value + strlen( value ); end > value &&
+            isspace( ( unsigned char )end[ -1 ] ); end-- );
+
+    *end = '\0';
+
+    if( ( arg = malloc( length + strlen( value ) + 4 ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    sprintf( arg, *value != '\0' ? "--%.*s=%s" : "--%.*s", ( int )length,
+            name, value );
+
+    return arg;
+}
+
+int append( echo_config_t *config, size_t *capacity, char *arg )
+{
+    char **argv;
+
+    /* One more for the NULL at the end. */
+    if( ( size_t )config->ec_argc + 2 > *capacity )
+    {
+        if( ( argv = realloc( config->ec_argv, ( *capacity * 2 + 8 ) *
+                        sizeof( char* ) ) ) == NULL )
+            return -1;
+
+        config->ec_argv = argv;
+        *capacity = *capacity * 2 + 8;
+    }
+
+    config->ec_argv[ config->ec_argc++ ] = arg;
+    config->ec_argv[ config->ec_argc ] = NULL;
+
+    return 0;
+}
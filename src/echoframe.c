@@ -0,0 +1,457 @@
+#include "echoframe.h"
+#include <string.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+
+static int send_all( tcp_context_t *ctx, struct iovec *iov, int iovcnt,
+        int *err );
+static int recv_exact( tcp_context_t *ctx, char *buffer, size_t size,
+        int *err );
+static int fill( echo_frame_reader_t *reader, tcp_context_t *ctx,
+        size_t need, int *err );
+
+void echo_frame_encode( const echo_frame_t *frame, unsigned char *buf )
+{
+    buf[ 0 ] = ( frame->ef_length >> 24 ) & 0xff;
+    buf[ 1 ] = ( frame->ef_length >> 16 ) & 0xff;
+    buf[ 2 ] = ( frame->ef_length >> 8 ) & 0xff;
+    buf[ 3 ] = frame->ef_length & 0xff;
+    buf[ 4 ] = frame->ef_type;
+    buf[ 5 ] = frame->ef_flags;
+    buf[ 6 ] = 0;
+    buf[ 7 ] = 0;
+}
+
+void echo_frame_decode( const unsigned char *buf, echo_frame_t *frame )
+{
+    frame->ef_length = ( ( uint32_t )buf[ 0 ] << 24 ) |
+        ( ( uint32_t )buf[ 1 ] << 16 ) |
+        ( ( uint32_t )buf[ 2 ] << 8 ) |
+        ( uint32_t )buf[ 3 ];
+    frame->ef_type = buf[ 4 ];
+    frame->ef_flags = buf[ 5 ];
+}
+
+ssize_t echo_frame_send( tcp_context_t *ctx, int type, int flags,
+        const char *payload, size_t size, int *err )
+{
+    struct iovec part;
+
+    if( payload == NULL && size > 0 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    part.iov_base = ( void* )payload;
+    part.iov_len = size;
+
+    return echo_frame_sendv( ctx, type, flags, &part, size > 0 ? 1 : 0,
+            err );
+}
+
+/* Empty parts are left out. */
+ssize_t echo_frame_sendv( tcp_context_t *ctx, int type, int flags,
+        const struct iovec *parts, int count, int *err )
+{
+    unsigned char header[ ECHO_FRAME_HEADER ];
+    struct iovec iov[ 1 + ECHO_FRAME_PARTS ];
+    echo_frame_t frame;
+    size_t size;
+    int i, iovcnt;
+
+    if( ctx == NULL || count < 0 || count > ECHO_FRAME_PARTS ||
+            ( parts == NULL && count > 0 ) )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( size = echo_frame_length( parts, count ) ) > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    frame.ef_length = size;
+    frame.ef_type = type;
+    frame.ef_flags = flags;
+    echo_frame_encode( &frame, header );
+
+    iov[ 0 ].iov_base = header;
+    iov[ 0 ].iov_len = ECHO_FRAME_HEADER;
+    iovcnt = 1;
+
+    for( i = 0; i < count; i++ )
+    {
+        if( parts[ i ].iov_len > 0 )
+            iov[ iovcnt++ ] = parts[ i ];
+    }
+
+    if( send_all( ctx, iov, iovcnt, err ) == -1 )
+        return -1;
+
+    return size;
+}
+
+size_t echo_frame_length( const struct iovec *parts, int count )
+{
+    size_t size;
+    int i;
+
+    for( size = 0, i = 0; i < count; i++ )
+    {
+        size += parts[ i ].iov_len;
+    }
+
+    return size;
+}
+
+size_t echo_frame_gather( char *buffer, const struct iovec *parts,
+        int count )
+{
+    size_t size;
+    int i;
+
+    for( size = 0, i = 0; i < count; i++ )
+    {
+        /* An empty part may have no base. */
+        if( parts[ i ].iov_len > 0 )
+            memcpy( buffer + size, parts[ i ].iov_base, parts[ i ].iov_len );
+
+        size += parts[ i ].iov_len;
+    }
+
+    return size;
+}
+
+/* The parts go out with the header, the file data after them. */
+ssize_t echo_frame_sendfile( tcp_context_t *ctx, int type,
+        const struct iovec *parts, int count, int fd, off_t offset,
+        size_t size, int *err )
+{
+    struct iovec iov[ 1 + ECHO_FRAME_PARTS ];
+    unsigned char header[ ECHO_FRAME_HEADER ];
+    echo_frame_t frame;
+    size_t length, total;
+    ssize_t bytes;
+    int i, iovcnt;
+
+    if( ctx == NULL || fd < 0 || count < 0 || count > ECHO_FRAME_PARTS ||
+            ( parts == NULL && count > 0 ) )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( length = echo_frame_length( parts, count ) ) + size >
+            ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    frame.ef_length = length + size;
+    frame.ef_type = type;
+    frame.ef_flags = 0;
+    echo_frame_encode( &frame, header );
+
+    iov[ 0 ].iov_base = header;
+    iov[ 0 ].iov_len = ECHO_FRAME_HEADER;
+    iovcnt = 1;
+
+    for( i = 0; i < count; i++ )
+    {
+        if( parts[ i ].iov_len > 0 )
+            iov[ iovcnt++ ] = parts[ i ];
+    }
+
+    if( send_all( ctx, iov, iovcnt, err ) == -1 )
+        return -1;
+
+    for( total = 0; total < size; total += bytes )
+    {
+        if( ( bytes = sendfile( ctx->tc_socket, fd, &offset,
+                        size - total ) ) == -1 )
+        {
+            if( errno == EINTR )
+            {
+                bytes = 0;
+                continue;
+            }
+
+            *err = errno;
+            return -1;
+        }
+
+        /* The frame cannot be finished, the stream is lost. */
+        if( bytes == 0 )
+        {
+            *err = EIO;
+            return -1;
+        }
+    }
+
+    return length + size;
+}
+
+int echo_frame_recv_header( tcp_context_t *ctx, echo_frame_t *frame,
+        int *err )
+{
+    unsigned char header[ ECHO_FRAME_HEADER ];
+    int retval;
+
+    if( ctx == NULL || frame == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( retval = recv_exact( ctx, ( char* )header, ECHO_FRAME_HEADER,
+                    err ) ) <= 0 )
+        return retval;
+
+    echo_frame_decode( header, frame );
+
+    return 1;
+}
+
+int echo_frame_recv_payload( tcp_context_t *ctx, const echo_frame_t *frame,
+        char *buffer, size_t size, int *err )
+{
+    int retval;
+
+    if( frame->ef_length > size )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    if( frame->ef_length > 0 )
+    {
+        if( ( retval = recv_exact( ctx, buffer, frame->ef_length,
+                        err ) ) == -1 )
+            return -1;
+
+        if( retval == 0 )
+        {
+            *err = ECONNRESET;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+ssize_t echo_frame_recv( tcp_context_t *ctx, echo_frame_t *frame,
+        char *buffer, size_t size, int *err )
+{
+    int retval;
+
+    if( ctx == NULL || frame == NULL || buffer == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( retval = echo_frame_recv_header( ctx, frame, err ) ) <= 0 )
+        return retval;
+
+    if( echo_frame_recv_payload( ctx, frame, buffer, size, err ) == -1 )
+        return -1;
+
+    return ECHO_FRAME_HEADER + frame->ef_length;
+}
+
+void echo_frame_reader_init( echo_frame_reader_t *reader, char *buffer,
+        size_t size )
+{
+    reader->efr_buffer = buffer;
+    reader->efr_size = size;
+    reader->efr_start = 0;
+    reader->efr_end = 0;
+    reader->efr_calls = 0;
+    reader->efr_frames = 0;
+}
+
+int echo_frame_reader_header( echo_frame_reader_t *reader,
+        tcp_context_t *ctx, echo_frame_t *frame, int *err )
+{
+    int retval;
+
+    if( reader == NULL || ctx == NULL || frame == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( retval = fill( reader, ctx, ECHO_FRAME_HEADER, err ) ) <= 0 )
+        return retval;
+
+    echo_frame_decode( ( unsigned char* )reader->efr_buffer +
+            reader->efr_start, frame );
+    reader->efr_start += ECHO_FRAME_HEADER;
+    reader->efr_frames++;
+
+    return 1;
+}
+
+/* Payloads that fit are read ahead with the frames after them, the larger
+ * ones would only be copied twice. */
+int echo_frame_reader_payload( echo_frame_reader_t *reader,
+        tcp_context_t *ctx, const echo_frame_t *frame, char *buffer,
+        size_t size, int *err )
+{
+    const char *data;
+    size_t held;
+    int retval;
+
+    if( frame->ef_length > size )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    if( frame->ef_length <= reader->efr_size )
+    {
+        if( ( retval = fill( reader, ctx, frame->ef_length, err ) ) == -1 )
+            return -1;
+
+        if( retval == 0 )
+        {
+            *err = ECONNRESET;
+            return -1;
+        }
+    }
+
+    if( ( held = echo_frame_reader_take( reader, &data,
+                    frame->ef_length ) ) > 0 )
+        memcpy( buffer, data, held );
+
+    if( held < frame->ef_length )
+    {
+        if( ( retval = recv_exact( ctx, buffer + held,
+                        frame->ef_length - held, err ) ) == -1 )
+            return -1;
+
+        if( retval == 0 )
+        {
+            *err = ECONNRESET;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+size_t echo_frame_reader_take( echo_frame_reader_t *reader,
+        const char **data, size_t size )
+{
+    size_t held;
+
+    held = reader->efr_end - reader->efr_start;
+    held = held < size ? held : size;
+    *data = reader->efr_buffer + reader->efr_start;
+    reader->efr_start += held;
+
+    return held;
+}
+
+/* A short write resumes where it stopped. */
+int send_all( tcp_context_t *ctx, struct iovec *iov, int iovcnt, int *err )
+{
+    ssize_t bytes;
+    int i;
+
+    i = 0;
+
+    while( i < iovcnt )
+    {
+        if( ( bytes = tcp_context_sendv( ctx, iov + i, iovcnt - i,
+                        err ) ) == -1 )
+            return -1;
+
+        while( i < iovcnt && ( size_t )bytes >= iov[ i ].iov_len )
+        {
+            bytes -= iov[ i ].iov_len;
+            i++;
+        }
+
+        if( i < iovcnt )
+        {
+            iov[ i ].iov_base = ( char* )iov[ i ].iov_base + bytes;
+            iov[ i ].iov_len -= bytes;
+        }
+    }
+
+    return 0;
+}
+
+int recv_exact( tcp_context_t *ctx, char *buffer, size_t size, int *err )
+{
+    size_t total;
+    ssize_t bytes;
+
+    total = 0;
+
+    while( total < size )
+    {
+        bytes = tcp_context_recv( ctx, buffer + total, size - total, err );
+
+        if( bytes == -1 )
+            return -1;
+
+        if( bytes == 0 )
+        {
+            if( total == 0 )
+                return 0;
+
+            *err = ECONNRESET;
+            return -1;
+        }
+
+        total += bytes;
+    }
+
+    return 1;
+}
+
+/* What is held moves to the front, then each call asks for all the room
+ * left: one call takes in every frame the socket has queued up to the
+ * size of the buffer. Returns 0 when the peer closed with nothing held. */
+int fill( echo_frame_reader_t *reader, tcp_context_t *ctx, size_t need,
+        int *err )
+{
+    ssize_t bytes;
+
+    if( reader->efr_end - reader->efr_start >= need )
+        return 1;
+
+    memmove( reader->efr_buffer, reader->efr_buffer + reader->efr_start,
+            reader->efr_end - reader->efr_start );
+    reader->efr_end -= reader->efr_start;
+    reader->efr_start = 0;
+
+    while( reader->efr_end < need )
+    {
+        if( ( bytes = tcp_context_recv( ctx, reader->efr_buffer +
+                        reader->efr_end, reader->efr_size - reader->efr_end,
+                        err ) ) == -1 )
+            return -1;
+
+        reader->efr_calls++;
+
+        if( bytes == 0 )
+        {
+            if( reader->efr_end == 0 )
+                return 0;
+
+            *err = ECONNRESET;
+            return -1;
+        }
+
+        reader->efr_end += bytes;
+    }
+
+    return 1;
+}
@@ -0,0 +1,236 @@
+#include "echointern.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define SAYS        " says:\n"
+#define SAYS_LENGTH ( sizeof( SAYS ) - 1 )
+
+/* Chained hash table, doubled whenever it holds one name per bucket. Names
+ * come and go with logins, the lock is never held while sending. */
+struct echo_intern
+{
+    pthread_mutex_t ei_lock;
+    echo_name_t **ei_buckets;
+    size_t ei_nbuckets;
+    size_t ei_count;
+};
+
+static echo_name_t **lookup( echo_intern_t *table, const char *name,
+        size_t length, uint32_t hash );
+static void grow( echo_intern_t *table );
+
+/* FNV-1a */
+uint32_t echo_intern_hash( const char *name, size_t length )
+{
+    uint32_t hash;
+    size_t i;
+
+    for( hash = 2166136261u, i = 0; i < length; i++ )
+    {
+        hash = ( hash ^ ( unsigned char )name[ i ] ) * 16777619u;
+    }
+
+    return hash;
+}
+
+echo_intern_t *echo_intern_create( int *err )
+{
+    echo_intern_t *table;
+
+    if( ( table = malloc( sizeof( echo_intern_t ) ) ) == NULL ||
+            ( table->ei_buckets = calloc( ECHO_INTERN_BUCKETS,
+                                          sizeof( echo_name_t* ) ) ) == NULL )
+    {
+        free( table );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    pthread_mutex_init( &table->ei_lock, NULL );
+    table->ei_nbuckets = ECHO_INTERN_BUCKETS;
+    table->ei_count = 0;
+
+    return table;
+}
+
+int echo_intern_reserve( echo_intern_t *table, size_t names, int *err )
+{
+    size_t size;
+    int retval;
+
+    retval = 0;
+    pthread_mutex_lock( &table->ei_lock );
+
+    while( table->ei_nbuckets < names )
+    {
+        size = table->ei_nbuckets;
+        grow( table );
+
+        if( table->ei_nbuckets == size )
+        {
+            *err = ENOMEM;
+            retval = -1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock( &table->ei_lock );
+
+    return retval;
+}
+
+/* The name and its prefix share one allocation, the prefix is serialized
+ * once here instead of for every line the member sends. */
+const echo_name_t *echo_intern_get( echo_intern_t *table, const char *name,
+        size_t length, int *err )
+{
+    echo_name_t **link, *entry;
+    uint32_t hash;
+    char *says;
+
+    if( table == NULL || name == NULL || length == 0 ||
+            memchr( name, '\0', length ) != NULL )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    hash = echo_intern_hash( name, length );
+    pthread_mutex_lock( &table->ei_lock );
+
+    if( ( entry = *( link = lookup( table, name, length, hash ) ) ) != NULL )
+    {
+        entry->en_refs++;
+        pthread_mutex_unlock( &table->ei_lock );
+        return entry;
+    }
+
+    if( ( entry = malloc( sizeof( echo_name_t ) + 2 * length +
+                    SAYS_LENGTH + 2 ) ) == NULL )
+    {
+        pthread_mutex_unlock( &table->ei_lock );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    memcpy( entry->en_name, name, length );
+    entry->en_name[ length ] = '\0';
+    says = entry->en_name + length + 1;
+    memcpy( says, name, length );
+    memcpy( says + length, SAYS, SAYS_LENGTH + 1 );
+
+    entry->en_refs = 1;
+    entry->en_hash = hash;
+    entry->en_length = length;
+    entry->en_says = says;
+    entry->en_says_length = length + SAYS_LENGTH;
+    entry->en_next = NULL;
+    *link = entry;
+
+    if( ++table->ei_count > table->ei_nbuckets )
+        grow( table );
+
+    pthread_mutex_unlock( &table->ei_lock );
+
+    return entry;
+}
+
+void echo_intern_put( echo_intern_t *table, const echo_name_t *name )
+{
+    echo_name_t **link, *entry;
+
+    if( table == NULL || name == NULL )
+        return;
+
+    pthread_mutex_lock( &table->ei_lock );
+    link = lookup( table, name->en_name, name->en_length, name->en_hash );
+
+    if( ( entry = *link ) == name && --entry->en_refs == 0 )
+    {
+        *link = entry->en_next;
+        table->ei_count--;
+        free( entry );
+    }
+
+    pthread_mutex_unlock( &table->ei_lock );
+}
+
+size_t echo_intern_count( echo_intern_t *table )
+{
+    size_t count;
+
+    pthread_mutex_lock( &table->ei_lock );
+    count = table->ei_count;
+    pthread_mutex_unlock( &table->ei_lock );
+
+    return count;
+}
+
+void echo_intern_destroy( echo_intern_t *table )
+{
+    echo_name_t *entry;
+    size_t i;
+
+    if( table == NULL )
+        return;
+
+    for( i = 0; i < table->ei_nbuckets; i++ )
+    {
+        while( ( entry = table->ei_buckets[ i ] ) != NULL )
+        {
+            table->ei_buckets[ i ] = entry->en_next;
+            free( entry );
+        }
+    }
+
+    pthread_mutex_destroy( &table->ei_lock );
+    free( table->ei_buckets );
+    free( table );
+}
+
+/* Returns the link pointing at the entry of name, or at the NULL ending
+ * its chain when there is none. */
+echo_name_t **lookup( echo_intern_t *table, const char *name, size_t length,
+        uint32_t hash )
+{
+    echo_name_t **link;
+
+    link = &table->ei_buckets[ hash & ( table->ei_nbuckets - 1 ) ];
+
+    while( *link != NULL && ( ( *link )->en_hash != hash ||
+                ( *link )->en_length != length ||
+                memcmp( ( *link )->en_name, name, length ) != 0 ) )
+    {
+        link = &( *link )->en_next;
+    }
+
+    return link;
+}
+
+/* Out of memory the chains just get longer. */
+void grow( echo_intern_t *table )
+{
+    echo_name_t **buckets, *entry;
+    size_t i, size;
+
+    size = table->ei_nbuckets * 2;
+
+    if( ( buckets = calloc( size, sizeof( echo_name_t* ) ) ) == NULL )
+        return;
+
+    for( i = 0; i < table->ei_nbuckets; i++ )
+    {
+        while( ( entry = table->ei_buckets[ i ] ) != NULL )
+        {
+            table->ei_buckets[ i ] = entry->en_next;
+            entry->en_next = buckets[ entry->en_hash & ( size - 1 ) ];
+            buckets[ entry->en_hash & ( size - 1 ) ] = entry;
+        }
+    }
+
+    free( table->ei_buckets );
+    table->ei_buckets = buckets;
+    table->ei_nbuckets = size;
+}
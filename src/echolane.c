@@ -0,0 +1,185 @@
+#include "echolane.h"
+#include "echoframe.h"
+#include <time.h>
+
+static const size_t g_weights[ ECHO_LANE_MAX ] = { 8, 4, 1 };
+static const char *g_names[ ECHO_LANE_MAX ] =
+{
+    "control",
+    "interactive",
+    "bulk"
+};
+
+echo_lane_t echo_lane_of( int type )
+{
+    switch( type )
+    {
+        case ECHO_FRAME_ACCEPT:
+        case ECHO_FRAME_REJECT:
+        case ECHO_FRAME_ERROR:
+            return ECHO_LANE_CONTROL;
+
+        case ECHO_FRAME_OFFER:
+        case ECHO_FRAME_CHUNK:
+        case ECHO_FRAME_END:
+            return ECHO_LANE_BULK;
+
+        default:
+            return ECHO_LANE_INTERACTIVE;
+    }
+}
+
+unsigned long long echo_lane_clock( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ( unsigned long long )ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void echo_lanes_init( echo_lanes_t *lanes )
+{
+    int i;
+
+    for( i = 0; i < ECHO_LANE_MAX; i++ )
+    {
+        lanes->els_lane[ i ].el_head = NULL;
+        lanes->els_lane[ i ].el_tail = NULL;
+        lanes->els_lane[ i ].el_depth = 0;
+        lanes->els_lane[ i ].el_deficit = 0;
+        atomic_init( &lanes->els_lane[ i ].el_frames, 0 );
+        atomic_init( &lanes->els_lane[ i ].el_total, 0 );
+        atomic_init( &lanes->els_lane[ i ].el_max, 0 );
+    }
+
+    /* The first round starts with control. */
+    lanes->els_current = ECHO_LANE_MAX - 1;
+    lanes->els_pending = 0;
+}
+
+void echo_lanes_push( echo_lanes_t *lanes, echo_lane_t lane,
+        echo_lane_node_t *node )
+{
+    echo_lane_queue_t *queue;
+
+    queue = &lanes->els_lane[ lane ];
+    node->eln_next = NULL;
+    node->eln_lane = lane;
+
+    if( queue->el_tail != NULL )
+        queue->el_tail->eln_next = node;
+    else
+        queue->el_head = node;
+
+    queue->el_tail = node;
+    queue->el_depth++;
+    lanes->els_pending++;
+}
+
+/* The lane being served keeps going while its credit covers the next node,
+ * otherwise the next lane gets its quanta. A lane left empty loses what it
+ * had saved, so that an idle lane cannot burst past the others later, and
+ * once every lane is empty the next round starts with control again. */
+echo_lane_node_t *echo_lanes_pop( echo_lanes_t *lanes )
+{
+    echo_lane_queue_t *queue;
+    echo_lane_node_t *node;
+
+    if( lanes->els_pending == 0 )
+        return NULL;
+
+    for( ;; )
+    {
+        queue = &lanes->els_lane[ lanes->els_current ];
+
+        if( ( node = queue->el_head ) != NULL &&
+                node->eln_size <= queue->el_deficit )
+            break;
+
+        if( node == NULL )
+            queue->el_deficit = 0;
+
+        lanes->els_current = ( lanes->els_current + 1 ) % ECHO_LANE_MAX;
+        queue = &lanes->els_lane[ lanes->els_current ];
+
+        if( queue->el_head != NULL )
+            queue->el_deficit += g_weights[ lanes->els_current ] *
+                ECHO_LANE_QUANTUM;
+    }
+
+    queue->el_deficit -= node->eln_size;
+
+    if( ( queue->el_head = node->eln_next ) == NULL )
+    {
+        queue->el_tail = NULL;
+        queue->el_deficit = 0;
+    }
+
+    queue->el_depth--;
+
+    if( --lanes->els_pending == 0 )
+        lanes->els_current = ECHO_LANE_MAX - 1;
+
+    return node;
+}
+
+void echo_lanes_done( echo_lanes_t *lanes, const echo_lane_node_t *node )
+{
+    echo_lane_queue_t *queue;
+    unsigned long long now, wait;
+
+    queue = &lanes->els_lane[ node->eln_lane ];
+    now = echo_lane_clock( );
+    wait = now > node->eln_queued ? now - node->eln_queued : 0;
+
+    /* Only this thread writes the counters, readers may see them torn
+     * across each other but never a value torn in half. */
+    atomic_store_explicit( &queue->el_frames, atomic_load_explicit(
+                &queue->el_frames, memory_order_relaxed ) + 1,
+            memory_order_relaxed );
+    atomic_store_explicit( &queue->el_total, atomic_load_explicit(
+                &queue->el_total, memory_order_relaxed ) + wait,
+            memory_order_relaxed );
+
+    if( wait > atomic_load_explicit( &queue->el_max, memory_order_relaxed ) )
+        atomic_store_explicit( &queue->el_max, wait, memory_order_relaxed );
+}
+
+size_t echo_lanes_pending( const echo_lanes_t *lanes )
+{
+    return lanes->els_pending;
+}
+
+void echo_lanes_usage( echo_lanes_t *lanes, echo_lane_t lane,
+        echo_lane_usage_t *usage )
+{
+    echo_lane_queue_t *queue;
+    unsigned long long max;
+
+    queue = &lanes->els_lane[ lane ];
+    usage->elu_frames += atomic_load_explicit( &queue->el_frames,
+            memory_order_relaxed );
+    usage->elu_total += atomic_load_explicit( &queue->el_total,
+            memory_order_relaxed );
+
+    if( ( max = atomic_load_explicit( &queue->el_max,
+                    memory_order_relaxed ) ) > usage->elu_max )
+        usage->elu_max = max;
+}
+
+void echo_lane_report( const echo_lane_usage_t *usage, const char *prefix,
+        FILE *file )
+{
+    int i;
+
+    for( i = 0; i < ECHO_LANE_MAX; i++ )
+    {
+        fprintf( file, "%s%s_frames=%llu\n%s%s_latency_avg_us=%.1f\n"
+                "%s%s_latency_max_us=%.1f\n", prefix, g_names[ i ],
+                usage[ i ].elu_frames, prefix, g_names[ i ],
+                usage[ i ].elu_frames > 0 ? usage[ i ].elu_total / 1000.0 /
+                usage[ i ].elu_frames : 0.0, prefix, g_names[ i ],
+                usage[ i ].elu_max / 1000.0 );
+    }
+}
@@ -0,0 +1,849 @@
+#include "echopeer.h"
+#include "echostats.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Recently seen sequence numbers of one origin, a sliding window as used
+ * against replays: o_top is the highest sequence seen and bit n of o_mask
+ * stands for o_top - n. */
+struct origin
+{
+    uint32_t o_node;
+    int o_used;
+    uint64_t o_top;
+    uint64_t o_mask;
+};
+
+struct link
+{
+    echo_peer_set_t *l_set;
+    tcp_context_t *l_tcp;       /* NULL while disconnected */
+    char *l_host;               /* NULL for accepted links */
+    int l_port;
+    uint32_t l_node;            /* remote node ID */
+    int l_up;                   /* handshake done */
+    int l_dead;                 /* the writer must stop */
+    pthread_mutex_t l_lock;     /* guards the output and l_dead */
+    pthread_cond_t l_cond;
+    char *l_out;                /* frames waiting for the writer */
+    size_t l_outlen;
+    size_t l_outsize;
+    struct link *l_next;
+};
+
+struct echo_peer_set
+{
+    uint32_t ps_node;
+    echo_peer_deliver_t ps_deliver;
+    void *ps_arg;
+    pthread_mutex_t ps_lock;    /* guards the links and the sequence */
+    pthread_cond_t ps_cond;
+    struct link *ps_links;
+    size_t ps_up;
+    unsigned long ps_generation;    /* bumped when a link goes up or down */
+    echo_peer_control_t ps_control;
+    void *ps_control_arg;
+    size_t ps_controlling;          /* control calls in progress */
+    size_t ps_threads;          /* link threads still running */
+    int ps_stopping;
+    uint64_t ps_seq;
+    pthread_mutex_t ps_seen_lock;
+    struct origin ps_origins[ ECHO_PEER_ORIGINS ];
+    size_t ps_evict;
+};
+
+static int spawn_link( echo_peer_set_t *set, tcp_context_t *ctx,
+        const char *host, int port, uint32_t node, int *err );
+static void *link_thread( void *arg );
+static void *writer_thread( void *arg );
+static int dial( struct link *link );
+static void serve( struct link *link );
+static int wait_retry( echo_peer_set_t *set );
+static void relay_in( struct link *link, const char *payload, size_t size );
+static void control_in( struct link *link, const char *payload,
+        size_t size );
+static void queue_all( echo_peer_set_t *set, const struct link *from,
+        const char *head, size_t headlen, const struct iovec *body,
+        int count );
+static void queue_link( struct link *link, const char *head,
+        size_t headlen, const struct iovec *body, int count );
+static int first_seen( echo_peer_set_t *set, uint32_t node, uint64_t seq );
+static void put_u32( unsigned char *buf, uint32_t value );
+static uint32_t get_u32( const unsigned char *buf );
+
+void echo_peer_strerror( int errnum, char *buf, size_t buflen )
+{
+    if( errnum == ESELFPEER )
+    {
+        strncpy( buf, "Peer has this node's ID", buflen );
+    }
+    else
+    {
+        strerror_r( errnum, buf, buflen );
+    }
+}
+
+echo_peer_set_t *echo_peer_create( uint32_t node,
+        echo_peer_deliver_t deliver, void *arg, int *err )
+{
+    echo_peer_set_t *set;
+
+    if( deliver == NULL )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( set = calloc( 1, sizeof( echo_peer_set_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    set->ps_node = node;
+    set->ps_deliver = deliver;
+    set->ps_arg = arg;
+
+    /* Sequences start from the clock so that a restarted node is not
+     * mistaken for a replay of its previous run. */
+    set->ps_seq = ( uint64_t )time( NULL ) << 20;
+    pthread_mutex_init( &set->ps_lock, NULL );
+    pthread_mutex_init( &set->ps_seen_lock, NULL );
+    pthread_cond_init( &set->ps_cond, NULL );
+
+    return set;
+}
+
+int echo_peer_connect( echo_peer_set_t *set, const char *host, int port,
+        int *err )
+{
+    if( set == NULL || host == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    return spawn_link( set, NULL, host, port, 0, err );
+}
+
+int echo_peer_attach( echo_peer_set_t *set, tcp_context_t *ctx,
+        const char *hello, size_t size, int *err )
+{
+    unsigned char reply[ 4 ];
+    uint32_t node;
+
+    if( set == NULL || ctx == NULL || hello == NULL || size != 4 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( node = get_u32( ( const unsigned char* )hello ) ) == set->ps_node )
+    {
+        *err = ESELFPEER;
+        return -1;
+    }
+
+    put_u32( reply, set->ps_node );
+
+    if( echo_frame_send( ctx, ECHO_FRAME_PEER, 0, ( char* )reply, 4,
+                err ) == -1 )
+        return -1;
+
+    return spawn_link( set, ctx, NULL, 0, node, err );
+}
+
+int echo_peer_broadcast( echo_peer_set_t *set, const char *text,
+        size_t size, int *err )
+{
+    struct iovec part;
+
+    if( text == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    part.iov_base = ( void* )text;
+    part.iov_len = size;
+
+    return echo_peer_broadcastv( set, &part, 1, err );
+}
+
+int echo_peer_broadcastv( echo_peer_set_t *set, const struct iovec *parts,
+        int count, int *err )
+{
+    unsigned char head[ ECHO_FRAME_HEADER + ECHO_PEER_RELAY ];
+    echo_frame_t frame;
+    uint64_t seq;
+    size_t size;
+
+    if( set == NULL || parts == NULL || count < 0 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( size = echo_frame_length( parts, count ) ) >
+            ECHO_FRAME_MAX - ECHO_PEER_RELAY )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    frame.ef_length = ECHO_PEER_RELAY + size;
+    frame.ef_type = ECHO_FRAME_RELAY;
+    frame.ef_flags = 0;
+    echo_frame_encode( &frame, head );
+
+    pthread_mutex_lock( &set->ps_lock );
+    seq = ++set->ps_seq;
+    pthread_mutex_unlock( &set->ps_lock );
+
+    put_u32( head + ECHO_FRAME_HEADER, set->ps_node );
+    put_u32( head + ECHO_FRAME_HEADER + 4, seq >> 32 );
+    put_u32( head + ECHO_FRAME_HEADER + 8, seq & 0xffffffff );
+
+    queue_all( set, NULL, ( char* )head, sizeof( head ), parts, count );
+
+    return 0;
+}
+
+size_t echo_peer_links( echo_peer_set_t *set )
+{
+    size_t up;
+
+    pthread_mutex_lock( &set->ps_lock );
+    up = set->ps_up;
+    pthread_mutex_unlock( &set->ps_lock );
+
+    return up;
+}
+
+void echo_peer_set_control( echo_peer_set_t *set,
+        echo_peer_control_t control, void *arg )
+{
+    pthread_mutex_lock( &set->ps_lock );
+    set->ps_control = control;
+    set->ps_control_arg = arg;
+
+    /* Once replaced, the previous function is no longer running. */
+    while( set->ps_controlling > 0 )
+    {
+        pthread_cond_wait( &set->ps_cond, &set->ps_lock );
+    }
+
+    pthread_mutex_unlock( &set->ps_lock );
+}
+
+int echo_peer_send( echo_peer_set_t *set, uint32_t node,
+        const char *payload, size_t size, int *err )
+{
+    unsigned char head[ ECHO_FRAME_HEADER ];
+    echo_frame_t frame;
+    struct link *link;
+    struct iovec body;
+
+    if( set == NULL || payload == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( size > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    frame.ef_length = size;
+    frame.ef_type = ECHO_FRAME_CONTROL;
+    frame.ef_flags = 0;
+    echo_frame_encode( &frame, head );
+
+    pthread_mutex_lock( &set->ps_lock );
+
+    for( link = set->ps_links; link != NULL; link = link->l_next )
+    {
+        if( link->l_up && link->l_node == node )
+            break;
+    }
+
+    body.iov_base = ( void* )payload;
+    body.iov_len = size;
+
+    if( link != NULL )
+        queue_link( link, ( char* )head, ECHO_FRAME_HEADER, &body, 1 );
+
+    pthread_mutex_unlock( &set->ps_lock );
+
+    if( link == NULL )
+    {
+        *err = ENOTCONN;
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t echo_peer_nodes( echo_peer_set_t *set, uint32_t *nodes, size_t max,
+        unsigned long *generation )
+{
+    struct link *link;
+    size_t count, i;
+
+    count = 0;
+    pthread_mutex_lock( &set->ps_lock );
+
+    for( link = set->ps_links; link != NULL; link = link->l_next )
+    {
+        if( !link->l_up )
+            continue;
+
+        /* Two nodes dialling each other share two links. */
+        for( i = 0; i < count && nodes[ i ] != link->l_node; i++ );
+
+        if( i == count && count < max )
+            nodes[ count++ ] = link->l_node;
+    }
+
+    *generation = set->ps_generation;
+    pthread_mutex_unlock( &set->ps_lock );
+
+    return count;
+}
+
+void echo_peer_destroy( echo_peer_set_t *set )
+{
+    struct link *link;
+
+    pthread_mutex_lock( &set->ps_lock );
+    set->ps_stopping = 1;
+
+    /* Shutting the sockets down wakes the link threads up, which then
+     * tear their links down. */
+    for( link = set->ps_links; link != NULL; link = link->l_next )
+    {
+        if( link->l_tcp != NULL && link->l_tcp->tc_socket != -1 )
+            shutdown( link->l_tcp->tc_socket, SHUT_RDWR );
+    }
+
+    pthread_cond_broadcast( &set->ps_cond );
+
+    while( set->ps_threads > 0 )
+    {
+        pthread_cond_wait( &set->ps_cond, &set->ps_lock );
+    }
+
+    pthread_mutex_unlock( &set->ps_lock );
+
+    pthread_cond_destroy( &set->ps_cond );
+    pthread_mutex_destroy( &set->ps_seen_lock );
+    pthread_mutex_destroy( &set->ps_lock );
+    free( set );
+}
+
+int spawn_link( echo_peer_set_t *set, tcp_context_t *ctx, const char *host,
+        int port, uint32_t node, int *err )
+{
+    struct link *link;
+    pthread_t thread;
+
+    if( ( link = calloc( 1, sizeof( struct link ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    if( host != NULL && ( link->l_host = strdup( host ) ) == NULL )
+    {
+        free( link );
+        *err = ENOMEM;
+        return -1;
+    }
+
+    link->l_set = set;
+    link->l_tcp = ctx;
+    link->l_port = port;
+    link->l_node = node;
+    pthread_mutex_init( &link->l_lock, NULL );
+    pthread_cond_init( &link->l_cond, NULL );
+
+    pthread_mutex_lock( &set->ps_lock );
+
+    if( set->ps_stopping ||
+            pthread_create( &thread, NULL, link_thread, link ) != 0 )
+    {
+        pthread_mutex_unlock( &set->ps_lock );
+        pthread_cond_destroy( &link->l_cond );
+        pthread_mutex_destroy( &link->l_lock );
+        free( link->l_host );
+        free( link );
+        *err = EAGAIN;
+        return -1;
+    }
+
+    pthread_detach( thread );
+    link->l_next = set->ps_links;
+    set->ps_links = link;
+    set->ps_threads++;
+    pthread_mutex_unlock( &set->ps_lock );
+
+    return 0;
+}
+
+void *link_thread( void *arg )
+{
+    echo_peer_set_t *set;
+    struct link *link, **prev;
+
+    link = ( struct link* )arg;
+    set = link->l_set;
+
+    if( link->l_host == NULL )
+    {
+        serve( link );
+    }
+    else
+    {
+        /* Configured peers are dialled until the node stops. */
+        do
+        {
+            if( dial( link ) == 0 )
+                serve( link );
+        }
+        while( wait_retry( set ) );
+    }
+
+    pthread_mutex_lock( &set->ps_lock );
+
+    for( prev = &set->ps_links; *prev != link; prev = &( *prev )->l_next );
+
+    *prev = link->l_next;
+    set->ps_threads--;
+    pthread_cond_broadcast( &set->ps_cond );
+    pthread_mutex_unlock( &set->ps_lock );
+
+    pthread_cond_destroy( &link->l_cond );
+    pthread_mutex_destroy( &link->l_lock );
+    free( link->l_out );
+    free( link->l_host );
+    free( link );
+
+    return NULL;
+}
+
+int dial( struct link *link )
+{
+    unsigned char hello[ 4 ];
+    echo_peer_set_t *set;
+    echo_frame_t frame;
+    tcp_context_t *ctx;
+    int err;
+
+    set = link->l_set;
+
+    if( ( ctx = tcp_context_create( &err ) ) == NULL )
+        return -1;
+
+    if( tcp_context_connect( ctx, link->l_host, link->l_port, &err ) == -1 )
+    {
+        tcp_context_destroy( ctx );
+        return -1;
+    }
+
+    /* Published before the handshake, so that a node stopping meanwhile
+     * can shut the socket down. */
+    pthread_mutex_lock( &set->ps_lock );
+
+    if( set->ps_stopping )
+    {
+        pthread_mutex_unlock( &set->ps_lock );
+        tcp_context_destroy( ctx );
+        return -1;
+    }
+
+    link->l_tcp = ctx;
+    pthread_mutex_unlock( &set->ps_lock );
+
+    put_u32( hello, set->ps_node );
+
+    if( echo_frame_send( ctx, ECHO_FRAME_PEER, 0, ( char* )hello, 4,
+                &err ) != -1 &&
+            echo_frame_recv( ctx, &frame, ( char* )hello, 4, &err ) > 0 &&
+            frame.ef_type == ECHO_FRAME_PEER && frame.ef_length == 4 &&
+            ( link->l_node = get_u32( hello ) ) != set->ps_node )
+        return 0;
+
+    pthread_mutex_lock( &set->ps_lock );
+    link->l_tcp = NULL;
+    pthread_mutex_unlock( &set->ps_lock );
+    tcp_context_destroy( ctx );
+
+    return -1;
+}
+
+/* Relays over an established link until it drops. The reading side runs
+ * here, the writing side on its own thread so that a slow peer never
+ * blocks the reader of another link. */
+void serve( struct link *link )
+{
+    echo_peer_set_t *set;
+    echo_frame_t frame;
+    tcp_context_t *ctx;
+    pthread_t writer;
+    char *buffer;
+    int started, err;
+
+    set = link->l_set;
+
+    if( ( buffer = malloc( ECHO_FRAME_MAX ) ) != NULL )
+    {
+        pthread_mutex_lock( &link->l_lock );
+        link->l_dead = 0;
+        link->l_outlen = 0;
+        pthread_mutex_unlock( &link->l_lock );
+
+        started = pthread_create( &writer, NULL, writer_thread,
+                link ) == 0;
+
+        if( started )
+        {
+            pthread_mutex_lock( &set->ps_lock );
+            link->l_up = 1;
+            set->ps_up++;
+            set->ps_generation++;
+            pthread_mutex_unlock( &set->ps_lock );
+
+            while( echo_frame_recv( link->l_tcp, &frame, buffer,
+                        ECHO_FRAME_MAX, &err ) > 0 )
+            {
+                if( frame.ef_type == ECHO_FRAME_RELAY )
+                {
+                    relay_in( link, buffer, frame.ef_length );
+                }
+                else if( frame.ef_type == ECHO_FRAME_CONTROL )
+                {
+                    control_in( link, buffer, frame.ef_length );
+                }
+            }
+
+            pthread_mutex_lock( &set->ps_lock );
+            link->l_up = 0;
+            set->ps_up--;
+            set->ps_generation++;
+            pthread_mutex_unlock( &set->ps_lock );
+
+            pthread_mutex_lock( &link->l_lock );
+            link->l_dead = 1;
+            pthread_cond_signal( &link->l_cond );
+            pthread_mutex_unlock( &link->l_lock );
+            pthread_join( writer, NULL );
+        }
+
+        free( buffer );
+    }
+
+    pthread_mutex_lock( &set->ps_lock );
+    ctx = link->l_tcp;
+    link->l_tcp = NULL;
+    pthread_mutex_unlock( &set->ps_lock );
+
+    tcp_context_destroy( ctx );
+}
+
+/* Writes whatever was queued since its last write in one call, so that a
+ * burst of broadcasts costs one system call per link. */
+void *writer_thread( void *arg )
+{
+    struct link *link;
+    char *batch, *tmp;
+    size_t size, swap, length, sent;
+    ssize_t bytes;
+    int err;
+
+    link = ( struct link* )arg;
+    batch = NULL;
+    size = 0;
+
+    pthread_mutex_lock( &link->l_lock );
+
+    while( 1 )
+    {
+        while( link->l_outlen == 0 && !link->l_dead )
+        {
+            pthread_cond_wait( &link->l_cond, &link->l_lock );
+        }
+
+        if( link->l_dead )
+            break;
+
+        tmp = link->l_out;
+        link->l_out = batch;
+        batch = tmp;
+        length = link->l_outlen;
+        link->l_outlen = 0;
+        swap = link->l_outsize;
+        link->l_outsize = size;
+        size = swap;
+        pthread_mutex_unlock( &link->l_lock );
+
+        for( sent = 0; sent < length; sent += bytes )
+        {
+            bytes = tcp_context_send( link->l_tcp, batch + sent,
+                    length - sent, &err );
+
+            if( bytes == -1 )
+                break;
+
+            echo_stats_add( ECHO_STAT_PEER_WRITES, 1 );
+        }
+
+        pthread_mutex_lock( &link->l_lock );
+
+        if( sent < length )
+        {
+            link->l_dead = 1;
+            shutdown( link->l_tcp->tc_socket, SHUT_RDWR );
+        }
+    }
+
+    pthread_mutex_unlock( &link->l_lock );
+    free( batch );
+
+    return NULL;
+}
+
+int wait_retry( echo_peer_set_t *set )
+{
+    struct timespec deadline;
+    int stopping;
+
+    clock_gettime( CLOCK_REALTIME, &deadline );
+    deadline.tv_sec += ECHO_PEER_RETRY;
+
+    pthread_mutex_lock( &set->ps_lock );
+
+    while( !set->ps_stopping &&
+            pthread_cond_timedwait( &set->ps_cond, &set->ps_lock,
+                &deadline ) != ETIMEDOUT );
+
+    stopping = set->ps_stopping;
+    pthread_mutex_unlock( &set->ps_lock );
+
+    return !stopping;
+}
+
+void control_in( struct link *link, const char *payload, size_t size )
+{
+    echo_peer_control_t control;
+    echo_peer_set_t *set;
+    void *arg;
+
+    set = link->l_set;
+
+    pthread_mutex_lock( &set->ps_lock );
+    control = set->ps_control;
+    arg = set->ps_control_arg;
+    set->ps_controlling += control != NULL;
+    pthread_mutex_unlock( &set->ps_lock );
+
+    if( control == NULL )
+        return;
+
+    control( link->l_node, payload, size, arg );
+
+    pthread_mutex_lock( &set->ps_lock );
+
+    if( --set->ps_controlling == 0 )
+        pthread_cond_broadcast( &set->ps_cond );
+
+    pthread_mutex_unlock( &set->ps_lock );
+}
+
+void relay_in( struct link *link, const char *payload, size_t size )
+{
+    unsigned char head[ ECHO_FRAME_HEADER ];
+    const unsigned char *relay;
+    echo_peer_set_t *set;
+    echo_frame_t frame;
+    struct iovec body;
+    uint32_t node;
+    uint64_t seq;
+
+    set = link->l_set;
+    relay = ( const unsigned char* )payload;
+
+    if( size < ECHO_PEER_RELAY )
+        return;
+
+    node = get_u32( relay );
+    seq = ( uint64_t )get_u32( relay + 4 ) << 32 | get_u32( relay + 8 );
+
+    if( node == set->ps_node || !first_seen( set, node, seq ) )
+    {
+        echo_stats_add( ECHO_STAT_RELAY_DUP, 1 );
+        return;
+    }
+
+    echo_stats_add( ECHO_STAT_RELAY_IN, 1 );
+    set->ps_deliver( payload + ECHO_PEER_RELAY, size - ECHO_PEER_RELAY,
+            set->ps_arg );
+
+    /* Flooded on to every other link, the windows of the other nodes stop
+     * it from going round in circles. */
+    frame.ef_length = size;
+    frame.ef_type = ECHO_FRAME_RELAY;
+    frame.ef_flags = 0;
+    echo_frame_encode( &frame, head );
+    body.iov_base = ( void* )payload;
+    body.iov_len = size;
+    queue_all( set, link, ( char* )head, ECHO_FRAME_HEADER, &body, 1 );
+}
+
+static void queue_all( echo_peer_set_t *set, const struct link *from,
+        const char *head, size_t headlen, const struct iovec *body,
+        int count )
+{
+    struct link *link;
+
+    pthread_mutex_lock( &set->ps_lock );
+
+    for( link = set->ps_links; link != NULL; link = link->l_next )
+    {
+        if( link != from && link->l_up )
+            queue_link( link, head, headlen, body, count );
+    }
+
+    pthread_mutex_unlock( &set->ps_lock );
+}
+
+/* The body parts are gathered straight into the link's output. */
+void queue_link( struct link *link, const char *head, size_t headlen,
+        const struct iovec *body, int count )
+{
+    size_t needed, size;
+    char *out;
+
+    pthread_mutex_lock( &link->l_lock );
+    needed = link->l_outlen + headlen + echo_frame_length( body, count );
+
+    if( link->l_dead )
+    {
+        pthread_mutex_unlock( &link->l_lock );
+        return;
+    }
+
+    /* A peer that cannot keep up is cut off rather than waited for, it
+     * reconnects once it has caught up. */
+    if( needed > ECHO_PEER_BACKLOG )
+    {
+        link->l_dead = 1;
+        shutdown( link->l_tcp->tc_socket, SHUT_RDWR );
+        pthread_cond_signal( &link->l_cond );
+        pthread_mutex_unlock( &link->l_lock );
+        return;
+    }
+
+    if( needed > link->l_outsize )
+    {
+        for( size = link->l_outsize > 0 ? link->l_outsize : ECHO_FRAME_MAX;
+                size < needed; size *= 2 );
+
+        if( ( out = realloc( link->l_out, size ) ) == NULL )
+        {
+            pthread_mutex_unlock( &link->l_lock );
+            return;
+        }
+
+        link->l_out = out;
+        link->l_outsize = size;
+    }
+
+    memcpy( link->l_out + link->l_outlen, head, headlen );
+    echo_frame_gather( link->l_out + link->l_outlen + headlen, body, count );
+
+    if( link->l_outlen == 0 )
+        pthread_cond_signal( &link->l_cond );
+
+    link->l_outlen = needed;
+    pthread_mutex_unlock( &link->l_lock );
+
+    echo_stats_add( ECHO_STAT_RELAY_OUT, 1 );
+}
+
+int first_seen( echo_peer_set_t *set, uint32_t node, uint64_t seq )
+{
+    struct origin *origin, *slot;
+    uint64_t shift;
+    int i, fresh;
+
+    pthread_mutex_lock( &set->ps_seen_lock );
+    slot = NULL;
+
+    for( i = 0; i < ECHO_PEER_ORIGINS; i++ )
+    {
+        origin = &set->ps_origins[ i ];
+
+        if( origin->o_used && origin->o_node == node )
+            break;
+
+        if( !origin->o_used && slot == NULL )
+            slot = origin;
+    }
+
+    if( i == ECHO_PEER_ORIGINS )
+    {
+        if( slot == NULL )
+        {
+            slot = &set->ps_origins[ set->ps_evict ];
+            set->ps_evict = ( set->ps_evict + 1 ) % ECHO_PEER_ORIGINS;
+        }
+
+        origin = slot;
+        origin->o_used = 1;
+        origin->o_node = node;
+        origin->o_top = 0;
+        origin->o_mask = 0;
+    }
+
+    if( seq > origin->o_top )
+    {
+        shift = seq - origin->o_top;
+        origin->o_mask = shift >= ECHO_PEER_WINDOW ? 0 :
+            origin->o_mask << shift;
+        origin->o_mask |= 1;
+        origin->o_top = seq;
+        fresh = 1;
+    }
+    else if( ( shift = origin->o_top - seq ) >= ECHO_PEER_WINDOW ||
+            ( origin->o_mask & ( 1ULL << shift ) ) )
+    {
+        fresh = 0;
+    }
+    else
+    {
+        origin->o_mask |= 1ULL << shift;
+        fresh = 1;
+    }
+
+    pthread_mutex_unlock( &set->ps_seen_lock );
+
+    return fresh;
+}
+
+void put_u32( unsigned char *buf, uint32_t value )
+{
+    buf[ 0 ] = value >> 24;
+    buf[ 1 ] = value >> 16;
+    buf[ 2 ] = value >> 8;
+    buf[ 3 ] = value;
+}
+
+uint32_t get_u32( const unsigned char *buf )
+{
+    return ( uint32_t )buf[ 0 ] << 24 | ( uint32_t )buf[ 1 ] << 16 |
+        ( uint32_t )buf[ 2 ] << 8 | buf[ 3 ];
+}
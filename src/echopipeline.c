@@ -0,0 +1,621 @@
+#include "echopipeline.h"
+#include "echoqueue.h"
+#include "echolane.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+/* Room left in the scratch buffer below which it is written out before the
+ * next frame is packed, a frame that does not fit would leave the deflate
+ * stream half advanced. */
+#define SCRATCH_LOW ( ECHO_FRAME_HEADER + ECHO_FRAME_MAX + 1024 )
+
+enum
+{
+    DELIVER_SEND,
+    DELIVER_ATTACH,
+    DELIVER_DETACH,
+    DELIVER_CLOSE,
+    DELIVER_STOP
+};
+
+/* Text shared by every delivery made of it */
+struct payload
+{
+    atomic_int p_refs;
+    size_t p_size;
+    char p_text[ ];
+};
+
+struct delivery
+{
+    echo_queue_node_t d_node;
+    echo_lane_node_t d_lane;    /* Where sends wait to be written */
+    int d_kind;
+    int d_type;
+    echo_client_context_t *d_client;    /* NULL for every member */
+    struct payload *d_payload;
+};
+
+struct member
+{
+    echo_client_context_t *m_client;
+    int m_dead;
+};
+
+/* Members and lanes are only touched by the writer's own thread. */
+struct writer
+{
+    echo_queue_t *w_queue;
+    echo_lanes_t w_lanes;
+    pthread_t w_thread;
+    struct member *w_members;
+    size_t w_capacity;
+    char *w_scratch;
+    atomic_size_t w_size;
+    atomic_ullong w_frames;
+    atomic_ullong w_flushes;
+};
+
+struct echo_pipeline
+{
+    size_t ep_writers;
+    struct writer ep_writer[ ];
+};
+
+static void *writer_thread( void *arg );
+static int take( struct writer *writer, struct delivery *delivery );
+static void write_lanes( struct writer *writer, int all );
+static void write_batch( struct writer *writer, struct delivery **batch,
+        size_t count );
+static int control( struct writer *writer, struct delivery *delivery );
+static void flush( struct writer *writer, struct member *member,
+        size_t used );
+static struct member *find( struct writer *writer,
+        const echo_client_context_t *client );
+static struct writer *owner( echo_pipeline_t *pipeline,
+        const echo_client_context_t *client );
+static int submit( struct writer *writer, int kind, int type,
+        echo_lane_t lane, echo_client_context_t *client,
+        struct payload *payload );
+static struct payload *share( const struct iovec *parts, int count,
+        int refs, int *err );
+static void release( struct payload *payload );
+
+echo_pipeline_t *echo_pipeline_create( size_t writers, int *err )
+{
+    echo_pipeline_t *pipeline;
+    struct writer *writer;
+    size_t i;
+
+    if( writers == 0 || writers > ECHO_PIPELINE_WRITERS )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( pipeline = calloc( 1, sizeof( echo_pipeline_t ) +
+                    writers * sizeof( struct writer ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    for( i = 0; i < writers; i++ )
+    {
+        writer = &pipeline->ep_writer[ i ];
+        echo_lanes_init( &writer->w_lanes );
+
+        if( ( writer->w_scratch = malloc( ECHO_PIPELINE_BUFFER ) ) == NULL )
+        {
+            *err = ENOMEM;
+            break;
+        }
+
+        if( ( writer->w_queue = echo_queue_create( err ) ) == NULL )
+        {
+            free( writer->w_scratch );
+            break;
+        }
+
+        if( pthread_create( &writer->w_thread, NULL, writer_thread,
+                    writer ) != 0 )
+        {
+            echo_queue_destroy( writer->w_queue );
+            free( writer->w_scratch );
+            *err = EAGAIN;
+            break;
+        }
+    }
+
+    pipeline->ep_writers = i;
+
+    if( i < writers )
+    {
+        echo_pipeline_destroy( pipeline );
+        return NULL;
+    }
+
+    return pipeline;
+}
+
+int echo_pipeline_attach( echo_pipeline_t *pipeline,
+        echo_client_context_t *client, int *err )
+{
+    if( submit( owner( pipeline, client ), DELIVER_ATTACH, 0, 0, client,
+                NULL ) == -1 )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Without memory for the delivery the client cannot be handed back, it
+ * stays with the writer until the pipeline is destroyed. */
+void echo_pipeline_detach( echo_pipeline_t *pipeline,
+        echo_client_context_t *client )
+{
+    submit( owner( pipeline, client ), DELIVER_DETACH, 0, 0, client, NULL );
+}
+
+int echo_pipeline_send( echo_pipeline_t *pipeline, const char *buffer,
+        size_t size, int *err )
+{
+    struct iovec part;
+
+    part.iov_base = ( void* )buffer;
+    part.iov_len = size;
+
+    return echo_pipeline_sendv( pipeline, ECHO_FRAME_TEXT,
+            ECHO_LANE_INTERACTIVE, &part, 1, err );
+}
+
+int echo_pipeline_sendv( echo_pipeline_t *pipeline, int type,
+        echo_lane_t lane, const struct iovec *parts, int count, int *err )
+{
+    struct payload *payload;
+    size_t i;
+
+    if( ( payload = share( parts, count, pipeline->ep_writers,
+                    err ) ) == NULL )
+        return -1;
+
+    for( i = 0; i < pipeline->ep_writers; i++ )
+    {
+        if( submit( &pipeline->ep_writer[ i ], DELIVER_SEND, type, lane,
+                    NULL, payload ) == -1 )
+        {
+            /* Writers left out drop their references at once. */
+            for( ; i < pipeline->ep_writers; i++ )
+            {
+                release( payload );
+            }
+
+            *err = ENOMEM;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int echo_pipeline_sendto( echo_pipeline_t *pipeline,
+        echo_client_context_t *client, int type, const char *buffer,
+        size_t size, int *err )
+{
+    struct iovec part;
+
+    part.iov_base = ( void* )buffer;
+    part.iov_len = size;
+
+    return echo_pipeline_sendtov( pipeline, client, type, &part, 1, err );
+}
+
+int echo_pipeline_sendtov( echo_pipeline_t *pipeline,
+        echo_client_context_t *client, int type, const struct iovec *parts,
+        int count, int *err )
+{
+    struct payload *payload;
+
+    if( ( payload = share( parts, count, 1, err ) ) == NULL )
+        return -1;
+
+    if( submit( owner( pipeline, client ), DELIVER_SEND, type,
+                echo_lane_of( type ), client, payload ) == -1 )
+    {
+        release( payload );
+        *err = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+int echo_pipeline_close( echo_pipeline_t *pipeline,
+        echo_client_context_t *client, int *err )
+{
+    if( submit( owner( pipeline, client ), DELIVER_CLOSE, 0, 0, client,
+                NULL ) == -1 )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+size_t echo_pipeline_writers( const echo_pipeline_t *pipeline )
+{
+    return pipeline->ep_writers;
+}
+
+void echo_pipeline_usage( echo_pipeline_t *pipeline, size_t writer,
+        echo_writer_usage_t *usage )
+{
+    struct writer *w;
+
+    w = &pipeline->ep_writer[ writer ];
+    usage->ew_members = atomic_load_explicit( &w->w_size,
+            memory_order_relaxed );
+    usage->ew_depth = echo_queue_depth( w->w_queue, &usage->ew_peak );
+    usage->ew_frames = atomic_load_explicit( &w->w_frames,
+            memory_order_relaxed );
+    usage->ew_flushes = atomic_load_explicit( &w->w_flushes,
+            memory_order_relaxed );
+}
+
+void echo_pipeline_lanes( echo_pipeline_t *pipeline,
+        echo_lane_usage_t *usage )
+{
+    size_t i;
+    int lane;
+
+    for( lane = 0; lane < ECHO_LANE_MAX; lane++ )
+    {
+        usage[ lane ].elu_frames = 0;
+        usage[ lane ].elu_total = 0;
+        usage[ lane ].elu_max = 0;
+
+        for( i = 0; i < pipeline->ep_writers; i++ )
+        {
+            echo_lanes_usage( &pipeline->ep_writer[ i ].w_lanes, lane,
+                    &usage[ lane ] );
+        }
+    }
+}
+
+void echo_pipeline_report( echo_pipeline_t *pipeline, FILE *file )
+{
+    echo_lane_usage_t lanes[ ECHO_LANE_MAX ];
+    echo_writer_usage_t usage;
+    size_t i;
+
+    for( i = 0; i < pipeline->ep_writers; i++ )
+    {
+        echo_pipeline_usage( pipeline, i, &usage );
+        fprintf( file, "writer%zu_members=%zu\nwriter%zu_depth=%zu\n"
+                "writer%zu_peak=%zu\nwriter%zu_frames=%llu\n"
+                "writer%zu_flushes=%llu\n", i, usage.ew_members, i,
+                usage.ew_depth, i, usage.ew_peak, i, usage.ew_frames, i,
+                usage.ew_flushes );
+    }
+
+    echo_pipeline_lanes( pipeline, lanes );
+    echo_lane_report( lanes, "writer_", file );
+}
+
+void echo_pipeline_destroy( echo_pipeline_t *pipeline )
+{
+    struct writer *writer;
+    size_t i;
+
+    for( i = 0; i < pipeline->ep_writers; i++ )
+    {
+        writer = &pipeline->ep_writer[ i ];
+
+        /* Spin until the stop can be queued, nothing else ends the thread. */
+        while( submit( writer, DELIVER_STOP, 0, 0, NULL, NULL ) == -1 );
+
+        pthread_join( writer->w_thread, NULL );
+        echo_queue_destroy( writer->w_queue );
+        free( writer->w_members );
+        free( writer->w_scratch );
+    }
+
+    free( pipeline );
+}
+
+/* Everything queued is sorted into the lanes before anything is written,
+ * so that a frame that cannot wait overtakes the backlog instead of
+ * queueing behind it. At most ECHO_PIPELINE_BATCH sends are then written
+ * before the queue is looked at again. A change of membership waits until
+ * the lanes are empty, as it must come after what was queued before it. */
+void *writer_thread( void *arg )
+{
+    struct delivery *delivery;
+    struct writer *writer;
+    int stop;
+
+    writer = ( struct writer* )arg;
+    stop = 0;
+
+    while( !stop )
+    {
+        if( echo_lanes_pending( &writer->w_lanes ) == 0 )
+        {
+            if( ( delivery = ( struct delivery* )echo_queue_wait(
+                            writer->w_queue, -1 ) ) == NULL )
+                continue;
+
+            stop = take( writer, delivery );
+        }
+
+        while( !stop && ( delivery = ( struct delivery* )echo_queue_pop(
+                        writer->w_queue ) ) != NULL )
+        {
+            stop = take( writer, delivery );
+        }
+
+        write_lanes( writer, 0 );
+    }
+
+    return NULL;
+}
+
+int take( struct writer *writer, struct delivery *delivery )
+{
+    if( delivery->d_kind == DELIVER_SEND )
+    {
+        echo_lanes_push( &writer->w_lanes, delivery->d_lane.eln_lane,
+                &delivery->d_lane );
+        return 0;
+    }
+
+    write_lanes( writer, 1 );
+
+    return control( writer, delivery );
+}
+
+/* One batch, or every batch when all is set. */
+void write_lanes( struct writer *writer, int all )
+{
+    struct delivery *batch[ ECHO_PIPELINE_BATCH ];
+    echo_lane_node_t *node;
+    size_t count;
+
+    do
+    {
+        for( count = 0; count < ECHO_PIPELINE_BATCH && ( node =
+                    echo_lanes_pop( &writer->w_lanes ) ) != NULL; count++ )
+        {
+            batch[ count ] = ( struct delivery* )( ( char* )node -
+                    offsetof( struct delivery, d_lane ) );
+        }
+
+        write_batch( writer, batch, count );
+    }
+    while( all && count > 0 );
+}
+
+void write_batch( struct writer *writer, struct delivery **batch,
+        size_t count )
+{
+    struct member *member;
+    struct delivery *delivery;
+    size_t i, j, size, used;
+    ssize_t bytes;
+    int err;
+
+    if( count == 0 )
+        return;
+
+    size = atomic_load_explicit( &writer->w_size, memory_order_relaxed );
+
+    for( i = 0; i < size; i++ )
+    {
+        member = &writer->w_members[ i ];
+        used = 0;
+
+        for( j = 0; j < count && !member->m_dead; j++ )
+        {
+            delivery = batch[ j ];
+
+            if( delivery->d_client != NULL &&
+                    delivery->d_client != member->m_client )
+                continue;
+
+            if( ECHO_PIPELINE_BUFFER - used < SCRATCH_LOW )
+            {
+                flush( writer, member, used );
+                used = 0;
+            }
+
+            if( ( bytes = echo_client_context_pack( member->m_client,
+                            delivery->d_type, delivery->d_payload->p_text,
+                            delivery->d_payload->p_size,
+                            writer->w_scratch + used,
+                            ECHO_PIPELINE_BUFFER - used, &err ) ) == -1 )
+                continue;
+
+            used += bytes;
+            atomic_fetch_add_explicit( &writer->w_frames, 1,
+                    memory_order_relaxed );
+        }
+
+        if( used > 0 )
+            flush( writer, member, used );
+    }
+
+    for( j = 0; j < count; j++ )
+    {
+        echo_lanes_done( &writer->w_lanes, &batch[ j ]->d_lane );
+        release( batch[ j ]->d_payload );
+        free( batch[ j ] );
+    }
+}
+
+int control( struct writer *writer, struct delivery *delivery )
+{
+    struct member *member, *members;
+    size_t size, capacity;
+    int kind;
+
+    size = atomic_load_explicit( &writer->w_size, memory_order_relaxed );
+    kind = delivery->d_kind;
+
+    if( kind == DELIVER_ATTACH )
+    {
+        if( size == writer->w_capacity )
+        {
+            capacity = writer->w_capacity ? writer->w_capacity * 2 : 16;
+
+            if( ( members = realloc( writer->w_members,
+                            capacity * sizeof( struct member ) ) ) == NULL )
+            {
+                /* The reader sees the connection end and detaches. */
+                shutdown( delivery->d_client->eec_tcp->tc_socket, SHUT_RDWR );
+                free( delivery );
+                return 0;
+            }
+
+            writer->w_members = members;
+            writer->w_capacity = capacity;
+        }
+
+        writer->w_members[ size ].m_client = delivery->d_client;
+        writer->w_members[ size ].m_dead = 0;
+        atomic_store_explicit( &writer->w_size, size + 1,
+                memory_order_relaxed );
+    }
+    else if( kind == DELIVER_DETACH )
+    {
+        if( ( member = find( writer, delivery->d_client ) ) != NULL )
+        {
+            *member = writer->w_members[ size - 1 ];
+            atomic_store_explicit( &writer->w_size, size - 1,
+                    memory_order_relaxed );
+        }
+
+        echo_client_context_destroy( delivery->d_client );
+    }
+    else if( kind == DELIVER_CLOSE )
+    {
+        if( ( member = find( writer, delivery->d_client ) ) != NULL )
+        {
+            shutdown( member->m_client->eec_tcp->tc_socket, SHUT_RDWR );
+            member->m_dead = 1;
+        }
+    }
+
+    free( delivery );
+
+    return kind == DELIVER_STOP;
+}
+
+/* A member whose socket fails is shut down and skipped from then on, its
+ * reader sees the connection end and detaches it. */
+void flush( struct writer *writer, struct member *member, size_t used )
+{
+    const char *data;
+    ssize_t bytes;
+    int err;
+
+    atomic_fetch_add_explicit( &writer->w_flushes, 1, memory_order_relaxed );
+
+    for( data = writer->w_scratch; used > 0; data += bytes, used -= bytes )
+    {
+        if( ( bytes = tcp_context_send( member->m_client->eec_tcp, data,
+                        used, &err ) ) <= 0 )
+        {
+            shutdown( member->m_client->eec_tcp->tc_socket, SHUT_RDWR );
+            member->m_dead = 1;
+            return;
+        }
+    }
+}
+
+struct member *find( struct writer *writer,
+        const echo_client_context_t *client )
+{
+    size_t i, size;
+
+    size = atomic_load_explicit( &writer->w_size, memory_order_relaxed );
+
+    for( i = 0; i < size; i++ )
+    {
+        if( writer->w_members[ i ].m_client == client )
+            return &writer->w_members[ i ];
+    }
+
+    return NULL;
+}
+
+/* A client always goes to the same writer, so what is queued for it is
+ * written in order without any table of owners. */
+struct writer *owner( echo_pipeline_t *pipeline,
+        const echo_client_context_t *client )
+{
+    uint64_t hash;
+
+    hash = ( ( uintptr_t )client >> 4 ) * 0x9E3779B97F4A7C15ULL;
+
+    return &pipeline->ep_writer[ ( hash >> 32 ) % pipeline->ep_writers ];
+}
+
+int submit( struct writer *writer, int kind, int type, echo_lane_t lane,
+        echo_client_context_t *client, struct payload *payload )
+{
+    struct delivery *delivery;
+
+    if( ( delivery = malloc( sizeof( struct delivery ) ) ) == NULL )
+        return -1;
+
+    delivery->d_kind = kind;
+    delivery->d_type = type;
+    delivery->d_client = client;
+    delivery->d_payload = payload;
+    delivery->d_lane.eln_lane = lane;
+    delivery->d_lane.eln_size = payload != NULL ? ECHO_FRAME_HEADER +
+        payload->p_size : 0;
+    delivery->d_lane.eln_queued = echo_lane_clock( );
+    echo_queue_push( writer->w_queue, &delivery->d_node );
+
+    return 0;
+}
+
+/* The parts are gathered once for all the writers. */
+struct payload *share( const struct iovec *parts, int count, int refs,
+        int *err )
+{
+    struct payload *payload;
+    size_t size;
+
+    if( ( size = echo_frame_length( parts, count ) ) > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return NULL;
+    }
+
+    if( ( payload = malloc( sizeof( struct payload ) + size ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    atomic_init( &payload->p_refs, refs );
+    payload->p_size = echo_frame_gather( payload->p_text, parts, count );
+
+    return payload;
+}
+
+void release( struct payload *payload )
+{
+    if( payload != NULL && atomic_fetch_sub_explicit( &payload->p_refs, 1,
+                memory_order_acq_rel ) == 1 )
+        free( payload );
+}
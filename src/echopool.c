@@ -0,0 +1,510 @@
+#include "echopool.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define CACHE_LINE  64
+#define STEAL_TRIES 2
+
+/* Chase-Lev deque with sequentially consistent top and bottom where the
+ * owner and the thieves race for the last task. The owner pushes and takes
+ * at the bottom, thieves take from the top. Tasks that do not fit go to the
+ * owner's inbox instead. */
+struct deque
+{
+    _Alignas( CACHE_LINE ) atomic_llong d_top;
+    _Alignas( CACHE_LINE ) atomic_llong d_bottom;
+    echo_task_t *_Atomic d_tasks[ ECHO_POOL_DEQUE ];
+};
+
+struct worker
+{
+    struct deque w_deque;
+    echo_queue_t *w_inbox;          /* tasks from outside, and nudges */
+    echo_queue_node_t w_wake;
+    atomic_int w_nudged;
+    atomic_int w_idle;
+    pthread_t w_thread;
+    echo_pool_t *w_pool;
+    unsigned int w_seed;
+    atomic_ullong w_tasks;
+    atomic_ullong w_steals;
+    atomic_ullong w_sleeps;
+};
+
+struct echo_pool
+{
+    size_t p_workers;
+    atomic_size_t p_next;
+    atomic_int p_idle;
+    atomic_int p_stopping;
+    struct worker *p_worker;
+};
+
+/* The serial executor is itself a task on the pool while it has work. */
+struct echo_serial
+{
+    echo_task_t es_task;
+    echo_pool_t *es_pool;
+    echo_queue_t *es_queue;
+    atomic_size_t es_pending;
+};
+
+static _Thread_local struct worker *t_worker;
+
+static void *worker_thread( void *arg );
+static echo_task_t *find_work( struct worker *worker );
+static void wake_idle( echo_pool_t *pool, struct worker *self );
+static void nudge( struct worker *worker );
+static void stop( echo_pool_t *pool, size_t started );
+static int deque_push( struct deque *deque, echo_task_t *task );
+static echo_task_t *deque_take( struct deque *deque );
+static echo_task_t *deque_steal( struct deque *deque );
+static void serial_run( echo_task_t *task );
+
+echo_pool_t *echo_pool_create( size_t workers, int *err )
+{
+    echo_pool_t *pool;
+    struct worker *worker;
+    size_t i;
+
+    if( workers == 0 || workers > ECHO_POOL_WORKERS )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( pool = malloc( sizeof( echo_pool_t ) ) ) == NULL ||
+            posix_memalign( ( void** )&pool->p_worker, CACHE_LINE,
+                workers * sizeof( struct worker ) ) != 0 )
+    {
+        free( pool );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    atomic_init( &pool->p_next, 0 );
+    atomic_init( &pool->p_idle, 0 );
+    atomic_init( &pool->p_stopping, 0 );
+
+    pool->p_workers = workers;
+
+    /* Every deque is ready before a thread can try to steal from it. */
+    for( i = 0; i < workers; i++ )
+    {
+        worker = &pool->p_worker[ i ];
+        atomic_init( &worker->w_deque.d_top, 0 );
+        atomic_init( &worker->w_deque.d_bottom, 0 );
+        atomic_init( &worker->w_nudged, 0 );
+        atomic_init( &worker->w_idle, 0 );
+        atomic_init( &worker->w_tasks, 0 );
+        atomic_init( &worker->w_steals, 0 );
+        atomic_init( &worker->w_sleeps, 0 );
+        worker->w_pool = pool;
+        worker->w_seed = i + 1;
+
+        if( ( worker->w_inbox = echo_queue_create( err ) ) == NULL )
+        {
+            while( i-- > 0 )
+            {
+                echo_queue_destroy( pool->p_worker[ i ].w_inbox );
+            }
+
+            free( pool->p_worker );
+            free( pool );
+            return NULL;
+        }
+    }
+
+    for( i = 0; i < workers; i++ )
+    {
+        if( pthread_create( &pool->p_worker[ i ].w_thread, NULL,
+                    worker_thread, &pool->p_worker[ i ] ) != 0 )
+        {
+            stop( pool, i );
+            *err = EAGAIN;
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void echo_pool_submit( echo_pool_t *pool, echo_task_t *task )
+{
+    struct worker *worker;
+
+    worker = t_worker;
+
+    if( worker != NULL && worker->w_pool == pool &&
+            deque_push( &worker->w_deque, task ) == 0 )
+    {
+        /* An idle worker is told there is something to steal. */
+        if( atomic_load( &pool->p_idle ) > 0 )
+            wake_idle( pool, worker );
+
+        return;
+    }
+
+    if( worker == NULL || worker->w_pool != pool )
+        worker = &pool->p_worker[ atomic_fetch_add_explicit(
+                    &pool->p_next, 1, memory_order_relaxed ) %
+                pool->p_workers ];
+
+    echo_queue_push( worker->w_inbox, &task->et_node );
+}
+
+size_t echo_pool_workers( const echo_pool_t *pool )
+{
+    return pool->p_workers;
+}
+
+void echo_pool_usage( echo_pool_t *pool, size_t worker,
+        echo_worker_usage_t *usage )
+{
+    struct worker *w;
+
+    w = &pool->p_worker[ worker ];
+    usage->ew_tasks = atomic_load_explicit( &w->w_tasks,
+            memory_order_relaxed );
+    usage->ew_steals = atomic_load_explicit( &w->w_steals,
+            memory_order_relaxed );
+    usage->ew_sleeps = atomic_load_explicit( &w->w_sleeps,
+            memory_order_relaxed );
+}
+
+void echo_pool_report( echo_pool_t *pool, FILE *file )
+{
+    echo_worker_usage_t usage;
+    size_t i;
+
+    for( i = 0; i < pool->p_workers; i++ )
+    {
+        echo_pool_usage( pool, i, &usage );
+        fprintf( file, "worker%zu_tasks=%llu\nworker%zu_steals=%llu\n"
+                "worker%zu_sleeps=%llu\n", i, usage.ew_tasks, i,
+                usage.ew_steals, i, usage.ew_sleeps );
+    }
+}
+
+void echo_pool_destroy( echo_pool_t *pool )
+{
+    stop( pool, pool->p_workers );
+}
+
+echo_serial_t *echo_serial_create( echo_pool_t *pool, int *err )
+{
+    echo_serial_t *serial;
+
+    if( ( serial = malloc( sizeof( echo_serial_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    if( ( serial->es_queue = echo_queue_create( err ) ) == NULL )
+    {
+        free( serial );
+        return NULL;
+    }
+
+    serial->es_task.et_run = serial_run;
+    serial->es_pool = pool;
+    atomic_init( &serial->es_pending, 0 );
+
+    return serial;
+}
+
+/* Only the submit that finds the executor empty schedules it, so it is
+ * never queued twice and its tasks never run side by side. The count goes
+ * up first, a run can then never pop more than it accounts for. */
+void echo_serial_submit( echo_serial_t *serial, echo_task_t *task )
+{
+    size_t pending;
+
+    pending = atomic_fetch_add( &serial->es_pending, 1 );
+    echo_queue_push( serial->es_queue, &task->et_node );
+
+    if( pending == 0 )
+        echo_pool_submit( serial->es_pool, &serial->es_task );
+}
+
+void echo_serial_wait( echo_serial_t *serial )
+{
+    while( atomic_load( &serial->es_pending ) > 0 )
+    {
+        poll( NULL, 0, 1 );
+    }
+}
+
+void echo_serial_destroy( echo_serial_t *serial )
+{
+    echo_serial_wait( serial );
+    echo_queue_destroy( serial->es_queue );
+    free( serial );
+}
+
+/* Deques are emptied first, the inbox next, and other workers are robbed
+ * last. A worker with nothing to do sleeps on its inbox until a task or a
+ * nudge arrives. */
+void *worker_thread( void *arg )
+{
+    struct worker *worker;
+    echo_queue_node_t *node;
+    echo_task_t *task;
+    echo_pool_t *pool;
+
+    worker = ( struct worker* )arg;
+    pool = worker->w_pool;
+    t_worker = worker;
+
+    while( 1 )
+    {
+        if( ( task = find_work( worker ) ) != NULL )
+        {
+            atomic_fetch_add_explicit( &worker->w_tasks, 1,
+                    memory_order_relaxed );
+            task->et_run( task );
+            continue;
+        }
+
+        if( atomic_load( &pool->p_stopping ) )
+            break;
+
+        atomic_store( &worker->w_idle, 1 );
+        atomic_fetch_add( &pool->p_idle, 1 );
+
+        /* A task pushed before the count went up is seen here, one pushed
+         * after it comes with a nudge. */
+        if( ( task = find_work( worker ) ) != NULL )
+        {
+            atomic_fetch_sub( &pool->p_idle, 1 );
+            atomic_store( &worker->w_idle, 0 );
+            atomic_fetch_add_explicit( &worker->w_tasks, 1,
+                    memory_order_relaxed );
+            task->et_run( task );
+            continue;
+        }
+
+        /* That look may have eaten the nudge sent by stop. */
+        if( atomic_load( &pool->p_stopping ) )
+        {
+            atomic_fetch_sub( &pool->p_idle, 1 );
+            atomic_store( &worker->w_idle, 0 );
+            break;
+        }
+
+        atomic_fetch_add_explicit( &worker->w_sleeps, 1,
+                memory_order_relaxed );
+        node = echo_queue_wait( worker->w_inbox, -1 );
+        atomic_fetch_sub( &pool->p_idle, 1 );
+        atomic_store( &worker->w_idle, 0 );
+
+        if( node == &worker->w_wake )
+        {
+            atomic_store( &worker->w_nudged, 0 );
+        }
+        else if( node != NULL )
+        {
+            atomic_fetch_add_explicit( &worker->w_tasks, 1,
+                    memory_order_relaxed );
+            ( ( echo_task_t* )node )->et_run( ( echo_task_t* )node );
+        }
+    }
+
+    t_worker = NULL;
+
+    return NULL;
+}
+
+echo_task_t *find_work( struct worker *worker )
+{
+    echo_queue_node_t *node;
+    echo_task_t *task;
+    echo_pool_t *pool;
+    size_t i, start;
+    int tries;
+
+    if( ( task = deque_take( &worker->w_deque ) ) != NULL )
+        return task;
+
+    while( ( node = echo_queue_pop( worker->w_inbox ) ) != NULL )
+    {
+        if( node != &worker->w_wake )
+            return ( echo_task_t* )node;
+
+        atomic_store( &worker->w_nudged, 0 );
+    }
+
+    pool = worker->w_pool;
+
+    for( tries = 0; tries < STEAL_TRIES; tries++ )
+    {
+        start = rand_r( &worker->w_seed ) % pool->p_workers;
+
+        for( i = 0; i < pool->p_workers; i++ )
+        {
+            if( &pool->p_worker[ ( start + i ) % pool->p_workers ] ==
+                    worker )
+                continue;
+
+            if( ( task = deque_steal( &pool->p_worker[ ( start + i ) %
+                            pool->p_workers ].w_deque ) ) != NULL )
+            {
+                atomic_fetch_add_explicit( &worker->w_steals, 1,
+                        memory_order_relaxed );
+                return task;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Wakes the first idle worker after the one woken last time. */
+void wake_idle( echo_pool_t *pool, struct worker *self )
+{
+    struct worker *worker;
+    size_t i, start;
+
+    start = atomic_fetch_add_explicit( &pool->p_next, 1,
+            memory_order_relaxed );
+
+    for( i = 0; i < pool->p_workers; i++ )
+    {
+        worker = &pool->p_worker[ ( start + i ) % pool->p_workers ];
+
+        if( worker != self && atomic_load( &worker->w_idle ) )
+        {
+            nudge( worker );
+            return;
+        }
+    }
+}
+
+/* The wake node is queued at most once until the worker pops it. */
+void nudge( struct worker *worker )
+{
+    if( atomic_exchange( &worker->w_nudged, 1 ) == 0 )
+        echo_queue_push( worker->w_inbox, &worker->w_wake );
+}
+
+/* Joins the first started workers and frees the pool. */
+void stop( echo_pool_t *pool, size_t started )
+{
+    size_t i;
+
+    atomic_store( &pool->p_stopping, 1 );
+
+    for( i = 0; i < started; i++ )
+    {
+        nudge( &pool->p_worker[ i ] );
+    }
+
+    for( i = 0; i < pool->p_workers; i++ )
+    {
+        if( i < started )
+            pthread_join( pool->p_worker[ i ].w_thread, NULL );
+
+        echo_queue_destroy( pool->p_worker[ i ].w_inbox );
+    }
+
+    free( pool->p_worker );
+    free( pool );
+}
+
+int deque_push( struct deque *deque, echo_task_t *task )
+{
+    long long bottom, top;
+
+    bottom = atomic_load_explicit( &deque->d_bottom, memory_order_relaxed );
+    top = atomic_load_explicit( &deque->d_top, memory_order_acquire );
+
+    if( bottom - top >= ECHO_POOL_DEQUE )
+        return -1;
+
+    atomic_store_explicit( &deque->d_tasks[ bottom % ECHO_POOL_DEQUE ],
+            task, memory_order_relaxed );
+    /* Ordered before the look at the idle count in echo_pool_submit. */
+    atomic_store( &deque->d_bottom, bottom + 1 );
+
+    return 0;
+}
+
+echo_task_t *deque_take( struct deque *deque )
+{
+    long long bottom, top;
+    echo_task_t *task;
+
+    bottom = atomic_load_explicit( &deque->d_bottom,
+            memory_order_relaxed ) - 1;
+    atomic_store( &deque->d_bottom, bottom );
+    top = atomic_load( &deque->d_top );
+
+    if( top > bottom )
+    {
+        atomic_store_explicit( &deque->d_bottom, bottom + 1,
+                memory_order_relaxed );
+        return NULL;
+    }
+
+    task = atomic_load_explicit( &deque->d_tasks[ bottom % ECHO_POOL_DEQUE ],
+            memory_order_relaxed );
+
+    /* The last task may be stolen meanwhile, the top decides. */
+    if( top == bottom )
+    {
+        if( !atomic_compare_exchange_strong_explicit( &deque->d_top, &top,
+                    top + 1, memory_order_seq_cst, memory_order_relaxed ) )
+            task = NULL;
+
+        atomic_store_explicit( &deque->d_bottom, bottom + 1,
+                memory_order_relaxed );
+    }
+
+    return task;
+}
+
+echo_task_t *deque_steal( struct deque *deque )
+{
+    long long bottom, top;
+    echo_task_t *task;
+
+    top = atomic_load( &deque->d_top );
+    bottom = atomic_load( &deque->d_bottom );
+
+    if( top >= bottom )
+        return NULL;
+
+    task = atomic_load_explicit( &deque->d_tasks[ top % ECHO_POOL_DEQUE ],
+            memory_order_relaxed );
+
+    if( !atomic_compare_exchange_strong_explicit( &deque->d_top, &top,
+                top + 1, memory_order_seq_cst, memory_order_relaxed ) )
+        return NULL;
+
+    return task;
+}
+
+/* Runs at most ECHO_SERIAL_BUDGET tasks before giving the worker back, a
+ * busy connection then waits its turn behind the others. */
+void serial_run( echo_task_t *task )
+{
+    echo_queue_node_t *node;
+    echo_serial_t *serial;
+    size_t ran;
+
+    serial = ( echo_serial_t* )task;
+
+    for( ran = 0; ran < ECHO_SERIAL_BUDGET &&
+            ( node = echo_queue_pop( serial->es_queue ) ) != NULL; ran++ )
+    {
+        ( ( echo_task_t* )node )->et_run( ( echo_task_t* )node );
+    }
+
+    /* A push halfway through counts as pending and brings it back. */
+    if( atomic_fetch_sub( &serial->es_pending, ran ) != ran )
+        echo_pool_submit( serial->es_pool, &serial->es_task );
+}
@@ -0,0 +1,669 @@
+#include "echopresence.h"
+#include "echostats.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MESSAGE_HEADER  8
+
+/* Operations carried by the control frames */
+enum
+{
+    OP_CLAIM = 1,       /* holder asks the owner for a lease */
+    OP_GRANT,           /* owner hands the lease out */
+    OP_DENY,            /* owner knows a live lease of another node */
+    OP_RELEASE          /* holder gives the lease back */
+};
+
+struct entry
+{
+    char e_name[ MAX_LENGTH ];
+    uint32_t e_node;
+    time_t e_expiry;
+    struct entry *e_next;
+};
+
+/* Chained hash table of usernames */
+struct table
+{
+    struct entry *t_buckets[ ECHO_PRESENCE_BUCKETS ];
+};
+
+struct point
+{
+    uint64_t p_hash;
+    uint32_t p_node;
+};
+
+struct echo_presence
+{
+    echo_peer_set_t *ep_peers;
+    uint32_t ep_node;
+    echo_presence_revoke_t ep_revoke;
+    void *ep_arg;
+    pthread_mutex_t ep_lock;
+    pthread_cond_t ep_cond;
+    int ep_stopping;
+    pthread_t ep_thread;
+    struct table ep_leases;     /* leases of the names this node owns */
+    struct table ep_cache;      /* holders learnt from other owners */
+    struct table ep_held;       /* names held by local members */
+    struct point ep_ring[ ECHO_PRESENCE_NODES * ECHO_PRESENCE_VNODES ];
+    size_t ep_points;
+    unsigned long ep_generation;
+};
+
+static void *renew_thread( void *arg );
+static void control( uint32_t node, const char *payload, size_t size,
+        void *arg );
+static uint32_t owner_of( echo_presence_t *presence, const char *uname );
+static void refresh_ring( echo_presence_t *presence );
+static size_t build_ring( struct point *ring, const uint32_t *nodes,
+        size_t count );
+static int lease( echo_presence_t *presence, const char *uname,
+        uint32_t node, uint32_t *holder, time_t *ttl );
+static void send_op( echo_presence_t *presence, uint32_t node, int op,
+        const char *uname, uint32_t holder, time_t ttl );
+static struct entry *table_find( struct table *table, const char *name );
+static struct entry *table_put( struct table *table, const char *name );
+static void table_remove( struct table *table, const char *name );
+static void table_clear( struct table *table );
+static uint64_t hash_bytes( const void *data, size_t size );
+static int compare_points( const void *a, const void *b );
+static time_t now( void );
+
+uint32_t echo_presence_hash_owner( const uint32_t *nodes, size_t count,
+        const char *uname )
+{
+    struct point ring[ ECHO_PRESENCE_NODES * ECHO_PRESENCE_VNODES ];
+    size_t points, low, high, mid;
+    uint64_t hash;
+
+    points = build_ring( ring, nodes, count );
+    hash = hash_bytes( uname, strlen( uname ) );
+    low = 0;
+    high = points;
+
+    while( low < high )
+    {
+        mid = ( low + high ) / 2;
+
+        if( ring[ mid ].p_hash < hash )
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return ring[ low == points ? 0 : low ].p_node;
+}
+
+echo_presence_t *echo_presence_create( echo_peer_set_t *peers,
+        uint32_t node, echo_presence_revoke_t revoke, void *arg, int *err )
+{
+    echo_presence_t *presence;
+
+    if( peers == NULL || revoke == NULL )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
+
+    if( ( presence = calloc( 1, sizeof( echo_presence_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    presence->ep_peers = peers;
+    presence->ep_node = node;
+    presence->ep_revoke = revoke;
+    presence->ep_arg = arg;
+    presence->ep_generation = ( unsigned long )-1;
+    pthread_mutex_init( &presence->ep_lock, NULL );
+    pthread_cond_init( &presence->ep_cond, NULL );
+    refresh_ring( presence );
+
+    if( pthread_create( &presence->ep_thread, NULL, renew_thread,
+                presence ) != 0 )
+    {
+        pthread_cond_destroy( &presence->ep_cond );
+        pthread_mutex_destroy( &presence->ep_lock );
+        free( presence );
+        *err = EAGAIN;
+        return NULL;
+    }
+
+    echo_peer_set_control( peers, control, presence );
+
+    return presence;
+}
+
+int echo_presence_claim( echo_presence_t *presence, const char *uname,
+        int *err )
+{
+    struct entry *cached;
+    uint32_t owner, holder;
+    time_t ttl;
+
+    pthread_mutex_lock( &presence->ep_lock );
+    refresh_ring( presence );
+    owner = owner_of( presence, uname );
+
+    /* Decided here when this node owns the name or has heard of a live
+     * lease, anything else is settled by the owner after the fact. */
+    if( owner == presence->ep_node )
+    {
+        if( !lease( presence, uname, presence->ep_node, &holder, &ttl ) )
+        {
+            pthread_mutex_unlock( &presence->ep_lock );
+            echo_stats_add( ECHO_STAT_PRESENCE_LOCAL, 1 );
+            *err = EDUPLICATE;
+            return -1;
+        }
+    }
+    else if( ( cached = table_find( &presence->ep_cache, uname ) ) != NULL &&
+            cached->e_node != presence->ep_node &&
+            cached->e_expiry > now( ) )
+    {
+        pthread_mutex_unlock( &presence->ep_lock );
+        echo_stats_add( ECHO_STAT_PRESENCE_LOCAL, 1 );
+        *err = EDUPLICATE;
+        return -1;
+    }
+
+    if( table_put( &presence->ep_held, uname ) == NULL )
+    {
+        pthread_mutex_unlock( &presence->ep_lock );
+        *err = ENOMEM;
+        return -1;
+    }
+
+    if( owner != presence->ep_node )
+    {
+        send_op( presence, owner, OP_CLAIM, uname, presence->ep_node, 0 );
+        echo_stats_add( ECHO_STAT_PRESENCE_CLAIMS, 1 );
+    }
+    else
+    {
+        echo_stats_add( ECHO_STAT_PRESENCE_LOCAL, 1 );
+    }
+
+    pthread_mutex_unlock( &presence->ep_lock );
+
+    return 0;
+}
+
+void echo_presence_release( echo_presence_t *presence, const char *uname )
+{
+    struct entry *leased;
+    uint32_t owner;
+
+    pthread_mutex_lock( &presence->ep_lock );
+
+    /* A name revoked meanwhile belongs to another node by now. */
+    if( table_find( &presence->ep_held, uname ) == NULL )
+    {
+        pthread_mutex_unlock( &presence->ep_lock );
+        return;
+    }
+
+    table_remove( &presence->ep_held, uname );
+    table_remove( &presence->ep_cache, uname );
+    owner = owner_of( presence, uname );
+
+    if( owner != presence->ep_node )
+    {
+        send_op( presence, owner, OP_RELEASE, uname, presence->ep_node, 0 );
+    }
+    else if( ( leased = table_find( &presence->ep_leases, uname ) ) != NULL &&
+            leased->e_node == presence->ep_node )
+    {
+        table_remove( &presence->ep_leases, uname );
+    }
+
+    pthread_mutex_unlock( &presence->ep_lock );
+}
+
+void echo_presence_destroy( echo_presence_t *presence )
+{
+    echo_peer_set_control( presence->ep_peers, NULL, NULL );
+
+    pthread_mutex_lock( &presence->ep_lock );
+    presence->ep_stopping = 1;
+    pthread_cond_signal( &presence->ep_cond );
+    pthread_mutex_unlock( &presence->ep_lock );
+    pthread_join( presence->ep_thread, NULL );
+
+    table_clear( &presence->ep_leases );
+    table_clear( &presence->ep_cache );
+    table_clear( &presence->ep_held );
+    pthread_cond_destroy( &presence->ep_cond );
+    pthread_mutex_destroy( &presence->ep_lock );
+    free( presence );
+}
+
+/* Renews the leases of the local members with their owners, right away
+ * when the ring changed since ownership may have moved. */
+void *renew_thread( void *arg )
+{
+    char ( *names )[ MAX_LENGTH ], ( *denied )[ MAX_LENGTH ];
+    echo_presence_t *presence;
+    struct timespec deadline;
+    unsigned long generation;
+    size_t count, ndenied, i, j;
+    struct entry *entry;
+    uint32_t owner, holder, nodes[ 1 ];
+    time_t next, ttl;
+
+    presence = ( echo_presence_t* )arg;
+    next = now( ) + ECHO_PRESENCE_RENEW;
+
+    pthread_mutex_lock( &presence->ep_lock );
+
+    while( !presence->ep_stopping )
+    {
+        clock_gettime( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait( &presence->ep_cond, &presence->ep_lock,
+                &deadline );
+
+        if( presence->ep_stopping )
+            break;
+
+        echo_peer_nodes( presence->ep_peers, nodes, 0, &generation );
+
+        if( generation == presence->ep_generation && now( ) < next )
+            continue;
+
+        refresh_ring( presence );
+        next = now( ) + ECHO_PRESENCE_RENEW;
+
+        for( count = 0, i = 0; i < ECHO_PRESENCE_BUCKETS; i++ )
+        {
+            for( entry = presence->ep_held.t_buckets[ i ]; entry != NULL;
+                    entry = entry->e_next )
+                count++;
+        }
+
+        names = malloc( ( count + 1 ) * sizeof( *names ) );
+        denied = malloc( ( count + 1 ) * sizeof( *denied ) );
+
+        if( names == NULL || denied == NULL )
+        {
+            free( names );
+            free( denied );
+            continue;
+        }
+
+        for( count = 0, i = 0; i < ECHO_PRESENCE_BUCKETS; i++ )
+        {
+            for( entry = presence->ep_held.t_buckets[ i ]; entry != NULL;
+                    entry = entry->e_next )
+                strcpy( names[ count++ ], entry->e_name );
+        }
+
+        for( ndenied = 0, j = 0; j < count; j++ )
+        {
+            owner = owner_of( presence, names[ j ] );
+
+            if( owner != presence->ep_node )
+            {
+                send_op( presence, owner, OP_CLAIM, names[ j ],
+                        presence->ep_node, 0 );
+            }
+            else if( !lease( presence, names[ j ], presence->ep_node,
+                        &holder, &ttl ) )
+            {
+                table_remove( &presence->ep_held, names[ j ] );
+                strcpy( denied[ ndenied++ ], names[ j ] );
+            }
+        }
+
+        /* Revoking takes the server's lock, which may be waiting on ours. */
+        pthread_mutex_unlock( &presence->ep_lock );
+
+        for( j = 0; j < ndenied; j++ )
+        {
+            echo_stats_add( ECHO_STAT_PRESENCE_REVOKED, 1 );
+            presence->ep_revoke( denied[ j ], presence->ep_arg );
+        }
+
+        free( names );
+        free( denied );
+        pthread_mutex_lock( &presence->ep_lock );
+    }
+
+    pthread_mutex_unlock( &presence->ep_lock );
+
+    return NULL;
+}
+
+void control( uint32_t node, const char *payload, size_t size, void *arg )
+{
+    const unsigned char *message;
+    echo_presence_t *presence;
+    char uname[ MAX_LENGTH ];
+    struct entry *entry;
+    uint32_t holder;
+    size_t length;
+    time_t ttl;
+    int revoke;
+
+    presence = ( echo_presence_t* )arg;
+    message = ( const unsigned char* )payload;
+
+    if( size < MESSAGE_HEADER ||
+            ( length = message[ 7 ] ) >= MAX_LENGTH ||
+            size != MESSAGE_HEADER + length )
+        return;
+
+    memcpy( uname, payload + MESSAGE_HEADER, length );
+    uname[ length ] = '\0';
+    holder = ( uint32_t )message[ 1 ] << 24 | ( uint32_t )message[ 2 ] << 16 |
+        ( uint32_t )message[ 3 ] << 8 | message[ 4 ];
+    ttl = message[ 5 ] << 8 | message[ 6 ];
+    revoke = 0;
+
+    pthread_mutex_lock( &presence->ep_lock );
+
+    switch( message[ 0 ] )
+    {
+        case OP_CLAIM:
+            if( lease( presence, uname, node, &holder, &ttl ) )
+            {
+                send_op( presence, node, OP_GRANT, uname, node, ttl );
+            }
+            else
+            {
+                send_op( presence, node, OP_DENY, uname, holder, ttl );
+            }
+            break;
+
+        case OP_GRANT:
+        case OP_DENY:
+            if( ( entry = table_put( &presence->ep_cache, uname ) ) != NULL )
+            {
+                /* Kept shorter than the lease, a name released since is
+                 * only refused for a few seconds. */
+                entry->e_node = holder;
+                entry->e_expiry = now( ) + ( ttl < ECHO_PRESENCE_CACHE ?
+                        ttl : ECHO_PRESENCE_CACHE );
+            }
+
+            if( message[ 0 ] == OP_DENY && holder != presence->ep_node &&
+                    table_find( &presence->ep_held, uname ) != NULL )
+            {
+                table_remove( &presence->ep_held, uname );
+                revoke = 1;
+            }
+            break;
+
+        case OP_RELEASE:
+            if( ( entry = table_find( &presence->ep_leases,
+                            uname ) ) != NULL && entry->e_node == node )
+                table_remove( &presence->ep_leases, uname );
+            break;
+    }
+
+    pthread_mutex_unlock( &presence->ep_lock );
+
+    if( revoke )
+    {
+        echo_stats_add( ECHO_STAT_PRESENCE_REVOKED, 1 );
+        presence->ep_revoke( uname, presence->ep_arg );
+    }
+}
+
+uint32_t owner_of( echo_presence_t *presence, const char *uname )
+{
+    size_t low, high, mid;
+    uint64_t hash;
+
+    hash = hash_bytes( uname, strlen( uname ) );
+    low = 0;
+    high = presence->ep_points;
+
+    while( low < high )
+    {
+        mid = ( low + high ) / 2;
+
+        if( presence->ep_ring[ mid ].p_hash < hash )
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return presence->ep_ring[ low == presence->ep_points ? 0 : low ].p_node;
+}
+
+/* Rebuilds the ring from the links that are up, only when they changed. */
+void refresh_ring( echo_presence_t *presence )
+{
+    uint32_t nodes[ ECHO_PRESENCE_NODES ];
+    unsigned long generation;
+    size_t count;
+
+    count = echo_peer_nodes( presence->ep_peers, nodes,
+            ECHO_PRESENCE_NODES - 1, &generation );
+
+    if( generation == presence->ep_generation )
+        return;
+
+    nodes[ count++ ] = presence->ep_node;
+    presence->ep_points = build_ring( presence->ep_ring, nodes, count );
+    presence->ep_generation = generation;
+}
+
+size_t build_ring( struct point *ring, const uint32_t *nodes, size_t count )
+{
+    unsigned char key[ 8 ];
+    size_t points, i, j;
+
+    points = 0;
+
+    for( i = 0; i < count && i < ECHO_PRESENCE_NODES; i++ )
+    {
+        for( j = 0; j < ECHO_PRESENCE_VNODES; j++ )
+        {
+            key[ 0 ] = nodes[ i ] >> 24;
+            key[ 1 ] = nodes[ i ] >> 16;
+            key[ 2 ] = nodes[ i ] >> 8;
+            key[ 3 ] = nodes[ i ];
+            key[ 4 ] = j >> 24;
+            key[ 5 ] = j >> 16;
+            key[ 6 ] = j >> 8;
+            key[ 7 ] = j;
+
+            ring[ points ].p_hash = hash_bytes( key, 8 );
+            ring[ points ].p_node = nodes[ i ];
+            points++;
+        }
+    }
+
+    qsort( ring, points, sizeof( struct point ), compare_points );
+
+    return points;
+}
+
+/* Hands out or renews the lease of a name this node owns. Returns zero
+ * and the live holder when another node has it. */
+int lease( echo_presence_t *presence, const char *uname, uint32_t node,
+        uint32_t *holder, time_t *ttl )
+{
+    struct entry *entry;
+    time_t current;
+
+    current = now( );
+    entry = table_find( &presence->ep_leases, uname );
+
+    if( entry != NULL && entry->e_node != node && entry->e_expiry > current )
+    {
+        *holder = entry->e_node;
+        *ttl = entry->e_expiry - current;
+        return 0;
+    }
+
+    if( entry == NULL &&
+            ( entry = table_put( &presence->ep_leases, uname ) ) == NULL )
+    {
+        /* Without memory the owner cannot remember the lease, it is
+         * granted and lives until the next renewal. */
+        *holder = node;
+        *ttl = ECHO_PRESENCE_TTL;
+        return 1;
+    }
+
+    entry->e_node = node;
+    entry->e_expiry = current + ECHO_PRESENCE_TTL;
+    *holder = node;
+    *ttl = ECHO_PRESENCE_TTL;
+
+    return 1;
+}
+
+void send_op( echo_presence_t *presence, uint32_t node, int op,
+        const char *uname, uint32_t holder, time_t ttl )
+{
+    unsigned char message[ MESSAGE_HEADER + MAX_LENGTH ];
+    size_t length;
+    int err;
+
+    length = strlen( uname );
+    message[ 0 ] = op;
+    message[ 1 ] = holder >> 24;
+    message[ 2 ] = holder >> 16;
+    message[ 3 ] = holder >> 8;
+    message[ 4 ] = holder;
+    message[ 5 ] = ttl >> 8;
+    message[ 6 ] = ttl;
+    message[ 7 ] = length;
+    memcpy( message + MESSAGE_HEADER, uname, length );
+
+    /* A lost message is made up for by the next renewal. */
+    echo_peer_send( presence->ep_peers, node, ( char* )message,
+            MESSAGE_HEADER + length, &err );
+}
+
+struct entry *table_find( struct table *table, const char *name )
+{
+    struct entry *entry;
+
+    entry = table->t_buckets[ hash_bytes( name, strlen( name ) ) %
+        ECHO_PRESENCE_BUCKETS ];
+
+    while( entry != NULL && strcmp( entry->e_name, name ) != 0 )
+    {
+        entry = entry->e_next;
+    }
+
+    return entry;
+}
+
+struct entry *table_put( struct table *table, const char *name )
+{
+    struct entry *entry;
+    size_t bucket;
+
+    if( ( entry = table_find( table, name ) ) != NULL )
+        return entry;
+
+    if( ( entry = calloc( 1, sizeof( struct entry ) ) ) == NULL )
+        return NULL;
+
+    bucket = hash_bytes( name, strlen( name ) ) % ECHO_PRESENCE_BUCKETS;
+    strcpy( entry->e_name, name );
+    entry->e_next = table->t_buckets[ bucket ];
+    table->t_buckets[ bucket ] = entry;
+
+    return entry;
+}
+
+void table_remove( struct table *table, const char *name )
+{
+    struct entry **link, *entry;
+
+    link = &table->t_buckets[ hash_bytes( name, strlen( name ) ) %
+        ECHO_PRESENCE_BUCKETS ];
+
+    while( ( entry = *link ) != NULL )
+    {
+        if( strcmp( entry->e_name, name ) == 0 )
+        {
+            *link = entry->e_next;
+            free( entry );
+            return;
+        }
+
+        link = &entry->e_next;
+    }
+}
+
+void table_clear( struct table *table )
+{
+    struct entry *entry;
+    size_t i;
+
+    for( i = 0; i < ECHO_PRESENCE_BUCKETS; i++ )
+    {
+        while( ( entry = table->t_buckets[ i ] ) != NULL )
+        {
+            table->t_buckets[ i ] = entry->e_next;
+            free( entry );
+        }
+    }
+}
+
+/* 64-bit FNV-1a followed by a final mix, FNV alone clusters short keys
+ * on the ring. */
+uint64_t hash_bytes( const void *data, size_t size )
+{
+    const unsigned char *bytes;
+    uint64_t hash;
+    size_t i;
+
+    bytes = ( const unsigned char* )data;
+    hash = 0xcbf29ce484222325ULL;
+
+    for( i = 0; i < size; i++ )
+    {
+        hash ^= bytes[ i ];
+        hash *= 0x100000001b3ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+int compare_points( const void *a, const void *b )
+{
+    const struct point *x, *y;
+
+    x = ( const struct point* )a;
+    y = ( const struct point* )b;
+
+    if( x->p_hash != y->p_hash )
+        return x->p_hash < y->p_hash ? -1 : 1;
+
+    return x->p_node < y->p_node ? -1 : x->p_node > y->p_node;
+}
+
+time_t now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec;
+}
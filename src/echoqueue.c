@@ -0,0 +1,213 @@
+#include "echoqueue.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define CACHE_LINE  64
+
+/* Producers only touch the head and the consumer only the tail, each on
+ * its own cache line. The stub keeps the list from ever being empty, so a
+ * push is one exchange and one store. The counts live next to the side
+ * that updates them. */
+struct echo_queue
+{
+    _Alignas( CACHE_LINE ) echo_queue_node_t *_Atomic eq_head;
+    atomic_size_t eq_pushed;
+    _Alignas( CACHE_LINE ) echo_queue_node_t *eq_tail;
+    echo_queue_node_t eq_stub;
+    atomic_size_t eq_popped;
+    atomic_size_t eq_peak;
+    _Alignas( CACHE_LINE ) atomic_int eq_waiting;
+    int eq_event;
+};
+
+static echo_queue_node_t *take( echo_queue_t *queue );
+static void enqueue( echo_queue_t *queue, echo_queue_node_t *node );
+
+echo_queue_t *echo_queue_create( int *err )
+{
+    echo_queue_t *queue;
+
+    if( posix_memalign( ( void** )&queue, CACHE_LINE,
+                sizeof( echo_queue_t ) ) != 0 )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    queue->eq_event = -1;
+    atomic_init( &queue->eq_stub.eqn_next, NULL );
+    atomic_init( &queue->eq_head, &queue->eq_stub );
+    atomic_init( &queue->eq_waiting, 0 );
+    atomic_init( &queue->eq_pushed, 0 );
+    atomic_init( &queue->eq_popped, 0 );
+    atomic_init( &queue->eq_peak, 0 );
+    queue->eq_tail = &queue->eq_stub;
+
+    return queue;
+}
+
+void echo_queue_push( echo_queue_t *queue, echo_queue_node_t *node )
+{
+    uint64_t one;
+
+    atomic_fetch_add_explicit( &queue->eq_pushed, 1, memory_order_relaxed );
+    enqueue( queue, node );
+
+    /* The link and this load are ordered against the consumer's store and
+     * its look at the queue, either it sees the node or the producer sees
+     * it waiting. */
+    if( atomic_load( &queue->eq_waiting ) &&
+            atomic_exchange( &queue->eq_waiting, 0 ) )
+    {
+        one = 1;
+
+        if( write( queue->eq_event, &one, sizeof( one ) ) == -1 )
+            return;
+    }
+}
+
+echo_queue_node_t *echo_queue_pop( echo_queue_t *queue )
+{
+    echo_queue_node_t *node;
+    size_t popped, depth;
+
+    if( ( node = take( queue ) ) == NULL )
+        return NULL;
+
+    popped = atomic_load_explicit( &queue->eq_popped,
+            memory_order_relaxed );
+    depth = atomic_load_explicit( &queue->eq_pushed,
+            memory_order_relaxed ) - popped;
+    atomic_store_explicit( &queue->eq_popped, popped + 1,
+            memory_order_relaxed );
+
+    if( depth > atomic_load_explicit( &queue->eq_peak,
+                memory_order_relaxed ) )
+        atomic_store_explicit( &queue->eq_peak, depth,
+                memory_order_relaxed );
+
+    return node;
+}
+
+echo_queue_node_t *echo_queue_wait( echo_queue_t *queue, int timeout )
+{
+    echo_queue_node_t *node;
+    struct pollfd pfd;
+    uint64_t count;
+
+    /* Made on the first wait, queues that are only polled need none.
+     * Producers never write to it before the consumer says it waits. */
+    if( queue->eq_event == -1 && ( queue->eq_event = eventfd( 0,
+                    EFD_CLOEXEC | EFD_NONBLOCK ) ) == -1 )
+    {
+        poll( NULL, 0, timeout == -1 || timeout > 1 ? 1 : timeout );
+        return echo_queue_pop( queue );
+    }
+
+    pfd.fd = queue->eq_event;
+    pfd.events = POLLIN;
+
+    while( ( node = echo_queue_pop( queue ) ) == NULL )
+    {
+        atomic_store( &queue->eq_waiting, 1 );
+
+        if( ( node = echo_queue_pop( queue ) ) != NULL )
+        {
+            atomic_store_explicit( &queue->eq_waiting, 0,
+                    memory_order_relaxed );
+            break;
+        }
+
+        if( poll( &pfd, 1, timeout ) == 0 )
+        {
+            atomic_store_explicit( &queue->eq_waiting, 0,
+                    memory_order_relaxed );
+            return echo_queue_pop( queue );
+        }
+
+        if( read( queue->eq_event, &count, sizeof( count ) ) == -1 &&
+                errno != EAGAIN )
+            return NULL;
+
+        /* A wakeup left over from an earlier wait counts as the time. */
+        if( timeout != -1 )
+            return echo_queue_pop( queue );
+    }
+
+    return node;
+}
+
+size_t echo_queue_depth( const echo_queue_t *queue, size_t *peak )
+{
+    size_t popped;
+
+    popped = atomic_load_explicit( &queue->eq_popped, memory_order_relaxed );
+
+    if( peak != NULL )
+        *peak = atomic_load_explicit( &queue->eq_peak, memory_order_relaxed );
+
+    /* Read last so that a racing pop cannot make it come out negative. */
+    return atomic_load_explicit( &queue->eq_pushed, memory_order_relaxed ) -
+        popped;
+}
+
+void echo_queue_destroy( echo_queue_t *queue )
+{
+    if( queue->eq_event != -1 )
+        close( queue->eq_event );
+
+    free( queue );
+}
+
+void enqueue( echo_queue_t *queue, echo_queue_node_t *node )
+{
+    echo_queue_node_t *prev;
+
+    atomic_store_explicit( &node->eqn_next, NULL, memory_order_relaxed );
+    prev = atomic_exchange_explicit( &queue->eq_head, node,
+            memory_order_acq_rel );
+    atomic_store( &prev->eqn_next, node );
+}
+
+echo_queue_node_t *take( echo_queue_t *queue )
+{
+    echo_queue_node_t *tail, *next;
+
+    tail = queue->eq_tail;
+    next = atomic_load( &tail->eqn_next );
+
+    if( tail == &queue->eq_stub )
+    {
+        if( next == NULL )
+            return NULL;
+
+        queue->eq_tail = next;
+        tail = next;
+        next = atomic_load( &tail->eqn_next );
+    }
+
+    if( next != NULL )
+    {
+        queue->eq_tail = next;
+        return tail;
+    }
+
+    /* The last node is handed out only once the stub is queued behind it,
+     * unless a producer already swung the head and has yet to link. */
+    if( tail != atomic_load_explicit( &queue->eq_head, memory_order_acquire ) )
+        return NULL;
+
+    enqueue( queue, &queue->eq_stub );
+    next = atomic_load( &tail->eqn_next );
+
+    if( next == NULL )
+        return NULL;
+
+    queue->eq_tail = next;
+
+    return tail;
+}
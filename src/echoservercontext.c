@@ -1,8 +1,31 @@
 #include "echoservercontext.h"
+#include "echostats.h"
 #include <errno.h>
+#include <limits.h>
 
-static int context_cmp( const void *a, const void *b );
-static int uname_cmp( const void *a, const void *b );
+/* Index entry, remembers where its client sits in the bag so that
+ * removals do not scan it either. */
+struct index_entry
+{
+    echo_client_context_t *ie_client;
+    ssize_t ie_slot;
+    uint32_t ie_hash;
+    struct index_entry *ie_next;
+};
+
+/* Chained hash table, doubled whenever it holds one client per bucket */
+struct echo_server_index
+{
+    struct index_entry **si_buckets;
+    size_t si_nbuckets;
+    size_t si_count;
+};
+
+static uint32_t uname_hash( const char *uname );
+static uint32_t client_hash( const echo_client_context_t *client );
+static struct index_entry **index_lookup( echo_server_index_t *index,
+        const char *uname, uint32_t hash );
+static int index_grow( echo_server_index_t *index );
 
 void echo_server_context_strerror( int errnum, char *buf, size_t buflen )
 {
@@ -45,15 +68,57 @@ echo_server_context_t *echo_server_context_create( tcp_context_t *ctx,
         return NULL;
     }
 
+    if( ( server->esc_index = malloc( sizeof( echo_server_index_t ) ) ) ==
+            NULL || ( server->esc_index->si_buckets = calloc(
+                    ECHO_INDEX_BUCKETS, sizeof( struct index_entry* ) ) ) ==
+            NULL )
+    {
+        free( server->esc_index );
+        bag_array_destroy( server->esc_bag );
+        free( server );
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    server->esc_index->si_nbuckets = ECHO_INDEX_BUCKETS;
+    server->esc_index->si_count = 0;
+
     server->esc_tcp = ctx;
 
     return server;
 }
 
+int echo_server_context_reserve( echo_server_context_t *ctx,
+        size_t clients, int *err )
+{
+    if( ctx == NULL || clients > SSIZE_MAX )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( bag_array_reserve( ctx->esc_bag, clients, err ) == -1 )
+        return -1;
+
+    /* The index grows once it holds a client per bucket. */
+    while( ctx->esc_index->si_nbuckets <= clients )
+    {
+        if( index_grow( ctx->esc_index ) == -1 )
+        {
+            *err = ENOMEM;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 int echo_server_context_insert( echo_server_context_t *ctx,
         echo_client_context_t *client, int *err )
 {
-    ssize_t found;
+    echo_server_index_t *index;
+    struct index_entry **link, *entry;
+    uint32_t hash;
 
     if( ctx == NULL || client == NULL )
     {
@@ -61,23 +126,50 @@ int echo_server_context_insert( echo_server_context_t *ctx,
         return -1;
     }
 
-    found = 0;
-    found = bag_array_find_first( ctx->esc_bag, client, &found, uname_cmp,
-            err );
+    index = ctx->esc_index;
+    hash = client_hash( client );
 
-    if( found != -1 )
+    if( *index_lookup( index, client->eec_uname, hash ) != NULL )
     {
         *err = EDUPLICATE;
         return -1;
     }
 
-    return bag_array_insert( ctx->esc_bag, client, err );
+    if( index->si_count >= index->si_nbuckets && index_grow( index ) == -1 )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    if( ( entry = malloc( sizeof( struct index_entry ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return -1;
+    }
+
+    if( bag_array_insert( ctx->esc_bag, client, err ) == -1 )
+    {
+        free( entry );
+        return -1;
+    }
+
+    link = &index->si_buckets[ hash & ( index->si_nbuckets - 1 ) ];
+    entry->ie_client = client;
+    entry->ie_slot = ctx->esc_bag->b_size - 1;
+    entry->ie_hash = hash;
+    entry->ie_next = *link;
+    *link = entry;
+    index->si_count++;
+
+    return 0;
 }
 
 tcp_context_t *echo_server_context_remove( echo_server_context_t *ctx,
         echo_client_context_t *client, int *err )
 {
-    ssize_t found;
+    struct index_entry **link, *entry, *moved;
+    echo_client_context_t *last;
+    void *removed;
 
     if( ctx == NULL || client == NULL )
     {
@@ -85,58 +177,286 @@ tcp_context_t *echo_server_context_remove( echo_server_context_t *ctx,
         return NULL;
     }
 
-    found = 0;
-    found = bag_array_find_first( ctx->esc_bag, client, &found, context_cmp,
-           err );
+    link = index_lookup( ctx->esc_index, client->eec_uname,
+            client_hash( client ) );
+
+    if( ( entry = *link ) == NULL || entry->ie_client != client )
+    {
+        *err = ENOTFOUND;
+        return NULL;
+    }
+
+    /* The bag fills the hole with its last client, whose entry follows. */
+    last = ctx->esc_bag->b_array[ ctx->esc_bag->b_size - 1 ];
+
+    if( ( removed = bag_array_remove( ctx->esc_bag, entry->ie_slot,
+                    err ) ) == NULL )
+        return NULL;
+
+    if( last != client )
+    {
+        moved = *index_lookup( ctx->esc_index, last->eec_uname,
+                client_hash( last ) );
+        moved->ie_slot = entry->ie_slot;
+    }
+
+    *link = entry->ie_next;
+    ctx->esc_index->si_count--;
+    free( entry );
+
+    return removed;
+}
+
+echo_client_context_t *echo_server_context_find( echo_server_context_t *ctx,
+        const char *uname, int *err )
+{
+    struct index_entry *entry;
+
+    if( ctx == NULL || uname == NULL )
+    {
+        *err = EINVAL;
+        return NULL;
+    }
 
-    if( found == -1 )
+    if( ( entry = *index_lookup( ctx->esc_index, uname,
+                    uname_hash( uname ) ) ) == NULL )
     {
+        *err = ENOTFOUND;
         return NULL;
     }
 
-    return bag_array_remove( ctx->esc_bag, found, err );
+    return entry->ie_client;
+}
+
+int echo_server_context_sendto( echo_server_context_t *ctx,
+        const char *uname, const char *buffer, size_t size, int *err )
+{
+    echo_client_context_t *client;
+
+    if( buffer == NULL || size == 0 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( client = echo_server_context_find( ctx, uname, err ) ) == NULL )
+        return -1;
+
+    if( echo_client_context_send( client, ECHO_FRAME_TEXT, buffer, size,
+                err ) == -1 )
+        return -1;
+
+    return 0;
 }
 
 int echo_server_context_sendall( echo_server_context_t *ctx,
         const char *buffer, size_t size, int *err )
+{
+    struct iovec part;
+
+    if( buffer == NULL )
+        return 0;
+
+    part.iov_base = ( void* )buffer;
+    part.iov_len = size;
+
+    return echo_server_context_sendallv( ctx, ECHO_FRAME_TEXT, &part, 1,
+            err );
+}
+
+/* Plain recipients get the parts as they are, only the compressed block
+ * needs them in one piece. */
+int echo_server_context_sendallv( echo_server_context_t *ctx, int type,
+        const struct iovec *parts, int count, int *err )
 {
     echo_client_context_t *client;
-    size_t i;
+    char *block;
+    ssize_t i, packed, sent;
+    size_t size;
+    int retval, tmp;
+
+    if( ctx == NULL || parts == NULL ||
+            ( size = echo_frame_length( parts, count ) ) == 0 )
+        return 0;
 
-    if( ctx != NULL && buffer != NULL && size > 0 )
+    if( size > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    block = NULL;
+    packed = -1;
+
+    /* Compress the message once as a standalone block and share it among
+     * every recipient that negotiated compression. */
+    if( size >= ECHO_COMPRESS_MIN && echo_compress_available( ) )
     {
         for( i = 0; i < ctx->esc_bag->b_size; i++ )
         {
-            client = bag_array_get( ctx->esc_bag, i, err );
+            client = ctx->esc_bag->b_array[ i ];
+
+            if( client->eec_features & ECHO_FEATURE_DEFLATE )
+                break;
+        }
+
+        if( i < ctx->esc_bag->b_size &&
+                ( block = malloc( ECHO_FRAME_MAX + size ) ) != NULL )
+        {
+            echo_frame_gather( block + ECHO_FRAME_MAX, parts, count );
+            packed = echo_compress_block_deflate( block + ECHO_FRAME_MAX,
+                    size, block, size, err );
+        }
+    }
 
-            if( client == NULL )
-                return -1;
+    retval = 0;
 
-            if( tcp_context_send( client->eec_tcp, buffer, size,
-                        err ) == -1 )
-                return -1;
+    /* A member whose connection failed does not keep the line from those
+     * after it, the first error is the one told. */
+    for( i = 0; i < ctx->esc_bag->b_size; i++ )
+    {
+        client = bag_array_get( ctx->esc_bag, i, &tmp );
+
+        if( client == NULL )
+        {
+            sent = -1;
+        }
+        else if( packed > 0 &&
+                ( client->eec_features & ECHO_FEATURE_DEFLATE ) )
+        {
+            echo_stats_add( ECHO_STAT_SHARED_BLOCKS, 1 );
+            sent = echo_frame_send( client->eec_tcp, type,
+                    ECHO_FRAME_DEFLATE_BLOCK, block, packed, &tmp );
+        }
+        else
+        {
+            sent = echo_frame_sendv( client->eec_tcp, type, 0, parts, count,
+                    &tmp );
+        }
+
+        if( sent == -1 && retval == 0 )
+        {
+            *err = tmp;
+            retval = -1;
         }
     }
+
+    free( block );
+
+    return retval;
+}
+
+int echo_server_context_sendfile( echo_server_context_t *ctx, int type,
+        const struct iovec *parts, int count, int fd, off_t offset,
+        size_t size, int *err )
+{
+    echo_client_context_t *client;
+    ssize_t i;
+
+    if( ctx == NULL )
+        return 0;
+
+    if( echo_frame_length( parts, count ) + size > ECHO_FRAME_MAX )
+    {
+        *err = EMSGSIZE;
+        return -1;
+    }
+
+    for( i = 0; i < ctx->esc_bag->b_size; i++ )
+    {
+        if( ( client = bag_array_get( ctx->esc_bag, i, err ) ) == NULL ||
+                echo_frame_sendfile( client->eec_tcp, type, parts, count, fd,
+                    offset, size, err ) == -1 )
+            return -1;
+    }
+
+    return 0;
 }
 
 void echo_server_context_destroy( echo_server_context_t *ctx )
 {
+    struct index_entry *entry;
+    size_t i;
+
+    for( i = 0; i < ctx->esc_index->si_nbuckets; i++ )
+    {
+        while( ( entry = ctx->esc_index->si_buckets[ i ] ) != NULL )
+        {
+            ctx->esc_index->si_buckets[ i ] = entry->ie_next;
+            free( entry );
+        }
+    }
+
+    free( ctx->esc_index->si_buckets );
+    free( ctx->esc_index );
     tcp_context_destroy( ctx->esc_tcp );
     bag_array_destroy( ctx->esc_bag );
     free( ctx );
 }
 
-int context_cmp( const void *a, const void *b )
+/* FNV-1a */
+uint32_t uname_hash( const char *uname )
+{
+    uint32_t hash;
+
+    for( hash = 2166136261u; *uname != '\0'; uname++ )
+    {
+        hash = ( hash ^ ( unsigned char )*uname ) * 16777619u;
+    }
+
+    return hash;
+}
+
+/* Interned names come with the same hash already computed. */
+uint32_t client_hash( const echo_client_context_t *client )
 {
-    return !( a == b );
+    if( client->eec_name != NULL )
+        return client->eec_name->en_hash;
+
+    return uname_hash( client->eec_uname );
 }
 
-int uname_cmp( const void *a, const void *b )
+/* Returns the link pointing at the entry of uname, or at the NULL ending
+ * its chain when there is none. */
+struct index_entry **index_lookup( echo_server_index_t *index,
+        const char *uname, uint32_t hash )
 {
-    echo_client_context_t *eec1, *eec2;
+    struct index_entry **link;
+
+    link = &index->si_buckets[ hash & ( index->si_nbuckets - 1 ) ];
+
+    while( *link != NULL && ( ( *link )->ie_hash != hash ||
+                strcmp( ( *link )->ie_client->eec_uname, uname ) != 0 ) )
+    {
+        link = &( *link )->ie_next;
+    }
+
+    return link;
+}
+
+int index_grow( echo_server_index_t *index )
+{
+    struct index_entry **buckets, *entry;
+    size_t i, size;
+
+    size = index->si_nbuckets * 2;
+
+    if( ( buckets = calloc( size, sizeof( struct index_entry* ) ) ) == NULL )
+        return -1;
+
+    for( i = 0; i < index->si_nbuckets; i++ )
+    {
+        while( ( entry = index->si_buckets[ i ] ) != NULL )
+        {
+            index->si_buckets[ i ] = entry->ie_next;
+            entry->ie_next = buckets[ entry->ie_hash & ( size - 1 ) ];
+            buckets[ entry->ie_hash & ( size - 1 ) ] = entry;
+        }
+    }
 
-    eec1 = ( echo_client_context_t* )a;
-    eec2 = ( echo_client_context_t* )b;
+    free( index->si_buckets );
+    index->si_buckets = buckets;
+    index->si_nbuckets = size;
 
-    return strcmp( eec1->eec_uname, eec2->eec_uname );
+    return 0;
 }
@@ -0,0 +1,172 @@
+#include "echostats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Counters owned by one thread at a time. Only the owner writes them, so
+ * an update is a plain load and store; readers sum every block. Blocks
+ * are never freed, a block released by an exiting thread keeps its counts
+ * and is adopted by the next thread that needs one. */
+struct stats_block
+{
+    atomic_ullong sb_counters[ ECHO_STAT_MAX ];
+    atomic_int sb_owned;
+    struct stats_block *sb_next;
+};
+
+static _Atomic( struct stats_block* ) g_blocks;
+static atomic_ullong g_fallback[ ECHO_STAT_MAX ];
+static pthread_key_t g_key;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static _Thread_local struct stats_block *t_block;
+
+static const char *g_names[ ECHO_STAT_MAX ] =
+{
+    "deflate_in",
+    "deflate_out",
+    "inflate_in",
+    "inflate_out",
+    "shared_blocks",
+    "err_eagain",
+    "err_eintr",
+    "err_econnreset",
+    "err_other",
+    "relay_out",
+    "relay_in",
+    "relay_dup",
+    "peer_writes",
+    "presence_local",
+    "presence_claims",
+    "presence_revoked",
+    "direct_sent",
+    "direct_offline",
+    "accepts",
+    "accept_batches",
+    "accept_shed"
+};
+
+static struct stats_block *local_block( void );
+static void release_block( void *arg );
+static void make_key( void );
+static double ratio( echo_stat_t raw, echo_stat_t packed );
+
+void echo_stats_add( echo_stat_t stat, unsigned long long value )
+{
+    struct stats_block *block;
+    atomic_ullong *counter;
+
+    if( ( block = local_block( ) ) == NULL )
+    {
+        atomic_fetch_add_explicit( &g_fallback[ stat ], value,
+                memory_order_relaxed );
+        return;
+    }
+
+    counter = &block->sb_counters[ stat ];
+    atomic_store_explicit( counter, atomic_load_explicit( counter,
+                memory_order_relaxed ) + value, memory_order_relaxed );
+}
+
+unsigned long long echo_stats_get( echo_stat_t stat )
+{
+    struct stats_block *block;
+    unsigned long long total;
+
+    total = atomic_load_explicit( &g_fallback[ stat ],
+            memory_order_relaxed );
+    block = atomic_load_explicit( &g_blocks, memory_order_acquire );
+
+    while( block != NULL )
+    {
+        total += atomic_load_explicit( &block->sb_counters[ stat ],
+                memory_order_relaxed );
+        block = block->sb_next;
+    }
+
+    return total;
+}
+
+void echo_stats_dump( FILE *stream )
+{
+    int i;
+
+    for( i = 0; i < ECHO_STAT_MAX; i++ )
+    {
+        fprintf( stream, "%s=%llu\n", g_names[ i ],
+                echo_stats_get( i ) );
+    }
+
+    fprintf( stream, "deflate_ratio=%.2f\n",
+            ratio( ECHO_STAT_DEFLATE_IN, ECHO_STAT_DEFLATE_OUT ) );
+    fprintf( stream, "inflate_ratio=%.2f\n",
+            ratio( ECHO_STAT_INFLATE_OUT, ECHO_STAT_INFLATE_IN ) );
+    fprintf( stream, "relay_batching=%.2f\n",
+            ratio( ECHO_STAT_RELAY_OUT, ECHO_STAT_PEER_WRITES ) );
+    fprintf( stream, "accept_batching=%.2f\n",
+            ratio( ECHO_STAT_ACCEPTS, ECHO_STAT_ACCEPT_BATCHES ) );
+    fflush( stream );
+}
+
+struct stats_block *local_block( void )
+{
+    struct stats_block *block;
+    int expected;
+
+    if( t_block != NULL )
+        return t_block;
+
+    pthread_once( &g_once, make_key );
+    block = atomic_load_explicit( &g_blocks, memory_order_acquire );
+
+    while( block != NULL )
+    {
+        expected = 0;
+
+        if( atomic_compare_exchange_strong( &block->sb_owned, &expected,
+                    1 ) )
+            break;
+
+        block = block->sb_next;
+    }
+
+    if( block == NULL )
+    {
+        if( ( block = calloc( 1, sizeof( struct stats_block ) ) ) == NULL )
+            return NULL;
+
+        atomic_store( &block->sb_owned, 1 );
+        block->sb_next = atomic_load( &g_blocks );
+
+        while( !atomic_compare_exchange_weak( &g_blocks, &block->sb_next,
+                    block ) );
+    }
+
+    t_block = block;
+    pthread_setspecific( g_key, block );
+
+    return block;
+}
+
+void release_block( void *arg )
+{
+    struct stats_block *block;
+
+    block = ( struct stats_block* )arg;
+    atomic_store( &block->sb_owned, 0 );
+}
+
+void make_key( void )
+{
+    pthread_key_create( &g_key, release_block );
+}
+
+double ratio( echo_stat_t raw, echo_stat_t packed )
+{
+    unsigned long long r, p;
+
+    r = echo_stats_get( raw );
+    p = echo_stats_get( packed );
+
+    return p == 0 ? 0.0 : ( double )r / ( double )p;
+}
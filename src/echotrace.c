@@ -0,0 +1,309 @@
+#include "echotrace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#define PREAMBLE    12
+
+/* Rings are never freed: a thread that exits gives its ring back and the
+ * next thread without one takes it, so there are only ever as many as
+ * threads ran at once, and a dump still shows what the gone ones did. */
+struct ring
+{
+    struct ring *r_next;
+    atomic_int r_taken;
+    uint32_t r_thread;
+    atomic_ullong r_head;       /* Entries ever recorded */
+    echo_trace_entry_t r_entries[ ECHO_TRACE_RING ];
+};
+
+static const char *g_names[ ECHO_TRACE_MAX ] =
+{
+    NULL, "ACCEPT", "HANDSHAKE", "RECV", "ENQUEUE", "FLUSH", "DISCONNECT"
+};
+static const char *g_args[ ECHO_TRACE_MAX ][ 3 ] =
+{
+    { NULL, NULL, NULL },
+    { "fd", "batch", NULL },
+    { "fd", "type", "flags" },
+    { "connection", "type", "length" },
+    { "type", "lane", "bytes" },
+    { "type", "lane", "bytes" },
+    { "connection", "fd", NULL }
+};
+static struct ring *_Atomic g_rings;
+static atomic_size_t g_count;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_key;
+static char g_path[ PATH_MAX ];
+static __thread struct ring *t_ring;
+
+static struct ring *take( void );
+static void make_key( void );
+static void give_back( void *arg );
+static void on_signal( int signum );
+static int write_all( int fd, const void *buffer, size_t size );
+
+/* Not inlined, so that a uprobe can be placed on it */
+__attribute__(( noinline )) void echo_trace_record( echo_trace_event_t event,
+        uint32_t a, uint32_t b, uint32_t c )
+{
+    echo_trace_entry_t *entry;
+    struct ring *ring;
+    unsigned long long head;
+    struct timespec ts;
+
+    if( ( ring = t_ring ) == NULL && ( ring = take( ) ) == NULL )
+        return;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    head = atomic_load_explicit( &ring->r_head, memory_order_relaxed );
+    entry = &ring->r_entries[ head & ( ECHO_TRACE_RING - 1 ) ];
+    entry->ete_time = ( uint64_t )ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    entry->ete_thread = ring->r_thread;
+    entry->ete_event = event;
+    entry->ete_reserved = 0;
+    entry->ete_args[ 0 ] = a;
+    entry->ete_args[ 1 ] = b;
+    entry->ete_args[ 2 ] = c;
+    entry->ete_padding = 0;
+    atomic_store_explicit( &ring->r_head, head + 1, memory_order_release );
+}
+
+size_t echo_trace_rings( void )
+{
+    return atomic_load( &g_count );
+}
+
+int echo_trace_dump( const char *path, int *err )
+{
+    unsigned char preamble[ PREAMBLE ];
+    unsigned long long head, first, end;
+    struct ring *ring;
+    uint32_t value;
+    int fd;
+
+    if( ( fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) == -1 )
+    {
+        *err = errno;
+        return -1;
+    }
+
+    memcpy( preamble, "ETRC", 4 );
+    value = ECHO_TRACE_VERSION;
+    memcpy( preamble + 4, &value, sizeof( value ) );
+    value = sizeof( echo_trace_entry_t );
+    memcpy( preamble + 8, &value, sizeof( value ) );
+
+    if( write_all( fd, preamble, sizeof( preamble ) ) == -1 )
+    {
+        *err = errno;
+        close( fd );
+        return -1;
+    }
+
+    for( ring = atomic_load( &g_rings ); ring != NULL; ring = ring->r_next )
+    {
+        head = atomic_load_explicit( &ring->r_head, memory_order_acquire );
+        first = head > ECHO_TRACE_RING ? head - ECHO_TRACE_RING : 0;
+
+        /* At most two pieces, up to the end of the array and from its
+         * start. */
+        while( first < head )
+        {
+            end = ( first | ( ECHO_TRACE_RING - 1 ) ) + 1;
+            end = end < head ? end : head;
+
+            if( write_all( fd, &ring->r_entries[ first &
+                        ( ECHO_TRACE_RING - 1 ) ], ( end - first ) *
+                        sizeof( echo_trace_entry_t ) ) == -1 )
+            {
+                *err = errno;
+                close( fd );
+                return -1;
+            }
+
+            first = end;
+        }
+    }
+
+    close( fd );
+
+    return 0;
+}
+
+int echo_trace_install( int signum, const char *path, int *err )
+{
+    struct sigaction action;
+
+    if( strlen( path ) >= sizeof( g_path ) )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    strcpy( g_path, path );
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+
+    if( sigaction( signum, &action, NULL ) == -1 )
+    {
+        *err = errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+long echo_trace_export( FILE *in, FILE *out, int *err )
+{
+    unsigned char preamble[ PREAMBLE ];
+    echo_trace_entry_t entry;
+    uint32_t version, size;
+    size_t bytes;
+    long count;
+    int i;
+
+    if( fread( preamble, 1, sizeof( preamble ), in ) != sizeof( preamble ) ||
+            memcmp( preamble, "ETRC", 4 ) != 0 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    memcpy( &version, preamble + 4, sizeof( version ) );
+    memcpy( &size, preamble + 8, sizeof( size ) );
+
+    if( version != ECHO_TRACE_VERSION || size != sizeof( entry ) )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    fprintf( out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" );
+
+    for( count = 0; ( bytes = fread( &entry, 1, sizeof( entry ),
+                    in ) ) == sizeof( entry ); )
+    {
+        /* Left mixed by a dump taken while it was written */
+        if( entry.ete_event == 0 || entry.ete_event >= ECHO_TRACE_MAX )
+            continue;
+
+        fprintf( out, "%s\n{\"name\":\"%s\",\"cat\":\"echo\",\"ph\":\"i\","
+                "\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{",
+                count > 0 ? "," : "", g_names[ entry.ete_event ],
+                entry.ete_time / 1000.0, ( unsigned int )entry.ete_thread );
+
+        for( i = 0; i < 3 && g_args[ entry.ete_event ][ i ] != NULL; i++ )
+        {
+            fprintf( out, "%s\"%s\":%u", i > 0 ? "," : "",
+                    g_args[ entry.ete_event ][ i ],
+                    ( unsigned int )entry.ete_args[ i ] );
+        }
+
+        fprintf( out, "}}" );
+        count++;
+    }
+
+    fprintf( out, "\n]}\n" );
+
+    if( bytes != 0 )
+    {
+        *err = EIO;
+        return -1;
+    }
+
+    return count;
+}
+
+/* A ring given back is taken with a compare and swap, a new one is pushed
+ * on the list the same way. Out of memory the entry is lost. */
+struct ring *take( void )
+{
+    struct ring *ring;
+    int expected;
+
+    pthread_once( &g_once, make_key );
+
+    for( ring = atomic_load( &g_rings ); ring != NULL; ring = ring->r_next )
+    {
+        expected = 0;
+
+        if( atomic_compare_exchange_strong( &ring->r_taken, &expected, 1 ) )
+            break;
+    }
+
+    if( ring == NULL )
+    {
+        if( ( ring = calloc( 1, sizeof( struct ring ) ) ) == NULL )
+            return NULL;
+
+        atomic_init( &ring->r_taken, 1 );
+        atomic_init( &ring->r_head, 0 );
+        ring->r_next = atomic_load( &g_rings );
+
+        while( !atomic_compare_exchange_weak( &g_rings, &ring->r_next,
+                    ring ) )
+            ;
+
+        atomic_fetch_add( &g_count, 1 );
+    }
+
+    ring->r_thread = syscall( SYS_gettid );
+    pthread_setspecific( g_key, ring );
+    t_ring = ring;
+
+    return ring;
+}
+
+void make_key( void )
+{
+    pthread_key_create( &g_key, give_back );
+}
+
+void give_back( void *arg )
+{
+    atomic_store( &( ( struct ring* )arg )->r_taken, 0 );
+}
+
+void on_signal( int signum )
+{
+    int saved, err;
+
+    ( void )signum;
+    saved = errno;
+    echo_trace_dump( g_path, &err );
+    errno = saved;
+}
+
+int write_all( int fd, const void *buffer, size_t size )
+{
+    const char *bytes;
+    ssize_t written;
+
+    for( bytes = buffer; size > 0; bytes += written, size -= written )
+    {
+        if( ( written = write( fd, bytes, size ) ) == -1 )
+        {
+            if( errno == EINTR )
+            {
+                written = 0;
+                continue;
+            }
+
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+#include "echotransfer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define COPY_SIZE   4096
+
+static int open_spool( const char *dir );
+static int copy( echo_transfer_t *transfer, int socket, size_t size,
+        int *err );
+
+echo_transfer_t *echo_transfer_create( const char *dir, uint32_t id,
+        int *err )
+{
+    echo_transfer_t *transfer;
+
+    if( ( transfer = malloc( sizeof( echo_transfer_t ) ) ) == NULL )
+    {
+        *err = ENOMEM;
+        return NULL;
+    }
+
+    if( ( transfer->et_spool = open_spool( dir ) ) == -1 )
+    {
+        *err = errno;
+        free( transfer );
+        return NULL;
+    }
+
+    if( pipe2( transfer->et_pipe, O_CLOEXEC ) == -1 )
+    {
+        *err = errno;
+        close( transfer->et_spool );
+        free( transfer );
+        return NULL;
+    }
+
+    atomic_init( &transfer->et_refs, 1 );
+    transfer->et_id = id;
+    transfer->et_length = 0;
+
+    return transfer;
+}
+
+/* Socket to pipe to file, the data never leaves the kernel. Sockets that
+ * cannot be spliced from are copied through a small buffer. */
+off_t echo_transfer_spool( echo_transfer_t *transfer, int socket,
+        size_t size, int *err )
+{
+    ssize_t moved, bytes, written;
+    off_t offset, out;
+    size_t total;
+
+    offset = out = transfer->et_length;
+
+    for( total = 0; total < size; total += moved )
+    {
+        moved = splice( socket, NULL, transfer->et_pipe[ 1 ], NULL,
+                size - total, SPLICE_F_MOVE );
+
+        if( moved == -1 && errno == EINTR )
+        {
+            moved = 0;
+            continue;
+        }
+
+        if( moved == -1 && errno == EINVAL && total == 0 )
+        {
+            if( copy( transfer, socket, size, err ) == -1 )
+                return -1;
+
+            return offset;
+        }
+
+        if( moved == -1 )
+        {
+            *err = errno;
+            return -1;
+        }
+
+        if( moved == 0 )
+        {
+            *err = ECONNRESET;
+            return -1;
+        }
+
+        for( bytes = moved; bytes > 0; )
+        {
+            if( ( written = splice( transfer->et_pipe[ 0 ], NULL,
+                            transfer->et_spool, &out, bytes,
+                            SPLICE_F_MOVE ) ) == -1 )
+            {
+                if( errno == EINTR )
+                    continue;
+
+                *err = errno;
+                return -1;
+            }
+
+            bytes -= written;
+        }
+    }
+
+    transfer->et_length = out;
+
+    return offset;
+}
+
+off_t echo_transfer_write( echo_transfer_t *transfer, const char *data,
+        size_t size, int *err )
+{
+    ssize_t written;
+    off_t offset;
+    size_t total;
+
+    offset = transfer->et_length;
+
+    for( total = 0; total < size; total += written )
+    {
+        if( ( written = pwrite( transfer->et_spool, data + total,
+                        size - total, offset + total ) ) == -1 )
+        {
+            if( errno == EINTR )
+            {
+                written = 0;
+                continue;
+            }
+
+            *err = errno;
+            return -1;
+        }
+    }
+
+    transfer->et_length = offset + size;
+
+    return offset;
+}
+
+int echo_transfer_read( echo_transfer_t *transfer, off_t offset,
+        char *buffer, size_t size, int *err )
+{
+    ssize_t bytes;
+    size_t total;
+
+    for( total = 0; total < size; total += bytes )
+    {
+        if( ( bytes = pread( transfer->et_spool, buffer + total,
+                        size - total, offset + total ) ) == -1 )
+        {
+            if( errno == EINTR )
+            {
+                bytes = 0;
+                continue;
+            }
+
+            *err = errno;
+            return -1;
+        }
+
+        if( bytes == 0 )
+        {
+            *err = EIO;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Best effort, file systems without holes keep the data until the end. */
+void echo_transfer_discard( echo_transfer_t *transfer, off_t offset,
+        size_t size )
+{
+    fallocate( transfer->et_spool, FALLOC_FL_PUNCH_HOLE |
+            FALLOC_FL_KEEP_SIZE, offset, size );
+}
+
+echo_transfer_t *echo_transfer_hold( echo_transfer_t *transfer )
+{
+    atomic_fetch_add( &transfer->et_refs, 1 );
+
+    return transfer;
+}
+
+void echo_transfer_put( echo_transfer_t *transfer )
+{
+    if( transfer == NULL || atomic_fetch_sub( &transfer->et_refs, 1 ) > 1 )
+        return;
+
+    close( transfer->et_pipe[ 0 ] );
+    close( transfer->et_pipe[ 1 ] );
+    close( transfer->et_spool );
+    free( transfer );
+}
+
+/* Without O_TMPFILE the file is named for the time it takes to unlink it. */
+int open_spool( const char *dir )
+{
+    char path[ 4096 ];
+    int fd;
+
+    if( ( fd = open( dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600 ) ) != -1 )
+        return fd;
+
+    if( snprintf( path, sizeof( path ), "%s/echo-spool-XXXXXX",
+                dir ) >= ( int )sizeof( path ) )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if( ( fd = mkostemp( path, O_CLOEXEC ) ) != -1 )
+        unlink( path );
+
+    return fd;
+}
+
+int copy( echo_transfer_t *transfer, int socket, size_t size, int *err )
+{
+    char buffer[ COPY_SIZE ];
+    ssize_t bytes, written, n;
+    size_t total, chunk;
+    off_t out;
+
+    out = transfer->et_length;
+
+    for( total = 0; total < size; total += bytes )
+    {
+        chunk = size - total < COPY_SIZE ? size - total : COPY_SIZE;
+
+        if( ( bytes = read( socket, buffer, chunk ) ) == -1 )
+        {
+            if( errno == EINTR )
+            {
+                bytes = 0;
+                continue;
+            }
+
+            *err = errno;
+            return -1;
+        }
+
+        if( bytes == 0 )
+        {
+            *err = ECONNRESET;
+            return -1;
+        }
+
+        for( written = 0; written < bytes; )
+        {
+            if( ( n = pwrite( transfer->et_spool, buffer + written,
+                            bytes - written, out ) ) == -1 )
+            {
+                if( errno == EINTR )
+                    continue;
+
+                *err = errno;
+                return -1;
+            }
+
+            written += n;
+            out += n;
+        }
+    }
+
+    transfer->et_length = out;
+
+    return 0;
+}
@@ -0,0 +1,298 @@
+#include "echoframe.h"
+#include "echocapture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#define FILENAME    0
+#define HOSTNAME    1
+#define PORT        2
+
+#define DRAIN_SIZE  65536
+
+/* Plays a capture back against a server, each recorded connection over a
+ * connection of its own. What the server sends back is read and dropped so
+ * that it never blocks on a replayed member. */
+struct replay
+{
+    tcp_context_t **r_links;    /* by connection ID, NULL when closed */
+    size_t r_size;
+    struct pollfd *r_fds;
+    const char *r_host;
+    int r_port;
+    unsigned long long r_frames;
+    unsigned long long r_bytes;
+};
+
+static int play( struct replay *replay, const echo_capture_record_t *record,
+        const char *payload, int *err );
+static tcp_context_t **link_of( struct replay *replay, uint32_t connection,
+        int *err );
+static void drain( struct replay *replay, int timeout );
+static unsigned long long now( void );
+
+int main( int argc, char *argv[ ] )
+{
+    static const struct option options[ ] =
+    {
+        { "max", no_argument, NULL, 'm' },
+        { NULL, 0, NULL, 0 }
+    };
+    static char payload[ ECHO_FRAME_MAX ];
+    echo_capture_record_t record;
+    unsigned long long start, elapsed;
+    struct replay replay;
+    FILE *file;
+    int opt, max, status, err;
+    char **args;
+    size_t i;
+
+    max = 0;
+
+    while( ( opt = getopt_long( argc, argv, "m", options, NULL ) ) != -1 )
+    {
+        if( opt == 'm' )
+        {
+            max = 1;
+        }
+        else
+        {
+            optind = argc;
+            break;
+        }
+    }
+
+    if( argc - optind != 3 )
+    {
+        fprintf( stderr, "USAGE: %s [--max] FILE HOSTNAME PORT\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    args = argv + optind;
+
+    if( ( file = echo_capture_open( args[ FILENAME ], &err ) ) == NULL )
+    {
+        fprintf( stderr, "echo_capture_open: %s: %s.\n", args[ FILENAME ],
+                strerror( err ) );
+        return EXIT_FAILURE;
+    }
+
+    memset( &replay, 0, sizeof( replay ) );
+    replay.r_host = args[ HOSTNAME ];
+    replay.r_port = atoi( args[ PORT ] );
+    status = EXIT_SUCCESS;
+    start = now( );
+
+    while( ( opt = echo_capture_read( file, &record, payload,
+                    sizeof( payload ), &err ) ) == 1 )
+    {
+        /* At 1x the wait for the next record is spent reading replies. */
+        elapsed = now( ) - start;
+
+        if( !max && record.ecr_time > elapsed )
+            drain( &replay, ( record.ecr_time - elapsed ) / 1000000 );
+        else
+            drain( &replay, 0 );
+
+        if( record.ecr_flags & ECHO_CAPTURE_ELIDED )
+        {
+            if( record.ecr_length > sizeof( payload ) )
+            {
+                opt = -1;
+                err = EMSGSIZE;
+                break;
+            }
+
+            memset( payload, 0, record.ecr_length );
+        }
+
+        if( play( &replay, &record, payload, &err ) == -1 )
+        {
+            char buf[ 256 ];
+            tcp_context_strerror( err, buf, 256 );
+            fprintf( stderr, "connection %u: %s.\n",
+                    ( unsigned int )record.ecr_connection, buf );
+            status = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    if( opt == -1 )
+    {
+        fprintf( stderr, "echo_capture_read: %s.\n", strerror( err ) );
+        status = EXIT_FAILURE;
+    }
+
+    drain( &replay, 0 );
+    elapsed = now( ) - start;
+
+    for( i = 0; i < replay.r_size; i++ )
+    {
+        if( replay.r_links[ i ] != NULL )
+            tcp_context_destroy( replay.r_links[ i ] );
+    }
+
+    free( replay.r_links );
+    free( replay.r_fds );
+    fclose( file );
+
+    printf( "%llu frames, %llu bytes in %.3f seconds\n", replay.r_frames,
+            replay.r_bytes, elapsed / 1e9 );
+
+    return status;
+}
+
+/* The handshake asks for the features the connection had but compression,
+ * payloads were captured decoded and go out as they are. A frame for a
+ * connection the server has closed is skipped. */
+int play( struct replay *replay, const echo_capture_record_t *record,
+        const char *payload, int *err )
+{
+    tcp_context_t **link;
+
+    if( ( link = link_of( replay, record->ecr_connection, err ) ) == NULL )
+        return -1;
+
+    if( *link != NULL && ( record->ecr_type == ECHO_CAPTURE_CLOSE ||
+                record->ecr_type == ECHO_FRAME_HELLO ) )
+    {
+        tcp_context_destroy( *link );
+        *link = NULL;
+    }
+
+    if( record->ecr_type == ECHO_CAPTURE_CLOSE )
+        return 0;
+
+    if( record->ecr_type == ECHO_FRAME_HELLO )
+    {
+
+        if( ( *link = tcp_context_create( err ) ) == NULL )
+            return -1;
+
+        if( tcp_context_connect( *link, replay->r_host, replay->r_port,
+                    err ) == -1 ||
+                echo_frame_send( *link, ECHO_FRAME_HELLO,
+                    record->ecr_flags & ~( ECHO_FEATURE_DEFLATE |
+                        ECHO_CAPTURE_ELIDED ), payload,
+                    record->ecr_length, err ) == -1 )
+        {
+            tcp_context_destroy( *link );
+            *link = NULL;
+            return -1;
+        }
+    }
+    else if( *link == NULL ||
+            echo_frame_send( *link, record->ecr_type, 0, payload,
+                record->ecr_length, err ) == -1 )
+    {
+        return 0;
+    }
+
+    replay->r_frames++;
+    replay->r_bytes += ECHO_FRAME_HEADER + record->ecr_length;
+
+    return 0;
+}
+
+/* Connection IDs are handed out in order from 1, the table grows to the
+ * highest one seen. */
+tcp_context_t **link_of( struct replay *replay, uint32_t connection,
+        int *err )
+{
+    tcp_context_t **links;
+    struct pollfd *fds;
+    size_t size;
+
+    if( connection >= replay->r_size )
+    {
+        size = replay->r_size > 0 ? replay->r_size : 64;
+
+        while( size <= connection )
+        {
+            size *= 2;
+        }
+
+        if( ( links = realloc( replay->r_links,
+                        size * sizeof( tcp_context_t* ) ) ) == NULL )
+        {
+            *err = ENOMEM;
+            return NULL;
+        }
+
+        replay->r_links = links;
+        memset( links + replay->r_size, 0,
+                ( size - replay->r_size ) * sizeof( tcp_context_t* ) );
+
+        if( ( fds = realloc( replay->r_fds,
+                        size * sizeof( struct pollfd ) ) ) == NULL )
+        {
+            *err = ENOMEM;
+            return NULL;
+        }
+
+        replay->r_fds = fds;
+        replay->r_size = size;
+    }
+
+    return &replay->r_links[ connection ];
+}
+
+/* Waits up to timeout milliseconds for replies and reads whatever came. A
+ * connection the server closed is closed here too. */
+void drain( struct replay *replay, int timeout )
+{
+    static char buffer[ DRAIN_SIZE ];
+    unsigned long long deadline, current;
+    ssize_t bytes;
+    size_t i;
+
+    deadline = now( ) + ( unsigned long long )timeout * 1000000;
+
+    do
+    {
+        for( i = 0; i < replay->r_size; i++ )
+        {
+            replay->r_fds[ i ].fd = replay->r_links[ i ] != NULL ?
+                replay->r_links[ i ]->tc_socket : -1;
+            replay->r_fds[ i ].events = POLLIN;
+            replay->r_fds[ i ].revents = 0;
+        }
+
+        current = now( );
+
+        if( poll( replay->r_fds, replay->r_size, deadline > current ?
+                    ( int )( ( deadline - current ) / 1000000 ) : 0 ) <= 0 )
+            continue;
+
+        for( i = 0; i < replay->r_size; i++ )
+        {
+            if( replay->r_fds[ i ].revents == 0 )
+                continue;
+
+            while( ( bytes = recv( replay->r_fds[ i ].fd, buffer,
+                            sizeof( buffer ), MSG_DONTWAIT ) ) > 0 )
+                ;
+
+            if( bytes == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) )
+            {
+                tcp_context_destroy( replay->r_links[ i ] );
+                replay->r_links[ i ] = NULL;
+            }
+        }
+    }
+    while( now( ) < deadline );
+}
+
+unsigned long long now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ( unsigned long long )ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
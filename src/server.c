@@ -1,33 +1,379 @@
 #include "echoservercontext.h"
+#include "echopeer.h"
+#include "echopresence.h"
+#include "echostats.h"
+#include "echoaffinity.h"
+#include "echoarena.h"
+#include "echoqueue.h"
+#include "echopipeline.h"
+#include "echolane.h"
+#include "echopool.h"
+#include "echointern.h"
+#include "echotransfer.h"
+#include "echocapture.h"
+#include "echotrace.h"
+#include "echoadmin.h"
+#include "echoconfig.h"
+#include <stddef.h>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <time.h>
+#include <getopt.h>
 #include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
 
-#define BACKLOG 1000
+#define BACKLOG     4096
+#define ACCEPT_BATCH 64
+#define ACCEPT_BACKOFF 10
+#define OUTBOX_BATCH 64
+#define MAX_PEERS   64
+#define BUFFER_SIZE ( ECHO_FRAME_TEXT_MAX + 1 )
+#define MESSAGE_PARTS 3
+#define TRACE_FILE  "server.trace"
+
+/* Levels of the lines written to the log while the server runs */
+enum
+{
+    LOG_ERROR,
+    LOG_INFO,
+    LOG_DEBUG
+};
 
 static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_idle = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t g_room_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_room = PTHREAD_COND_INITIALIZER;
+static size_t g_threads;
+static struct argument *g_pending;
+static echo_peer_set_t *g_peers;
+static echo_presence_t *g_presence;
+static echo_affinity_t *g_affinity;
+static echo_arena_t *g_arena;
+static echo_arena_t *g_readers;
+static size_t g_read_ahead;
+static size_t g_queue_limit;
+static atomic_ullong g_queue_waits;
+static atomic_ullong g_read_calls;
+static atomic_ullong g_read_frames;
+static atomic_int g_stopping;
+static echo_queue_t *g_outbox;
+static echo_pipeline_t *g_pipeline;
+static echo_pool_t *g_pool;
+static echo_intern_t *g_names;
+static const char *g_spool;
+static atomic_uint g_transfers;
+static echo_capture_t *g_capture;
+static atomic_uint g_connections;
+static struct message g_stop;
+static echo_lanes_t g_lanes;
+static echo_admin_t *g_admin;
+static atomic_uint g_rate;
+static atomic_int g_log_level = LOG_INFO;
+static int g_wake[ 2 ] = { -1, -1 };
+static const char *g_levels[ ] = { "error", "info", "debug" };
 static void *accept_thread( void *arg );
 static void *connex_thread( void *arg );
+static void *outbox_thread( void *arg );
+static echo_client_context_t *handshake( struct argument *args );
+static echo_client_context_t *login( echo_server_context_t *server,
+        tcp_context_t *ctx, const char *username, int features );
+static void track( struct argument *args );
+static void settle( struct argument *args );
+static void untrack( void );
+static void stop_connections( echo_server_context_t *server );
+static int spawn( pthread_t *thread, void *( *start )( void* ), void *arg,
+        int *cpu );
+static void announce( echo_server_context_t *server,
+        echo_client_context_t *client, const char *event, echo_lane_t lane );
+static void deliver( const char *text, size_t size, void *arg );
+static void post( echo_server_context_t *server, int type, echo_lane_t lane,
+        const struct iovec *parts, int count, int relay );
+static void compose( struct message *message, const echo_name_t *name,
+        size_t size );
+static void enqueue( struct message *message, echo_lane_t lane );
+static int take( echo_queue_node_t *node );
+static void flush( echo_server_context_t *server, int type, echo_lane_t lane,
+        const struct iovec *parts, int count, int relay );
+static void offer( echo_server_context_t *server,
+        echo_client_context_t *client, echo_transfer_t **transfer,
+        const char *name, size_t length );
+static int spool( echo_client_context_t *client, echo_transfer_t *transfer,
+        size_t size );
+static int drop( echo_client_context_t *client, char *buffer, size_t size );
+static void finish( echo_server_context_t *server,
+        echo_transfer_t **transfer, int status );
+static void relay_chunk( echo_server_context_t *server,
+        struct message *message );
+static void put_id( unsigned char *buffer, uint32_t id );
+static void capture( uint32_t connection, int type, int flags,
+        const char *payload, size_t length );
+static void handle( echo_task_t *task );
+static void write_to( echo_client_context_t *client, int type,
+        const char *text, size_t size );
+static void write_tov( echo_client_context_t *client, int type,
+        const struct iovec *parts, int count );
+static void direct( echo_server_context_t *server,
+        echo_client_context_t *client, const char *payload, size_t size );
+static void revoke_login( const char *uname, void *arg );
+static int cut_off( echo_server_context_t *server, const char *uname,
+        const char *notice );
+static void pace( double *due );
+static void hold_back( void );
+static const char *config_path( int argc, char *argv[ ] );
+static void say( int level, const char *format, ... );
+static int level_of( const char *name );
+static const char *command( int argc, char *argv[ ], FILE *out,
+        void *arg );
+static void list_sessions( FILE *out );
+static void report( FILE *out );
+static void wait_stop( void );
+static struct message *checkout( void );
+static void checkin( struct message *message );
+static char *borrow( void );
+static void give_back( char *buffer );
+static void serve( echo_server_context_t *server,
+        echo_client_context_t *client, struct message *message, int cpu );
+static int connect_peer( const char *peer, int *err );
 FILE *logfile;
 
+/* Text on its way to the members, queued by the connection and peer
+ * threads and routed by the outbox thread. A connection reads each frame
+ * straight into the payload of one, an arena chunk, and the line goes out
+ * as parts pointing at it: the payload itself is never copied. */
+struct message
+{
+    echo_queue_node_t m_node;
+    echo_lane_node_t m_lane;    /* Where it waits for the outbox */
+    echo_task_t m_task;         /* Handled on the pool in the order read */
+    echo_server_context_t *m_server;
+    echo_client_context_t *m_client;
+    int m_type;
+    size_t m_size;              /* Payload read, or file data relayed */
+    int m_frame;                /* Frame type sent to the members */
+    int m_relay;                /* Also sent to the other nodes */
+    echo_transfer_t *m_transfer;    /* File the data is relayed from */
+    off_t m_offset;
+    int m_count;
+    struct iovec m_parts[ MESSAGE_PARTS ];
+    char m_prefix[ MAX_LENGTH + 8 ];    /* "name says:\n", or a file ID */
+    char m_payload[ ];
+};
+
 struct argument
 {
     echo_server_context_t *a_server;
-    echo_client_context_t *a_client;
+    tcp_context_t *a_tcp;
+    int a_cpu;
+    struct argument *a_prev;    /* In g_pending until the first frame */
+    struct argument *a_next;
 };
 
 int main( int argc, char *argv[ ] )
 {
+    static const struct option options[ ] =
+    {
+        { "node-id", required_argument, NULL, 'n' },
+        { "peer", required_argument, NULL, 'p' },
+        { "cpus", required_argument, NULL, 'c' },
+        { "arena", required_argument, NULL, 'a' },
+        { "huge-pages", no_argument, NULL, 'H' },
+        { "profile", required_argument, NULL, 't' },
+        { "writers", required_argument, NULL, 'w' },
+        { "workers", required_argument, NULL, 'W' },
+        { "spool", required_argument, NULL, 's' },
+        { "capture", required_argument, NULL, 'C' },
+        { "read-ahead", required_argument, NULL, 'r' },
+        { "admin", required_argument, NULL, 'A' },
+        { "rate", required_argument, NULL, 'R' },
+        { "log-level", required_argument, NULL, 'l' },
+        { "config", required_argument, NULL, 'f' },
+        { "users", required_argument, NULL, 'u' },
+        { "queue-limit", required_argument, NULL, 'q' },
+        { NULL, 0, NULL, 0 }
+    };
+    const char *peers[ MAX_PEERS ], *cpus, *tuning, *capfile, *adminfile;
+    echo_config_t *config;
+    const char *path;
+    echo_lane_usage_t lanes[ ECHO_LANE_MAX ];
     echo_server_context_t *server;
+    struct message *message;
+    tcp_profile_t profile;
     tcp_context_t *ctx;
-    pthread_t thread;
-    size_t i;
-    int err;
+    pthread_t thread, outbox;
+    size_t i, npeers;
+    uint32_t node;
+    size_t chunks, writers, workers, users, peak, line;
+    int opt, cpu, huge, level, sized, err;
+
+    node = ( uint32_t )time( NULL ) ^ ( uint32_t )getpid( ) << 16;
+    npeers = 0;
+    cpus = NULL;
+    chunks = ECHO_ARENA_CHUNKS;
+    sized = 0;
+    huge = ECHO_ARENA_THP;
+    tuning = "latency";
+    writers = 0;
+    workers = 0;
+    g_spool = P_tmpdir;
+    capfile = NULL;
+    adminfile = NULL;
+    users = 0;
+    config = NULL;
+
+    /* The file's options go first, those given on the command line win.
+     * They are kept to the end, optarg points into them. */
+    if( ( path = config_path( argc, argv ) ) != NULL )
+    {
+        if( ( config = echo_config_load( path, argc, argv, &line,
+                        &err ) ) == NULL )
+        {
+            if( err == EINVAL )
+                fprintf( stderr, "echo_config_load: %s:%zu: not an "
+                        "option.\n", path, line );
+            else
+                fprintf( stderr, "echo_config_load: %s: %s.\n", path,
+                        strerror( err ) );
+
+            return EXIT_FAILURE;
+        }
+
+        argc = config->ec_argc;
+        argv = config->ec_argv;
+    }
+
+    while( ( opt = getopt_long( argc, argv,
+                    "n:p:c:a:Ht:w:W:s:C:r:A:R:l:f:u:q:", options,
+                    NULL ) ) != -1 )
+    {
+        if( opt == 'n' )
+        {
+            node = strtoul( optarg, NULL, 10 );
+        }
+        else if( opt == 'p' && npeers < MAX_PEERS )
+        {
+            peers[ npeers++ ] = optarg;
+        }
+        else if( opt == 'c' )
+        {
+            cpus = optarg;
+        }
+        else if( opt == 'a' )
+        {
+            chunks = strtoul( optarg, NULL, 10 );
+            sized = 1;
+        }
+        else if( opt == 'H' )
+        {
+            huge |= ECHO_ARENA_HUGETLB;
+        }
+        else if( opt == 't' )
+        {
+            tuning = optarg;
+        }
+        else if( opt == 'w' )
+        {
+            writers = strtoul( optarg, NULL, 10 );
+        }
+        else if( opt == 'W' )
+        {
+            workers = strtoul( optarg, NULL, 10 );
+        }
+        else if( opt == 's' )
+        {
+            g_spool = optarg;
+        }
+        else if( opt == 'C' )
+        {
+            capfile = optarg;
+        }
+        else if( opt == 'r' )
+        {
+            g_read_ahead = strtoul( optarg, NULL, 10 );
+        }
+        else if( opt == 'A' )
+        {
+            adminfile = optarg;
+        }
+        else if( opt == 'R' )
+        {
+            g_rate = strtoul( optarg, NULL, 10 );
+        }
+        else if( opt == 'l' && ( level = level_of( optarg ) ) != -1 )
+        {
+            g_log_level = level;
+        }
+        else if( opt == 'f' )
+        {
+            /* Read before the other options. */
+        }
+        else if( opt == 'u' )
+        {
+            users = strtoul( optarg, NULL, 10 );
+        }
+        else if( opt == 'q' )
+        {
+            g_queue_limit = strtoul( optarg, NULL, 10 );
+        }
+        else
+        {
+            optind = argc;
+            break;
+        }
+    }
+
+    if( argc - optind != 1 ||
+            ( g_read_ahead > 0 && g_read_ahead < ECHO_FRAME_HEADER ) )
+    {
+        fprintf( stderr, "USAGE: %s [--node-id ID] [--peer HOST:PORT]... "
+                "[--cpus LIST] [--arena CHUNKS] [--huge-pages] "
+                "[--profile PROFILE] [--writers COUNT] [--workers COUNT] "
+                "[--spool DIR] [--capture FILE] [--read-ahead BYTES] "
+                "[--admin PATH] [--rate LINES] [--log-level LEVEL] "
+                "[--config FILE] [--users COUNT] [--queue-limit MESSAGES] "
+                "PORT\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    if( tcp_profile_parse( tuning, &profile, &err ) == -1 )
+    {
+        fprintf( stderr, "tcp_profile_parse: %s: %s.\n", tuning,
+                strerror( err ) );
+        return EXIT_FAILURE;
+    }
+
+    if( cpus != NULL &&
+            ( g_affinity = echo_affinity_create( cpus, &err ) ) == NULL )
+    {
+        fprintf( stderr, "echo_affinity_create: %s: %s.\n", cpus,
+                strerror( err ) );
+        return EXIT_FAILURE;
+    }
+
+    /* Each member holds a buffer, so does each message queued for the
+     * outbox. */
+    if( !sized && users + g_queue_limit > chunks )
+        chunks = users + g_queue_limit;
+
+    /* Connection buffers come from one mapping. */
+    if( chunks > 0 && ( g_arena = echo_arena_create(
+                    sizeof( struct message ) + BUFFER_SIZE, chunks, huge,
+                    &err ) ) == NULL )
+    {
+        fprintf( stderr, "echo_arena_create: %s.\n", strerror( err ) );
+        return EXIT_FAILURE;
+    }
 
-    if( argc != 2 )
+    /* So do read-ahead buffers, from one of their own. */
+    if( chunks > 0 && g_read_ahead > 0 && ( g_readers = echo_arena_create(
+                    g_read_ahead, chunks, huge, &err ) ) == NULL )
     {
-        fprintf( stderr, "USAGE: %s PORT\n", argv[ 0 ] );
+        fprintf( stderr, "echo_arena_create: %s.\n", strerror( err ) );
         return EXIT_FAILURE;
     }
 
@@ -37,6 +383,25 @@ int main( int argc, char *argv[ ] )
         return EXIT_FAILURE;
     }
 
+#ifdef ECHO_TRACING
+    /* SIGUSR2 dumps what the threads did last, see tracejson. */
+    if( echo_trace_install( SIGUSR2, TRACE_FILE, &err ) == -1 )
+    {
+        fprintf( stderr, "echo_trace_install: %s.\n", strerror( err ) );
+        fclose( logfile );
+        return EXIT_FAILURE;
+    }
+#endif
+
+    if( capfile != NULL && ( g_capture = echo_capture_create( capfile,
+                    ECHO_CAPTURE_RING, &err ) ) == NULL )
+    {
+        fprintf( stderr, "echo_capture_create: %s: %s.\n", capfile,
+                strerror( err ) );
+        fclose( logfile );
+        return EXIT_FAILURE;
+    }
+
     fprintf( logfile, "Creating server's tcp context... " );
 
     if( ( ctx = tcp_context_create( &err ) ) == NULL )
@@ -48,10 +413,11 @@ int main( int argc, char *argv[ ] )
         return EXIT_FAILURE;
     }
 
+    tcp_context_set_profile( ctx, &profile, &err );
     fprintf( logfile,
             "DONE\nBinding server's tcp context to localhost... " );
 
-    if( tcp_context_bind( ctx, atoi( argv[ 1 ] ), &err ) == -1 )
+    if( tcp_context_bind( ctx, atoi( argv[ optind ] ), &err ) == -1 )
     {
         char buf[ 256 ];
         tcp_context_strerror( err, buf, 256 );
@@ -73,6 +439,9 @@ int main( int argc, char *argv[ ] )
         return EXIT_FAILURE;
     }
 
+    /* The accept thread drains the queue on readiness and stops at
+     * EAGAIN. */
+    tcp_context_set_blocking( ctx, 0, &err );
     fprintf( logfile, "DONE\nCreating echo server context... " );
     server = echo_server_context_create( ctx, &err );
 
@@ -87,96 +456,338 @@ int main( int argc, char *argv[ ] )
         return EXIT_FAILURE;
     }
 
+    if( ( g_names = echo_intern_create( &err ) ) == NULL )
+    {
+        fprintf( stderr, "echo_intern_create: %s.\n", strerror( err ) );
+        echo_server_context_destroy( server );
+        fclose( logfile );
+        return EXIT_FAILURE;
+    }
+
+    /* The first surge of logins after a start should find the tables sized
+     * and the buffers it takes first already backed by memory. */
+    if( users > 0 )
+    {
+        fprintf( logfile, "DONE\nPreallocating for %zu users... ", users );
+
+        if( echo_server_context_reserve( server, users, &err ) == -1 ||
+                echo_intern_reserve( g_names, users, &err ) == -1 )
+        {
+            fprintf( stderr, "Preallocating: %s.\n", strerror( err ) );
+            fprintf( logfile, "FAILED\n" );
+            echo_intern_destroy( g_names );
+            echo_server_context_destroy( server );
+            fclose( logfile );
+            return EXIT_FAILURE;
+        }
+
+        if( g_arena != NULL )
+            echo_arena_prefault( g_arena, users + g_queue_limit );
+
+        if( g_readers != NULL )
+            echo_arena_prefault( g_readers, users );
+    }
+
+    if( writers > 0 )
+    {
+        fprintf( logfile, "DONE\nSpawning %zu writer threads... ", writers );
+
+        if( ( g_pipeline = echo_pipeline_create( writers, &err ) ) == NULL )
+        {
+            fprintf( stderr, "echo_pipeline_create: %s.\n", strerror( err ) );
+            echo_server_context_destroy( server );
+            fclose( logfile );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if( workers > 0 )
+    {
+        fprintf( logfile, "DONE\nSpawning %zu worker threads... ", workers );
+
+        if( ( g_pool = echo_pool_create( workers, &err ) ) == NULL )
+        {
+            fprintf( stderr, "echo_pool_create: %s.\n", strerror( err ) );
+
+            if( g_pipeline != NULL )
+                echo_pipeline_destroy( g_pipeline );
+
+            echo_server_context_destroy( server );
+            fclose( logfile );
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf( logfile, "DONE\nSpawning outbox thread... " );
+    echo_lanes_init( &g_lanes );
+
+    if( ( g_outbox = echo_queue_create( &err ) ) == NULL ||
+            ( errno = spawn( &outbox, outbox_thread, server, &cpu ) ) != 0 )
+    {
+        perror( "outbox" );
+
+        if( g_outbox != NULL )
+            echo_queue_destroy( g_outbox );
+
+        echo_server_context_destroy( server );
+        fclose( logfile );
+        return EXIT_FAILURE;
+    }
+
+    fprintf( logfile, "DONE\nLinking node %u to its peers... ", node );
+    g_peers = echo_peer_create( node, deliver, server, &err );
+
+    if( g_peers != NULL )
+        g_presence = echo_presence_create( g_peers, node, revoke_login, server,
+                &err );
+
+    for( i = 0; g_presence != NULL && i < npeers; i++ )
+    {
+        if( connect_peer( peers[ i ], &err ) == -1 )
+            break;
+    }
+
+    if( g_presence == NULL || i < npeers )
+    {
+        char buf[ 256 ];
+        echo_peer_strerror( err, buf, 256 );
+        fprintf( stderr, "echo_peer_connect: %s.\n", buf );
+        fprintf( logfile, "FAILED\n" );
+
+        if( g_presence != NULL )
+            echo_presence_destroy( g_presence );
+
+        if( g_peers != NULL )
+            echo_peer_destroy( g_peers );
+
+        echo_server_context_destroy( server );
+        fclose( logfile );
+        return EXIT_FAILURE;
+    }
+
+    if( g_affinity != NULL )
+    {
+        fprintf( logfile, "DONE\nPinning threads to %zu cpus... ",
+                echo_affinity_cpus( g_affinity ) );
+    }
+
+    if( adminfile != NULL )
+    {
+        fprintf( logfile, "DONE\nOpening admin socket %s... ", adminfile );
+
+        if( pipe( g_wake ) == -1 )
+            err = errno;
+
+        if( g_wake[ 0 ] == -1 || ( g_admin = echo_admin_create( adminfile,
+                        command, server, &err ) ) == NULL )
+        {
+            fprintf( stderr, "echo_admin_create: %s: %s.\n", adminfile,
+                    strerror( err ) );
+            fprintf( logfile, "FAILED\n" );
+            echo_presence_destroy( g_presence );
+            echo_peer_destroy( g_peers );
+            echo_server_context_destroy( server );
+            fclose( logfile );
+            return EXIT_FAILURE;
+        }
+    }
+
     fprintf( logfile, "DONE\nSpawning acceptance thread... " );
-    errno = pthread_create( &thread, NULL, accept_thread, server );
+    errno = spawn( &thread, accept_thread, server, &cpu );
 
     if( errno != 0 )
     {
         perror( "pthread_create" );
+
+        if( g_admin != NULL )
+            echo_admin_destroy( g_admin );
+
+        echo_presence_destroy( g_presence );
+        echo_peer_destroy( g_peers );
         echo_server_context_destroy( server );
         fclose( logfile );
         return EXIT_FAILURE;
     }
 
     fprintf( logfile, "DONE\n" );
-    getchar( );
+    wait_stop( );
 
-    pthread_mutex_lock( &g_lock );
+    /* Commands would look at what is being torn down, the table stays for
+     * the connection threads winding down. */
+    if( g_admin != NULL )
+        echo_admin_stop( g_admin );
 
-    for( i = 0; i < server->esc_bag->b_size; i++ )
+    /* Shutting the listener down wakes the accept thread out of poll. */
+    g_stopping = 1;
+    shutdown( ctx->tc_socket, SHUT_RDWR );
+    pthread_join( thread, NULL );
+
+    /* No connection thread starts from here, those running are ended and
+     * waited for before anything they use is torn down. */
+    stop_connections( server );
+
+    /* What was queued before the stop still goes out. */
+    echo_queue_push( g_outbox, &g_stop.m_node );
+    pthread_join( outbox, NULL );
+
+    /* Queue depths between the stages show which one holds the rest up. */
+    echo_queue_depth( g_outbox, &peak );
+    fprintf( logfile, "router_peak=%zu\n", peak );
+    memset( lanes, 0, sizeof( lanes ) );
+
+    for( i = 0; i < ECHO_LANE_MAX; i++ )
+    {
+        echo_lanes_usage( &g_lanes, i, &lanes[ i ] );
+    }
+
+    echo_lane_report( lanes, "router_", logfile );
+
+    if( g_pool != NULL )
+    {
+        echo_pool_report( g_pool, logfile );
+        echo_pool_destroy( g_pool );
+    }
+
+    if( g_pipeline != NULL )
+    {
+        echo_pipeline_report( g_pipeline, logfile );
+        echo_pipeline_destroy( g_pipeline );
+    }
+
+    /* Links go first, they deliver into the server context. */
+    echo_presence_destroy( g_presence );
+    echo_peer_destroy( g_peers );
+
+    while( ( message = ( struct message* )echo_queue_pop( g_outbox ) ) !=
+            NULL )
     {
-        echo_client_context_destroy( bag_array_get( server->esc_bag, i,
-                    &err ) );
+        echo_transfer_put( message->m_transfer );
+        checkin( message );
     }
 
+    /* Every member has logged out with its thread. */
     echo_server_context_destroy( server );
-    pthread_mutex_unlock( &g_lock );
+
+    if( g_admin != NULL )
+        echo_admin_destroy( g_admin );
+
+    echo_stats_dump( logfile );
+
+    if( g_affinity != NULL )
+    {
+        echo_affinity_report( g_affinity, logfile );
+        echo_affinity_destroy( g_affinity );
+    }
+
+    /* Every buffer is back, the outbox was drained above. */
+    if( g_arena != NULL )
+    {
+        echo_arena_report( g_arena, logfile );
+        echo_arena_destroy( g_arena );
+    }
+
+    if( g_readers != NULL )
+        echo_arena_destroy( g_readers );
+
+    /* Waits tell whether the limit is too low for the outbox. */
+    if( g_queue_limit > 0 )
+        fprintf( logfile, "queue_waits=%llu\n", atomic_load( &g_queue_waits ) );
+
+    /* Frames per call tell how much the read-ahead saves. */
+    if( g_read_ahead > 0 )
+    {
+        fprintf( logfile, "read_ahead_calls=%llu\nread_ahead_frames=%llu\n",
+                atomic_load( &g_read_calls ), atomic_load( &g_read_frames ) );
+    }
+
+#ifdef ECHO_TRACING
+    echo_trace_dump( TRACE_FILE, &err );
+    fprintf( logfile, "trace_rings=%zu\n", echo_trace_rings( ) );
+#endif
+
+    if( g_capture != NULL )
+    {
+        echo_capture_close( g_capture );
+        fprintf( logfile, "capture_dropped=%llu\n",
+                echo_capture_dropped( g_capture ) );
+        echo_capture_destroy( g_capture );
+    }
 
     fclose( logfile );
 
+    if( config != NULL )
+        echo_config_destroy( config );
+
     return EXIT_SUCCESS;
 }
 
+/* Pending connections are taken in batches of at most ACCEPT_BATCH before
+ * going back to poll, so that a reconnect storm is drained quickly without
+ * keeping the thread away from the stop flag. The first frame is read by
+ * the connection thread, a slow client cannot hold up the queue. */
 void *accept_thread( void *arg )
 {
-    struct argument args;
+    tcp_context_t *clients[ ACCEPT_BATCH ];
     echo_server_context_t *server;
-    echo_client_context_t *client;
-    char username[ MAX_LENGTH ];
-    tcp_context_t *ctx;
+    struct argument *args;
+    struct pollfd pfd;
     pthread_t thread;
+    ssize_t count, i;
     int err;
 
-    pthread_detach( pthread_self( ) );
     server = ( echo_server_context_t* )arg;
+    pfd.fd = server->esc_tcp->tc_socket;
+    pfd.events = POLLIN;
 
-    while( 1 )
+    while( !g_stopping )
     {
-        ctx = tcp_context_accept( server->esc_tcp, &err );
+        if( poll( &pfd, 1, -1 ) == -1 )
+            continue;
 
-        fprintf( logfile, "Accepting incoming connection... " );
+        count = tcp_context_accept_batch( server->esc_tcp, clients,
+                ACCEPT_BATCH, 0, &err );
 
-        if( ctx != NULL )
+        if( count == -1 )
         {
-            memset( username, 0, MAX_LENGTH );
-            tcp_context_recv( ctx, username, MAX_LENGTH, &err );
-            client = echo_client_context_create( ctx, username, &err );
+            if( err == EAGAIN || err == EWOULDBLOCK || g_stopping )
+                continue;
 
-            if( client != NULL )
-            {
-                int tmp;
+            say( LOG_ERROR, "Accepting incoming connection... FAILED\n" );
 
-                pthread_mutex_lock( &g_lock );
-                args.a_server = server;
-                args.a_client = client;
-                tmp = echo_server_context_insert( server, client, &err );
-                pthread_mutex_unlock( &g_lock );
+            /* Out of descriptors the queue may stay readable, poll would
+             * return at once until connections close. */
+            poll( NULL, 0, ACCEPT_BACKOFF );
+            continue;
+        }
 
-                if( tmp == -1 )
-                {
-                    if( err == EDUPLICATE )
-                    {
-                        tcp_context_send( client->eec_tcp, "FAILED", 7,
-                                &err );
-                    }
-
-                    echo_client_context_destroy( client );
-                    fprintf( logfile, "FAILED\n" );
-                    continue;
-                }
+        for( i = 0; i < count; i++ )
+        {
+            ECHO_TRACE( ACCEPT, clients[ i ]->tc_socket, count, 0 );
 
-                tcp_context_send( client->eec_tcp, "DONE", 5, &err );
-                pthread_create( &thread, NULL, connex_thread, &args );
-                fprintf( logfile, "DONE\n" );
+            if( ( args = malloc( sizeof( struct argument ) ) ) != NULL )
+            {
+                args->a_server = server;
+                args->a_tcp = clients[ i ];
+                track( args );
             }
-            else
+
+            if( args == NULL || spawn( &thread, connex_thread, args,
+                        &args->a_cpu ) != 0 )
             {
-                fprintf( logfile, "FAILED\n" );
+                if( args != NULL )
+                {
+                    settle( args );
+                    untrack( );
+                    free( args );
+                }
+
+                tcp_context_destroy( clients[ i ] );
+                say( LOG_ERROR,
+                        "Accepting incoming connection... FAILED\n" );
+                continue;
             }
-        }
-        else
-        {
-            fprintf( logfile, "FAILED\n" );
+
+            pthread_detach( thread );
         }
     }
 
@@ -186,44 +797,1281 @@ void *accept_thread( void *arg )
 void *connex_thread( void *arg )
 {
     struct argument *args;
-    char buffer[ 2048 ], message[ 4096 ];
     echo_server_context_t *server;
     echo_client_context_t *client;
-    ssize_t bytes;
-    int err;
+    struct message *message;
+    tcp_context_t *ctx;
+    int cpu;
 
-    pthread_mutex_lock( &g_lock );
     args = ( struct argument* )arg;
     server = args->a_server;
-    client = args->a_client;
-    pthread_mutex_unlock( &g_lock );
+    ctx = args->a_tcp;
+    cpu = args->a_cpu;
+
+    if( ( message = checkout( ) ) == NULL )
+    {
+        settle( args );
+        tcp_context_destroy( ctx );
+    }
+    else if( ( client = handshake( args ) ) == NULL )
+    {
+        checkin( message );
+    }
+    else
+    {
+        serve( server, client, message, cpu );
+    }
 
-    sprintf( message, "%s joined\n", client->eec_uname );
+    free( args );
 
-    pthread_mutex_lock( &g_lock );
-    echo_server_context_sendall( server, message, strlen( message ), &err );
-    pthread_mutex_unlock( &g_lock );
+    if( g_affinity != NULL )
+        echo_affinity_leave( g_affinity, cpu );
 
-    while( ( bytes = tcp_context_recv( client->eec_tcp,
-                    buffer, 2048, &err ) ) > 0 )
+    /* Last, what the thread used may be torn down from here on. */
+    untrack( );
+
+    return NULL;
+}
+
+
+/* Everything queued is sorted into the lanes first, then at most
+ * OUTBOX_BATCH messages go out under one hold of the lock so that logins
+ * are not kept waiting. A notice queued behind a backlog of chat or file
+ * data is taken out of turn and goes out with the next batch. */
+void *outbox_thread( void *arg )
+{
+    echo_server_context_t *server;
+    echo_queue_node_t *node;
+    echo_lane_node_t *lane;
+    struct message *message;
+    int count, stop;
+
+    server = ( echo_server_context_t* )arg;
+    stop = 0;
+
+    while( !stop || echo_lanes_pending( &g_lanes ) > 0 )
     {
-        sprintf( message, "%s says:\n%s\n", client->eec_uname, buffer );
-        pthread_mutex_lock( &g_lock );
-        echo_server_context_sendall( server, message, strlen( message ),
-                &err );
-        pthread_mutex_unlock( &g_lock );
-        memset( buffer, 0, 2048 );
-    }
+        if( !stop && echo_lanes_pending( &g_lanes ) == 0 )
+        {
+            if( ( node = echo_queue_wait( g_outbox, -1 ) ) == NULL )
+                continue;
+
+            stop = take( node );
+        }
 
-    sprintf( message, "%s left\n", client->eec_uname );
+        while( !stop && ( node = echo_queue_pop( g_outbox ) ) != NULL )
+        {
+            stop = take( node );
+        }
 
-    pthread_mutex_lock( &g_lock );
+        /* The queue was just drained, connections held back at its limit
+         * may read again. */
+        if( g_queue_limit > 0 )
+        {
+            pthread_mutex_lock( &g_room_lock );
+            pthread_cond_broadcast( &g_room );
+            pthread_mutex_unlock( &g_room_lock );
+        }
 
-    echo_server_context_remove( server, client, &err );
-    echo_server_context_sendall( server, message, strlen( message ), &err );
-    pthread_mutex_unlock( &g_lock );
+        pthread_mutex_lock( &g_lock );
 
-    echo_client_context_destroy( client );
+        for( count = 0; count < OUTBOX_BATCH &&
+                ( lane = echo_lanes_pop( &g_lanes ) ) != NULL; count++ )
+        {
+            message = ( struct message* )( ( char* )lane -
+                    offsetof( struct message, m_lane ) );
 
-    return NULL;
+            if( message->m_transfer != NULL )
+            {
+                relay_chunk( server, message );
+            }
+            else
+            {
+                flush( server, message->m_frame, lane->eln_lane,
+                        message->m_parts, message->m_count,
+                        message->m_relay );
+            }
+
+            echo_lanes_done( &g_lanes, lane );
+            checkin( message );
+        }
+
+        pthread_mutex_unlock( &g_lock );
+    }
+
+    return NULL;
+}
+
+/* The first frame tells clients from peer nodes, a peer link is handed
+ * over to the peer set and the thread is done with it. */
+echo_client_context_t *handshake( struct argument *args )
+{
+    echo_server_context_t *server;
+    char username[ MAX_LENGTH ];
+    echo_frame_t frame;
+    tcp_context_t *ctx;
+    ssize_t bytes;
+    int err;
+
+    server = args->a_server;
+    ctx = args->a_tcp;
+    memset( username, 0, MAX_LENGTH );
+    bytes = echo_frame_recv( ctx, &frame, username, MAX_LENGTH - 1, &err );
+
+    /* From here the socket may be closed or handed over. */
+    settle( args );
+
+    if( bytes <= 0 || ( frame.ef_type != ECHO_FRAME_HELLO &&
+                frame.ef_type != ECHO_FRAME_PEER ) )
+    {
+        say( LOG_ERROR, "Accepting incoming connection... FAILED\n" );
+        tcp_context_destroy( ctx );
+        return NULL;
+    }
+
+    ECHO_TRACE( HANDSHAKE, ctx->tc_socket, frame.ef_type, frame.ef_flags );
+
+    if( frame.ef_type == ECHO_FRAME_PEER )
+    {
+        if( echo_peer_attach( g_peers, ctx, username, frame.ef_length,
+                    &err ) == -1 )
+        {
+            say( LOG_ERROR, "Accepting peer connection... FAILED\n" );
+            tcp_context_destroy( ctx );
+        }
+
+        return NULL;
+    }
+
+    return login( server, ctx, username, frame.ef_flags );
+}
+
+/* With workers running the thread only reads, what the frames ask for is
+ * done on the pool by the connection's serial executor. Each frame is read
+ * into a message of its own, handed over with it. With a read-ahead buffer
+ * the frames a sender wrote in a burst are read with one call and copied
+ * out of it. */
+void serve( echo_server_context_t *server, echo_client_context_t *client,
+        struct message *message, int cpu )
+{
+    echo_admin_session_t *session;
+    echo_frame_reader_t reader;
+    echo_transfer_t *transfer;
+    struct message *next;
+    echo_serial_t *serial;
+    echo_frame_t frame;
+    char *ahead;
+    double due;
+    uint32_t id;
+    int err;
+
+    transfer = NULL;
+    serial = NULL;
+    ahead = NULL;
+    session = NULL;
+    due = 0;
+    id = atomic_fetch_add( &g_connections, 1 ) + 1;
+
+    if( g_read_ahead > 0 && ( ahead = borrow( ) ) != NULL )
+    {
+        echo_frame_reader_init( &reader, ahead, g_read_ahead );
+        client->eec_reader = &reader;
+    }
+
+    if( g_pool != NULL )
+        serial = echo_serial_create( g_pool, &err );
+
+    if( g_affinity != NULL )
+    {
+        say( LOG_INFO, "%s served on cpu %d node %d\n", client->eec_uname,
+                echo_affinity_current( ), echo_affinity_node( g_affinity,
+                    cpu ) );
+    }
+
+    announce( server, client, " joined\n", ECHO_LANE_CONTROL );
+    /* The handshake was read before the connection had an ID. */
+    capture( id, ECHO_FRAME_HELLO, client->eec_features, client->eec_uname,
+            strlen( client->eec_uname ) );
+    say( LOG_DEBUG, "%s joined as connection %u\n", client->eec_uname, id );
+
+    if( g_admin != NULL )
+        session = echo_admin_open( g_admin, id, client->eec_tcp->tc_socket,
+                client->eec_uname );
+
+    while( echo_client_context_recv_header( client, &frame, &err ) > 0 )
+    {
+        ECHO_TRACE( RECV, id, frame.ef_type, frame.ef_length );
+        echo_admin_count( session, ECHO_FRAME_HEADER + frame.ef_length );
+
+        /* File data goes to the spool without being read, that of a
+         * refused transfer is dropped. */
+        if( frame.ef_type == ECHO_FRAME_CHUNK && frame.ef_flags == 0 )
+        {
+            capture( id, frame.ef_type, frame.ef_flags, NULL,
+                    frame.ef_length );
+
+            if( ( transfer != NULL ? spool( client, transfer,
+                            frame.ef_length ) : drop( client,
+                            message->m_payload, frame.ef_length ) ) == -1 )
+                break;
+
+            continue;
+        }
+
+        if( echo_client_context_recv_payload( client, &frame,
+                    message->m_payload, BUFFER_SIZE - 1, &err ) == -1 )
+            break;
+
+        capture( id, frame.ef_type, frame.ef_flags, message->m_payload,
+                frame.ef_length );
+
+        if( frame.ef_type == ECHO_FRAME_OFFER )
+        {
+            offer( server, client, &transfer, message->m_payload,
+                    frame.ef_length );
+            continue;
+        }
+
+        if( frame.ef_type == ECHO_FRAME_END )
+        {
+            finish( server, &transfer, 0 );
+            continue;
+        }
+
+        if( frame.ef_type != ECHO_FRAME_DIRECT &&
+                frame.ef_type != ECHO_FRAME_CHAT )
+            continue;
+
+        pace( &due );
+        hold_back( );
+
+        /* Out of buffers the frame waits for those before it and is done
+         * with here, its buffer kept for the next one. */
+        if( ( next = checkout( ) ) == NULL )
+        {
+            if( serial != NULL )
+                echo_serial_wait( serial );
+
+            if( frame.ef_type == ECHO_FRAME_DIRECT )
+            {
+                direct( server, client, message->m_payload,
+                        frame.ef_length );
+                continue;
+            }
+
+            compose( message, client->eec_name, frame.ef_length );
+            pthread_mutex_lock( &g_lock );
+            flush( server, ECHO_FRAME_TEXT, ECHO_LANE_INTERACTIVE,
+                    message->m_parts, message->m_count, 1 );
+            pthread_mutex_unlock( &g_lock );
+            continue;
+        }
+
+        message->m_task.et_run = handle;
+        message->m_server = server;
+        message->m_client = client;
+        message->m_type = frame.ef_type;
+        message->m_size = frame.ef_length;
+
+        if( serial != NULL )
+            echo_serial_submit( serial, &message->m_task );
+        else
+            handle( &message->m_task );
+
+        message = next;
+    }
+
+    capture( id, ECHO_CAPTURE_CLOSE, 0, NULL, 0 );
+    ECHO_TRACE( DISCONNECT, id, client->eec_tcp->tc_socket, 0 );
+    say( LOG_DEBUG, "%s left connection %u\n", client->eec_uname, id );
+
+    /* Before its socket is closed, the admin thread may be asking it. */
+    echo_admin_close( session );
+
+    /* Its jobs still use the client. */
+    if( serial != NULL )
+        echo_serial_destroy( serial );
+
+    if( ahead != NULL )
+    {
+        atomic_fetch_add( &g_read_calls, reader.efr_calls );
+        atomic_fetch_add( &g_read_frames, reader.efr_frames );
+        client->eec_reader = NULL;
+        give_back( ahead );
+    }
+
+    /* A transfer cut short is ended for its receivers. */
+    finish( server, &transfer, 1 );
+
+    pthread_mutex_lock( &g_lock );
+    echo_server_context_remove( server, client, &err );
+    pthread_mutex_unlock( &g_lock );
+    echo_presence_release( g_presence, client->eec_uname );
+    /* Not out of turn, the member's last lines must come before it. */
+    announce( server, client, " left\n", ECHO_LANE_INTERACTIVE );
+    echo_intern_put( g_names, client->eec_name );
+    client->eec_name = NULL;
+
+    /* Its writer may still hold frames for it. */
+    if( g_pipeline != NULL )
+        echo_pipeline_detach( g_pipeline, client );
+    else
+        echo_client_context_destroy( client );
+
+    checkin( message );
+}
+
+/* Runs on the connection's own thread, the client context and its
+ * compression state are first touched there and so come from the memory
+ * of the node the thread is pinned to. */
+echo_client_context_t *login( echo_server_context_t *server,
+        tcp_context_t *ctx, const char *username, int features )
+{
+    echo_client_context_t *client;
+    int tmp, err;
+
+    if( !echo_compress_available( ) )
+        features &= ~ECHO_FEATURE_DEFLATE;
+
+    if( ( client = echo_client_context_create( ctx, username,
+                    &err ) ) == NULL )
+    {
+        tcp_context_destroy( ctx );
+        return NULL;
+    }
+
+    /* Every line the member sends starts with the prefix made here. */
+    if( ( client->eec_name = echo_intern_get( g_names, client->eec_uname,
+                    strlen( client->eec_uname ), &err ) ) == NULL )
+    {
+        echo_client_context_destroy( client );
+        return NULL;
+    }
+
+    if( echo_client_context_set_features( client, features, &err ) == -1 )
+    {
+        features = 0;
+    }
+
+    /* The reply goes out under the lock so that no broadcast can reach the
+     * client ahead of it. Once stopping, the connections have been shut
+     * down and one let in now would not be. */
+    pthread_mutex_lock( &g_lock );
+
+    if( g_stopping )
+    {
+        err = ECANCELED;
+        tmp = -1;
+    }
+    else
+    {
+        tmp = echo_server_context_insert( server, client, &err );
+    }
+
+    /* Unique on this node, the directory decides for the others without
+     * waiting on them. */
+    if( tmp != -1 && echo_presence_claim( g_presence, client->eec_uname,
+                &err ) == -1 )
+    {
+        echo_server_context_remove( server, client, &tmp );
+        tmp = -1;
+    }
+
+    if( tmp != -1 )
+    {
+        echo_frame_send( client->eec_tcp, ECHO_FRAME_ACCEPT, features, NULL,
+                0, &err );
+    }
+
+    /* The reply is written before the writer takes the socket over. */
+    if( tmp != -1 && g_pipeline != NULL &&
+            echo_pipeline_attach( g_pipeline, client, &err ) == -1 )
+    {
+        echo_server_context_remove( server, client, &tmp );
+        echo_presence_release( g_presence, client->eec_uname );
+        tmp = -1;
+    }
+
+    pthread_mutex_unlock( &g_lock );
+
+    if( tmp == -1 )
+    {
+        if( err == EDUPLICATE )
+        {
+            echo_frame_send( client->eec_tcp, ECHO_FRAME_REJECT, 0, "FAILED",
+                    6, &err );
+        }
+
+        echo_intern_put( g_names, client->eec_name );
+        echo_client_context_destroy( client );
+        return NULL;
+    }
+
+    return client;
+}
+
+/* Counts a connection thread about to start, its socket kept in g_pending
+ * until the first frame is read. */
+void track( struct argument *args )
+{
+    pthread_mutex_lock( &g_lock );
+    args->a_prev = NULL;
+    args->a_next = g_pending;
+
+    if( g_pending != NULL )
+        g_pending->a_prev = args;
+
+    g_pending = args;
+    g_threads++;
+    pthread_mutex_unlock( &g_lock );
+}
+
+void settle( struct argument *args )
+{
+    pthread_mutex_lock( &g_lock );
+
+    if( args->a_prev != NULL )
+        args->a_prev->a_next = args->a_next;
+    else
+        g_pending = args->a_next;
+
+    if( args->a_next != NULL )
+        args->a_next->a_prev = args->a_prev;
+
+    pthread_mutex_unlock( &g_lock );
+}
+
+void untrack( void )
+{
+    pthread_mutex_lock( &g_lock );
+
+    if( --g_threads == 0 )
+        pthread_cond_broadcast( &g_idle );
+
+    pthread_mutex_unlock( &g_lock );
+}
+
+/* Connection threads are detached, so they are counted instead. Sockets
+ * waiting for a first frame and those of members are shut down, which
+ * ends their reads, and logins from then on are refused. The outbox keeps
+ * running meanwhile, the threads post leave notices and may be held back
+ * by the queue limit. */
+void stop_connections( echo_server_context_t *server )
+{
+    echo_client_context_t *client;
+    struct argument *args;
+    ssize_t i;
+    int err;
+
+    pthread_mutex_lock( &g_lock );
+
+    for( args = g_pending; args != NULL; args = args->a_next )
+    {
+        shutdown( args->a_tcp->tc_socket, SHUT_RDWR );
+    }
+
+    for( i = 0; i < server->esc_bag->b_size; i++ )
+    {
+        client = bag_array_get( server->esc_bag, i, &err );
+        shutdown( client->eec_tcp->tc_socket, SHUT_RDWR );
+    }
+
+    while( g_threads > 0 )
+    {
+        pthread_cond_wait( &g_idle, &g_lock );
+    }
+
+    pthread_mutex_unlock( &g_lock );
+}
+
+/* Threads are pinned when a CPU list was given, each to the allowed CPU
+ * running the fewest of them. */
+int spawn( pthread_t *thread, void *( *start )( void* ), void *arg,
+        int *cpu )
+{
+    pthread_attr_t attr;
+    int retval;
+
+    *cpu = -1;
+
+    if( g_affinity == NULL )
+        return pthread_create( thread, NULL, start, arg );
+
+    if( ( retval = pthread_attr_init( &attr ) ) != 0 )
+        return retval;
+
+    if( ( *cpu = echo_affinity_place( g_affinity, &attr, &retval ) ) != -1 &&
+            ( retval = pthread_create( thread, &attr, start, arg ) ) != 0 )
+    {
+        echo_affinity_leave( g_affinity, *cpu );
+    }
+
+    pthread_attr_destroy( &attr );
+
+    return retval;
+}
+
+/* Local members and, through the peer links, the other nodes. */
+void announce( echo_server_context_t *server, echo_client_context_t *client,
+        const char *event, echo_lane_t lane )
+{
+    struct iovec parts[ 2 ];
+
+    parts[ 0 ].iov_base = client->eec_uname;
+    parts[ 0 ].iov_len = strlen( client->eec_uname );
+    parts[ 1 ].iov_base = ( void* )event;
+    parts[ 1 ].iov_len = strlen( event );
+    post( server, ECHO_FRAME_TEXT, lane, parts, 2, 1 );
+}
+
+void deliver( const char *text, size_t size, void *arg )
+{
+    struct iovec part;
+
+    part.iov_base = ( void* )text;
+    part.iov_len = size;
+    post( ( echo_server_context_t* )arg, ECHO_FRAME_TEXT,
+            ECHO_LANE_INTERACTIVE, &part, 1, 0 );
+}
+
+/* Senders hand the text over and go back to reading, only the outbox
+ * thread waits on the lock and the sockets. Notices and relayed lines are
+ * short and are gathered into a message of their own. */
+void post( echo_server_context_t *server, int type, echo_lane_t lane,
+        const struct iovec *parts, int count, int relay )
+{
+    struct message *message;
+
+    if( ( message = malloc( sizeof( struct message ) +
+                    echo_frame_length( parts, count ) ) ) == NULL )
+    {
+        pthread_mutex_lock( &g_lock );
+        flush( server, type, lane, parts, count, relay );
+        pthread_mutex_unlock( &g_lock );
+        return;
+    }
+
+    message->m_parts[ 0 ].iov_base = message->m_payload;
+    message->m_parts[ 0 ].iov_len = echo_frame_gather( message->m_payload,
+            parts, count );
+    message->m_count = 1;
+    message->m_frame = type;
+    message->m_relay = relay;
+    message->m_transfer = NULL;
+    enqueue( message, lane );
+}
+
+/* Lays a chat line out as the "name says:" prefix interned with the name,
+ * the payload where it was read and its line end. The prefix is copied,
+ * the name may be gone before the outbox gets to the line. */
+void compose( struct message *message, const echo_name_t *name,
+        size_t size )
+{
+    memcpy( message->m_prefix, name->en_says, name->en_says_length );
+    message->m_parts[ 0 ].iov_base = message->m_prefix;
+    message->m_parts[ 0 ].iov_len = name->en_says_length;
+    message->m_parts[ 1 ].iov_base = message->m_payload;
+    message->m_parts[ 1 ].iov_len = size;
+    message->m_parts[ 2 ].iov_base = "\n";
+    message->m_parts[ 2 ].iov_len = 1;
+    message->m_count = 3;
+    message->m_frame = ECHO_FRAME_TEXT;
+    message->m_relay = 1;
+    message->m_transfer = NULL;
+}
+
+/* Stamped here, the lanes time the wait from the reader to the socket. */
+void enqueue( struct message *message, echo_lane_t lane )
+{
+    message->m_lane.eln_lane = lane;
+    message->m_lane.eln_size = ECHO_FRAME_HEADER + echo_frame_length(
+            message->m_parts, message->m_count ) +
+        ( message->m_transfer != NULL ? message->m_size : 0 );
+    message->m_lane.eln_queued = echo_lane_clock( );
+    ECHO_TRACE( ENQUEUE, message->m_frame, lane, message->m_lane.eln_size );
+    echo_queue_push( g_outbox, &message->m_node );
+}
+
+/* Returns 1 for the stop, which is never put in a lane. */
+int take( echo_queue_node_t *node )
+{
+    struct message *message;
+
+    if( node == &g_stop.m_node )
+        return 1;
+
+    message = ( struct message* )node;
+    echo_lanes_push( &g_lanes, message->m_lane.eln_lane, &message->m_lane );
+
+    return 0;
+}
+
+/* Called with the lock held */
+void flush( echo_server_context_t *server, int type, echo_lane_t lane,
+        const struct iovec *parts, int count, int relay )
+{
+    int err;
+
+    ECHO_TRACE( FLUSH, type, lane, ECHO_FRAME_HEADER + echo_frame_length(
+                parts, count ) );
+
+    if( g_pipeline != NULL )
+        echo_pipeline_sendv( g_pipeline, type, lane, parts, count, &err );
+    else
+        echo_server_context_sendallv( server, type, parts, count, &err );
+
+    if( relay )
+        echo_peer_broadcastv( g_peers, parts, count, &err );
+}
+
+/* What a frame of a connection asks for, on its thread or on the pool. */
+void handle( echo_task_t *task )
+{
+    struct message *message;
+
+    message = ( struct message* )( ( char* )task -
+            offsetof( struct message, m_task ) );
+
+    if( message->m_type == ECHO_FRAME_DIRECT )
+    {
+        direct( message->m_server, message->m_client, message->m_payload,
+                message->m_size );
+        checkin( message );
+        return;
+    }
+
+    compose( message, message->m_client->eec_name, message->m_size );
+    enqueue( message, ECHO_LANE_INTERACTIVE );
+}
+
+/* Files are offered to the members of this node alone, a name with a NUL
+ * or a spool that cannot be made refuses the transfer. */
+void offer( echo_server_context_t *server, echo_client_context_t *client,
+        echo_transfer_t **transfer, const char *name, size_t length )
+{
+    static const char refused[ ] = "Transfer refused\n";
+    unsigned char id[ ECHO_FRAME_ID ];
+    struct iovec parts[ 4 ];
+    int err;
+
+    /* An offer ends the transfer before it. */
+    finish( server, transfer, 1 );
+
+    if( length == 0 || memchr( name, '\0', length ) != NULL ||
+            ( *transfer = echo_transfer_create( g_spool,
+                    atomic_fetch_add( &g_transfers, 1 ) + 1,
+                    &err ) ) == NULL )
+    {
+        pthread_mutex_lock( &g_lock );
+        write_to( client, ECHO_FRAME_ERROR, refused, strlen( refused ) );
+        pthread_mutex_unlock( &g_lock );
+        return;
+    }
+
+    put_id( id, ( *transfer )->et_id );
+    parts[ 0 ].iov_base = id;
+    parts[ 0 ].iov_len = ECHO_FRAME_ID;
+    parts[ 1 ].iov_base = client->eec_uname;
+    parts[ 1 ].iov_len = strlen( client->eec_uname );
+    parts[ 2 ].iov_base = "";
+    parts[ 2 ].iov_len = 1;
+    parts[ 3 ].iov_base = ( void* )name;
+    parts[ 3 ].iov_len = length;
+    post( server, ECHO_FRAME_OFFER, ECHO_LANE_BULK, parts, 4, 0 );
+
+    parts[ 0 ] = parts[ 1 ];
+    parts[ 1 ].iov_base = " sends ";
+    parts[ 1 ].iov_len = 7;
+    parts[ 2 ] = parts[ 3 ];
+    parts[ 3 ].iov_base = "\n";
+    parts[ 3 ].iov_len = 1;
+    post( server, ECHO_FRAME_TEXT, ECHO_LANE_INTERACTIVE, parts, 4, 0 );
+}
+
+/* The chunk is queued as a range of the spool, the outbox relays one chunk
+ * at a time between the chat lines. */
+int spool( echo_client_context_t *client, echo_transfer_t *transfer,
+        size_t size )
+{
+    struct message *message;
+    const char *data;
+    size_t held;
+    off_t offset;
+    int err;
+
+    if( size > ECHO_FRAME_MAX - ECHO_FRAME_ID )
+        return -1;
+
+    /* The start of the chunk may have been read ahead with its header,
+     * the rest is spliced after it. */
+    offset = transfer->et_length;
+    held = 0;
+
+    if( client->eec_reader != NULL && ( held = echo_frame_reader_take(
+                    client->eec_reader, &data, size ) ) > 0 &&
+            echo_transfer_write( transfer, data, held, &err ) == -1 )
+        return -1;
+
+    if( held < size && echo_transfer_spool( transfer,
+                client->eec_tcp->tc_socket, size - held, &err ) == -1 )
+        return -1;
+
+    if( size == 0 )
+        return 0;
+
+    /* Out of memory the chunk is lost, and with it the connection. */
+    if( ( message = malloc( sizeof( struct message ) ) ) == NULL )
+        return -1;
+
+    put_id( ( unsigned char* )message->m_prefix, transfer->et_id );
+    message->m_parts[ 0 ].iov_base = message->m_prefix;
+    message->m_parts[ 0 ].iov_len = ECHO_FRAME_ID;
+    message->m_count = 1;
+    message->m_frame = ECHO_FRAME_CHUNK;
+    message->m_relay = 0;
+    message->m_transfer = echo_transfer_hold( transfer );
+    message->m_offset = offset;
+    message->m_size = size;
+    enqueue( message, ECHO_LANE_BULK );
+
+    return 0;
+}
+
+int drop( echo_client_context_t *client, char *buffer, size_t size )
+{
+    const char *data;
+    ssize_t bytes;
+    int err;
+
+    if( client->eec_reader != NULL )
+        size -= echo_frame_reader_take( client->eec_reader, &data, size );
+
+    for( ; size > 0; size -= bytes )
+    {
+        if( ( bytes = tcp_context_recv( client->eec_tcp, buffer,
+                        size < BUFFER_SIZE ? size : BUFFER_SIZE,
+                        &err ) ) <= 0 )
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Receivers learn whether the file came whole, status 0, or not. */
+void finish( echo_server_context_t *server, echo_transfer_t **transfer,
+        int status )
+{
+    unsigned char end[ ECHO_FRAME_ID + 1 ];
+    struct iovec part;
+
+    if( *transfer == NULL )
+        return;
+
+    put_id( end, ( *transfer )->et_id );
+    end[ ECHO_FRAME_ID ] = status;
+    part.iov_base = end;
+    part.iov_len = sizeof( end );
+    post( server, ECHO_FRAME_END, ECHO_LANE_BULK, &part, 1, 0 );
+
+    echo_transfer_put( *transfer );
+    *transfer = NULL;
+}
+
+/* Called with the lock held. The kernel copies the chunk from the spool to
+ * each member, the writers batch and compress and so get it read back. */
+void relay_chunk( echo_server_context_t *server, struct message *message )
+{
+    echo_transfer_t *transfer;
+    struct iovec parts[ 2 ];
+    char *data;
+    int err;
+
+    transfer = message->m_transfer;
+    ECHO_TRACE( FLUSH, ECHO_FRAME_CHUNK, ECHO_LANE_BULK,
+            message->m_lane.eln_size );
+
+    if( g_pipeline == NULL )
+    {
+        echo_server_context_sendfile( server, ECHO_FRAME_CHUNK,
+                message->m_parts, message->m_count, transfer->et_spool,
+                message->m_offset, message->m_size, &err );
+    }
+    else if( ( data = malloc( message->m_size ) ) != NULL )
+    {
+        if( echo_transfer_read( transfer, message->m_offset, data,
+                    message->m_size, &err ) == 0 )
+        {
+            parts[ 0 ] = message->m_parts[ 0 ];
+            parts[ 1 ].iov_base = data;
+            parts[ 1 ].iov_len = message->m_size;
+            echo_pipeline_sendv( g_pipeline, ECHO_FRAME_CHUNK,
+                    ECHO_LANE_BULK, parts, 2, &err );
+        }
+
+        free( data );
+    }
+
+    echo_transfer_discard( transfer, message->m_offset, message->m_size );
+    echo_transfer_put( transfer );
+}
+
+void put_id( unsigned char *buffer, uint32_t id )
+{
+    buffer[ 0 ] = id >> 24;
+    buffer[ 1 ] = id >> 16;
+    buffer[ 2 ] = id >> 8;
+    buffer[ 3 ] = id;
+}
+
+/* A full ring drops the record, the count is in the log. */
+void capture( uint32_t connection, int type, int flags, const char *payload,
+        size_t length )
+{
+    int err;
+
+    if( g_capture != NULL )
+        echo_capture_record( g_capture, connection, type, flags, payload,
+                length, &err );
+}
+
+/* With writers running only they write to the members. Called with the
+ * lock held. */
+void write_to( echo_client_context_t *client, int type, const char *text,
+        size_t size )
+{
+    struct iovec part;
+
+    part.iov_base = ( void* )text;
+    part.iov_len = size;
+    write_tov( client, type, &part, 1 );
+}
+
+void write_tov( echo_client_context_t *client, int type,
+        const struct iovec *parts, int count )
+{
+    int err;
+
+    if( g_pipeline != NULL )
+        echo_pipeline_sendtov( g_pipeline, client, type, parts, count,
+                &err );
+    else
+        echo_client_context_sendv( client, type, parts, count, &err );
+}
+
+/* Private messages go through the recipient's own connection and are
+ * never relayed, members of other nodes count as offline. */
+void direct( echo_server_context_t *server, echo_client_context_t *client,
+        const char *payload, size_t size )
+{
+    echo_client_context_t *peer;
+    struct iovec parts[ 4 ];
+    char to[ MAX_LENGTH ];
+    size_t length;
+    int err;
+
+    if( size == 0 || ( length = ( unsigned char )payload[ 0 ] ) == 0 ||
+            length >= MAX_LENGTH || 1 + length >= size )
+        return;
+
+    memcpy( to, payload + 1, length );
+    to[ length ] = '\0';
+
+    pthread_mutex_lock( &g_lock );
+
+    /* The line is sent in parts, the text straight from the sender's
+     * buffer. */
+    if( ( peer = echo_server_context_find( server, to, &err ) ) != NULL )
+    {
+        parts[ 0 ].iov_base = client->eec_uname;
+        parts[ 0 ].iov_len = strlen( client->eec_uname );
+        parts[ 1 ].iov_base = " whispers:\n";
+        parts[ 1 ].iov_len = 11;
+        parts[ 2 ].iov_base = ( void* )( payload + 1 + length );
+        parts[ 2 ].iov_len = size - 1 - length;
+        parts[ 3 ].iov_base = "\n";
+        parts[ 3 ].iov_len = 1;
+        write_tov( peer, ECHO_FRAME_TEXT, parts, 4 );
+        echo_stats_add( ECHO_STAT_DIRECT_SENT, 1 );
+    }
+    else if( err == ENOTFOUND )
+    {
+        echo_stats_add( ECHO_STAT_DIRECT_OFFLINE, 1 );
+        parts[ 0 ].iov_base = to;
+        parts[ 0 ].iov_len = length;
+        parts[ 1 ].iov_base = " is not online\n";
+        parts[ 1 ].iov_len = 15;
+        write_tov( client, ECHO_FRAME_ERROR, parts, 2 );
+    }
+
+    pthread_mutex_unlock( &g_lock );
+}
+
+/* Another node held the name first, its local holder is told and cut off
+ * as if kicked. */
+void revoke_login( const char *uname, void *arg )
+{
+    cut_off( ( echo_server_context_t* )arg, uname,
+            "Username already taken\n" );
+}
+
+/* The member is told why and its connection shut down, which lets its
+ * thread clean up as on any logout. Returns whether it was online. */
+int cut_off( echo_server_context_t *server, const char *uname,
+        const char *notice )
+{
+    echo_client_context_t *client;
+    int err;
+
+    pthread_mutex_lock( &g_lock );
+    client = echo_server_context_find( server, uname, &err );
+
+    if( client != NULL )
+    {
+        write_to( client, ECHO_FRAME_TEXT, notice, strlen( notice ) );
+
+        if( g_pipeline != NULL )
+            echo_pipeline_close( g_pipeline, client, &err );
+        else
+            shutdown( client->eec_tcp->tc_socket, SHUT_RDWR );
+    }
+
+    pthread_mutex_unlock( &g_lock );
+
+    return client != NULL;
+}
+
+/* Lines over the rate wait their turn: the connection is not read in the
+ * meantime and TCP holds its sender back. A second's worth may come at
+ * once. due is when the next line is owed, a member that went quiet is
+ * not owed more than that second. */
+void pace( double *due )
+{
+    double now, interval, wait;
+    struct timespec ts;
+    unsigned int rate;
+
+    if( ( rate = atomic_load_explicit( &g_rate,
+                    memory_order_relaxed ) ) == 0 )
+        return;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    now = ts.tv_sec + ts.tv_nsec / 1e9;
+    interval = 1.0 / rate;
+
+    if( *due < now )
+        *due = now;
+
+    if( ( wait = *due - now - ( 1.0 - interval ) ) > 0 )
+    {
+        ts.tv_sec = ( time_t )wait;
+        ts.tv_nsec = ( long )( ( wait - ts.tv_sec ) * 1e9 );
+        nanosleep( &ts, NULL );
+    }
+
+    *due += interval;
+}
+
+/* Past the limit on the outbox's queue a connection is not read until it
+ * catches up, which holds its sender back instead of letting the queue
+ * and the buffers grow. */
+void hold_back( void )
+{
+    if( g_queue_limit == 0 ||
+            echo_queue_depth( g_outbox, NULL ) < g_queue_limit )
+        return;
+
+    atomic_fetch_add_explicit( &g_queue_waits, 1, memory_order_relaxed );
+
+    /* The outbox signals under the lock after it pops, so a drain between
+     * the check and the wait is not missed. */
+    pthread_mutex_lock( &g_room_lock );
+
+    while( echo_queue_depth( g_outbox, NULL ) >= g_queue_limit )
+    {
+        pthread_cond_wait( &g_room, &g_room_lock );
+    }
+
+    pthread_mutex_unlock( &g_room_lock );
+}
+
+/* Only --config FILE and --config=FILE, it is read before getopt runs. */
+const char *config_path( int argc, char *argv[ ] )
+{
+    int i;
+
+    for( i = 1; i < argc && strcmp( argv[ i ], "--" ) != 0; i++ )
+    {
+        if( strcmp( argv[ i ], "--config" ) == 0 && i + 1 < argc )
+            return argv[ i + 1 ];
+
+        if( strncmp( argv[ i ], "--config=", 9 ) == 0 )
+            return argv[ i ] + 9;
+    }
+
+    return NULL;
+}
+
+/* Lines past the level set are not written. */
+void say( int level, const char *format, ... )
+{
+    va_list args;
+
+    if( level > atomic_load_explicit( &g_log_level, memory_order_relaxed ) )
+        return;
+
+    va_start( args, format );
+    vfprintf( logfile, format, args );
+    va_end( args );
+}
+
+int level_of( const char *name )
+{
+    int level;
+
+    for( level = LOG_ERROR; level <= LOG_DEBUG; level++ )
+    {
+        if( strcmp( name, g_levels[ level ] ) == 0 )
+            return level;
+    }
+
+    return -1;
+}
+
+/* Runs on the admin thread. A kick takes the lock to find the member, the
+ * other commands only read counters their owners update without one, or
+ * store a setting the connection threads load on their next frame. */
+const char *command( int argc, char *argv[ ], FILE *out, void *arg )
+{
+    unsigned long rate;
+    char *end;
+    int level;
+
+    if( strcmp( argv[ 0 ], "sessions" ) == 0 && argc == 1 )
+    {
+        list_sessions( out );
+    }
+    else if( strcmp( argv[ 0 ], "kick" ) == 0 && argc == 2 )
+    {
+        if( !cut_off( ( echo_server_context_t* )arg, argv[ 1 ],
+                    "Removed by the operator\n" ) )
+            return "not online";
+
+        say( LOG_INFO, "%s kicked\n", argv[ 1 ] );
+    }
+    else if( strcmp( argv[ 0 ], "rate" ) == 0 && argc <= 2 )
+    {
+        if( argc == 2 )
+        {
+            rate = strtoul( argv[ 1 ], &end, 10 );
+
+            if( *end != '\0' || argv[ 1 ][ 0 ] == '-' || rate > UINT_MAX )
+                return "invalid rate";
+
+            atomic_store( &g_rate, rate );
+            say( LOG_INFO, "Rate set to %lu lines per second\n", rate );
+        }
+
+        fprintf( out, "rate=%u\n", atomic_load( &g_rate ) );
+    }
+    else if( strcmp( argv[ 0 ], "log" ) == 0 && argc <= 2 )
+    {
+        if( argc == 2 )
+        {
+            if( ( level = level_of( argv[ 1 ] ) ) == -1 )
+                return "unknown level";
+
+            atomic_store( &g_log_level, level );
+        }
+
+        fprintf( out, "log=%s\n", g_levels[ atomic_load( &g_log_level ) ] );
+    }
+    else if( strcmp( argv[ 0 ], "stats" ) == 0 && argc == 1 )
+    {
+        report( out );
+    }
+    else if( strcmp( argv[ 0 ], "stop" ) == 0 && argc == 1 )
+    {
+        if( write( g_wake[ 1 ], "", 1 ) == -1 )
+            return "cannot stop";
+    }
+    else if( strcmp( argv[ 0 ], "help" ) == 0 && argc == 1 )
+    {
+        fprintf( out, "sessions\nkick NAME\nrate [LINES]\n"
+                "log [error|info|debug]\nstats\nstop\n" );
+    }
+    else
+    {
+        return "unknown command or arguments, see help";
+    }
+
+    return NULL;
+}
+
+/* The queues are the kernel's for the socket: input not read yet, and
+ * output not acknowledged yet. They are asked after the copy and left out
+ * if the slot changed meanwhile, the descriptor may be another's then. */
+void list_sessions( FILE *out )
+{
+    echo_admin_session_t *session;
+    echo_admin_view_t view;
+    int recvq, sendq;
+    size_t count, i;
+    time_t now;
+
+    now = time( NULL );
+
+    for( count = 0, i = 0; i < ECHO_ADMIN_SLOTS; i++ )
+    {
+        session = echo_admin_slot( g_admin, i );
+
+        if( !echo_admin_view( session, &view ) )
+            continue;
+
+        if( ioctl( view.eav_fd, FIONREAD, &recvq ) == -1 )
+            recvq = -1;
+
+        if( ioctl( view.eav_fd, TIOCOUTQ, &sendq ) == -1 )
+            sendq = -1;
+
+        if( !echo_admin_same( session, &view ) )
+            continue;
+
+        fprintf( out, "id=%u name=%s fd=%d seconds=%lld frames=%llu "
+                "bytes=%llu recvq=%d sendq=%d\n", view.eav_id,
+                view.eav_name, view.eav_fd,
+                ( long long )( now - view.eav_since ), view.eav_frames,
+                view.eav_bytes, recvq, sendq );
+        count++;
+    }
+
+    fprintf( out, "sessions=%zu\n", count );
+}
+
+/* What server.log gets on exit, as it stands, less what takes a lock. */
+void report( FILE *out )
+{
+    echo_lane_usage_t lanes[ ECHO_LANE_MAX ];
+    size_t depth, peak;
+    int i;
+
+    echo_stats_dump( out );
+    depth = echo_queue_depth( g_outbox, &peak );
+    fprintf( out, "router_depth=%zu\nrouter_peak=%zu\n", depth, peak );
+    memset( lanes, 0, sizeof( lanes ) );
+
+    for( i = 0; i < ECHO_LANE_MAX; i++ )
+    {
+        echo_lanes_usage( &g_lanes, i, &lanes[ i ] );
+    }
+
+    echo_lane_report( lanes, "router_", out );
+
+    if( g_pool != NULL )
+        echo_pool_report( g_pool, out );
+
+    if( g_pipeline != NULL )
+        echo_pipeline_report( g_pipeline, out );
+
+    /* Connections add theirs as they end. */
+    if( g_read_ahead > 0 )
+        fprintf( out, "read_ahead_calls=%llu\nread_ahead_frames=%llu\n",
+                atomic_load( &g_read_calls ), atomic_load( &g_read_frames ) );
+
+    if( g_capture != NULL )
+        fprintf( out, "capture_dropped=%llu\n",
+                echo_capture_dropped( g_capture ) );
+
+    if( g_queue_limit > 0 )
+        fprintf( out, "queue_limit=%zu\nqueue_waits=%llu\n", g_queue_limit,
+                atomic_load( &g_queue_waits ) );
+
+    fprintf( out, "connections=%u\n", atomic_load( &g_connections ) );
+}
+
+/* Input on stdin, or its end, stops the server, and so does the stop
+ * command of the admin socket. */
+void wait_stop( void )
+{
+    struct pollfd pfds[ 2 ];
+
+    pfds[ 0 ].fd = STDIN_FILENO;
+    pfds[ 0 ].events = POLLIN;
+    pfds[ 1 ].fd = g_wake[ 0 ];
+    pfds[ 1 ].events = POLLIN;
+
+    while( poll( pfds, 2, -1 ) == -1 && errno == EINTR )
+        ;
+}
+
+struct message *checkout( void )
+{
+    struct message *message;
+    int err;
+
+    if( g_arena != NULL && ( message = echo_arena_get( g_arena,
+                    &err ) ) != NULL )
+        return message;
+
+    /* Past the arena's size buffers are allocated one by one. */
+    return malloc( sizeof( struct message ) + BUFFER_SIZE );
+}
+
+/* Takes back received and posted messages alike. */
+void checkin( struct message *message )
+{
+    if( g_arena != NULL && message != NULL && echo_arena_owns( g_arena,
+                message ) )
+    {
+        echo_arena_put( g_arena, message );
+    }
+    else
+    {
+        free( message );
+    }
+}
+
+char *borrow( void )
+{
+    char *buffer;
+    int err;
+
+    if( g_readers != NULL && ( buffer = echo_arena_get( g_readers,
+                    &err ) ) != NULL )
+        return buffer;
+
+    return malloc( g_read_ahead );
+}
+
+void give_back( char *buffer )
+{
+    if( g_readers != NULL && echo_arena_owns( g_readers, buffer ) )
+        echo_arena_put( g_readers, buffer );
+    else
+        free( buffer );
+}
+
+int connect_peer( const char *peer, int *err )
+{
+    char host[ 256 ];
+    const char *colon;
+    size_t length;
+
+    if( ( colon = strrchr( peer, ':' ) ) == NULL ||
+            ( length = colon - peer ) >= sizeof( host ) )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    /* [::1]:5000 names an IPv6 peer. */
+    if( length >= 2 && peer[ 0 ] == '[' && peer[ length - 1 ] == ']' )
+    {
+        peer++;
+        length -= 2;
+    }
+
+    memcpy( host, peer, length );
+    host[ length ] = '\0';
+
+    return echo_peer_connect( g_peers, host, atoi( colon + 1 ), err );
 }
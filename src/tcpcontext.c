@@ -1,12 +1,161 @@
+#define _GNU_SOURCE
 #include "tcpcontext.h"
+#include "echostats.h"
 #include <pthread.h>
 #include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
-static pthread_mutex_t g_errno_lock = PTHREAD_MUTEX_INITIALIZER;
+#define RESOLVE_BUCKETS 64
+#define RESOLVE_ADDRS   4
+
+/* A resolved host and port, cached until its expiry */
+struct resolve_entry
+{
+    char re_host[ 256 ];
+    int re_port;
+    time_t re_expiry;
+    int re_count;
+    struct sockaddr_storage re_addrs[ RESOLVE_ADDRS ];
+    socklen_t re_lens[ RESOLVE_ADDRS ];
+};
+
+static pthread_rwlock_t g_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct resolve_entry g_cache[ RESOLVE_BUCKETS ];
+static pthread_mutex_t g_reserve_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_reserve = -2;
+
+static int resolve( const char *host, int port, struct resolve_entry *entry,
+        int *err );
+static unsigned int resolve_hash( const char *host, int port );
+static int bind_family( tcp_context_t *ctx, int family, int port );
+static int record_error( int errnum );
+static int shed( int listener );
+static void apply_listener( tcp_context_t *ctx );
+static void apply_connection( tcp_context_t *ctx );
+static void set_option( int socket, int level, int name, int value );
+
+/* Options a profile specification may set, by name */
+static const struct
+{
+    const char *po_name;
+    size_t po_offset;
+} g_options[ ] =
+{
+    { "nodelay", offsetof( tcp_profile_t, tp_nodelay ) },
+    { "quickack", offsetof( tcp_profile_t, tp_quickack ) },
+    { "sndbuf", offsetof( tcp_profile_t, tp_sndbuf ) },
+    { "rcvbuf", offsetof( tcp_profile_t, tp_rcvbuf ) },
+    { "defer_accept", offsetof( tcp_profile_t, tp_defer_accept ) },
+    { "fastopen", offsetof( tcp_profile_t, tp_fastopen ) },
+    { "busy_poll", offsetof( tcp_profile_t, tp_busy_poll ) },
+    { "notsent_lowat", offsetof( tcp_profile_t, tp_notsent_lowat ) }
+};
 
 void tcp_context_strerror( int errnum, char *buf, size_t buflen )
 {
-    strerror_r( errnum, buf, buflen );
+    const char *message;
+
+    if( errnum == EHOSTNOTFOUND )
+    {
+        strncpy( buf, "Host name could not be resolved", buflen );
+    }
+    else
+    {
+        message = strerror_r( errnum, buf, buflen );
+
+        /* The GNU variant may hand back a static string instead. */
+        if( message != buf )
+            snprintf( buf, buflen, "%s", message );
+    }
+}
+
+void tcp_profile_get( int name, tcp_profile_t *profile )
+{
+    memset( profile, 0, sizeof( tcp_profile_t ) );
+
+    if( name == TCP_PROFILE_LATENCY )
+    {
+        /* Frames leave as soon as they are written and the send queue is
+         * kept short, logins are accepted once their HELLO arrived. */
+        profile->tp_nodelay = 1;
+        profile->tp_quickack = 1;
+        profile->tp_defer_accept = 1;
+        profile->tp_fastopen = 256;
+        profile->tp_notsent_lowat = 16384;
+    }
+    else if( name == TCP_PROFILE_THROUGHPUT )
+    {
+        profile->tp_sndbuf = 4 * 1024 * 1024;
+        profile->tp_rcvbuf = 4 * 1024 * 1024;
+        profile->tp_defer_accept = 1;
+    }
+}
+
+int tcp_profile_parse( const char *spec, tcp_profile_t *profile, int *err )
+{
+    static const char *names[ ] = { "default", "latency", "throughput" };
+    const char *item, *equal, *end;
+    size_t length, i;
+    long value;
+    char *stop;
+
+    tcp_profile_get( TCP_PROFILE_DEFAULT, profile );
+
+    for( item = spec; *item != '\0'; item = *end == ',' ? end + 1 : end )
+    {
+        if( ( end = strchr( item, ',' ) ) == NULL )
+            end = item + strlen( item );
+
+        length = end - item;
+
+        if( ( equal = memchr( item, '=', length ) ) == NULL )
+        {
+            /* Only the first item may name a profile. */
+            for( i = 0; item == spec && i < 3; i++ )
+            {
+                if( strlen( names[ i ] ) == length &&
+                        strncmp( item, names[ i ], length ) == 0 )
+                    break;
+            }
+
+            if( item != spec || i == 3 )
+            {
+                *err = EINVAL;
+                return -1;
+            }
+
+            tcp_profile_get( i, profile );
+            continue;
+        }
+
+        for( i = 0; i < sizeof( g_options ) / sizeof( g_options[ 0 ] ); i++ )
+        {
+            if( strlen( g_options[ i ].po_name ) == ( size_t )( equal - item )
+                    && strncmp( item, g_options[ i ].po_name,
+                        equal - item ) == 0 )
+                break;
+        }
+
+        errno = 0;
+        value = strtol( equal + 1, &stop, 10 );
+
+        if( i == sizeof( g_options ) / sizeof( g_options[ 0 ] ) ||
+                stop == equal + 1 || stop != end || errno != 0 ||
+                value < 0 || value > 1 << 30 )
+        {
+            *err = EINVAL;
+            return -1;
+        }
+
+        *( int* )( ( char* )profile + g_options[ i ].po_offset ) =
+            ( int )value;
+    }
+
+    return 0;
 }
 
 tcp_context_t *tcp_context_create( int *err )
@@ -19,13 +168,10 @@ tcp_context_t *tcp_context_create( int *err )
         return NULL;
     }
 
-    ctx->tc_socket = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
-
-    if( ctx->tc_socket == -1 )
-    {
-        free( ctx );
-        return NULL;
-    }
+    memset( &ctx->tc_addr, 0, sizeof( ctx->tc_addr ) );
+    ctx->tc_addrlen = 0;
+    ctx->tc_socket = -1;
+    tcp_profile_get( TCP_PROFILE_DEFAULT, &ctx->tc_profile );
 
     return ctx;
 }
@@ -33,59 +179,192 @@ tcp_context_t *tcp_context_create( int *err )
 int tcp_context_connect( tcp_context_t *ctx, const char *host, int port,
        int *err )
 {
-    struct hostent *ent;
+    struct resolve_entry entry;
+    int i;
 
-    if( ctx == NULL || host == NULL || port > 65535 )
+    if( ctx == NULL || host == NULL || port < 0 || port > 65535 ||
+            ctx->tc_socket != -1 )
     {
         *err = EINVAL;
         return -1;
     }
 
-    if( ( ent = gethostbyname( host ) ) == NULL )
+    if( resolve( host, port, &entry, err ) == -1 )
+        return -1;
+
+    for( i = 0; i < entry.re_count; i++ )
     {
-        pthread_mutex_lock( &g_errno_lock );
-        *err = h_errno;
-        pthread_mutex_unlock( &g_errno_lock );
+        ctx->tc_socket = socket( entry.re_addrs[ i ].ss_family,
+                SOCK_STREAM, IPPROTO_TCP );
+
+        if( ctx->tc_socket == -1 )
+        {
+            *err = record_error( errno );
+            continue;
+        }
+
+        if( connect( ctx->tc_socket,
+                    ( struct sockaddr* )&entry.re_addrs[ i ],
+                    entry.re_lens[ i ] ) == 0 )
+        {
+            memcpy( &ctx->tc_addr, &entry.re_addrs[ i ], entry.re_lens[ i ] );
+            ctx->tc_addrlen = entry.re_lens[ i ];
+            return 0;
+        }
+
+        *err = record_error( errno );
+        close( ctx->tc_socket );
+        ctx->tc_socket = -1;
+    }
+
+    return -1;
+}
+
+int tcp_context_connect_start( tcp_context_t *ctx, const char *host,
+        int port, int *err )
+{
+    struct resolve_entry entry;
+    int i;
+
+    if( ctx == NULL || host == NULL || port < 0 || port > 65535 ||
+            ctx->tc_socket != -1 )
+    {
+        *err = EINVAL;
         return -1;
     }
 
-    memset( &ctx->tc_addr, 0, sizeof( ctx->tc_addr ) );
-    memcpy( &ctx->tc_addr.sin_addr, ent->h_addr_list[ 0 ], ent->h_length );
-    ctx->tc_addr.sin_family = AF_INET;
-    ctx->tc_addr.sin_port = htons( port );
+    if( resolve( host, port, &entry, err ) == -1 )
+        return -1;
+
+    for( i = 0; i < entry.re_count; i++ )
+    {
+        ctx->tc_socket = socket( entry.re_addrs[ i ].ss_family,
+                SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP );
+
+        if( ctx->tc_socket == -1 )
+        {
+            *err = record_error( errno );
+            continue;
+        }
+
+        memcpy( &ctx->tc_addr, &entry.re_addrs[ i ], entry.re_lens[ i ] );
+        ctx->tc_addrlen = entry.re_lens[ i ];
+
+        if( connect( ctx->tc_socket, ( struct sockaddr* )&ctx->tc_addr,
+                    ctx->tc_addrlen ) == 0 )
+            return 0;
+
+        if( errno == EINPROGRESS )
+        {
+            *err = EINPROGRESS;
+            return -1;
+        }
+
+        *err = record_error( errno );
+        close( ctx->tc_socket );
+        ctx->tc_socket = -1;
+    }
 
-    return connect( ctx->tc_socket, ( struct sockaddr* )&ctx->tc_addr,
-            sizeof( ctx->tc_addr ) );
+    return -1;
 }
 
-int tcp_context_bind( tcp_context_t *ctx, int port, int *err )
+int tcp_context_connect_finish( tcp_context_t *ctx, int *err )
 {
-    int retval, optval;
+    socklen_t size;
+    int error;
 
-    if( ctx == NULL || port > 65535 )
+    if( ctx == NULL || ctx->tc_socket == -1 )
     {
         *err = EINVAL;
         return -1;
     }
 
-    optval = 1;
-    setsockopt( ctx->tc_socket, SOL_SOCKET, SO_REUSEADDR, &optval,
-            sizeof( optval ) );
+    size = sizeof( error );
 
-    memset( &ctx->tc_addr, 0, sizeof( ctx->tc_addr ) );
-    ctx->tc_addr.sin_addr.s_addr = INADDR_ANY;
-    ctx->tc_addr.sin_family = AF_INET;
-    ctx->tc_addr.sin_port = htons( port );
+    if( getsockopt( ctx->tc_socket, SOL_SOCKET, SO_ERROR, &error,
+                &size ) == -1 )
+    {
+        *err = record_error( errno );
+        return -1;
+    }
 
-    if( ( retval = bind( ctx->tc_socket, ( struct sockaddr* )&ctx->tc_addr,
-                sizeof( ctx->tc_addr ) ) ) == -1 )
+    if( error != 0 )
     {
-        pthread_mutex_lock( &g_errno_lock );
-        *err = errno;
-        pthread_mutex_unlock( &g_errno_lock );
+        *err = record_error( error );
+        return -1;
     }
 
-    return retval;
+    return 0;
+}
+
+int tcp_context_transient( int errnum )
+{
+    return errnum == EAGAIN || errnum == EWOULDBLOCK || errnum == EINTR;
+}
+
+int tcp_context_set_blocking( tcp_context_t *ctx, int blocking, int *err )
+{
+    int flags;
+
+    if( ctx == NULL || ctx->tc_socket == -1 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    if( ( flags = fcntl( ctx->tc_socket, F_GETFL ) ) == -1 )
+    {
+        *err = record_error( errno );
+        return -1;
+    }
+
+    flags = blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK;
+
+    if( fcntl( ctx->tc_socket, F_SETFL, flags ) == -1 )
+    {
+        *err = record_error( errno );
+        return -1;
+    }
+
+    return 0;
+}
+
+int tcp_context_set_profile( tcp_context_t *ctx,
+        const tcp_profile_t *profile, int *err )
+{
+    if( ctx == NULL || profile == NULL )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    ctx->tc_profile = *profile;
+
+    if( ctx->tc_socket != -1 )
+        apply_connection( ctx );
+
+    return 0;
+}
+
+int tcp_context_bind( tcp_context_t *ctx, int port, int *err )
+{
+    if( ctx == NULL || port < 0 || port > 65535 || ctx->tc_socket != -1 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    /* Prefer a dual-stack IPv6 socket, which accepts IPv4 clients as
+     * mapped addresses, and fall back to IPv4 when any step of it fails,
+     * as on hosts booted without IPv6. */
+    if( bind_family( ctx, AF_INET6, port ) == -1 &&
+            bind_family( ctx, AF_INET, port ) == -1 )
+    {
+        *err = record_error( errno );
+        return -1;
+    }
+
+    return 0;
 }
 
 int tcp_context_listen( tcp_context_t *ctx, int backlog, int *err )
@@ -98,11 +377,30 @@ int tcp_context_listen( tcp_context_t *ctx, int backlog, int *err )
         return -1;
     }
 
-    if( ( retval = listen( ctx->tc_socket, backlog ) ) == -1 )
+    apply_listener( ctx );
+
+    /* The reserve used to shed connections once descriptors run out. */
+    pthread_mutex_lock( &g_reserve_lock );
+
+    if( g_reserve == -2 )
+        g_reserve = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+
+    pthread_mutex_unlock( &g_reserve_lock );
+
+    retval = listen( ctx->tc_socket, backlog );
+
+    /* Bound but unable to listen on IPv6, IPv4 may still do. */
+    if( retval == -1 && ctx->tc_addr.ss_family == AF_INET6 &&
+            bind_family( ctx, AF_INET, ntohs( ( ( struct sockaddr_in6* )
+                        &ctx->tc_addr )->sin6_port ) ) == 0 )
+    {
+        apply_listener( ctx );
+        retval = listen( ctx->tc_socket, backlog );
+    }
+
+    if( retval == -1 )
     {
-        pthread_mutex_lock( &g_errno_lock );
-        *err = errno;
-        pthread_mutex_unlock( &g_errno_lock );
+        *err = record_error( errno );
     }
 
     return retval;
@@ -125,26 +423,95 @@ tcp_context_t *tcp_context_accept( const tcp_context_t *ctx, int *err )
         return NULL;
     }
 
-    size = sizeof( client->tc_addr );
-    client->tc_socket = accept( ctx->tc_socket,
-            ( struct sockaddr* )&client->tc_addr, &size );
+    do
+    {
+        size = sizeof( client->tc_addr );
+        client->tc_socket = accept( ctx->tc_socket,
+                ( struct sockaddr* )&client->tc_addr, &size );
+    }
+    while( client->tc_socket == -1 &&
+            ( *err = record_error( errno ) ) == EINTR );
 
     if( client->tc_socket == -1 )
     {
-        pthread_mutex_lock( &g_errno_lock );
-        *err = errno;
-        pthread_mutex_unlock( &g_errno_lock );
         free( client );
         return NULL;
     }
 
+    client->tc_addrlen = size;
+    client->tc_profile = ctx->tc_profile;
+    apply_connection( client );
+
     return client;
 }
 
+ssize_t tcp_context_accept_batch( const tcp_context_t *ctx,
+        tcp_context_t **clients, size_t max, int flags, int *err )
+{
+    struct sockaddr_storage addr;
+    tcp_context_t *client;
+    socklen_t size;
+    size_t count;
+    int fd;
+
+    if( ctx == NULL || clients == NULL || max == 0 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    for( count = 0; count < max; )
+    {
+        size = sizeof( addr );
+        fd = accept4( ctx->tc_socket, ( struct sockaddr* )&addr, &size,
+                SOCK_CLOEXEC |
+                ( flags & TCP_ACCEPT_NONBLOCK ? SOCK_NONBLOCK : 0 ) );
+
+        if( fd == -1 )
+        {
+            *err = record_error( errno );
+
+            /* Connections reset while queued are skipped. */
+            if( *err == EINTR || *err == ECONNABORTED || *err == EPROTO )
+                continue;
+
+            if( *err == EMFILE || *err == ENFILE )
+            {
+                if( shed( ctx->tc_socket ) == 0 )
+                    echo_stats_add( ECHO_STAT_ACCEPT_SHED, 1 );
+            }
+
+            break;
+        }
+
+        if( ( client = malloc( sizeof( tcp_context_t ) ) ) == NULL )
+        {
+            close( fd );
+            *err = ENOMEM;
+            break;
+        }
+
+        memcpy( &client->tc_addr, &addr, size );
+        client->tc_addrlen = size;
+        client->tc_socket = fd;
+        client->tc_profile = ctx->tc_profile;
+        apply_connection( client );
+        clients[ count++ ] = client;
+    }
+
+    if( count == 0 )
+        return -1;
+
+    echo_stats_add( ECHO_STAT_ACCEPTS, count );
+    echo_stats_add( ECHO_STAT_ACCEPT_BATCHES, 1 );
+
+    return count;
+}
+
 ssize_t tcp_context_send( tcp_context_t *ctx, const char *buffer,
         size_t size, int *err )
 {
-    int retval;
+    ssize_t retval;
 
     if( ctx == NULL || buffer == NULL || size == 0 )
     {
@@ -152,11 +519,37 @@ ssize_t tcp_context_send( tcp_context_t *ctx, const char *buffer,
         return -1;
     }
 
-    if( ( retval = send( ctx->tc_socket, buffer, size, 0 ) ) == -1 )
+    while( ( retval = send( ctx->tc_socket, buffer, size,
+                    MSG_NOSIGNAL ) ) == -1 )
     {
-        pthread_mutex_lock( &g_errno_lock );
-        *err = errno;
-        pthread_mutex_unlock( &g_errno_lock );
+        if( ( *err = record_error( errno ) ) != EINTR )
+            break;
+    }
+
+    return retval;
+}
+
+ssize_t tcp_context_sendv( tcp_context_t *ctx, const struct iovec *iov,
+        int iovcnt, int *err )
+{
+    struct msghdr msg;
+    ssize_t retval;
+
+    if( ctx == NULL || iov == NULL || iovcnt <= 0 )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = ( struct iovec* )iov;
+    msg.msg_iovlen = iovcnt;
+
+    while( ( retval = sendmsg( ctx->tc_socket, &msg,
+                    MSG_NOSIGNAL ) ) == -1 )
+    {
+        if( ( *err = record_error( errno ) ) != EINTR )
+            break;
     }
 
     return retval;
@@ -165,7 +558,7 @@ ssize_t tcp_context_send( tcp_context_t *ctx, const char *buffer,
 ssize_t tcp_context_recv( tcp_context_t *ctx, char *buffer, size_t size,
        int *err )
 {
-    int retval;
+    ssize_t retval;
 
     if( ctx == NULL || buffer == NULL || size == 0 )
     {
@@ -173,11 +566,10 @@ ssize_t tcp_context_recv( tcp_context_t *ctx, char *buffer, size_t size,
         return -1;
     }
 
-    if( ( retval = recv( ctx->tc_socket, buffer, size, 0 ) ) == -1 )
+    while( ( retval = recv( ctx->tc_socket, buffer, size, 0 ) ) == -1 )
     {
-        pthread_mutex_lock( &g_errno_lock );
-        *err = errno;
-        pthread_mutex_unlock( &g_errno_lock );
+        if( ( *err = record_error( errno ) ) != EINTR )
+            break;
     }
 
     return retval;
@@ -185,7 +577,262 @@ ssize_t tcp_context_recv( tcp_context_t *ctx, char *buffer, size_t size,
 
 void tcp_context_destroy( tcp_context_t *ctx )
 {
-    shutdown( ctx->tc_socket, SHUT_RDWR );
-    close( ctx->tc_socket );
+    if( ctx->tc_socket != -1 )
+    {
+        shutdown( ctx->tc_socket, SHUT_RDWR );
+        close( ctx->tc_socket );
+    }
+
     free( ctx );
 }
+
+void tcp_context_flush_cache( void )
+{
+    int i;
+
+    pthread_rwlock_wrlock( &g_cache_lock );
+
+    for( i = 0; i < RESOLVE_BUCKETS; i++ )
+    {
+        g_cache[ i ].re_expiry = 0;
+    }
+
+    pthread_rwlock_unlock( &g_cache_lock );
+}
+
+int resolve( const char *host, int port, struct resolve_entry *entry,
+        int *err )
+{
+    struct addrinfo hints, *res, *ai;
+    struct resolve_entry *slot;
+    char service[ 8 ];
+    time_t now;
+    int retval;
+
+    if( strlen( host ) >= sizeof( entry->re_host ) )
+    {
+        *err = EINVAL;
+        return -1;
+    }
+
+    now = time( NULL );
+    slot = &g_cache[ resolve_hash( host, port ) % RESOLVE_BUCKETS ];
+
+    pthread_rwlock_rdlock( &g_cache_lock );
+
+    if( slot->re_expiry > now && slot->re_port == port &&
+            strcmp( slot->re_host, host ) == 0 )
+    {
+        memcpy( entry, slot, sizeof( struct resolve_entry ) );
+        pthread_rwlock_unlock( &g_cache_lock );
+        return 0;
+    }
+
+    pthread_rwlock_unlock( &g_cache_lock );
+
+    /* The lookup itself runs unlocked; concurrent misses on the same name
+     * simply race to fill the slot with equivalent answers. */
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    sprintf( service, "%d", port );
+
+    if( ( retval = getaddrinfo( host, service, &hints, &res ) ) != 0 )
+    {
+        *err = retval == EAI_SYSTEM ? errno : EHOSTNOTFOUND;
+        return -1;
+    }
+
+    memset( entry, 0, sizeof( struct resolve_entry ) );
+    strcpy( entry->re_host, host );
+    entry->re_port = port;
+    entry->re_expiry = now + TCP_RESOLVE_TTL;
+
+    for( ai = res; ai != NULL && entry->re_count < RESOLVE_ADDRS;
+            ai = ai->ai_next )
+    {
+        memcpy( &entry->re_addrs[ entry->re_count ], ai->ai_addr,
+                ai->ai_addrlen );
+        entry->re_lens[ entry->re_count ] = ai->ai_addrlen;
+        entry->re_count++;
+    }
+
+    freeaddrinfo( res );
+
+    if( entry->re_count == 0 )
+    {
+        *err = EHOSTNOTFOUND;
+        return -1;
+    }
+
+    pthread_rwlock_wrlock( &g_cache_lock );
+    memcpy( slot, entry, sizeof( struct resolve_entry ) );
+    pthread_rwlock_unlock( &g_cache_lock );
+
+    return 0;
+}
+
+unsigned int resolve_hash( const char *host, int port )
+{
+    unsigned int hash;
+
+    hash = 2166136261u;
+
+    while( *host != '\0' )
+    {
+        hash = ( hash ^ ( unsigned char )*host++ ) * 16777619u;
+    }
+
+    return ( hash ^ ( unsigned int )port ) * 16777619u;
+}
+
+/* Replaces the socket of ctx with one of family bound to port on every
+ * local address, -1 with errno set and no socket left on failure. */
+int bind_family( tcp_context_t *ctx, int family, int port )
+{
+    struct sockaddr_in6 *in6;
+    struct sockaddr_in *in;
+    int optval, saved;
+
+    if( ctx->tc_socket != -1 )
+    {
+        close( ctx->tc_socket );
+        ctx->tc_socket = -1;
+    }
+
+    memset( &ctx->tc_addr, 0, sizeof( ctx->tc_addr ) );
+
+    if( family == AF_INET6 )
+    {
+        in6 = ( struct sockaddr_in6* )&ctx->tc_addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr = in6addr_any;
+        in6->sin6_port = htons( port );
+        ctx->tc_addrlen = sizeof( struct sockaddr_in6 );
+    }
+    else
+    {
+        in = ( struct sockaddr_in* )&ctx->tc_addr;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = INADDR_ANY;
+        in->sin_port = htons( port );
+        ctx->tc_addrlen = sizeof( struct sockaddr_in );
+    }
+
+    if( ( ctx->tc_socket = socket( family, SOCK_STREAM,
+                    IPPROTO_TCP ) ) == -1 )
+        return -1;
+
+    optval = 0;
+
+    if( family != AF_INET6 || setsockopt( ctx->tc_socket, IPPROTO_IPV6,
+                IPV6_V6ONLY, &optval, sizeof( optval ) ) == 0 )
+    {
+        optval = 1;
+        setsockopt( ctx->tc_socket, SOL_SOCKET, SO_REUSEADDR, &optval,
+                sizeof( optval ) );
+
+        if( bind( ctx->tc_socket, ( struct sockaddr* )&ctx->tc_addr,
+                    ctx->tc_addrlen ) == 0 )
+            return 0;
+    }
+
+    saved = errno;
+    close( ctx->tc_socket );
+    ctx->tc_socket = -1;
+    errno = saved;
+
+    return -1;
+}
+
+int record_error( int errnum )
+{
+    switch( errnum )
+    {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            echo_stats_add( ECHO_STAT_ERR_EAGAIN, 1 );
+            break;
+        case EINTR:
+            echo_stats_add( ECHO_STAT_ERR_EINTR, 1 );
+            break;
+        case ECONNRESET:
+        case EPIPE:
+            echo_stats_add( ECHO_STAT_ERR_ECONNRESET, 1 );
+            break;
+        default:
+            echo_stats_add( ECHO_STAT_ERR_OTHER, 1 );
+            break;
+    }
+
+    return errnum;
+}
+
+/* Out of descriptors the listener stays readable. The reserve is given up
+ * to accept the oldest pending connection and drop it, then taken back. */
+int shed( int listener )
+{
+    int fd, retval;
+
+    pthread_mutex_lock( &g_reserve_lock );
+    retval = -1;
+
+    if( g_reserve >= 0 )
+    {
+        close( g_reserve );
+
+        if( ( fd = accept( listener, NULL, NULL ) ) != -1 )
+        {
+            close( fd );
+            retval = 0;
+        }
+    }
+
+    g_reserve = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+    pthread_mutex_unlock( &g_reserve_lock );
+
+    return retval;
+}
+
+/* Buffer sizes must be set before listen for the window scale to follow
+ * them, accepted sockets inherit them. */
+void apply_listener( tcp_context_t *ctx )
+{
+    const tcp_profile_t *profile;
+
+    profile = &ctx->tc_profile;
+    set_option( ctx->tc_socket, SOL_SOCKET, SO_SNDBUF, profile->tp_sndbuf );
+    set_option( ctx->tc_socket, SOL_SOCKET, SO_RCVBUF, profile->tp_rcvbuf );
+    set_option( ctx->tc_socket, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+            profile->tp_defer_accept );
+    set_option( ctx->tc_socket, IPPROTO_TCP, TCP_FASTOPEN,
+            profile->tp_fastopen );
+}
+
+void apply_connection( tcp_context_t *ctx )
+{
+    const tcp_profile_t *profile;
+
+    profile = &ctx->tc_profile;
+    set_option( ctx->tc_socket, SOL_SOCKET, SO_SNDBUF, profile->tp_sndbuf );
+    set_option( ctx->tc_socket, SOL_SOCKET, SO_RCVBUF, profile->tp_rcvbuf );
+    set_option( ctx->tc_socket, IPPROTO_TCP, TCP_NODELAY,
+            profile->tp_nodelay );
+    set_option( ctx->tc_socket, IPPROTO_TCP, TCP_QUICKACK,
+            profile->tp_quickack );
+    set_option( ctx->tc_socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+            profile->tp_notsent_lowat );
+#ifdef SO_BUSY_POLL
+    set_option( ctx->tc_socket, SOL_SOCKET, SO_BUSY_POLL,
+            profile->tp_busy_poll );
+#endif
+}
+
+/* Zero keeps the kernel's default, refused options are skipped. */
+void set_option( int socket, int level, int name, int value )
+{
+    if( value != 0 )
+        setsockopt( socket, level, name, &value, sizeof( value ) );
+}
@@ -0,0 +1,36 @@
+#include "echotrace.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Converts a trace dump of the server to Chrome trace JSON on stdout. */
+int main( int argc, char *argv[ ] )
+{
+    FILE *file;
+    long count;
+    int err;
+
+    if( argc != 2 )
+    {
+        fprintf( stderr, "USAGE: %s FILE\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    if( ( file = fopen( argv[ 1 ], "rb" ) ) == NULL )
+    {
+        perror( "fopen" );
+        return EXIT_FAILURE;
+    }
+
+    if( ( count = echo_trace_export( file, stdout, &err ) ) == -1 )
+    {
+        fprintf( stderr, "echo_trace_export: %s: %s.\n", argv[ 1 ],
+                strerror( err ) );
+        fclose( file );
+        return EXIT_FAILURE;
+    }
+
+    fclose( file );
+    fprintf( stderr, "%ld events\n", count );
+
+    return EXIT_SUCCESS;
+}
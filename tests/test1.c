@@ -28,6 +28,7 @@ int main( void )
     bytes = tcp_context_recv( client_ctx, buffer, 256, &err );
 
     assert( !strncmp( buffer, "hello, world", bytes ) );
+    pthread_join( thread, NULL );
 
     tcp_context_destroy( client_ctx );
     tcp_context_destroy( server_ctx );
@@ -41,11 +42,12 @@ void *connection_thread( void *arg )
     char buffer[ ] = "hello, world";
     int err;
 
-    pthread_detach( pthread_self( ) );
+    ( void )arg;
     client_ctx = tcp_context_create( &err );
 
     tcp_context_connect( client_ctx, "localhost", PORT, &err );
     tcp_context_send( client_ctx, buffer, strlen( buffer ), &err );
+    tcp_context_destroy( client_ctx );
 
     return NULL;
 }
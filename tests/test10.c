@@ -0,0 +1,94 @@
+#include "echoservercontext.h"
+#include "testclient.h"
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/socket.h>
+
+#define CLIENTS 1000
+
+int main( void )
+{
+    echo_client_context_t *clients[ CLIENTS ], *client;
+    echo_server_context_t *server;
+    tcp_context_t *peer;
+    char name[ 32 ], buffer[ 64 ];
+    echo_frame_t frame;
+    int fds[ 2 ], i, err;
+
+    assert( ( server = echo_server_context_create( tcp_context_create(
+                        &err ), &err ) ) != NULL );
+    assert( echo_server_context_reserve( NULL, CLIENTS, &err ) == -1 );
+    assert( err == EINVAL );
+    assert( echo_server_context_reserve( server, CLIENTS, &err ) == 0 );
+    assert( server->esc_bag->b_capacity == CLIENTS );
+
+    for( i = 0; i < CLIENTS; i++ )
+    {
+        sprintf( name, "user%d", i );
+        clients[ i ] = test_client_create( name, -1, 0 );
+        assert( echo_server_context_insert( server, clients[ i ],
+                    &err ) == 0 );
+    }
+
+    /* Reserved room was enough. */
+    assert( server->esc_bag->b_capacity == CLIENTS );
+    client = test_client_create( "user7", -1, 0 );
+    assert( echo_server_context_insert( server, client, &err ) == -1 );
+    assert( err == EDUPLICATE );
+    assert( echo_server_context_remove( server, client, &err ) == NULL );
+    assert( err == ENOTFOUND );
+    echo_client_context_destroy( client );
+
+    /* Removals move clients around the bag, lookups must not notice. */
+    for( i = 0; i < CLIENTS; i += 3 )
+    {
+        assert( echo_server_context_remove( server, clients[ i ],
+                    &err ) != NULL );
+        echo_client_context_destroy( clients[ i ] );
+        clients[ i ] = NULL;
+    }
+
+    assert( server->esc_bag->b_size == CLIENTS - ( CLIENTS + 2 ) / 3 );
+
+    for( i = 0; i < CLIENTS; i++ )
+    {
+        sprintf( name, "user%d", i );
+        client = echo_server_context_find( server, name, &err );
+        assert( client == clients[ i ] );
+        assert( client != NULL || err == ENOTFOUND );
+    }
+
+    assert( echo_server_context_find( server, "nobody", &err ) == NULL );
+    assert( err == ENOTFOUND );
+
+    /* Only the recipient hears a direct message. */
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    client = test_client_create( "bob", fds[ 0 ], 0 );
+    assert( echo_server_context_insert( server, client, &err ) == 0 );
+    assert( echo_server_context_sendto( server, "bob", "hi\n", 3,
+                &err ) == 0 );
+    assert( echo_server_context_sendto( server, "carol", "hi\n", 3,
+                &err ) == -1 && err == ENOTFOUND );
+
+    assert( ( peer = tcp_context_create( &err ) ) != NULL );
+    peer->tc_socket = fds[ 1 ];
+    assert( echo_frame_recv( peer, &frame, buffer, sizeof( buffer ),
+                &err ) == ECHO_FRAME_HEADER + 3 );
+    assert( frame.ef_type == ECHO_FRAME_TEXT && memcmp( buffer, "hi\n",
+                3 ) == 0 );
+    tcp_context_destroy( peer );
+
+    for( i = 0; i < server->esc_bag->b_size; )
+    {
+        client = bag_array_get( server->esc_bag, i, &err );
+        assert( echo_server_context_remove( server, client, &err ) !=
+                NULL );
+        echo_client_context_destroy( client );
+    }
+
+    assert( echo_server_context_find( server, "user1", &err ) == NULL );
+    echo_server_context_destroy( server );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+#define _GNU_SOURCE
+#include "echoaffinity.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <assert.h>
+
+#define ROUNDS 2
+
+static void *pinned( void *arg );
+
+int main( void )
+{
+    int placed[ ECHO_AFFINITY_CPUS ], first, cpu, i, err;
+    echo_affinity_t *affinity;
+    pthread_attr_t attr;
+    pthread_t thread;
+    cpu_set_t allowed;
+    char list[ 32 ];
+    size_t count;
+
+    assert( sched_getaffinity( 0, sizeof( allowed ), &allowed ) == 0 );
+    count = CPU_COUNT( &allowed );
+
+    for( first = 0; !CPU_ISSET( first, &allowed ); first++ );
+
+    assert( echo_affinity_create( "abc", &err ) == NULL && err == EINVAL );
+    assert( echo_affinity_create( "3-1", &err ) == NULL && err == EINVAL );
+    assert( echo_affinity_create( "0,", &err ) == NULL && err == EINVAL );
+    assert( echo_affinity_create( "100000", &err ) == NULL &&
+            err == EINVAL );
+
+    /* A thread pinned to one CPU finds only that CPU in its mask. */
+    sprintf( list, "%d", first );
+    assert( ( affinity = echo_affinity_create( list, &err ) ) != NULL );
+    assert( echo_affinity_cpus( affinity ) == 1 );
+    assert( echo_affinity_node( affinity, first ) >= 0 );
+    assert( echo_affinity_node( affinity, first + 1 ) == -1 );
+
+    assert( pthread_attr_init( &attr ) == 0 );
+    assert( ( cpu = echo_affinity_place( affinity, &attr, &err ) ) == first );
+    assert( pthread_create( &thread, &attr, pinned, &cpu ) == 0 );
+    assert( pthread_join( thread, NULL ) == 0 );
+    echo_affinity_leave( affinity, cpu );
+    pthread_attr_destroy( &attr );
+    echo_affinity_destroy( affinity );
+
+    /* Threads spread evenly over every allowed CPU. */
+    assert( ( affinity = echo_affinity_create( NULL, &err ) ) != NULL );
+    assert( echo_affinity_cpus( affinity ) == count );
+    memset( placed, 0, sizeof( placed ) );
+
+    for( i = 0; i < ( int )count * ROUNDS; i++ )
+    {
+        assert( pthread_attr_init( &attr ) == 0 );
+        assert( ( cpu = echo_affinity_place( affinity, &attr, &err ) ) >= 0 );
+        assert( CPU_ISSET( cpu, &allowed ) );
+        assert( pthread_create( &thread, &attr, pinned, &cpu ) == 0 );
+        assert( pthread_join( thread, NULL ) == 0 );
+        pthread_attr_destroy( &attr );
+        placed[ cpu ]++;
+    }
+
+    for( cpu = 0; cpu < ECHO_AFFINITY_CPUS; cpu++ )
+    {
+        assert( placed[ cpu ] == ( CPU_ISSET( cpu, &allowed ) ? ROUNDS : 0 ) );
+    }
+
+    /* A CPU left by its thread is the first to be reused. */
+    echo_affinity_leave( affinity, first );
+    assert( pthread_attr_init( &attr ) == 0 );
+    assert( echo_affinity_place( affinity, &attr, &err ) == first );
+    pthread_attr_destroy( &attr );
+
+    echo_affinity_report( affinity, stdout );
+    echo_affinity_destroy( affinity );
+
+    return EXIT_SUCCESS;
+}
+
+void *pinned( void *arg )
+{
+    cpu_set_t set;
+
+    assert( sched_getaffinity( 0, sizeof( set ), &set ) == 0 );
+    assert( CPU_COUNT( &set ) == 1 && CPU_ISSET( *( int* )arg, &set ) );
+    assert( echo_affinity_current( ) == *( int* )arg );
+
+    return NULL;
+}
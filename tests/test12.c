@@ -0,0 +1,142 @@
+#include "echoarena.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define CHUNKS  64
+#define THREADS 8
+#define ROUNDS  10000
+
+static void *churn( void *arg );
+static int resident( const char *start, size_t length );
+
+int main( void )
+{
+    char *chunks[ CHUNKS ];
+    echo_arena_usage_t usage;
+    echo_arena_t *arena;
+    pthread_t threads[ THREADS ];
+    int i, j, err;
+
+    assert( echo_arena_create( 0, CHUNKS, 0, &err ) == NULL &&
+            err == EINVAL );
+    assert( ( arena = echo_arena_create( 1000, CHUNKS, ECHO_ARENA_THP,
+                    &err ) ) != NULL );
+
+    /* Chunks are distinct, cache line aligned and do not overlap. */
+    for( i = 0; i < CHUNKS; i++ )
+    {
+        assert( ( chunks[ i ] = echo_arena_get( arena, &err ) ) != NULL );
+        assert( echo_arena_owns( arena, chunks[ i ] ) );
+        assert( ( ( uintptr_t )chunks[ i ] & 63 ) == 0 );
+        memset( chunks[ i ], i, 1000 );
+    }
+
+    for( i = 0; i < CHUNKS; i++ )
+    {
+        for( j = 0; j < 1000; j++ )
+        {
+            assert( chunks[ i ][ j ] == ( char )i );
+        }
+    }
+
+    assert( echo_arena_get( arena, &err ) == NULL && err == ENOBUFS );
+    assert( !echo_arena_owns( arena, &err ) );
+
+    echo_arena_usage( arena, &usage );
+    assert( usage.eu_chunks == CHUNKS && usage.eu_size == 1024 );
+    assert( usage.eu_used == CHUNKS && usage.eu_peak == CHUNKS );
+    assert( usage.eu_misses == 1 );
+
+    /* The chunk returned last is handed out first. */
+    echo_arena_put( arena, chunks[ 5 ] );
+    assert( echo_arena_get( arena, &err ) == chunks[ 5 ] );
+
+    for( i = 0; i < CHUNKS; i++ )
+    {
+        echo_arena_put( arena, chunks[ i ] );
+    }
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        assert( pthread_create( &threads[ i ], NULL, churn, arena ) == 0 );
+    }
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        assert( pthread_join( threads[ i ], NULL ) == 0 );
+    }
+
+    echo_arena_usage( arena, &usage );
+    assert( usage.eu_used == 0 && usage.eu_peak == CHUNKS );
+    echo_arena_report( arena, stdout );
+    echo_arena_destroy( arena );
+
+    /* Chunks prefaulted are resident before their first checkout. */
+    assert( ( arena = echo_arena_create( ECHO_ARENA_CHUNK, CHUNKS, 0,
+                    &err ) ) != NULL );
+    assert( echo_arena_prefault( arena, 4 ) == 4 * ECHO_ARENA_CHUNK );
+    assert( resident( echo_arena_get( arena, &err ), 4 * ECHO_ARENA_CHUNK ) );
+    assert( echo_arena_prefault( arena, CHUNKS * 2 ) ==
+            CHUNKS * ECHO_ARENA_CHUNK );
+    echo_arena_destroy( arena );
+
+    /* Reserved huge pages may be missing, the arena still works. */
+    assert( ( arena = echo_arena_create( ECHO_ARENA_CHUNK, 4,
+                    ECHO_ARENA_HUGETLB, &err ) ) != NULL );
+    assert( ( chunks[ 0 ] = echo_arena_get( arena, &err ) ) != NULL );
+    memset( chunks[ 0 ], 0, ECHO_ARENA_CHUNK );
+    echo_arena_put( arena, chunks[ 0 ] );
+    echo_arena_destroy( arena );
+
+    return EXIT_SUCCESS;
+}
+
+/* Two chunks held at a time, each tagged to catch double checkouts. */
+void *churn( void *arg )
+{
+    echo_arena_t *arena;
+    char *first, *second;
+    int i, err;
+
+    arena = ( echo_arena_t* )arg;
+
+    for( i = 0; i < ROUNDS; i++ )
+    {
+        assert( ( first = echo_arena_get( arena, &err ) ) != NULL );
+        assert( ( second = echo_arena_get( arena, &err ) ) != NULL );
+        *( pthread_t* )first = pthread_self( );
+        *( pthread_t* )second = pthread_self( );
+        sched_yield( );
+        assert( pthread_equal( *( pthread_t* )first, pthread_self( ) ) );
+        assert( pthread_equal( *( pthread_t* )second, pthread_self( ) ) );
+        echo_arena_put( arena, second );
+        echo_arena_put( arena, first );
+    }
+
+    return NULL;
+}
+
+int resident( const char *start, size_t length )
+{
+    unsigned char pages[ 64 ];
+    size_t page, i;
+
+    page = sysconf( _SC_PAGESIZE );
+    assert( length / page <= sizeof( pages ) );
+    assert( mincore( ( void* )start, length, pages ) == 0 );
+
+    for( i = 0; i < length / page; i++ )
+    {
+        if( !( pages[ i ] & 1 ) )
+            return 0;
+    }
+
+    return 1;
+}
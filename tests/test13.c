@@ -0,0 +1,84 @@
+#include "tcpcontext.h"
+#include <errno.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define PORT    5030
+#define BACKLOG 16
+
+static int option( const tcp_context_t *ctx, int level, int name );
+
+int main( void )
+{
+    tcp_context_t *server_ctx, *client_ctx, *peer_ctx;
+    tcp_profile_t profile, expected;
+    char buffer[ 16 ];
+    int err;
+
+    assert( tcp_profile_parse( "default", &profile, &err ) == 0 );
+    tcp_profile_get( TCP_PROFILE_DEFAULT, &expected );
+    assert( memcmp( &profile, &expected, sizeof( profile ) ) == 0 );
+
+    assert( tcp_profile_parse( "throughput,sndbuf=131072,nodelay=1",
+                &profile, &err ) == 0 );
+    assert( profile.tp_sndbuf == 131072 && profile.tp_nodelay == 1 );
+    assert( profile.tp_rcvbuf == 4 * 1024 * 1024 );
+
+    assert( tcp_profile_parse( "busy_poll=50", &profile, &err ) == 0 );
+    assert( profile.tp_busy_poll == 50 && profile.tp_nodelay == 0 );
+
+    assert( tcp_profile_parse( "fast", &profile, &err ) == -1 &&
+            err == EINVAL );
+    assert( tcp_profile_parse( "nodelay=1,latency", &profile, &err ) ==
+            -1 && err == EINVAL );
+    assert( tcp_profile_parse( "nodelay=x", &profile, &err ) == -1 );
+    assert( tcp_profile_parse( "nagle=1", &profile, &err ) == -1 );
+    assert( tcp_profile_parse( "sndbuf=-1", &profile, &err ) == -1 );
+
+    /* The listener takes the profile on listen and hands it down. */
+    tcp_profile_get( TCP_PROFILE_LATENCY, &profile );
+    assert( ( server_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_set_profile( server_ctx, &profile, &err ) == 0 );
+    assert( tcp_context_bind( server_ctx, PORT, &err ) != -1 );
+    assert( tcp_context_listen( server_ctx, BACKLOG, &err ) != -1 );
+    assert( option( server_ctx, IPPROTO_TCP, TCP_DEFER_ACCEPT ) > 0 );
+
+    /* Deferred accepts wait for the first bytes. */
+    assert( ( client_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_connect( client_ctx, "localhost", PORT, &err ) ==
+            0 );
+    assert( tcp_context_send( client_ctx, "ping", 4, &err ) == 4 );
+    assert( ( peer_ctx = tcp_context_accept( server_ctx, &err ) ) != NULL );
+    assert( option( peer_ctx, IPPROTO_TCP, TCP_NODELAY ) == 1 );
+    assert( option( peer_ctx, IPPROTO_TCP, TCP_NOTSENT_LOWAT ) ==
+            profile.tp_notsent_lowat );
+    assert( tcp_context_recv( peer_ctx, buffer, sizeof( buffer ),
+                &err ) == 4 );
+
+    /* Connected contexts take it at once. */
+    assert( option( client_ctx, IPPROTO_TCP, TCP_NODELAY ) == 0 );
+    tcp_profile_get( TCP_PROFILE_THROUGHPUT, &profile );
+    profile.tp_nodelay = 1;
+    assert( tcp_context_set_profile( client_ctx, &profile, &err ) == 0 );
+    assert( option( client_ctx, IPPROTO_TCP, TCP_NODELAY ) == 1 );
+    assert( option( client_ctx, SOL_SOCKET, SO_SNDBUF ) >= 256 * 1024 );
+
+    tcp_context_destroy( peer_ctx );
+    tcp_context_destroy( client_ctx );
+    tcp_context_destroy( server_ctx );
+
+    return EXIT_SUCCESS;
+}
+
+int option( const tcp_context_t *ctx, int level, int name )
+{
+    socklen_t length;
+    int value;
+
+    length = sizeof( value );
+    assert( getsockopt( ctx->tc_socket, level, name, &value,
+                &length ) == 0 );
+
+    return value;
+}
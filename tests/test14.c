@@ -0,0 +1,88 @@
+#include "tcpcontext.h"
+#include "echostats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <sys/resource.h>
+
+#define PORT    5050
+#define BACKLOG 256
+#define CLIENTS 100
+#define BATCH   32
+
+int main( void )
+{
+    tcp_context_t *server_ctx, *clients[ CLIENTS ], *accepted[ BATCH ];
+    tcp_context_t *late;
+    struct rlimit limit, saved;
+    ssize_t count;
+    size_t total;
+    int i, fd, err;
+
+    assert( ( server_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_bind( server_ctx, PORT, &err ) != -1 );
+    assert( tcp_context_listen( server_ctx, BACKLOG, &err ) != -1 );
+    assert( tcp_context_set_blocking( server_ctx, 0, &err ) == 0 );
+
+    assert( tcp_context_accept_batch( server_ctx, accepted, 0, 0,
+                &err ) == -1 && err == EINVAL );
+    assert( tcp_context_accept_batch( server_ctx, accepted, BATCH, 0,
+                &err ) == -1 && err == EAGAIN );
+
+    for( i = 0; i < CLIENTS; i++ )
+    {
+        assert( ( clients[ i ] = tcp_context_create( &err ) ) != NULL );
+        assert( tcp_context_connect( clients[ i ], "localhost", PORT,
+                    &err ) == 0 );
+    }
+
+    /* The queue is drained in batches no larger than asked for. */
+    for( total = 0; total < CLIENTS; total += count )
+    {
+        assert( ( count = tcp_context_accept_batch( server_ctx, accepted,
+                        BATCH, TCP_ACCEPT_NONBLOCK, &err ) ) > 0 );
+        assert( count <= BATCH );
+
+        for( i = 0; i < count; i++ )
+        {
+            assert( fcntl( accepted[ i ]->tc_socket, F_GETFD ) &
+                    FD_CLOEXEC );
+            assert( fcntl( accepted[ i ]->tc_socket, F_GETFL ) &
+                    O_NONBLOCK );
+            tcp_context_destroy( accepted[ i ] );
+        }
+    }
+
+    assert( total == CLIENTS );
+    assert( tcp_context_accept_batch( server_ctx, accepted, BATCH, 0,
+                &err ) == -1 && err == EAGAIN );
+    assert( echo_stats_get( ECHO_STAT_ACCEPTS ) == CLIENTS );
+
+    /* Out of descriptors the pending connection is shed, not left in the
+     * queue to keep the listener readable. */
+    assert( ( late = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_connect( late, "localhost", PORT, &err ) == 0 );
+    assert( getrlimit( RLIMIT_NOFILE, &saved ) == 0 );
+    assert( ( fd = open( "/dev/null", O_RDONLY ) ) != -1 );
+    close( fd );
+    limit = saved;
+    limit.rlim_cur = fd;
+    assert( setrlimit( RLIMIT_NOFILE, &limit ) == 0 );
+
+    assert( tcp_context_accept_batch( server_ctx, accepted, BATCH, 0,
+                &err ) == -1 && err == EMFILE );
+    assert( echo_stats_get( ECHO_STAT_ACCEPT_SHED ) == 1 );
+    assert( setrlimit( RLIMIT_NOFILE, &saved ) == 0 );
+    assert( tcp_context_accept_batch( server_ctx, accepted, BATCH, 0,
+                &err ) == -1 && err == EAGAIN );
+
+    for( i = 0; i < CLIENTS; i++ )
+    {
+        tcp_context_destroy( clients[ i ] );
+    }
+
+    tcp_context_destroy( late );
+    tcp_context_destroy( server_ctx );
+
+    return EXIT_SUCCESS;
+}
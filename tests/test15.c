@@ -0,0 +1,84 @@
+#include "echoqueue.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define PRODUCERS   4
+#define ITEMS       100000
+
+struct item
+{
+    echo_queue_node_t i_node;
+    int i_producer;
+    int i_seq;
+};
+
+static void *produce( void *arg );
+
+static echo_queue_t *g_queue;
+static struct item g_items[ PRODUCERS ][ ITEMS ];
+
+int main( void )
+{
+    pthread_t threads[ PRODUCERS ];
+    echo_queue_node_t *node;
+    int next[ PRODUCERS ];
+    struct item *item, single;
+    long i;
+    int err;
+
+    assert( ( g_queue = echo_queue_create( &err ) ) != NULL );
+
+    /* Empty, with a push while the stub is the only node and the last node
+     * taken before the next push. */
+    assert( echo_queue_pop( g_queue ) == NULL );
+    assert( echo_queue_wait( g_queue, 10 ) == NULL );
+    echo_queue_push( g_queue, &single.i_node );
+    assert( echo_queue_pop( g_queue ) == &single.i_node );
+    assert( echo_queue_pop( g_queue ) == NULL );
+    echo_queue_push( g_queue, &single.i_node );
+    assert( echo_queue_wait( g_queue, -1 ) == &single.i_node );
+
+    for( i = 0; i < PRODUCERS; i++ )
+    {
+        next[ i ] = 0;
+        assert( pthread_create( &threads[ i ], NULL, produce,
+                    ( void* )i ) == 0 );
+    }
+
+    /* Every node arrives once and each producer's in the order pushed. */
+    for( i = 0; i < PRODUCERS * ITEMS; i++ )
+    {
+        assert( ( node = echo_queue_wait( g_queue, -1 ) ) != NULL );
+        item = ( struct item* )node;
+        assert( item->i_seq == next[ item->i_producer ]++ );
+    }
+
+    for( i = 0; i < PRODUCERS; i++ )
+    {
+        assert( pthread_join( threads[ i ], NULL ) == 0 );
+        assert( next[ i ] == ITEMS );
+    }
+
+    assert( echo_queue_pop( g_queue ) == NULL );
+    echo_queue_destroy( g_queue );
+
+    return EXIT_SUCCESS;
+}
+
+void *produce( void *arg )
+{
+    long producer;
+    int i;
+
+    producer = ( long )arg;
+
+    for( i = 0; i < ITEMS; i++ )
+    {
+        g_items[ producer ][ i ].i_producer = producer;
+        g_items[ producer ][ i ].i_seq = i;
+        echo_queue_push( g_queue, &g_items[ producer ][ i ].i_node );
+    }
+
+    return NULL;
+}
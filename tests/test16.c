@@ -0,0 +1,104 @@
+#include "echopipeline.h"
+#include "testclient.h"
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/socket.h>
+
+#define CLIENTS     8
+#define MESSAGES    200
+#define WRITERS     3
+
+int main( void )
+{
+    echo_client_context_t *clients[ CLIENTS ], *peers[ CLIENTS ];
+    echo_writer_usage_t usage;
+    echo_pipeline_t *pipeline;
+    unsigned long long frames;
+    char text[ 64 ], buffer[ 64 ];
+    echo_frame_t frame;
+    int fds[ 2 ], features, seen, i, j, err;
+    size_t k;
+
+    assert( echo_pipeline_create( 0, &err ) == NULL && err == EINVAL );
+    assert( ( pipeline = echo_pipeline_create( WRITERS, &err ) ) != NULL );
+    assert( echo_pipeline_writers( pipeline ) == WRITERS );
+
+    /* Half the members have a deflate stream, packed frames must carry it
+     * across flushes. */
+    for( i = 0; i < CLIENTS; i++ )
+    {
+        features = i % 2 && echo_compress_available( ) ?
+            ECHO_FEATURE_DEFLATE : 0;
+        assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+        clients[ i ] = test_client_create( "member", fds[ 0 ], features );
+        peers[ i ] = test_client_create( "peer", fds[ 1 ], features );
+        assert( echo_pipeline_attach( pipeline, clients[ i ], &err ) == 0 );
+    }
+
+    for( i = 0; i < MESSAGES; i++ )
+    {
+        sprintf( text, "message %d\n", i );
+        assert( echo_pipeline_send( pipeline, text, strlen( text ),
+                    &err ) == 0 );
+
+        if( i == MESSAGES / 2 )
+            assert( echo_pipeline_sendto( pipeline, clients[ 3 ],
+                        ECHO_FRAME_ERROR, "only you\n", 9, &err ) == 0 );
+    }
+
+    assert( echo_pipeline_close( pipeline, clients[ 5 ], &err ) == 0 );
+
+    /* Every member gets every message in order and a closed member its
+     * frames before the end. The direct one is a control frame, it may
+     * overtake the lines queued before it but none queued after. */
+    for( seen = 0, i = 0; i < CLIENTS; i++ )
+    {
+        for( j = 0; j < MESSAGES; j++ )
+        {
+            assert( echo_client_context_recv( peers[ i ], &frame, buffer,
+                        sizeof( buffer ), &err ) > 0 );
+
+            if( i == 3 && frame.ef_type == ECHO_FRAME_ERROR )
+            {
+                assert( !seen++ && j <= MESSAGES / 2 + 1 );
+                assert( memcmp( buffer, "only you\n", 9 ) == 0 );
+                assert( echo_client_context_recv( peers[ i ], &frame,
+                            buffer, sizeof( buffer ), &err ) > 0 );
+            }
+
+            sprintf( text, "message %d\n", j );
+            assert( frame.ef_type == ECHO_FRAME_TEXT );
+            assert( memcmp( buffer, text, strlen( text ) ) == 0 );
+        }
+    }
+
+    assert( seen );
+    assert( echo_client_context_recv( peers[ 5 ], &frame, buffer,
+                sizeof( buffer ), &err ) == 0 );
+
+    frames = 0;
+
+    for( k = 0; k < WRITERS; k++ )
+    {
+        echo_pipeline_usage( pipeline, k, &usage );
+        frames += usage.ew_frames;
+        assert( usage.ew_flushes <= usage.ew_frames );
+    }
+
+    assert( frames == CLIENTS * MESSAGES + 1 );
+
+    for( i = 0; i < CLIENTS; i++ )
+    {
+        echo_pipeline_detach( pipeline, clients[ i ] );
+    }
+
+    echo_pipeline_destroy( pipeline );
+
+    for( i = 0; i < CLIENTS; i++ )
+    {
+        echo_client_context_destroy( peers[ i ] );
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+#include "echopool.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define WORKERS     4
+#define TASKS       100000
+#define DEPTH       14
+#define SERIALS     16
+#define ORDERED     5000
+
+struct job
+{
+    echo_task_t j_task;
+    echo_pool_t *j_pool;
+    int j_depth;
+};
+
+struct step
+{
+    echo_task_t s_task;
+    int s_serial;
+    int s_seq;
+};
+
+static void count( echo_task_t *task );
+static void split( echo_task_t *task );
+static void ordered( echo_task_t *task );
+static void hold( echo_task_t *task );
+
+static atomic_long g_count;
+static atomic_int g_held;
+static int g_next[ SERIALS ];
+static atomic_int g_running[ SERIALS ];
+
+int main( void )
+{
+    echo_serial_t *serials[ SERIALS ];
+    echo_worker_usage_t usage;
+    unsigned long long tasks, steals;
+    echo_pool_t *pool;
+    struct job *job;
+    struct step *step;
+    int i, j, err;
+    size_t k;
+
+    assert( echo_pool_create( 0, &err ) == NULL && err == EINVAL );
+    assert( ( pool = echo_pool_create( WORKERS, &err ) ) != NULL );
+
+    /* Tasks from outside are spread over the inboxes. */
+    for( i = 0; i < TASKS; i++ )
+    {
+        assert( ( job = malloc( sizeof( struct job ) ) ) != NULL );
+        job->j_task.et_run = count;
+        echo_pool_submit( pool, &job->j_task );
+    }
+
+    /* A tree of tasks is started on one worker and spread by stealing. */
+    assert( ( job = malloc( sizeof( struct job ) ) ) != NULL );
+    job->j_task.et_run = split;
+    job->j_pool = pool;
+    job->j_depth = DEPTH;
+    echo_pool_submit( pool, &job->j_task );
+
+    /* Each executor runs its tasks in order and one at a time. */
+    for( i = 0; i < SERIALS; i++ )
+    {
+        assert( ( serials[ i ] = echo_serial_create( pool, &err ) ) != NULL );
+    }
+
+    for( j = 0; j < ORDERED; j++ )
+    {
+        for( i = 0; i < SERIALS; i++ )
+        {
+            assert( ( step = malloc( sizeof( struct step ) ) ) != NULL );
+            step->s_task.et_run = ordered;
+            step->s_serial = i;
+            step->s_seq = j;
+            echo_serial_submit( serials[ i ], &step->s_task );
+        }
+    }
+
+    for( i = 0; i < SERIALS; i++ )
+    {
+        echo_serial_destroy( serials[ i ] );
+        assert( g_next[ i ] == ORDERED );
+    }
+
+    echo_pool_destroy( pool );
+    assert( atomic_load( &g_count ) == TASKS + ( 1L << DEPTH ) );
+
+    /* The worker holding the tree only gets it back by others stealing
+     * it, and the counts add up. */
+    assert( ( pool = echo_pool_create( WORKERS, &err ) ) != NULL );
+    assert( ( job = malloc( sizeof( struct job ) ) ) != NULL );
+    job->j_task.et_run = hold;
+    job->j_pool = pool;
+    job->j_depth = DEPTH;
+    echo_pool_submit( pool, &job->j_task );
+
+    while( !atomic_load( &g_held ) )
+    {
+        sched_yield();
+    }
+
+    tasks = steals = 0;
+
+    for( k = 0; k < echo_pool_workers( pool ); k++ )
+    {
+        echo_pool_usage( pool, k, &usage );
+        tasks += usage.ew_tasks;
+        steals += usage.ew_steals;
+    }
+
+    assert( tasks == ( 2ULL << DEPTH ) );
+    assert( steals > 0 );
+    echo_pool_destroy( pool );
+
+    return EXIT_SUCCESS;
+}
+
+void count( echo_task_t *task )
+{
+    atomic_fetch_add( &g_count, 1 );
+    free( task );
+}
+
+/* Leaves count, inner nodes hand two halves back to the pool. */
+void split( echo_task_t *task )
+{
+    struct job *job, *child;
+    int i;
+
+    job = ( struct job* )task;
+
+    if( job->j_depth == 0 )
+    {
+        count( task );
+        return;
+    }
+
+    for( i = 0; i < 2; i++ )
+    {
+        assert( ( child = malloc( sizeof( struct job ) ) ) != NULL );
+        *child = *job;
+        child->j_depth--;
+        echo_pool_submit( job->j_pool, &child->j_task );
+    }
+
+    free( job );
+}
+
+void ordered( echo_task_t *task )
+{
+    struct step *step;
+
+    step = ( struct step* )task;
+    assert( atomic_exchange( &g_running[ step->s_serial ], 1 ) == 0 );
+    assert( step->s_seq == g_next[ step->s_serial ]++ );
+    atomic_store( &g_running[ step->s_serial ], 0 );
+    free( step );
+}
+
+/* Starts a tree on its own worker and keeps that worker busy until the
+ * tree is done. */
+void hold( echo_task_t *task )
+{
+    struct job *job;
+    long done;
+
+    job = ( struct job* )task;
+    done = atomic_load( &g_count ) + ( 1L << job->j_depth );
+    job->j_task.et_run = split;
+    echo_pool_submit( job->j_pool, &job->j_task );
+
+    while( atomic_load( &g_count ) < done )
+    {
+        sched_yield();
+    }
+
+    atomic_store( &g_held, 1 );
+}
@@ -0,0 +1,144 @@
+#include "echointern.h"
+#include "echoservercontext.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define NAMES       1000
+#define THREADS     4
+#define ROUNDS      1000
+#define SHARED      16
+
+static void *churn( void *arg );
+
+static echo_intern_t *g_table;
+
+int main( void )
+{
+    const echo_name_t *names[ NAMES ], *alice, *name;
+    echo_client_context_t *client;
+    echo_server_context_t *server;
+    tcp_context_t *ctx;
+    pthread_t threads[ THREADS ];
+    char buffer[ 32 ], overlong[ MAX_LENGTH + 1 ];
+    int i, err;
+
+    assert( echo_intern_hash( "", 0 ) == 2166136261u );
+    assert( echo_intern_hash( "a", 1 ) == 0xe40c292cu );
+    assert( ( g_table = echo_intern_create( &err ) ) != NULL );
+
+    /* One copy per name, prefix and hash made with it. */
+    assert( ( alice = echo_intern_get( g_table, "alice", 5, &err ) ) !=
+            NULL );
+    assert( echo_intern_get( g_table, "alice", 5, &err ) == alice );
+    assert( strcmp( alice->en_name, "alice" ) == 0 && alice->en_length == 5 );
+    assert( alice->en_says_length == strlen( "alice says:\n" ) );
+    assert( strcmp( alice->en_says, "alice says:\n" ) == 0 );
+    assert( alice->en_hash == echo_intern_hash( "alice", 5 ) );
+
+    assert( ( name = echo_intern_get( g_table, "bobby", 3, &err ) ) != NULL );
+    assert( strcmp( name->en_name, "bob" ) == 0 && name != alice );
+    assert( echo_intern_count( g_table ) == 2 );
+
+    assert( echo_intern_get( g_table, "", 0, &err ) == NULL && err == EINVAL );
+    assert( echo_intern_get( g_table, "a\0b", 3, &err ) == NULL &&
+            err == EINVAL );
+
+    /* The last hold frees the name. */
+    echo_intern_put( g_table, name );
+    echo_intern_put( g_table, alice );
+    assert( echo_intern_count( g_table ) == 1 );
+    echo_intern_put( g_table, alice );
+    assert( echo_intern_count( g_table ) == 0 );
+
+    /* Names survive the table growing under them, up front or not. */
+    assert( echo_intern_get( g_table, "carol", 5, &err ) != NULL );
+    assert( echo_intern_reserve( g_table, NAMES / 2, &err ) == 0 );
+    assert( echo_intern_reserve( g_table, 1, &err ) == 0 );
+    assert( ( name = echo_intern_get( g_table, "carol", 5, &err ) ) !=
+            NULL );
+    assert( strcmp( name->en_name, "carol" ) == 0 );
+    echo_intern_put( g_table, name );
+    echo_intern_put( g_table, name );
+
+    for( i = 0; i < NAMES; i++ )
+    {
+        sprintf( buffer, "user%d", i );
+        assert( ( names[ i ] = echo_intern_get( g_table, buffer,
+                        strlen( buffer ), &err ) ) != NULL );
+    }
+
+    assert( echo_intern_count( g_table ) == NAMES );
+
+    for( i = 0; i < NAMES; i++ )
+    {
+        sprintf( buffer, "user%d", i );
+        assert( echo_intern_get( g_table, buffer, strlen( buffer ),
+                    &err ) == names[ i ] );
+        echo_intern_put( g_table, names[ i ] );
+        echo_intern_put( g_table, names[ i ] );
+    }
+
+    assert( echo_intern_count( g_table ) == 0 );
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        assert( pthread_create( &threads[ i ], NULL, churn, NULL ) == 0 );
+    }
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    assert( echo_intern_count( g_table ) == 0 );
+
+    /* The index takes the interned hash and still finds the client by
+     * its plain name. */
+    assert( ( server = echo_server_context_create( tcp_context_create(
+                        &err ), &err ) ) != NULL );
+    assert( ( client = echo_client_context_create( tcp_context_create(
+                        &err ), "carol", &err ) ) != NULL );
+    assert( ( client->eec_name = echo_intern_get( g_table, "carol", 5,
+                    &err ) ) != NULL );
+    assert( echo_server_context_insert( server, client, &err ) == 0 );
+    assert( echo_server_context_find( server, "carol", &err ) == client );
+    assert( echo_server_context_remove( server, client, &err ) != NULL );
+    echo_intern_put( g_table, client->eec_name );
+    echo_client_context_destroy( client );
+    echo_server_context_destroy( server );
+
+    memset( overlong, 'x', MAX_LENGTH );
+    overlong[ MAX_LENGTH ] = '\0';
+    assert( ( ctx = tcp_context_create( &err ) ) != NULL );
+    assert( echo_client_context_create( ctx, overlong, &err ) == NULL &&
+            err == EINVAL );
+    tcp_context_destroy( ctx );
+
+    echo_intern_destroy( g_table );
+
+    return EXIT_SUCCESS;
+}
+
+/* Logins and logouts of the same few names from several threads */
+void *churn( void *arg )
+{
+    const echo_name_t *name;
+    char buffer[ 32 ];
+    int i, err;
+
+    ( void )arg;
+
+    for( i = 0; i < ROUNDS; i++ )
+    {
+        sprintf( buffer, "shared%d", i % SHARED );
+        assert( ( name = echo_intern_get( g_table, buffer, strlen( buffer ),
+                        &err ) ) != NULL );
+        assert( strcmp( name->en_name, buffer ) == 0 );
+        echo_intern_put( g_table, name );
+    }
+
+    return NULL;
+}
@@ -0,0 +1,162 @@
+#include "echoservercontext.h"
+#include "echocompress.h"
+#include "testclient.h"
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/socket.h>
+
+#define TEXT_SIZE   1024
+
+int main( void )
+{
+    char text[ TEXT_SIZE ], buffer[ 2 * TEXT_SIZE ], plain[ 2 * TEXT_SIZE ];
+    struct iovec parts[ ECHO_FRAME_PARTS + 1 ];
+    echo_client_context_t *bob, *carol, *reader;
+    echo_server_context_t *server;
+    tcp_context_t *ctx, *peer;
+    echo_frame_t frame;
+    ssize_t bytes;
+    int fds[ 2 ], i, err;
+
+    memset( text, 'x', sizeof( text ) );
+
+    parts[ 0 ].iov_base = "alice says:\n";
+    parts[ 0 ].iov_len = 12;
+    parts[ 1 ].iov_base = NULL;
+    parts[ 1 ].iov_len = 0;
+    parts[ 2 ].iov_base = text;
+    parts[ 2 ].iov_len = sizeof( text );
+    parts[ 3 ].iov_base = "\n";
+    parts[ 3 ].iov_len = 1;
+
+    assert( echo_frame_length( parts, 4 ) == 12 + TEXT_SIZE + 1 );
+    assert( echo_frame_gather( buffer, parts, 4 ) == 12 + TEXT_SIZE + 1 );
+    assert( memcmp( buffer, "alice says:\nxxx", 15 ) == 0 );
+    assert( buffer[ 12 + TEXT_SIZE ] == '\n' );
+
+    /* The parts arrive as one frame, empty ones left out. */
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    ctx = test_client_peer( fds[ 0 ] );
+    peer = test_client_peer( fds[ 1 ] );
+
+    assert( echo_frame_sendv( ctx, ECHO_FRAME_TEXT, 0, parts, 4, &err ) ==
+            12 + TEXT_SIZE + 1 );
+    assert( echo_frame_recv( peer, &frame, plain, sizeof( plain ), &err ) ==
+            ECHO_FRAME_HEADER + 12 + TEXT_SIZE + 1 );
+    assert( frame.ef_length == 12 + TEXT_SIZE + 1 );
+    assert( memcmp( plain, buffer, frame.ef_length ) == 0 );
+
+    assert( echo_frame_sendv( ctx, ECHO_FRAME_ACCEPT, 0, NULL, 0, &err ) ==
+            0 );
+    assert( echo_frame_recv( peer, &frame, plain, sizeof( plain ), &err ) ==
+            ECHO_FRAME_HEADER && frame.ef_type == ECHO_FRAME_ACCEPT );
+
+    for( i = 0; i <= ECHO_FRAME_PARTS; i++ )
+    {
+        parts[ i ].iov_base = "a";
+        parts[ i ].iov_len = 1;
+    }
+
+    assert( echo_frame_sendv( ctx, ECHO_FRAME_TEXT, 0, parts,
+                ECHO_FRAME_PARTS + 1, &err ) == -1 && err == EINVAL );
+
+    parts[ 0 ].iov_base = text;
+    parts[ 0 ].iov_len = ECHO_FRAME_MAX;
+
+    assert( echo_frame_sendv( ctx, ECHO_FRAME_TEXT, 0, parts, 2,
+                &err ) == -1 && err == EMSGSIZE );
+
+    tcp_context_destroy( ctx );
+
+    /* Every member gets the whole line, plain or as the shared block. */
+    assert( ( server = echo_server_context_create( tcp_context_create(
+                        &err ), &err ) ) != NULL );
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    bob = test_client_create( "bob", fds[ 0 ], 0 );
+    assert( echo_server_context_insert( server, bob, &err ) == 0 );
+    tcp_context_destroy( peer );
+    peer = test_client_peer( fds[ 1 ] );
+
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    carol = test_client_create( "carol", fds[ 0 ], 0 );
+    ctx = test_client_peer( fds[ 1 ] );
+    assert( echo_server_context_insert( server, carol, &err ) == 0 );
+
+    if( echo_compress_available( ) )
+    {
+        assert( echo_client_context_set_features( carol,
+                    ECHO_FEATURE_DEFLATE, &err ) == 0 );
+    }
+
+    parts[ 0 ].iov_base = "alice says:\n";
+    parts[ 0 ].iov_len = 12;
+    parts[ 1 ].iov_base = text;
+    parts[ 1 ].iov_len = sizeof( text );
+    parts[ 2 ].iov_base = "\n";
+    parts[ 2 ].iov_len = 1;
+
+    assert( echo_server_context_sendallv( server, ECHO_FRAME_TEXT, parts,
+                3, &err ) == 0 );
+
+    assert( echo_frame_recv( peer, &frame, plain, sizeof( plain ), &err ) >
+            0 );
+    assert( frame.ef_flags == 0 && frame.ef_length == 12 + TEXT_SIZE + 1 );
+    assert( memcmp( plain, buffer, frame.ef_length ) == 0 );
+
+    assert( echo_frame_recv( ctx, &frame, plain, sizeof( plain ), &err ) >
+            0 );
+
+    if( frame.ef_flags == ECHO_FRAME_DEFLATE_BLOCK )
+    {
+        memcpy( text, plain, frame.ef_length );
+        assert( ( bytes = echo_compress_block_inflate( text,
+                        frame.ef_length, plain, sizeof( plain ),
+                        &err ) ) == 12 + TEXT_SIZE + 1 );
+        frame.ef_length = bytes;
+    }
+
+    assert( frame.ef_length == 12 + TEXT_SIZE + 1 );
+    assert( memcmp( plain, buffer, frame.ef_length ) == 0 );
+
+    /* One member gets the parts over its own stream, if it has one. */
+    memset( text, 'x', sizeof( text ) );
+    assert( ( reader = echo_client_context_create( ctx, "", &err ) ) !=
+            NULL );
+    assert( echo_client_context_set_features( reader,
+                carol->eec_features, &err ) == 0 );
+
+    assert( echo_client_context_sendv( bob, ECHO_FRAME_TEXT, parts, 3,
+                &err ) == 12 + TEXT_SIZE + 1 );
+    assert( echo_frame_recv( peer, &frame, plain, sizeof( plain ), &err ) >
+            0 );
+    assert( frame.ef_flags == 0 && frame.ef_length == 12 + TEXT_SIZE + 1 );
+    assert( memcmp( plain, buffer, frame.ef_length ) == 0 );
+
+    assert( echo_client_context_sendv( carol, ECHO_FRAME_ERROR, parts, 3,
+                &err ) == 12 + TEXT_SIZE + 1 );
+    assert( echo_client_context_recv( reader, &frame, plain,
+                sizeof( plain ), &err ) > 0 );
+    assert( frame.ef_type == ECHO_FRAME_ERROR );
+    assert( frame.ef_length == 12 + TEXT_SIZE + 1 );
+    assert( memcmp( plain, buffer, frame.ef_length ) == 0 );
+
+    /* A member whose connection is gone does not keep it from the rest. */
+    shutdown( peer->tc_socket, SHUT_RDWR );
+    parts[ 1 ].iov_len = 10;
+    assert( echo_server_context_sendallv( server, ECHO_FRAME_TEXT, parts,
+                3, &err ) == -1 && err == EPIPE );
+    assert( echo_frame_recv( ctx, &frame, plain, sizeof( plain ), &err ) >
+            0 );
+    assert( frame.ef_flags == 0 && frame.ef_length == 12 + 10 + 1 );
+
+    assert( echo_server_context_remove( server, bob, &err ) != NULL );
+    assert( echo_server_context_remove( server, carol, &err ) != NULL );
+    echo_client_context_destroy( bob );
+    echo_client_context_destroy( carol );
+    echo_server_context_destroy( server );
+    tcp_context_destroy( peer );
+    echo_client_context_destroy( reader );
+
+    return EXIT_SUCCESS;
+}
@@ -3,7 +3,7 @@
 #include <assert.h>
 #include <pthread.h>
 
-#define PORT    5000
+#define PORT    5004
 #define BACKLOG 1000
 
 static void *connection_thread( void *arg );
@@ -25,6 +25,7 @@ int main( void )
     assert( client_ctx != NULL );
 
     tcp_context_send( client_ctx, buffer, strlen( buffer ), &err );
+    pthread_join( thread, NULL );
 
     tcp_context_destroy( client_ctx );
     tcp_context_destroy( server_ctx );
@@ -39,7 +40,7 @@ void *connection_thread( void *arg )
     ssize_t bytes;
     int err;
 
-    pthread_detach( pthread_self( ) );
+    ( void )arg;
     client_ctx = tcp_context_create( &err );
 
     tcp_context_connect( client_ctx, "localhost", PORT, &err );
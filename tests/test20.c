@@ -0,0 +1,326 @@
+#include "echoclient.h"
+#include "echotransfer.h"
+#include "testserver.h"
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#define PORT        5040
+#define CHUNKS      64
+#define FILE_SIZE   ( CHUNKS * ECHO_FRAME_CHUNK_SIZE )
+#define DEADLINE    30
+
+/* Bob checks every byte of alice's file as it comes. */
+struct bot
+{
+    int b_ready;
+    int b_offered;
+    uint32_t b_id;
+    size_t b_received;
+    size_t b_chat_at;
+    int b_ended;
+    int b_closed;
+};
+
+static void check_spool( void );
+static unsigned char pattern( size_t offset );
+static uint32_t get_id( const char *payload );
+static void on_login( echo_session_t *session, int accepted, void *arg );
+static void on_message( echo_session_t *session, int type,
+        const char *payload, size_t size, void *arg );
+static void on_close( echo_session_t *session, int err, void *arg );
+
+int main( void )
+{
+    static const echo_session_handler_t handler =
+    {
+        on_login, on_message, NULL, on_close
+    };
+    char server[ PATH_MAX ], dir[ ] = "/tmp/echo-test20-XXXXXX";
+    char chunk[ ECHO_FRAME_CHUNK_SIZE ], port[ 16 ], *argv[ 7 ];
+    echo_session_t *alice, *bob;
+    struct bot bots[ 2 ];
+    echo_client_loop_t *loop;
+    int input, sent, i, status, err;
+    time_t deadline;
+    pid_t pid;
+
+    check_spool( );
+
+    assert( realpath( getenv( "ECHO_SERVER" ) != NULL ?
+                getenv( "ECHO_SERVER" ) : "./server", server ) != NULL );
+    assert( mkdtemp( dir ) != NULL && chdir( dir ) == 0 );
+    signal( SIGPIPE, SIG_IGN );
+
+    /* A read-ahead smaller than a chunk, each is spooled partly from it
+     * and partly spliced. */
+    sprintf( port, "%d", PORT );
+    argv[ 0 ] = server;
+    argv[ 1 ] = "--spool";
+    argv[ 2 ] = dir;
+    argv[ 3 ] = "--read-ahead";
+    argv[ 4 ] = "4096";
+    argv[ 5 ] = port;
+    argv[ 6 ] = NULL;
+    pid = test_server_spawn( argv, &input );
+    test_server_wait( PORT );
+
+    memset( bots, 0, sizeof( bots ) );
+    assert( ( loop = echo_client_loop_create( 4, &err ) ) != NULL );
+    assert( ( alice = echo_client_loop_connect( loop, "localhost", PORT,
+                    &handler, &bots[ 0 ], &err ) ) != NULL );
+    assert( ( bob = echo_client_loop_connect( loop, "localhost", PORT,
+                    &handler, &bots[ 1 ], &err ) ) != NULL );
+    assert( echo_session_login( alice, "alice", 0, &err ) == 0 );
+    assert( echo_session_login( bob, "bob", 0, &err ) == 0 );
+    deadline = time( NULL ) + DEADLINE;
+
+    while( !bots[ 0 ].b_ready || !bots[ 1 ].b_ready )
+    {
+        assert( time( NULL ) < deadline );
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    /* A chat line sent halfway through must not wait for the rest of the
+     * file, it may even overtake chunks sent before it. */
+    assert( echo_session_offer( alice, "dir/big.bin", &err ) == 0 );
+
+    for( sent = 0; sent < CHUNKS; )
+    {
+        assert( time( NULL ) < deadline );
+
+        for( i = 0; i < ECHO_FRAME_CHUNK_SIZE; i++ )
+        {
+            chunk[ i ] = pattern( ( size_t )sent * ECHO_FRAME_CHUNK_SIZE +
+                    i );
+        }
+
+        if( echo_session_chunk( alice, chunk, sizeof( chunk ), &err ) == 0 )
+        {
+            if( ++sent == CHUNKS / 2 )
+            {
+                while( echo_session_send( alice, "halfway", 7, &err ) ==
+                        -1 )
+                {
+                    assert( err == EAGAIN && time( NULL ) < deadline );
+                    assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+                }
+            }
+
+            continue;
+        }
+
+        assert( err == EAGAIN );
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    while( echo_session_end( alice, &err ) == -1 )
+    {
+        assert( err == EAGAIN && time( NULL ) < deadline );
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    while( !bots[ 1 ].b_ended )
+    {
+        assert( time( NULL ) < deadline );
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    assert( bots[ 1 ].b_offered && bots[ 1 ].b_received == FILE_SIZE );
+    assert( bots[ 1 ].b_chat_at <= FILE_SIZE / 2 );
+
+    echo_session_close( alice );
+    echo_session_close( bob );
+
+    while( echo_client_loop_sessions( loop ) > 0 )
+    {
+        assert( time( NULL ) < deadline );
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    echo_client_loop_destroy( loop );
+    assert( bots[ 0 ].b_closed && bots[ 1 ].b_closed );
+
+    close( input );
+    assert( waitpid( pid, &status, 0 ) == pid );
+    assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+
+    return EXIT_SUCCESS;
+}
+
+/* Data goes from a socket to the spool and back out as a frame. */
+void check_spool( void )
+{
+    char data[ 3 * ECHO_FRAME_CHUNK_SIZE ];
+    char buffer[ 2 * ECHO_FRAME_CHUNK_SIZE ];
+    struct iovec part;
+    echo_transfer_t *transfer;
+    tcp_context_t *ctx, *peer;
+    echo_frame_t frame;
+    char id[ ECHO_FRAME_ID ] = { 0, 0, 1, 2 };
+    int fds[ 2 ], i, err;
+
+    for( i = 0; i < ( int )sizeof( data ); i++ )
+    {
+        data[ i ] = pattern( i );
+    }
+
+    assert( ( transfer = echo_transfer_create( "/tmp", 258, &err ) ) !=
+            NULL );
+    assert( transfer->et_id == 258 && transfer->et_length == 0 );
+
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    assert( write( fds[ 1 ], data, ECHO_FRAME_CHUNK_SIZE ) ==
+            ECHO_FRAME_CHUNK_SIZE );
+    assert( echo_transfer_spool( transfer, fds[ 0 ], ECHO_FRAME_CHUNK_SIZE,
+                &err ) == 0 );
+    assert( write( fds[ 1 ], data + ECHO_FRAME_CHUNK_SIZE,
+                2 * ECHO_FRAME_CHUNK_SIZE ) == 2 * ECHO_FRAME_CHUNK_SIZE );
+    assert( echo_transfer_spool( transfer, fds[ 0 ],
+                2 * ECHO_FRAME_CHUNK_SIZE, &err ) == ECHO_FRAME_CHUNK_SIZE );
+    assert( transfer->et_length == sizeof( data ) );
+
+    assert( echo_transfer_read( transfer, ECHO_FRAME_CHUNK_SIZE, buffer,
+                2 * ECHO_FRAME_CHUNK_SIZE, &err ) == 0 );
+    assert( memcmp( buffer, data + ECHO_FRAME_CHUNK_SIZE,
+                2 * ECHO_FRAME_CHUNK_SIZE ) == 0 );
+    assert( echo_transfer_read( transfer, 2 * ECHO_FRAME_CHUNK_SIZE + 1,
+                buffer, ECHO_FRAME_CHUNK_SIZE, &err ) == -1 && err == EIO );
+
+    /* The sender hanging up midway is not taken for the end of the data. */
+    close( fds[ 1 ] );
+    assert( echo_transfer_spool( transfer, fds[ 0 ], 1, &err ) == -1 &&
+            err == ECONNRESET );
+    close( fds[ 0 ] );
+
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    assert( ( ctx = tcp_context_create( &err ) ) != NULL );
+    assert( ( peer = tcp_context_create( &err ) ) != NULL );
+    ctx->tc_socket = fds[ 0 ];
+    peer->tc_socket = fds[ 1 ];
+
+    part.iov_base = id;
+    part.iov_len = ECHO_FRAME_ID;
+
+    assert( echo_frame_sendfile( ctx, ECHO_FRAME_CHUNK, &part, 1,
+                transfer->et_spool, ECHO_FRAME_CHUNK_SIZE,
+                ECHO_FRAME_CHUNK_SIZE, &err ) ==
+            ECHO_FRAME_ID + ECHO_FRAME_CHUNK_SIZE );
+    assert( echo_frame_recv( peer, &frame, buffer, sizeof( buffer ),
+                &err ) == ECHO_FRAME_HEADER + ECHO_FRAME_ID +
+            ECHO_FRAME_CHUNK_SIZE );
+    assert( frame.ef_type == ECHO_FRAME_CHUNK && frame.ef_flags == 0 );
+    assert( get_id( buffer ) == 258 );
+    assert( memcmp( buffer + ECHO_FRAME_ID, data + ECHO_FRAME_CHUNK_SIZE,
+                ECHO_FRAME_CHUNK_SIZE ) == 0 );
+
+    assert( echo_frame_sendfile( ctx, ECHO_FRAME_CHUNK, &part, 1,
+                transfer->et_spool, sizeof( data ), 1, &err ) == -1 &&
+            err == EIO );
+
+    /* Data read ahead with a header goes in after the spliced data. */
+    assert( echo_transfer_write( transfer, data, 16, &err ) ==
+            sizeof( data ) );
+    assert( transfer->et_length == sizeof( data ) + 16 );
+    assert( echo_transfer_read( transfer, sizeof( data ), buffer, 16,
+                &err ) == 0 );
+    assert( memcmp( buffer, data, 16 ) == 0 );
+
+    /* Relayed data is given back, the rest stays readable. */
+    echo_transfer_discard( transfer, 0, ECHO_FRAME_CHUNK_SIZE );
+    assert( echo_transfer_read( transfer, 2 * ECHO_FRAME_CHUNK_SIZE, buffer,
+                ECHO_FRAME_CHUNK_SIZE, &err ) == 0 );
+    assert( memcmp( buffer, data + 2 * ECHO_FRAME_CHUNK_SIZE,
+                ECHO_FRAME_CHUNK_SIZE ) == 0 );
+
+    assert( echo_transfer_hold( transfer ) == transfer );
+    echo_transfer_put( transfer );
+    echo_transfer_put( transfer );
+    echo_transfer_put( NULL );
+
+    tcp_context_destroy( ctx );
+    tcp_context_destroy( peer );
+}
+
+unsigned char pattern( size_t offset )
+{
+    return ( unsigned char )( offset * 31 + offset / 4099 );
+}
+
+uint32_t get_id( const char *payload )
+{
+    const unsigned char *bytes;
+
+    bytes = ( const unsigned char* )payload;
+
+    return ( uint32_t )bytes[ 0 ] << 24 | ( uint32_t )bytes[ 1 ] << 16 |
+        ( uint32_t )bytes[ 2 ] << 8 | bytes[ 3 ];
+}
+
+void on_login( echo_session_t *session, int accepted, void *arg )
+{
+    ( void )session;
+    assert( accepted );
+    ( ( struct bot* )arg )->b_ready = 1;
+}
+
+/* Alice gets her own file back and leaves it alone. */
+void on_message( echo_session_t *session, int type, const char *payload,
+        size_t size, void *arg )
+{
+    struct bot *bot;
+    size_t i;
+
+    bot = ( struct bot* )arg;
+
+    if( strcmp( echo_session_uname( session ), "bob" ) != 0 )
+        return;
+
+    if( type == ECHO_FRAME_TEXT )
+    {
+        if( size >= 8 && memcmp( payload + size - 8, "halfway\n", 8 ) == 0 )
+            bot->b_chat_at = bot->b_received;
+
+        return;
+    }
+
+    assert( size >= ECHO_FRAME_ID && !bot->b_ended );
+
+    if( type == ECHO_FRAME_OFFER )
+    {
+        assert( !bot->b_offered );
+        assert( size == ECHO_FRAME_ID + 6 + 11 );
+        assert( memcmp( payload + ECHO_FRAME_ID, "alice\0dir/big.bin",
+                    17 ) == 0 );
+        bot->b_id = get_id( payload );
+        bot->b_offered = 1;
+    }
+    else if( type == ECHO_FRAME_CHUNK )
+    {
+        assert( bot->b_offered && get_id( payload ) == bot->b_id );
+
+        for( i = ECHO_FRAME_ID; i < size; i++ )
+        {
+            assert( ( unsigned char )payload[ i ] ==
+                    pattern( bot->b_received++ ) );
+        }
+    }
+    else if( type == ECHO_FRAME_END )
+    {
+        assert( bot->b_offered && get_id( payload ) == bot->b_id );
+        assert( size == ECHO_FRAME_ID + 1 && payload[ ECHO_FRAME_ID ] == 0 );
+        bot->b_ended = 1;
+    }
+}
+
+void on_close( echo_session_t *session, int err, void *arg )
+{
+    ( void )session;
+    assert( err == 0 );
+    ( ( struct bot* )arg )->b_closed = 1;
+}
@@ -0,0 +1,161 @@
+#include "echopipeline.h"
+#include "testclient.h"
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/socket.h>
+
+#define NODES       100
+#define CHUNKS      256
+
+static void push( echo_lanes_t *lanes, echo_lane_node_t *node,
+        echo_lane_t lane, size_t size );
+
+int main( void )
+{
+    static echo_lane_node_t nodes[ 2 * NODES ];
+    static char chunk[ ECHO_FRAME_CHUNK_SIZE ], buffer[ ECHO_FRAME_MAX ];
+    echo_lane_usage_t usage[ ECHO_LANE_MAX ];
+    echo_client_context_t *client, *peer;
+    echo_pipeline_t *pipeline;
+    echo_lane_node_t *node;
+    echo_lanes_t lanes;
+    echo_frame_t frame;
+    struct iovec part;
+    int fds[ 2 ], bulk, control, i, err;
+
+    assert( echo_lane_of( ECHO_FRAME_ACCEPT ) == ECHO_LANE_CONTROL );
+    assert( echo_lane_of( ECHO_FRAME_ERROR ) == ECHO_LANE_CONTROL );
+    assert( echo_lane_of( ECHO_FRAME_TEXT ) == ECHO_LANE_INTERACTIVE );
+    assert( echo_lane_of( ECHO_FRAME_DIRECT ) == ECHO_LANE_INTERACTIVE );
+    assert( echo_lane_of( ECHO_FRAME_CHUNK ) == ECHO_LANE_BULK );
+
+    /* Control first, then chat, then the data queued before both. */
+    echo_lanes_init( &lanes );
+    assert( echo_lanes_pop( &lanes ) == NULL );
+
+    for( i = 0; i < 10; i++ )
+    {
+        push( &lanes, &nodes[ i ], ECHO_LANE_BULK, ECHO_FRAME_CHUNK_SIZE );
+    }
+
+    for( i = 10; i < 20; i++ )
+    {
+        push( &lanes, &nodes[ i ], ECHO_LANE_INTERACTIVE, 100 );
+    }
+
+    push( &lanes, &nodes[ 20 ], ECHO_LANE_CONTROL, 50 );
+    push( &lanes, &nodes[ 21 ], ECHO_LANE_CONTROL, 50 );
+    assert( echo_lanes_pending( &lanes ) == 22 );
+
+    assert( echo_lanes_pop( &lanes ) == &nodes[ 20 ] );
+    assert( echo_lanes_pop( &lanes ) == &nodes[ 21 ] );
+
+    for( i = 10; i < 20; i++ )
+    {
+        assert( echo_lanes_pop( &lanes ) == &nodes[ i ] );
+    }
+
+    for( i = 0; i < 10; i++ )
+    {
+        assert( echo_lanes_pop( &lanes ) == &nodes[ i ] );
+    }
+
+    assert( echo_lanes_pop( &lanes ) == NULL );
+
+    /* Under load bulk still gets its share, one quantum to four. */
+    for( i = 0; i < NODES; i++ )
+    {
+        push( &lanes, &nodes[ i ], ECHO_LANE_BULK, ECHO_LANE_QUANTUM );
+        push( &lanes, &nodes[ NODES + i ], ECHO_LANE_INTERACTIVE,
+                ECHO_LANE_QUANTUM );
+    }
+
+    for( bulk = 0, i = 0; i < 50; i++ )
+    {
+        assert( ( node = echo_lanes_pop( &lanes ) ) != NULL );
+
+        if( node->eln_lane == ECHO_LANE_BULK )
+        {
+            assert( node == &nodes[ bulk++ ] );
+        }
+    }
+
+    assert( bulk == 10 );
+
+    while( ( node = echo_lanes_pop( &lanes ) ) != NULL )
+    {
+        echo_lanes_done( &lanes, node );
+    }
+
+    memset( usage, 0, sizeof( usage ) );
+    echo_lanes_usage( &lanes, ECHO_LANE_BULK, &usage[ ECHO_LANE_BULK ] );
+    assert( usage[ ECHO_LANE_BULK ].elu_frames == NODES - 10 );
+    assert( usage[ ECHO_LANE_BULK ].elu_max >= 1000000 );
+    assert( usage[ ECHO_LANE_BULK ].elu_total >=
+            usage[ ECHO_LANE_BULK ].elu_max );
+
+    /* A reply queued behind megabytes of file data for a member whose
+     * socket is full goes out with the writer's next batch. */
+    assert( ( pipeline = echo_pipeline_create( 1, &err ) ) != NULL );
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    client = test_client_create( "member", fds[ 0 ], 0 );
+    peer = test_client_create( "peer", fds[ 1 ], 0 );
+    assert( echo_pipeline_attach( pipeline, client, &err ) == 0 );
+
+    part.iov_base = chunk;
+    part.iov_len = sizeof( chunk );
+
+    for( i = 0; i < CHUNKS; i++ )
+    {
+        memcpy( chunk, &i, sizeof( i ) );
+        assert( echo_pipeline_sendv( pipeline, ECHO_FRAME_CHUNK,
+                    ECHO_LANE_BULK, &part, 1, &err ) == 0 );
+    }
+
+    assert( echo_pipeline_sendto( pipeline, client, ECHO_FRAME_ACCEPT, NULL,
+                0, &err ) == 0 );
+    assert( echo_pipeline_close( pipeline, client, &err ) == 0 );
+
+    for( bulk = 0, control = -1; bulk < CHUNKS; )
+    {
+        assert( echo_client_context_recv( peer, &frame, buffer,
+                    sizeof( buffer ), &err ) > 0 );
+
+        if( frame.ef_type == ECHO_FRAME_ACCEPT )
+        {
+            assert( control == -1 );
+            control = bulk;
+            continue;
+        }
+
+        assert( frame.ef_type == ECHO_FRAME_CHUNK );
+        assert( frame.ef_length == sizeof( chunk ) );
+        assert( memcmp( buffer, &bulk, sizeof( bulk ) ) == 0 );
+        bulk++;
+    }
+
+    assert( control != -1 && control <= ECHO_PIPELINE_BATCH + 1 );
+    assert( echo_client_context_recv( peer, &frame, buffer, sizeof( buffer ),
+                &err ) == 0 );
+
+    echo_pipeline_lanes( pipeline, usage );
+    assert( usage[ ECHO_LANE_CONTROL ].elu_frames == 1 );
+    assert( usage[ ECHO_LANE_INTERACTIVE ].elu_frames == 0 );
+    assert( usage[ ECHO_LANE_BULK ].elu_frames == CHUNKS );
+
+    echo_pipeline_detach( pipeline, client );
+    echo_pipeline_destroy( pipeline );
+    echo_client_context_destroy( peer );
+
+    return EXIT_SUCCESS;
+}
+
+/* Stamped a millisecond ago */
+void push( echo_lanes_t *lanes, echo_lane_node_t *node, echo_lane_t lane,
+        size_t size )
+{
+    node->eln_size = size;
+    node->eln_queued = echo_lane_clock( ) - 1000000;
+    echo_lanes_push( lanes, lane, node );
+}
@@ -0,0 +1,173 @@
+#include "echocapture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define PATH        "test22.cap"
+#define THREADS     4
+#define RECORDS     10000
+#define SMALL       4096
+
+struct producer
+{
+    echo_capture_t *p_capture;
+    uint32_t p_connection;
+};
+
+static void *produce( void *arg );
+
+int main( void )
+{
+    static char buffer[ 256 ];
+    struct producer producers[ THREADS ];
+    pthread_t threads[ THREADS ];
+    echo_capture_record_t record;
+    echo_capture_t *capture;
+    unsigned int next[ THREADS + 1 ], seq, records;
+    FILE *file;
+    int i, err;
+
+    assert( echo_capture_create( PATH, 1000, &err ) == NULL );
+    assert( err == EINVAL );
+    assert( echo_capture_create( PATH, 2048, &err ) == NULL );
+    assert( err == EINVAL );
+
+    /* Records of several threads all come back, each thread's in order. */
+    assert( ( capture = echo_capture_create( PATH, ECHO_CAPTURE_RING,
+                    &err ) ) != NULL );
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        producers[ i ].p_capture = capture;
+        producers[ i ].p_connection = i + 1;
+        assert( pthread_create( &threads[ i ], NULL, produce,
+                    &producers[ i ] ) == 0 );
+    }
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    assert( echo_capture_record( capture, 1, 12, 0, NULL, 16384,
+                &err ) == 0 );
+    echo_capture_close( capture );
+    assert( echo_capture_dropped( capture ) == 0 );
+    assert( echo_capture_record( capture, 1, 4, 0, "late", 4, &err ) == -1 );
+    assert( err == ENOBUFS );
+    echo_capture_destroy( capture );
+
+    assert( ( file = echo_capture_open( PATH, &err ) ) != NULL );
+    memset( next, 0, sizeof( next ) );
+
+    for( records = 0; records < THREADS * ( RECORDS + 1 ); records++ )
+    {
+        assert( echo_capture_read( file, &record, buffer, sizeof( buffer ),
+                    &err ) == 1 );
+        assert( record.ecr_connection >= 1 &&
+                record.ecr_connection <= THREADS );
+
+        if( next[ record.ecr_connection ] == RECORDS )
+        {
+            assert( record.ecr_type == ECHO_CAPTURE_CLOSE );
+            assert( record.ecr_length == 0 );
+            next[ record.ecr_connection ]++;
+            continue;
+        }
+
+        assert( record.ecr_type == 4 && record.ecr_flags == 1 );
+        assert( record.ecr_length == sizeof( seq ) + record.ecr_connection );
+        memcpy( &seq, buffer, sizeof( seq ) );
+        assert( seq == next[ record.ecr_connection ]++ );
+    }
+
+    /* Only the length of file data is kept. */
+    assert( echo_capture_read( file, &record, buffer, sizeof( buffer ),
+                &err ) == 1 );
+    assert( record.ecr_type == 12 && record.ecr_length == 16384 );
+    assert( record.ecr_flags == ECHO_CAPTURE_ELIDED );
+    assert( echo_capture_read( file, &record, buffer, sizeof( buffer ),
+                &err ) == 0 );
+    fclose( file );
+
+    /* A ring too small for a burst drops what does not fit and counts it,
+     * the rest is intact. */
+    assert( ( capture = echo_capture_create( PATH, SMALL, &err ) ) != NULL );
+
+    for( seq = 0; seq < RECORDS; seq++ )
+    {
+        memset( buffer, seq, 100 );
+
+        if( echo_capture_record( capture, 1, 4, 0, buffer, 100, &err ) == -1 )
+            assert( err == ENOBUFS );
+    }
+
+    assert( echo_capture_record( capture, 1, 4, 0, buffer, SMALL,
+                &err ) == -1 );
+    echo_capture_close( capture );
+    assert( echo_capture_dropped( capture ) > 0 );
+
+    assert( ( file = echo_capture_open( PATH, &err ) ) != NULL );
+
+    for( records = 0; echo_capture_read( file, &record, buffer,
+                sizeof( buffer ), &err ) == 1; records++ )
+    {
+        assert( record.ecr_length == 100 );
+        assert( buffer[ 0 ] == buffer[ 99 ] );
+    }
+
+    assert( records + echo_capture_dropped( capture ) == RECORDS + 1 );
+    fclose( file );
+    echo_capture_destroy( capture );
+
+    /* A record cut short is an error, the file is not a capture without
+     * its preamble. */
+    assert( ( file = fopen( PATH, "r+b" ) ) != NULL );
+    assert( ftruncate( fileno( file ), ECHO_CAPTURE_PREAMBLE +
+                ECHO_CAPTURE_HEADER + 50 ) == 0 );
+    fclose( file );
+    assert( ( file = echo_capture_open( PATH, &err ) ) != NULL );
+    assert( echo_capture_read( file, &record, buffer, sizeof( buffer ),
+                &err ) == -1 );
+    assert( err == EIO );
+    fclose( file );
+
+    assert( ( file = fopen( PATH, "wb" ) ) != NULL );
+    fputs( "ECHO CAPTURE FILE", file );
+    fclose( file );
+    assert( echo_capture_open( PATH, &err ) == NULL );
+    assert( err == EINVAL );
+
+    unlink( PATH );
+
+    return EXIT_SUCCESS;
+}
+
+/* Connection N sends payloads of 4 + N bytes starting with a sequence
+ * number, then closes. */
+void *produce( void *arg )
+{
+    struct producer *producer;
+    char payload[ 64 ];
+    unsigned int seq;
+    int err;
+
+    producer = ( struct producer* )arg;
+    memset( payload, 0, sizeof( payload ) );
+
+    for( seq = 0; seq < RECORDS; seq++ )
+    {
+        memcpy( payload, &seq, sizeof( seq ) );
+        assert( echo_capture_record( producer->p_capture,
+                    producer->p_connection, 4, 1, payload,
+                    sizeof( seq ) + producer->p_connection, &err ) == 0 );
+    }
+
+    assert( echo_capture_record( producer->p_capture, producer->p_connection,
+                ECHO_CAPTURE_CLOSE, 0, NULL, 0, &err ) == 0 );
+
+    return NULL;
+}
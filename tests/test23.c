@@ -0,0 +1,181 @@
+#include "echotrace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define PATH        "test23.trace"
+#define THREADS     4
+#define ENTRIES     100
+#define SEQUENTIAL  10
+
+static void *wrap( void *arg );
+static void *recv_frames( void *arg );
+static void *disconnect( void *arg );
+static size_t load( echo_trace_entry_t *entries, size_t size );
+
+int main( void )
+{
+    static echo_trace_entry_t entries[ THREADS * ECHO_TRACE_RING ];
+    unsigned int next[ THREADS ], i;
+    pthread_t threads[ THREADS ];
+    size_t count, rings, recvs;
+    char line[ 256 ];
+    FILE *dump, *json;
+    int err;
+
+    /* A ring keeps the last ECHO_TRACE_RING entries, oldest first. */
+    assert( pthread_create( &threads[ 0 ], NULL, wrap, NULL ) == 0 );
+    pthread_join( threads[ 0 ], NULL );
+    assert( echo_trace_rings( ) == 1 );
+
+    assert( echo_trace_install( SIGUSR2, PATH, &err ) == 0 );
+    assert( raise( SIGUSR2 ) == 0 );
+    assert( ( count = load( entries, THREADS * ECHO_TRACE_RING ) ) ==
+            ECHO_TRACE_RING );
+
+    for( i = 0; i < count; i++ )
+    {
+        assert( entries[ i ].ete_event == ECHO_TRACE_ENQUEUE );
+        assert( entries[ i ].ete_args[ 0 ] == ENTRIES + i );
+        assert( i == 0 || entries[ i ].ete_time >= entries[ i - 1 ].ete_time );
+    }
+
+    /* Concurrent threads each keep their entries in order. */
+    for( i = 0; i < THREADS; i++ )
+    {
+        assert( pthread_create( &threads[ i ], NULL, recv_frames,
+                    ( void* )( size_t )i ) == 0 );
+    }
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    assert( ( rings = echo_trace_rings( ) ) <= THREADS );
+    assert( echo_trace_dump( PATH, &err ) == 0 );
+    count = load( entries, THREADS * ECHO_TRACE_RING );
+    memset( next, 0, sizeof( next ) );
+
+    for( recvs = 0, i = 0; i < count; i++ )
+    {
+        if( entries[ i ].ete_event != ECHO_TRACE_RECV )
+            continue;
+
+        assert( entries[ i ].ete_args[ 0 ] < THREADS );
+        assert( entries[ i ].ete_args[ 1 ] ==
+                next[ entries[ i ].ete_args[ 0 ] ]++ );
+        assert( entries[ i ].ete_args[ 2 ] == 4 );
+        assert( entries[ i ].ete_thread != 0 );
+        recvs++;
+    }
+
+    assert( recvs == THREADS * ENTRIES );
+
+    /* Threads that come and go take the rings of those gone. */
+    for( i = 0; i < SEQUENTIAL; i++ )
+    {
+        assert( pthread_create( &threads[ 0 ], NULL, disconnect,
+                    NULL ) == 0 );
+        pthread_join( threads[ 0 ], NULL );
+    }
+
+    assert( echo_trace_rings( ) == rings );
+
+    /* The JSON has one event per entry. */
+    assert( echo_trace_dump( PATH, &err ) == 0 );
+    count = load( entries, THREADS * ECHO_TRACE_RING );
+    assert( ( dump = fopen( PATH, "rb" ) ) != NULL );
+    assert( ( json = tmpfile( ) ) != NULL );
+    assert( echo_trace_export( dump, json, &err ) == ( long )count );
+    fclose( dump );
+    rewind( json );
+    assert( fgets( line, sizeof( line ), json ) != NULL );
+    assert( strncmp( line, "{\"displayTimeUnit\"", 18 ) == 0 );
+
+    for( recvs = 0; fgets( line, sizeof( line ), json ) != NULL; )
+    {
+        if( strstr( line, "\"name\":\"DISCONNECT\"" ) != NULL )
+        {
+            assert( strstr( line, "\"args\":{\"connection\":7,\"fd\":9}" ) !=
+                    NULL );
+            recvs++;
+        }
+    }
+
+    assert( recvs == SEQUENTIAL );
+    fclose( json );
+
+    assert( ( json = tmpfile( ) ) != NULL );
+    fputs( "not a trace", json );
+    rewind( json );
+    assert( echo_trace_export( json, stdout, &err ) == -1 );
+    assert( err == EINVAL );
+    fclose( json );
+
+    unlink( PATH );
+
+    return EXIT_SUCCESS;
+}
+
+void *wrap( void *arg )
+{
+    unsigned int i;
+
+    ( void )arg;
+
+    for( i = 0; i < ECHO_TRACE_RING + ENTRIES; i++ )
+    {
+        ECHO_TRACE( ENQUEUE, i, 0, 0 );
+    }
+
+    return NULL;
+}
+
+/* Thread N records frames of connection N. */
+void *recv_frames( void *arg )
+{
+    unsigned int i;
+
+    for( i = 0; i < ENTRIES; i++ )
+    {
+        ECHO_TRACE( RECV, ( uint32_t )( size_t )arg, i, 4 );
+    }
+
+    return NULL;
+}
+
+void *disconnect( void *arg )
+{
+    ( void )arg;
+    ECHO_TRACE( DISCONNECT, 7, 9, 0 );
+
+    return NULL;
+}
+
+/* Reads the dump back, checking its preamble */
+size_t load( echo_trace_entry_t *entries, size_t size )
+{
+    unsigned char preamble[ 12 ];
+    uint32_t value;
+    size_t count;
+    FILE *file;
+
+    assert( ( file = fopen( PATH, "rb" ) ) != NULL );
+    assert( fread( preamble, 1, sizeof( preamble ), file ) ==
+            sizeof( preamble ) );
+    assert( memcmp( preamble, "ETRC", 4 ) == 0 );
+    memcpy( &value, preamble + 4, sizeof( value ) );
+    assert( value == ECHO_TRACE_VERSION );
+    memcpy( &value, preamble + 8, sizeof( value ) );
+    assert( value == sizeof( echo_trace_entry_t ) );
+    count = fread( entries, sizeof( echo_trace_entry_t ), size, file );
+    assert( feof( file ) );
+    fclose( file );
+
+    return count;
+}
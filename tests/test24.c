@@ -0,0 +1,426 @@
+#include "echoframe.h"
+#include "testserver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define PORT        5060
+#define CHURNERS    8
+#define CYCLES      500
+#define TIMEOUT     10
+#define MAX_LENGTH  32
+#define FLOODERS    8
+#define SILENT      8
+
+/* Stress run against ./server: connections join and leave from many
+ * threads at once, chat lines are written in pieces cut at random byte
+ * boundaries, and some connections are dropped in the middle of a frame or
+ * send a header no frame can have. An observer that stays logged in must
+ * get every complete line exactly once and intact, and the server must
+ * still take logins and exit cleanly afterwards. ECHO_STRESS multiplies the
+ * number of cycles. A second server is then stopped while members flood
+ * it and connections wait to log in, it must wind them down and exit
+ * cleanly. */
+enum
+{
+    LEAVE,          /* logs in and out */
+    CHAT,           /* sends a line in pieces, then leaves */
+    TRUNCATE,       /* drops the connection halfway through a frame */
+    OVERSIZE,       /* sends a header longer than any frame */
+    ACTIONS
+};
+
+struct churner
+{
+    int c_index;
+    unsigned int c_seed;
+    int c_actions[ ACTIONS ];
+};
+
+static atomic_int g_received;
+static atomic_int g_flooding;
+static int g_cycles;
+static unsigned char *g_seen;
+
+static void *churn( void *arg );
+static void *observe( void *arg );
+static size_t line( int churner, int cycle, char *buffer );
+static void send_split( tcp_context_t *ctx, const char *buffer, size_t size,
+        unsigned int *seed );
+static void leave( tcp_context_t *ctx );
+static double now( void );
+static void check_stop( const char *server );
+static void *flood( void *arg );
+
+int main( void )
+{
+    char server[ PATH_MAX ], dir[ ] = "/tmp/echo-test24-XXXXXX";
+    char port[ 16 ], *argv[ 3 ];
+    struct churner churners[ CHURNERS ];
+    pthread_t threads[ CHURNERS ], observer;
+    int input, chats, actions[ ACTIONS ], i, j, status;
+    tcp_context_t *ctx, *last;
+    double start, elapsed;
+    char name[ MAX_LENGTH ];
+    time_t deadline;
+    pid_t pid;
+
+    assert( realpath( getenv( "ECHO_SERVER" ) != NULL ?
+                getenv( "ECHO_SERVER" ) : "./server", server ) != NULL );
+    assert( mkdtemp( dir ) != NULL && chdir( dir ) == 0 );
+    signal( SIGPIPE, SIG_IGN );
+
+    g_cycles = CYCLES * ( getenv( "ECHO_STRESS" ) != NULL ?
+            atoi( getenv( "ECHO_STRESS" ) ) : 1 );
+    assert( g_cycles > 0 );
+    assert( ( g_seen = calloc( CHURNERS * g_cycles, 1 ) ) != NULL );
+
+    sprintf( port, "%d", PORT );
+    argv[ 0 ] = server;
+    argv[ 1 ] = port;
+    argv[ 2 ] = NULL;
+    pid = test_server_spawn( argv, &input );
+    test_server_wait( PORT );
+
+    assert( ( ctx = test_server_join( PORT, "observer", TIMEOUT ) ) != NULL );
+    assert( pthread_create( &observer, NULL, observe, ctx ) == 0 );
+
+    start = now( );
+
+    for( i = 0; i < CHURNERS; i++ )
+    {
+        memset( &churners[ i ], 0, sizeof( churners[ i ] ) );
+        churners[ i ].c_index = i;
+        churners[ i ].c_seed = ( unsigned int )time( NULL ) * 31 + i;
+        assert( pthread_create( &threads[ i ], NULL, churn,
+                    &churners[ i ] ) == 0 );
+    }
+
+    memset( actions, 0, sizeof( actions ) );
+
+    for( i = 0; i < CHURNERS; i++ )
+    {
+        pthread_join( threads[ i ], NULL );
+
+        for( j = 0; j < ACTIONS; j++ )
+        {
+            actions[ j ] += churners[ i ].c_actions[ j ];
+        }
+    }
+
+    /* Every line sent whole reaches the observer. */
+    chats = actions[ CHAT ];
+    deadline = time( NULL ) + TIMEOUT;
+
+    while( atomic_load( &g_received ) < chats )
+    {
+        assert( time( NULL ) < deadline );
+        usleep( 10000 );
+    }
+
+    elapsed = now( ) - start;
+
+    /* Names are free again once their connections are gone, those dropped
+     * last may take the server a moment. */
+    for( i = 0; i < CHURNERS; i++ )
+    {
+        sprintf( name, "c%d.%d", i, g_cycles - 1 );
+
+        while( ( last = test_server_join( PORT, name, TIMEOUT ) ) == NULL )
+        {
+            assert( time( NULL ) < deadline );
+            usleep( 10000 );
+        }
+
+        leave( last );
+    }
+
+    shutdown( ctx->tc_socket, SHUT_WR );
+    pthread_join( observer, NULL );
+    tcp_context_destroy( ctx );
+    assert( atomic_load( &g_received ) == chats );
+
+    close( input );
+    assert( waitpid( pid, &status, 0 ) == pid );
+    assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+
+    printf( "%d connections in %.2f s, %.0f per second\n",
+            CHURNERS * g_cycles, elapsed, CHURNERS * g_cycles / elapsed );
+    printf( "%d left, %d chatted, %d truncated, %d oversized\n",
+            actions[ LEAVE ], actions[ CHAT ], actions[ TRUNCATE ],
+            actions[ OVERSIZE ] );
+    free( g_seen );
+    check_stop( server );
+
+    return EXIT_SUCCESS;
+}
+
+void *churn( void *arg )
+{
+    char buffer[ ECHO_FRAME_HEADER + ECHO_FRAME_MAX ], name[ MAX_LENGTH ];
+    struct churner *churner;
+    echo_frame_t frame;
+    tcp_context_t *ctx;
+    int cycle, action, err;
+    size_t size;
+
+    churner = ( struct churner* )arg;
+
+    for( cycle = 0; cycle < g_cycles; cycle++ )
+    {
+        sprintf( name, "c%d.%d", churner->c_index, cycle );
+        assert( ( ctx = test_server_join( PORT, name, TIMEOUT ) ) != NULL );
+        action = rand_r( &churner->c_seed ) % ACTIONS;
+        churner->c_actions[ action ]++;
+
+        if( action == CHAT )
+        {
+            frame.ef_type = ECHO_FRAME_CHAT;
+            frame.ef_flags = 0;
+            frame.ef_length = line( churner->c_index, cycle,
+                    buffer + ECHO_FRAME_HEADER );
+            echo_frame_encode( &frame, ( unsigned char* )buffer );
+            send_split( ctx, buffer, ECHO_FRAME_HEADER + frame.ef_length,
+                    &churner->c_seed );
+            leave( ctx );
+        }
+        else if( action == TRUNCATE )
+        {
+            frame.ef_type = ECHO_FRAME_CHAT;
+            frame.ef_flags = 0;
+            frame.ef_length = 1000;
+            echo_frame_encode( &frame, ( unsigned char* )buffer );
+            memset( buffer + ECHO_FRAME_HEADER, 'x', frame.ef_length );
+            size = ECHO_FRAME_HEADER + rand_r( &churner->c_seed ) %
+                frame.ef_length;
+            assert( tcp_context_send( ctx, buffer, size, &err ) ==
+                    ( ssize_t )size );
+            tcp_context_destroy( ctx );
+        }
+        else if( action == OVERSIZE )
+        {
+            frame.ef_type = ECHO_FRAME_CHAT;
+            frame.ef_flags = 0;
+            frame.ef_length = ECHO_FRAME_MAX * 16;
+            echo_frame_encode( &frame, ( unsigned char* )buffer );
+            assert( tcp_context_send( ctx, buffer, ECHO_FRAME_HEADER,
+                        &err ) == ECHO_FRAME_HEADER );
+            leave( ctx );
+        }
+        else
+        {
+            leave( ctx );
+        }
+    }
+
+    return NULL;
+}
+
+/* Counts the lines of the churners, ignoring notices and checking that
+ * none is cut, altered or seen twice. */
+void *observe( void *arg )
+{
+    static char buffer[ ECHO_FRAME_MAX ];
+    char expected[ ECHO_FRAME_MAX ], *text;
+    int churner, cycle, err;
+    echo_frame_t frame;
+    tcp_context_t *ctx;
+    ssize_t bytes;
+    size_t size;
+
+    ctx = ( tcp_context_t* )arg;
+
+    while( ( bytes = echo_frame_recv( ctx, &frame, buffer,
+                    sizeof( buffer ) - 1, &err ) ) > 0 )
+    {
+        buffer[ frame.ef_length ] = '\0';
+
+        if( frame.ef_type != ECHO_FRAME_TEXT ||
+                ( text = strstr( buffer, " says:\n" ) ) == NULL )
+            continue;
+
+        text += 7;
+        assert( sscanf( text, "stress %d %d", &churner, &cycle ) == 2 );
+        assert( churner >= 0 && churner < CHURNERS );
+        assert( cycle >= 0 && cycle < g_cycles );
+        size = line( churner, cycle, expected );
+        assert( buffer + frame.ef_length - text == ( ssize_t )size + 1 );
+        assert( memcmp( text, expected, size ) == 0 && text[ size ] == '\n' );
+        assert( !g_seen[ churner * g_cycles + cycle ] );
+        g_seen[ churner * g_cycles + cycle ] = 1;
+        atomic_fetch_add( &g_received, 1 );
+    }
+
+    assert( bytes == 0 );
+
+    return NULL;
+}
+
+/* Lines run from a few bytes to a few hundred, with a filler that tells
+ * them apart. */
+size_t line( int churner, int cycle, char *buffer )
+{
+    size_t size, filler, i;
+
+    size = sprintf( buffer, "stress %d %d ", churner, cycle );
+    filler = ( churner * 131 + cycle * 17 ) % 400;
+
+    for( i = 0; i < filler; i++ )
+    {
+        buffer[ size++ ] = 'a' + ( churner + cycle + i ) % 26;
+    }
+
+    return size;
+}
+
+/* Each piece goes out in a write of its own, a pause now and then lets the
+ * server read what came so far before the rest. */
+void send_split( tcp_context_t *ctx, const char *buffer, size_t size,
+        unsigned int *seed )
+{
+    size_t piece;
+    int err;
+
+    while( size > 0 )
+    {
+        piece = 1 + rand_r( seed ) % ( size < 64 ? size : 64 );
+        assert( tcp_context_send( ctx, buffer, piece, &err ) ==
+                ( ssize_t )piece );
+        buffer += piece;
+        size -= piece;
+
+        if( rand_r( seed ) % 8 == 0 )
+            usleep( 100 );
+    }
+}
+
+/* Stops writing and reads until the server closes, which it does once it
+ * has handled everything sent before. */
+void leave( tcp_context_t *ctx )
+{
+    char buffer[ 4096 ];
+    ssize_t bytes;
+    int err;
+
+    shutdown( ctx->tc_socket, SHUT_WR );
+
+    while( ( bytes = tcp_context_recv( ctx, buffer, sizeof( buffer ),
+                    &err ) ) > 0 )
+        ;
+
+    assert( bytes == 0 || err == ECONNRESET );
+    tcp_context_destroy( ctx );
+}
+
+double now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Stopped under load, with workers, writers, the read-ahead, a queue limit,
+ * a capture and the admin socket in use by the connections it ends. */
+void check_stop( const char *server )
+{
+    char port[ 16 ], *argv[ 9 ];
+    pthread_t threads[ FLOODERS ];
+    tcp_context_t *silent[ SILENT ];
+    int input, status, i, err;
+    time_t deadline;
+    pid_t pid;
+
+    sprintf( port, "%d", PORT + 1 );
+    argv[ 0 ] = ( char* )server;
+    argv[ 1 ] = "--workers=2";
+    argv[ 2 ] = "--writers=2";
+    argv[ 3 ] = "--read-ahead=4096";
+    argv[ 4 ] = "--queue-limit=8";
+    argv[ 5 ] = "--capture=capture.bin";
+    argv[ 6 ] = "--admin=admin.sock";
+    argv[ 7 ] = port;
+    argv[ 8 ] = NULL;
+    pid = test_server_spawn( argv, &input );
+    test_server_wait( PORT + 1 );
+
+    for( i = 0; i < FLOODERS; i++ )
+    {
+        assert( pthread_create( &threads[ i ], NULL, flood,
+                    ( void* )( intptr_t )i ) == 0 );
+    }
+
+    /* Connected but not logged in, their threads wait for a first frame. */
+    for( i = 0; i < SILENT; i++ )
+    {
+        assert( ( silent[ i ] = tcp_context_create( &err ) ) != NULL );
+        assert( tcp_context_connect( silent[ i ], "localhost", PORT + 1,
+                    &err ) == 0 );
+    }
+
+    deadline = time( NULL ) + TIMEOUT;
+
+    while( atomic_load( &g_flooding ) < FLOODERS )
+    {
+        assert( time( NULL ) < deadline );
+        usleep( 10000 );
+    }
+
+    usleep( 100000 );
+    close( input );
+
+    while( waitpid( pid, &status, WNOHANG ) == 0 )
+    {
+        if( time( NULL ) >= deadline )
+        {
+            kill( pid, SIGKILL );
+            assert( !"server did not stop" );
+        }
+
+        usleep( 10000 );
+    }
+
+    assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+
+    for( i = 0; i < FLOODERS; i++ )
+    {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    for( i = 0; i < SILENT; i++ )
+    {
+        tcp_context_destroy( silent[ i ] );
+    }
+
+    unlink( "capture.bin" );
+}
+
+/* Sends lines without reading until the server goes away. */
+void *flood( void *arg )
+{
+    char name[ MAX_LENGTH ];
+    tcp_context_t *ctx;
+    int err;
+
+    sprintf( name, "f%d", ( int )( intptr_t )arg );
+    assert( ( ctx = test_server_join( PORT + 1, name, TIMEOUT ) ) != NULL );
+    atomic_fetch_add( &g_flooding, 1 );
+
+    while( echo_frame_send( ctx, ECHO_FRAME_CHAT, 0, "flood", 5, &err ) > 0 );
+
+    tcp_context_destroy( ctx );
+
+    return NULL;
+}
@@ -0,0 +1,173 @@
+#include "echoclientcontext.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define FRAMES      100
+#define SMALL       ( ECHO_FRAME_HEADER + 4 )
+
+static size_t put_frame( char *wire, int type, const char *payload,
+        size_t size );
+static tcp_context_t *wrap( int fd );
+
+int main( void )
+{
+    char wire[ 8192 ], ahead[ 4096 ], payload[ 256 ], text[ 32 ];
+    echo_client_context_t *client;
+    echo_frame_reader_t reader;
+    tcp_context_t *ctx;
+    echo_frame_t frame;
+    const char *data;
+    size_t length, i;
+    int fds[ 2 ], err;
+
+    /* A burst written at once is parsed out of a single call. */
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    ctx = wrap( fds[ 0 ] );
+
+    for( length = 0, i = 0; i < FRAMES; i++ )
+    {
+        sprintf( text, "line %zu", i );
+        length += put_frame( wire + length, ECHO_FRAME_CHAT, text,
+                strlen( text ) );
+    }
+
+    assert( write( fds[ 1 ], wire, length ) == ( ssize_t )length );
+    echo_frame_reader_init( &reader, ahead, sizeof( ahead ) );
+
+    for( i = 0; i < FRAMES; i++ )
+    {
+        sprintf( text, "line %zu", i );
+        assert( echo_frame_reader_header( &reader, ctx, &frame, &err ) == 1 );
+        assert( frame.ef_type == ECHO_FRAME_CHAT );
+        assert( frame.ef_length == strlen( text ) );
+        assert( echo_frame_reader_payload( &reader, ctx, &frame, payload,
+                    sizeof( payload ), &err ) == 0 );
+        assert( memcmp( payload, text, frame.ef_length ) == 0 );
+    }
+
+    assert( reader.efr_calls == 1 && reader.efr_frames == FRAMES );
+
+    /* A reader barely larger than a header moves what it holds to the
+     * front, and payloads it cannot hold are read past it. */
+    memset( payload, 'p', sizeof( payload ) );
+    length = put_frame( wire, ECHO_FRAME_CHAT, payload, 10 );
+    length += put_frame( wire + length, ECHO_FRAME_CHAT, payload, 200 );
+    length += put_frame( wire + length, ECHO_FRAME_OFFER, NULL, 0 );
+    assert( write( fds[ 1 ], wire, length ) == ( ssize_t )length );
+    echo_frame_reader_init( &reader, ahead, SMALL );
+
+    assert( echo_frame_reader_header( &reader, ctx, &frame, &err ) == 1 );
+    assert( frame.ef_length == 10 );
+    memset( payload, 0, sizeof( payload ) );
+    assert( echo_frame_reader_payload( &reader, ctx, &frame, payload,
+                sizeof( payload ), &err ) == 0 );
+    assert( memcmp( payload, "pppppppppp", 11 ) == 0 );
+
+    assert( echo_frame_reader_header( &reader, ctx, &frame, &err ) == 1 );
+    assert( frame.ef_length == 200 );
+    assert( echo_frame_reader_payload( &reader, ctx, &frame, payload, 100,
+                &err ) == -1 && err == EMSGSIZE );
+    memset( payload, 0, sizeof( payload ) );
+    assert( echo_frame_reader_payload( &reader, ctx, &frame, payload,
+                sizeof( payload ), &err ) == 0 );
+
+    for( i = 0; i < 200; i++ )
+    {
+        assert( payload[ i ] == 'p' );
+    }
+
+    assert( echo_frame_reader_header( &reader, ctx, &frame, &err ) == 1 );
+    assert( frame.ef_type == ECHO_FRAME_OFFER && frame.ef_length == 0 );
+    assert( echo_frame_reader_payload( &reader, ctx, &frame, payload,
+                sizeof( payload ), &err ) == 0 );
+
+    /* File data taken out of it leaves the rest on the socket. */
+    length = put_frame( wire, ECHO_FRAME_CHUNK, payload, 100 );
+    assert( write( fds[ 1 ], wire, length ) == ( ssize_t )length );
+    echo_frame_reader_init( &reader, ahead, sizeof( ahead ) );
+    assert( echo_frame_reader_header( &reader, ctx, &frame, &err ) == 1 );
+    assert( echo_frame_reader_take( &reader, &data, 40 ) == 40 );
+    assert( memcmp( data, payload, 40 ) == 0 );
+    assert( echo_frame_reader_take( &reader, &data, 100 ) == 60 );
+    assert( echo_frame_reader_take( &reader, &data, 100 ) == 0 );
+
+    /* Closed in the middle of a header, then of a payload. */
+    assert( write( fds[ 1 ], wire, 3 ) == 3 );
+    shutdown( fds[ 1 ], SHUT_WR );
+    assert( echo_frame_reader_header( &reader, ctx, &frame, &err ) == -1 &&
+            err == ECONNRESET );
+    close( fds[ 1 ] );
+    tcp_context_destroy( ctx );
+
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    ctx = wrap( fds[ 0 ] );
+    echo_frame_reader_init( &reader, ahead, sizeof( ahead ) );
+    length = put_frame( wire, ECHO_FRAME_CHAT, payload, 100 );
+    assert( write( fds[ 1 ], wire, length - 1 ) == ( ssize_t )length - 1 );
+    shutdown( fds[ 1 ], SHUT_WR );
+    assert( echo_frame_reader_header( &reader, ctx, &frame, &err ) == 1 );
+    assert( echo_frame_reader_payload( &reader, ctx, &frame, payload,
+                sizeof( payload ), &err ) == -1 && err == ECONNRESET );
+    close( fds[ 1 ] );
+    assert( echo_frame_reader_header( NULL, ctx, &frame, &err ) == -1 &&
+            err == EINVAL );
+
+    /* A client context reads through the reader it is given, up to the
+     * close between frames. */
+    assert( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+    assert( ( client = echo_client_context_create( wrap( fds[ 0 ] ),
+                    "alice", &err ) ) != NULL );
+    echo_frame_reader_init( &reader, ahead, sizeof( ahead ) );
+    client->eec_reader = &reader;
+    length = put_frame( wire, ECHO_FRAME_CHAT, "hi", 2 );
+    length += put_frame( wire + length, ECHO_FRAME_DIRECT, "there", 5 );
+    assert( write( fds[ 1 ], wire, length ) == ( ssize_t )length );
+    close( fds[ 1 ] );
+
+    assert( echo_client_context_recv( client, &frame, payload,
+                sizeof( payload ), &err ) == ECHO_FRAME_HEADER + 2 );
+    assert( frame.ef_type == ECHO_FRAME_CHAT &&
+            memcmp( payload, "hi", 2 ) == 0 );
+    assert( echo_client_context_recv_header( client, &frame, &err ) == 1 );
+    assert( frame.ef_type == ECHO_FRAME_DIRECT );
+    assert( echo_client_context_recv_payload( client, &frame, payload,
+                sizeof( payload ), &err ) == 0 );
+    assert( memcmp( payload, "there", 5 ) == 0 );
+    assert( echo_client_context_recv_header( client, &frame, &err ) == 0 );
+    assert( reader.efr_calls == 2 && reader.efr_frames == 2 );
+
+    echo_client_context_destroy( client );
+    tcp_context_destroy( ctx );
+
+    return EXIT_SUCCESS;
+}
+
+size_t put_frame( char *wire, int type, const char *payload, size_t size )
+{
+    echo_frame_t frame;
+
+    frame.ef_length = size;
+    frame.ef_type = type;
+    frame.ef_flags = 0;
+    echo_frame_encode( &frame, ( unsigned char* )wire );
+
+    if( size > 0 )
+        memcpy( wire + ECHO_FRAME_HEADER, payload, size );
+
+    return ECHO_FRAME_HEADER + size;
+}
+
+tcp_context_t *wrap( int fd )
+{
+    tcp_context_t *ctx;
+    int err;
+
+    assert( ( ctx = tcp_context_create( &err ) ) != NULL );
+    ctx->tc_socket = fd;
+
+    return ctx;
+}
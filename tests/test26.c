@@ -0,0 +1,350 @@
+#include "echoadmin.h"
+#include "echoframe.h"
+#include "testserver.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define PORT        5070
+#define THREADS     4
+#define ROUNDS      2000
+#define DEADLINE    30
+
+static const char *handle( int argc, char *argv[ ], FILE *out, void *arg );
+static int ask( const char *path, const char *command, char *reply,
+        size_t size );
+static int dial( const char *path );
+static void *churn( void *arg );
+static void check_server( const char *server, const char *path );
+
+static atomic_int g_stop;
+
+int main( void )
+{
+    char path[ 64 ], reply[ 4096 ], line[ 1024 ], server[ PATH_MAX ];
+    char dir[ ] = "/tmp/echo-test26-XXXXXX";
+    pthread_t threads[ THREADS ];
+    echo_admin_session_t *session;
+    echo_admin_view_t view;
+    echo_admin_t *admin;
+    struct sockaddr_un addr;
+    unsigned long views;
+    int calls, fd, err, i;
+
+    assert( realpath( getenv( "ECHO_SERVER" ) != NULL ?
+                getenv( "ECHO_SERVER" ) : "./server", server ) != NULL );
+    assert( mkdtemp( dir ) != NULL && chdir( dir ) == 0 );
+    sprintf( path, "%s/admin", dir );
+    signal( SIGPIPE, SIG_IGN );
+
+    /* Paths that cannot be bound, or that hold something else. */
+    memset( line, 'x', sizeof( line ) - 1 );
+    line[ sizeof( line ) - 1 ] = '\0';
+    assert( echo_admin_create( line, handle, NULL, &err ) == NULL );
+    assert( err == EINVAL );
+    assert( ( fd = open( path, O_CREAT | O_WRONLY, 0600 ) ) != -1 );
+    close( fd );
+    assert( echo_admin_create( path, handle, NULL, &err ) == NULL );
+    assert( err == EEXIST );
+    unlink( path );
+
+    /* The handler gets the words of the line, its reply ends with OK or
+     * ERROR and the reason. */
+    calls = 0;
+    assert( ( admin = echo_admin_create( path, handle, &calls, &err ) ) !=
+            NULL );
+    assert( echo_admin_create( path, handle, NULL, &err ) == NULL );
+    assert( err == EADDRINUSE );
+    assert( ask( path, "echo  one\ttwo", reply, sizeof( reply ) ) == 0 );
+    assert( strcmp( reply, "3 echo one two\n" ) == 0 );
+    assert( ask( path, "fail now", reply, sizeof( reply ) ) == -1 );
+    assert( strcmp( reply, "ERROR boom\n" ) == 0 );
+    assert( ask( path, "a b c d e f g h i", reply, sizeof( reply ) ) == -1 );
+    assert( strcmp( reply, "ERROR too many arguments\n" ) == 0 );
+    assert( calls == 2 );
+
+    /* So does a line longer than the buffer, then the connection ends. */
+    memset( line, 'y', ECHO_ADMIN_LINE );
+    line[ ECHO_ADMIN_LINE ] = '\0';
+    assert( ask( path, line, reply, sizeof( reply ) ) == -1 );
+    assert( strcmp( reply, "ERROR line too long\n" ) == 0 );
+
+    /* A session is seen until closed, a copy tells when it went stale. */
+    session = echo_admin_open( admin, 7, 9, "alice" );
+    assert( session == echo_admin_slot( admin, 0 ) );
+    echo_admin_count( session, 10 );
+    echo_admin_count( session, 5 );
+    assert( echo_admin_view( session, &view ) == 1 );
+    assert( view.eav_id == 7 && view.eav_fd == 9 );
+    assert( view.eav_frames == 2 && view.eav_bytes == 15 );
+    assert( strcmp( view.eav_name, "alice" ) == 0 );
+    assert( view.eav_since <= time( NULL ) );
+    assert( echo_admin_same( session, &view ) );
+    echo_admin_close( session );
+    assert( !echo_admin_same( session, &view ) );
+    assert( echo_admin_view( session, &view ) == 0 );
+    assert( echo_admin_view( echo_admin_slot( admin, 1 ), &view ) == 0 );
+    echo_admin_count( NULL, 1 );
+    echo_admin_close( NULL );
+
+    /* Sessions coming and going are only ever seen whole, their counters
+     * may be a frame apart. */
+    atomic_store( &g_stop, 0 );
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        assert( pthread_create( &threads[ i ], NULL, churn, admin ) == 0 );
+    }
+
+    for( views = 0; views < ROUNDS; )
+    {
+        for( i = 0; i < THREADS * 2; i++ )
+        {
+            if( !echo_admin_view( echo_admin_slot( admin, i ), &view ) )
+                continue;
+
+            sprintf( line, "t%u", view.eav_id );
+            assert( strcmp( view.eav_name, line ) == 0 );
+            assert( view.eav_fd == ( int )view.eav_id + 100 );
+            assert( view.eav_bytes % 3 == 0 && view.eav_frames <= 3 );
+            assert( view.eav_bytes / 3 + 1 >= view.eav_frames &&
+                    view.eav_bytes / 3 <= view.eav_frames + 1 );
+            views++;
+        }
+    }
+
+    atomic_store( &g_stop, 1 );
+
+    for( i = 0; i < THREADS; i++ )
+    {
+        pthread_join( threads[ i ], NULL );
+    }
+
+    /* The file goes with the socket. */
+    echo_admin_destroy( admin );
+    assert( access( path, F_OK ) == -1 );
+
+    /* A socket nobody listens on is what a crashed server leaves. */
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+    assert( ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) != -1 );
+    assert( bind( fd, ( struct sockaddr* )&addr, sizeof( addr ) ) == 0 );
+    close( fd );
+    assert( ( admin = echo_admin_create( path, handle, &calls, &err ) ) !=
+            NULL );
+    assert( ask( path, "echo", reply, sizeof( reply ) ) == 0 );
+    echo_admin_destroy( admin );
+
+    check_server( server, path );
+    unlink( "server.log" );
+    unlink( "server.trace" );
+    rmdir( dir );
+
+    return EXIT_SUCCESS;
+}
+
+/* Writes the count and the words back, fails on "fail". */
+const char *handle( int argc, char *argv[ ], FILE *out, void *arg )
+{
+    int i;
+
+    ( *( int* )arg )++;
+
+    if( strcmp( argv[ 0 ], "fail" ) == 0 )
+        return "boom";
+
+    fprintf( out, "%d", argc );
+
+    for( i = 0; i < argc; i++ )
+    {
+        fprintf( out, " %s", argv[ i ] );
+    }
+
+    fprintf( out, "\n" );
+
+    return NULL;
+}
+
+/* Sends a command and reads the reply to its last line: 0 when it ends
+ * with OK, which is left out of reply, -1 when it ends with ERROR. */
+int ask( const char *path, const char *command, char *reply, size_t size )
+{
+    char line[ 1100 ], *last;
+    size_t used;
+    ssize_t bytes;
+    int fd;
+
+    /* At once, the server may hang up on the first part. */
+    assert( strlen( command ) + 1 < sizeof( line ) );
+    sprintf( line, "%s\n", command );
+    fd = dial( path );
+    assert( send( fd, line, strlen( line ), 0 ) == ( ssize_t )strlen( line ) );
+
+    for( used = 0; ; used += bytes )
+    {
+        assert( used < size - 1 );
+        assert( ( bytes = recv( fd, reply + used, size - 1 - used, 0 ) ) >
+                0 );
+        reply[ used + bytes ] = '\0';
+
+        if( used + bytes == 0 || reply[ used + bytes - 1 ] != '\n' )
+            continue;
+
+        reply[ used + bytes - 1 ] = '\0';
+        last = strrchr( reply, '\n' );
+        last = last == NULL ? reply : last + 1;
+        reply[ used + bytes - 1 ] = '\n';
+
+        if( strcmp( last, "OK\n" ) == 0 )
+        {
+            *last = '\0';
+            close( fd );
+            return 0;
+        }
+
+        if( strncmp( last, "ERROR", 5 ) == 0 )
+        {
+            close( fd );
+            return -1;
+        }
+    }
+}
+
+int dial( const char *path )
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+    assert( ( fd = socket( AF_UNIX, SOCK_STREAM, 0 ) ) != -1 );
+    assert( connect( fd, ( struct sockaddr* )&addr, sizeof( addr ) ) == 0 );
+
+    return fd;
+}
+
+/* Thread N keeps logging in as tN on descriptor N + 100, three bytes a
+ * frame. */
+void *churn( void *arg )
+{
+    static atomic_uint next;
+    echo_admin_session_t *session;
+    unsigned int id;
+    char name[ 16 ];
+    int i;
+
+    id = atomic_fetch_add( &next, 1 );
+    sprintf( name, "t%u", id );
+
+    while( !atomic_load( &g_stop ) )
+    {
+        assert( ( session = echo_admin_open( ( echo_admin_t* )arg, id,
+                        id + 100, name ) ) != NULL );
+
+        for( i = 0; i < 3; i++ )
+        {
+            echo_admin_count( session, 3 );
+        }
+
+        echo_admin_close( session );
+    }
+
+    return NULL;
+}
+
+/* The server lists its members, kicks one out, takes new settings and
+ * stops on command. */
+void check_server( const char *server, const char *path )
+{
+    char reply[ 4096 ], buffer[ ECHO_FRAME_MAX ], port[ 16 ], *argv[ 5 ];
+    echo_frame_t frame;
+    tcp_context_t *alice;
+    int input, status, err;
+    time_t deadline;
+    pid_t pid;
+
+    /* The admin socket is up before the listener. */
+    sprintf( port, "%d", PORT );
+    argv[ 0 ] = ( char* )server;
+    argv[ 1 ] = "--admin";
+    argv[ 2 ] = ( char* )path;
+    argv[ 3 ] = port;
+    argv[ 4 ] = NULL;
+    pid = test_server_spawn( argv, &input );
+    test_server_wait( PORT );
+    deadline = time( NULL ) + DEADLINE;
+    assert( ( alice = test_server_join( PORT, "alice", DEADLINE ) ) != NULL );
+    assert( echo_frame_send( alice, ECHO_FRAME_CHAT, 0, "hi", 2,
+                &err ) > 0 );
+
+    /* The line is counted once the connection thread has read it. */
+    while( ask( path, "sessions", reply, sizeof( reply ) ) != 0 ||
+            strstr( reply, "frames=1 bytes=" ) == NULL )
+    {
+        assert( time( NULL ) < deadline );
+        usleep( 10000 );
+    }
+
+    assert( strstr( reply, "name=alice " ) != NULL );
+    assert( strstr( reply, "recvq=0 sendq=" ) != NULL );
+    assert( strstr( reply, "sessions=1\n" ) != NULL );
+
+    assert( ask( path, "stats", reply, sizeof( reply ) ) == 0 );
+    assert( strstr( reply, "router_depth=" ) != NULL );
+    assert( ask( path, "rate 50", reply, sizeof( reply ) ) == 0 );
+    assert( strcmp( reply, "rate=50\n" ) == 0 );
+    assert( ask( path, "rate -1", reply, sizeof( reply ) ) == -1 );
+    assert( ask( path, "rate", reply, sizeof( reply ) ) == 0 );
+    assert( strcmp( reply, "rate=50\n" ) == 0 );
+    assert( ask( path, "log debug", reply, sizeof( reply ) ) == 0 );
+    assert( strcmp( reply, "log=debug\n" ) == 0 );
+    assert( ask( path, "log loud", reply, sizeof( reply ) ) == -1 );
+    assert( ask( path, "nothing", reply, sizeof( reply ) ) == -1 );
+
+    /* A member kicked is told, then its connection ends. */
+    assert( ask( path, "kick alice", reply, sizeof( reply ) ) == 0 );
+
+    do
+    {
+        assert( time( NULL ) < deadline );
+        assert( echo_frame_recv( alice, &frame, buffer, sizeof( buffer ),
+                    &err ) > 0 );
+    }
+    while( frame.ef_type != ECHO_FRAME_TEXT ||
+            strncmp( buffer, "Removed by the operator", 23 ) != 0 );
+
+    while( echo_frame_recv( alice, &frame, buffer, sizeof( buffer ),
+                &err ) > 0 )
+    {
+        assert( time( NULL ) < deadline );
+    }
+
+    tcp_context_destroy( alice );
+
+    while( ask( path, "kick alice", reply, sizeof( reply ) ) == 0 )
+    {
+        assert( time( NULL ) < deadline );
+        usleep( 10000 );
+    }
+
+    assert( strcmp( reply, "ERROR not online\n" ) == 0 );
+
+    /* Stopped from the socket, stdin still open. */
+    assert( ask( path, "stop", reply, sizeof( reply ) ) == 0 );
+    assert( waitpid( pid, &status, 0 ) == pid );
+    assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+    assert( access( path, F_OK ) == -1 );
+    close( input );
+}
@@ -0,0 +1,192 @@
+#include "echoconfig.h"
+#include "echoframe.h"
+#include "testserver.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define PORT        5080
+#define LINES       200
+#define DEADLINE    30
+
+static void write_file( const char *path, const char *text );
+static int check_bad( const char *path, const char *text );
+static void check_server( const char *server );
+
+int main( void )
+{
+    static const char *expected[ ] =
+    {
+        "server", "--users=100", "--queue-limit=16", "--huge-pages",
+        "--spool=/tmp/with space", "--log-level=debug", "--users", "5",
+        "4000"
+    };
+    char *argv[ ] = { "server", "--users", "5", "4000", NULL };
+    char path[ PATH_MAX ], server[ PATH_MAX ], overlong[ 2048 ];
+    char dir[ ] = "/tmp/echo-test27-XXXXXX";
+    echo_config_t *config;
+    size_t line;
+    int i, err;
+
+    assert( realpath( getenv( "ECHO_SERVER" ) != NULL ?
+                getenv( "ECHO_SERVER" ) : "./server", server ) != NULL );
+    assert( mkdtemp( dir ) != NULL && chdir( dir ) == 0 );
+    sprintf( path, "%s/echo.conf", dir );
+
+    /* Names become long options ahead of the command line's. */
+    write_file( path, "# preallocation\n"
+            "users 100\n"
+            "\n"
+            "queue-limit = 16\n"
+            "  huge-pages  \n"
+            "spool=/tmp/with space \n"
+            "  # indented comment\n"
+            "log-level\tdebug" );
+    assert( ( config = echo_config_load( path, 4, argv, &line,
+                    &err ) ) != NULL );
+    assert( config->ec_argc == 9 && config->ec_read == 5 );
+
+    for( i = 0; i < config->ec_argc; i++ )
+    {
+        assert( strcmp( config->ec_argv[ i ], expected[ i ] ) == 0 );
+    }
+
+    assert( config->ec_argv[ config->ec_argc ] == NULL );
+    assert( config->ec_argv[ 6 ] == argv[ 1 ] );
+    echo_config_destroy( config );
+
+    /* An empty file leaves the command line as it is. */
+    write_file( path, "" );
+    assert( ( config = echo_config_load( path, 1, argv, &line,
+                    &err ) ) != NULL );
+    assert( config->ec_argc == 1 && config->ec_read == 0 );
+    assert( config->ec_argv[ 0 ] == argv[ 0 ] && config->ec_argv[ 1 ] == NULL );
+    echo_config_destroy( config );
+
+    /* Lines that are not options are told by number. */
+    assert( check_bad( path, "users 1\nrate: 5\n" ) == 2 );
+    assert( check_bad( path, "-users 1\n" ) == 1 );
+    assert( check_bad( path, "# none\n= 5\n\n" ) == 2 );
+    memset( overlong, 'a', sizeof( overlong ) - 2 );
+    overlong[ sizeof( overlong ) - 2 ] = '\n';
+    overlong[ sizeof( overlong ) - 1 ] = '\0';
+    assert( check_bad( path, overlong ) == 1 );
+
+    unlink( path );
+    assert( echo_config_load( path, 1, argv, &line, &err ) == NULL );
+    assert( err == ENOENT );
+
+    check_server( server );
+    unlink( "server.log" );
+    unlink( "server.trace" );
+    rmdir( dir );
+
+    return EXIT_SUCCESS;
+}
+
+void write_file( const char *path, const char *text )
+{
+    FILE *file;
+
+    assert( ( file = fopen( path, "w" ) ) != NULL );
+    assert( fputs( text, file ) != EOF || *text == '\0' );
+    assert( fclose( file ) == 0 );
+}
+
+/* Gives the line the error was found on. */
+int check_bad( const char *path, const char *text )
+{
+    char *argv[ ] = { "server", NULL };
+    size_t line;
+    int err;
+
+    write_file( path, text );
+    assert( echo_config_load( path, 1, argv, &line, &err ) == NULL );
+    assert( err == EINVAL );
+
+    return ( int )line;
+}
+
+/* The server starts from a file and relays a burst through a queue limit
+ * of one message, it refuses a file it cannot read. */
+void check_server( const char *server )
+{
+    char buffer[ ECHO_FRAME_MAX ], port[ 16 ], *argv[ 5 ];
+    tcp_context_t *alice, *bob;
+    echo_frame_t frame;
+    int input, status, lines, i, err;
+    time_t deadline;
+    FILE *log;
+    pid_t pid;
+
+    write_file( "bad.conf", "users 64\nport: 1\n" );
+    assert( ( pid = fork( ) ) != -1 );
+
+    if( pid == 0 )
+    {
+        argv[ 0 ] = ( char* )server;
+        argv[ 1 ] = "--config=bad.conf";
+        argv[ 2 ] = "5081";
+        argv[ 3 ] = NULL;
+        close( STDERR_FILENO );
+        execv( server, argv );
+        _exit( 127 );
+    }
+
+    assert( waitpid( pid, &status, 0 ) == pid );
+    assert( WIFEXITED( status ) && WEXITSTATUS( status ) == EXIT_FAILURE );
+    unlink( "bad.conf" );
+
+    write_file( "echo.conf", "users 64\nqueue-limit 1\nlog-level debug\n" );
+    sprintf( port, "%d", PORT );
+    argv[ 0 ] = ( char* )server;
+    argv[ 1 ] = "--config";
+    argv[ 2 ] = "echo.conf";
+    argv[ 3 ] = port;
+    argv[ 4 ] = NULL;
+    pid = test_server_spawn( argv, &input );
+    test_server_wait( PORT );
+    assert( ( alice = test_server_join( PORT, "alice", DEADLINE ) ) != NULL );
+    assert( ( bob = test_server_join( PORT, "bob", DEADLINE ) ) != NULL );
+
+    for( i = 0; i < LINES; i++ )
+    {
+        assert( echo_frame_send( alice, ECHO_FRAME_CHAT, 0, "hi", 2,
+                    &err ) > 0 );
+    }
+
+    deadline = time( NULL ) + DEADLINE;
+
+    for( lines = 0; lines < LINES; )
+    {
+        assert( time( NULL ) < deadline );
+        assert( echo_frame_recv( bob, &frame, buffer, sizeof( buffer ),
+                    &err ) > 0 );
+
+        if( frame.ef_type == ECHO_FRAME_TEXT &&
+                strncmp( buffer, "alice says:\nhi\n", 15 ) == 0 )
+            lines++;
+    }
+
+    tcp_context_destroy( alice );
+    tcp_context_destroy( bob );
+    close( input );
+    assert( waitpid( pid, &status, 0 ) == pid );
+    assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+    unlink( "echo.conf" );
+
+    /* Preallocated before taking logins, waits counted. */
+    assert( ( log = fopen( "server.log", "r" ) ) != NULL );
+    memset( buffer, 0, sizeof( buffer ) );
+    assert( fread( buffer, 1, sizeof( buffer ) - 1, log ) > 0 );
+    fclose( log );
+    assert( strstr( buffer, "Preallocating for 64 users... DONE" ) != NULL );
+    assert( strstr( buffer, "queue_waits=" ) != NULL );
+    assert( strstr( buffer, "alice joined as connection" ) != NULL );
+}
@@ -1,4 +1,5 @@
 #include "bagarray.h"
+#include <errno.h>
 #include <assert.h>
 
 static int cmp( const void *a, const void *b );
@@ -7,10 +8,19 @@ int main( void )
 {
     bag_array_t *bag;
     ssize_t from;
+    void **array;
     int *n, i, key, err;
 
     assert( ( bag = bag_array_create( &err ) ) != NULL );
 
+    /* Room made up front is not reallocated until it runs out. */
+    assert( bag_array_reserve( bag, -1, &err ) == -1 && err == EINVAL );
+    assert( bag_array_reserve( bag, 1000, &err ) == 0 );
+    assert( bag->b_capacity == 1000 && bag->b_size == 0 );
+    assert( bag_array_reserve( bag, 10, &err ) == 0 );
+    assert( bag->b_capacity == 1000 );
+    array = bag->b_array;
+
     for( i = 0; i < 1000; i++ )
     {
         n = malloc( sizeof( int ) );
@@ -19,6 +29,7 @@ int main( void )
         bag_array_insert( bag, n, &err );
     }
 
+    assert( bag->b_array == array && bag->b_capacity == 1000 );
     assert( *( int* )bag_array_get( bag, 500, &err ) == 1001 );
 
     from = 0;
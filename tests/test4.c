@@ -0,0 +1,64 @@
+#include "echocompress.h"
+#include "echoframe.h"
+#include <string.h>
+#include <assert.h>
+
+#define ROUNDS 100
+
+int main( void )
+{
+    char line[ 256 ], packed[ 512 ], plain[ 512 ];
+    echo_compress_t *tx, *rx;
+    unsigned char header[ ECHO_FRAME_HEADER ];
+    echo_frame_t in, out;
+    ssize_t bytes, total, raw;
+    int i, err;
+
+    in.ef_length = 70000;
+    in.ef_type = ECHO_FRAME_TEXT;
+    in.ef_flags = ECHO_FRAME_DEFLATE_BLOCK;
+    echo_frame_encode( &in, header );
+    echo_frame_decode( header, &out );
+    assert( out.ef_length == 70000 && out.ef_type == ECHO_FRAME_TEXT );
+    assert( out.ef_flags == ECHO_FRAME_DEFLATE_BLOCK );
+
+    if( !echo_compress_available( ) )
+        return EXIT_SUCCESS;
+
+    assert( ( tx = echo_compress_create( &err ) ) != NULL );
+    assert( ( rx = echo_compress_create( &err ) ) != NULL );
+
+    total = raw = 0;
+
+    for( i = 0; i < ROUNDS; i++ )
+    {
+        sprintf( line, "bot-%d says: the build is green, the build is green",
+                i % 7 );
+        bytes = echo_compress_deflate( tx, line, strlen( line ), packed,
+                sizeof( packed ), &err );
+        assert( bytes > 0 );
+        total += bytes;
+        raw += strlen( line );
+
+        bytes = echo_compress_inflate( rx, packed, bytes, plain,
+                sizeof( plain ), &err );
+        assert( bytes == ( ssize_t )strlen( line ) );
+        assert( memcmp( line, plain, bytes ) == 0 );
+    }
+
+    /* The shared history has to pay off on repetitive traffic. */
+    assert( total * 4 < raw );
+
+    memset( line, 'a', sizeof( line ) );
+    bytes = echo_compress_block_deflate( line, sizeof( line ), packed,
+            sizeof( packed ), &err );
+    assert( bytes > 0 && bytes < ( ssize_t )sizeof( line ) );
+    assert( echo_compress_block_inflate( packed, bytes, plain,
+                sizeof( plain ), &err ) == sizeof( line ) );
+    assert( memcmp( line, plain, sizeof( line ) ) == 0 );
+
+    echo_compress_destroy( tx );
+    echo_compress_destroy( rx );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#include "tcpcontext.h"
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#define PORT    5001
+#define TAKEN   5003
+#define BACKLOG 1000
+
+static void roundtrip( tcp_context_t *server_ctx, const char *host,
+        int family );
+static void check_fallback( void );
+
+int main( void )
+{
+    tcp_context_t *client_ctx, *server_ctx;
+    int err;
+
+    assert( ( server_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_bind( server_ctx, PORT, &err ) != -1 );
+    assert( tcp_context_listen( server_ctx, BACKLOG, &err ) != -1 );
+
+    roundtrip( server_ctx, "127.0.0.1", AF_INET );
+    roundtrip( server_ctx, "127.0.0.1", AF_INET );
+
+    if( server_ctx->tc_addr.ss_family == AF_INET6 )
+    {
+        roundtrip( server_ctx, "::1", AF_INET6 );
+    }
+
+    roundtrip( server_ctx, "localhost", AF_UNSPEC );
+    tcp_context_flush_cache( );
+    roundtrip( server_ctx, "localhost", AF_UNSPEC );
+
+    assert( ( client_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_connect( client_ctx, "no-such-host.invalid", PORT,
+                &err ) == -1 );
+    assert( err == EHOSTNOTFOUND );
+
+    tcp_context_destroy( client_ctx );
+    tcp_context_destroy( server_ctx );
+    check_fallback( );
+
+    return EXIT_SUCCESS;
+}
+
+/* With the IPv6 port held by an IPv6 only socket the bind falls back to
+ * IPv4, which that socket leaves free. */
+void check_fallback( void )
+{
+    tcp_context_t *server_ctx, *client_ctx, *peer_ctx;
+    struct sockaddr_in6 addr;
+    int fd, optval, err;
+
+    if( ( fd = socket( AF_INET6, SOCK_STREAM, 0 ) ) == -1 )
+        return;
+
+    optval = 1;
+    assert( setsockopt( fd, IPPROTO_IPV6, IPV6_V6ONLY, &optval,
+                sizeof( optval ) ) == 0 );
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons( TAKEN );
+    assert( bind( fd, ( struct sockaddr* )&addr, sizeof( addr ) ) == 0 );
+
+    assert( ( server_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_bind( server_ctx, TAKEN, &err ) != -1 );
+    assert( server_ctx->tc_addr.ss_family == AF_INET );
+    assert( tcp_context_listen( server_ctx, BACKLOG, &err ) != -1 );
+
+    assert( ( client_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_connect( client_ctx, "127.0.0.1", TAKEN,
+                &err ) == 0 );
+    assert( ( peer_ctx = tcp_context_accept( server_ctx, &err ) ) != NULL );
+
+    tcp_context_destroy( peer_ctx );
+    tcp_context_destroy( client_ctx );
+    tcp_context_destroy( server_ctx );
+    close( fd );
+}
+
+void roundtrip( tcp_context_t *server_ctx, const char *host, int family )
+{
+    tcp_context_t *client_ctx, *peer_ctx;
+    char buffer[ 256 ];
+    ssize_t bytes;
+    int err;
+
+    assert( ( client_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_connect( client_ctx, host, PORT, &err ) == 0 );
+    assert( family == AF_UNSPEC ||
+            client_ctx->tc_addr.ss_family == family );
+
+    peer_ctx = tcp_context_accept( server_ctx, &err );
+    assert( peer_ctx != NULL );
+
+    assert( tcp_context_send( client_ctx, host, strlen( host ),
+                &err ) == ( ssize_t )strlen( host ) );
+    bytes = tcp_context_recv( peer_ctx, buffer, 256, &err );
+    assert( bytes == ( ssize_t )strlen( host ) );
+    assert( !strncmp( buffer, host, bytes ) );
+
+    tcp_context_destroy( peer_ctx );
+    tcp_context_destroy( client_ctx );
+}
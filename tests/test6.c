@@ -0,0 +1,53 @@
+#include "echostats.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define THREADS 8
+#define ROUNDS  100000
+
+static void *count_thread( void *arg );
+
+int main( void )
+{
+    pthread_t threads[ THREADS ];
+    int i, j;
+
+    /* Two generations of threads, the second one adopts the blocks left
+     * behind by the first without losing their counts. */
+    for( j = 0; j < 2; j++ )
+    {
+        for( i = 0; i < THREADS; i++ )
+        {
+            assert( pthread_create( &threads[ i ], NULL, count_thread,
+                        NULL ) == 0 );
+        }
+
+        for( i = 0; i < THREADS; i++ )
+        {
+            pthread_join( threads[ i ], NULL );
+        }
+    }
+
+    assert( echo_stats_get( ECHO_STAT_ERR_EINTR ) ==
+            2ULL * THREADS * ROUNDS );
+    assert( echo_stats_get( ECHO_STAT_ERR_OTHER ) == 2ULL * THREADS );
+
+    return EXIT_SUCCESS;
+}
+
+void *count_thread( void *arg )
+{
+    int i;
+
+    ( void )arg;
+
+    for( i = 0; i < ROUNDS; i++ )
+    {
+        echo_stats_add( ECHO_STAT_ERR_EINTR, 1 );
+    }
+
+    echo_stats_add( ECHO_STAT_ERR_OTHER, 1 );
+
+    return NULL;
+}
@@ -0,0 +1,207 @@
+#include "echoclient.h"
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+#define PORT        5002
+#define BACKLOG     1000
+#define SESSIONS    16
+#define MESSAGES    200
+
+struct bot
+{
+    int b_accepted;
+    int b_rejected;
+    int b_received;
+    int b_closed;
+};
+
+static void *accept_thread( void *arg );
+static void *echo_thread( void *arg );
+static void on_login( echo_session_t *session, int accepted, void *arg );
+static void on_message( echo_session_t *session, int type,
+        const char *payload, size_t size, void *arg );
+static void on_close( echo_session_t *session, int err, void *arg );
+
+int main( void )
+{
+    static const echo_session_handler_t handler =
+    {
+        on_login, on_message, NULL, on_close
+    };
+    struct bot bots[ SESSIONS + 1 ];
+    echo_client_loop_t *loop;
+    echo_session_t *session;
+    tcp_context_t *server_ctx;
+    char uname[ 32 ];
+    pthread_t thread;
+    int i, err;
+
+    assert( ( server_ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_bind( server_ctx, PORT, &err ) != -1 );
+    assert( tcp_context_listen( server_ctx, BACKLOG, &err ) != -1 );
+    pthread_create( &thread, NULL, accept_thread, server_ctx );
+
+    memset( bots, 0, sizeof( bots ) );
+    assert( ( loop = echo_client_loop_create( 4, &err ) ) != NULL );
+
+    /* The last bot asks for a name the server refuses. */
+    for( i = 0; i <= SESSIONS; i++ )
+    {
+        if( i < SESSIONS )
+        {
+            sprintf( uname, "bot%d", i );
+        }
+        else
+        {
+            strcpy( uname, "taken" );
+        }
+
+        session = echo_client_loop_connect( loop, "localhost", PORT,
+                &handler, &bots[ i ], &err );
+        assert( session != NULL );
+        assert( echo_session_login( session, uname, 0, &err ) == 0 );
+        assert( echo_session_login( session, uname, 0, &err ) == -1 );
+    }
+
+    assert( echo_client_loop_sessions( loop ) == SESSIONS + 1 );
+
+    while( echo_client_loop_sessions( loop ) > 0 )
+    {
+        assert( echo_client_loop_run( loop, 5000, &err ) > 0 );
+    }
+
+    for( i = 0; i < SESSIONS; i++ )
+    {
+        assert( bots[ i ].b_accepted && !bots[ i ].b_rejected );
+        assert( bots[ i ].b_received == MESSAGES );
+        assert( bots[ i ].b_closed );
+    }
+
+    assert( bots[ SESSIONS ].b_rejected && bots[ SESSIONS ].b_closed );
+    assert( bots[ SESSIONS ].b_received == 0 );
+
+    echo_client_loop_destroy( loop );
+    pthread_join( thread, NULL );
+    tcp_context_destroy( server_ctx );
+
+    return EXIT_SUCCESS;
+}
+
+void *accept_thread( void *arg )
+{
+    tcp_context_t *client_ctx;
+    pthread_t thread;
+    int i, err;
+
+    for( i = 0; i <= SESSIONS; i++ )
+    {
+        client_ctx = tcp_context_accept( ( tcp_context_t* )arg, &err );
+        assert( client_ctx != NULL );
+        pthread_create( &thread, NULL, echo_thread, client_ctx );
+        pthread_detach( thread );
+    }
+
+    return NULL;
+}
+
+/* Plays the server's side, echoing every chat message back as text */
+void *echo_thread( void *arg )
+{
+    tcp_context_t *client_ctx;
+    char buffer[ ECHO_FRAME_MAX ];
+    echo_frame_t frame;
+    int err;
+
+    client_ctx = ( tcp_context_t* )arg;
+
+    assert( echo_frame_recv( client_ctx, &frame, buffer, ECHO_FRAME_MAX,
+                &err ) > 0 );
+    assert( frame.ef_type == ECHO_FRAME_HELLO );
+
+    if( frame.ef_length == 5 && !strncmp( buffer, "taken", 5 ) )
+    {
+        echo_frame_send( client_ctx, ECHO_FRAME_REJECT, 0, "FAILED", 6,
+                &err );
+        tcp_context_destroy( client_ctx );
+        return NULL;
+    }
+
+    echo_frame_send( client_ctx, ECHO_FRAME_ACCEPT, 0, NULL, 0, &err );
+
+    while( echo_frame_recv( client_ctx, &frame, buffer, ECHO_FRAME_MAX,
+                &err ) > 0 )
+    {
+        assert( frame.ef_type == ECHO_FRAME_CHAT );
+        echo_frame_send( client_ctx, ECHO_FRAME_TEXT, 0, buffer,
+                frame.ef_length, &err );
+    }
+
+    tcp_context_destroy( client_ctx );
+
+    return NULL;
+}
+
+void on_login( echo_session_t *session, int accepted, void *arg )
+{
+    char message[ 64 ], large[ ECHO_FRAME_TEXT_MAX + 1 ];
+    struct bot *bot;
+    int i, err;
+
+    bot = ( struct bot* )arg;
+
+    if( !accepted )
+    {
+        bot->b_rejected = 1;
+        return;
+    }
+
+    bot->b_accepted = 1;
+
+    /* Text the server would not read is refused before it is queued. */
+    memset( large, 'x', sizeof( large ) );
+    assert( echo_session_send( session, large, sizeof( large ),
+                &err ) == -1 && err == EMSGSIZE );
+    assert( echo_session_direct( session, "bot0", large,
+                sizeof( large ) - 5, &err ) == -1 && err == EMSGSIZE );
+    assert( echo_session_pending( session ) == 0 );
+
+    /* Everything queued here leaves in one write. */
+    for( i = 0; i < MESSAGES; i++ )
+    {
+        sprintf( message, "%s %d", echo_session_uname( session ), i );
+        assert( echo_session_send( session, message, strlen( message ),
+                    &err ) == 0 );
+    }
+
+    assert( echo_session_pending( session ) > 0 );
+}
+
+void on_message( echo_session_t *session, int type, const char *payload,
+        size_t size, void *arg )
+{
+    struct bot *bot;
+    char message[ 64 ];
+
+    bot = ( struct bot* )arg;
+    assert( type == ECHO_FRAME_TEXT );
+
+    sprintf( message, "%s %d", echo_session_uname( session ),
+            bot->b_received );
+    assert( size == strlen( message ) && !memcmp( payload, message, size ) );
+
+    if( ++bot->b_received == MESSAGES )
+        echo_session_close( session );
+}
+
+void on_close( echo_session_t *session, int err, void *arg )
+{
+    struct bot *bot;
+
+    ( void )session;
+    bot = ( struct bot* )arg;
+
+    assert( err == ( bot->b_rejected ? EACCES : 0 ) );
+    bot->b_closed = 1;
+}
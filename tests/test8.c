@@ -0,0 +1,244 @@
+#include "echoclient.h"
+#include "testserver.h"
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define NODES       3
+#define BASE_PORT   5010
+#define MESSAGES    100
+#define DEADLINE    30
+
+/* One client per node, each one must see every message exactly once. */
+struct bot
+{
+    const char *b_name;
+    echo_session_t *b_session;
+    int b_ready;
+    int b_probed[ NODES ];
+    int b_seen[ NODES ][ MESSAGES ];
+    int b_count[ NODES ];
+    int b_closed;
+};
+
+static const char *g_names[ NODES ] = { "alice", "bob", "carol" };
+
+static pid_t spawn_node( const char *server, int node, int *input );
+static int all_probed( struct bot *bots );
+static int all_delivered( struct bot *bots );
+static void on_login( echo_session_t *session, int accepted, void *arg );
+static void on_message( echo_session_t *session, int type,
+        const char *payload, size_t size, void *arg );
+static void on_close( echo_session_t *session, int err, void *arg );
+
+int main( void )
+{
+    static const echo_session_handler_t handler =
+    {
+        on_login, on_message, NULL, on_close
+    };
+    char server[ PATH_MAX ], dir[ ] = "/tmp/echo-test8-XXXXXX";
+    char message[ 64 ];
+    struct bot bots[ NODES ];
+    echo_client_loop_t *loop;
+    int inputs[ NODES ], i, j, status, err;
+    pid_t pids[ NODES ];
+    time_t deadline;
+
+    assert( realpath( getenv( "ECHO_SERVER" ) != NULL ?
+                getenv( "ECHO_SERVER" ) : "./server", server ) != NULL );
+    assert( mkdtemp( dir ) != NULL && chdir( dir ) == 0 );
+    signal( SIGPIPE, SIG_IGN );
+
+    for( i = 0; i < NODES; i++ )
+    {
+        pids[ i ] = spawn_node( server, i, &inputs[ i ] );
+        test_server_wait( BASE_PORT + i );
+    }
+
+    memset( bots, 0, sizeof( bots ) );
+    assert( ( loop = echo_client_loop_create( NODES, &err ) ) != NULL );
+
+    for( i = 0; i < NODES; i++ )
+    {
+        bots[ i ].b_name = g_names[ i ];
+        bots[ i ].b_session = echo_client_loop_connect( loop, "localhost",
+                BASE_PORT + i, &handler, &bots[ i ], &err );
+        assert( bots[ i ].b_session != NULL );
+        assert( echo_session_login( bots[ i ].b_session, g_names[ i ], 0,
+                    &err ) == 0 );
+    }
+
+    /* Links come up in the background, probe until every node hears
+     * every other. */
+    deadline = time( NULL ) + DEADLINE;
+
+    while( !all_probed( bots ) )
+    {
+        assert( time( NULL ) < deadline );
+
+        for( i = 0; i < NODES; i++ )
+        {
+            if( bots[ i ].b_ready )
+                echo_session_send( bots[ i ].b_session, "probe", 5, &err );
+        }
+
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    for( i = 0; i < NODES; i++ )
+    {
+        for( j = 0; j < MESSAGES; j++ )
+        {
+            sprintf( message, "message %d", j );
+            assert( echo_session_send( bots[ i ].b_session, message,
+                        strlen( message ), &err ) == 0 );
+        }
+    }
+
+    while( !all_delivered( bots ) )
+    {
+        assert( time( NULL ) < deadline );
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    /* Nothing may turn up twice even after the floods have settled. */
+    for( i = 0; i < 5; i++ )
+    {
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    for( i = 0; i < NODES; i++ )
+    {
+        echo_session_close( bots[ i ].b_session );
+    }
+
+    while( echo_client_loop_sessions( loop ) > 0 )
+    {
+        assert( time( NULL ) < deadline );
+        assert( echo_client_loop_run( loop, 100, &err ) != -1 );
+    }
+
+    echo_client_loop_destroy( loop );
+
+    for( i = 0; i < NODES; i++ )
+    {
+        assert( bots[ i ].b_closed );
+        close( inputs[ i ] );
+        assert( waitpid( pids[ i ], &status, 0 ) == pids[ i ] );
+        assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Node i peers with every node started before it, which makes a full
+ * mesh with a cycle for the relays to be suppressed on. */
+pid_t spawn_node( const char *server, int node, int *input )
+{
+    char *argv[ 4 + 2 * NODES ], id[ 16 ], port[ 16 ];
+    char peers[ NODES ][ 32 ];
+    int argc, i;
+
+    sprintf( id, "%d", node + 1 );
+    sprintf( port, "%d", BASE_PORT + node );
+    argc = 0;
+    argv[ argc++ ] = ( char* )server;
+    argv[ argc++ ] = "--node-id";
+    argv[ argc++ ] = id;
+
+    for( i = 0; i < node; i++ )
+    {
+        sprintf( peers[ i ], "--peer=localhost:%d", BASE_PORT + i );
+        argv[ argc++ ] = peers[ i ];
+    }
+
+    argv[ argc++ ] = port;
+    argv[ argc ] = NULL;
+
+    return test_server_spawn( argv, input );
+}
+
+int all_probed( struct bot *bots )
+{
+    int i, j;
+
+    for( i = 0; i < NODES; i++ )
+    {
+        for( j = 0; j < NODES; j++ )
+        {
+            if( !bots[ i ].b_probed[ j ] )
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+int all_delivered( struct bot *bots )
+{
+    int i, j;
+
+    for( i = 0; i < NODES; i++ )
+    {
+        for( j = 0; j < NODES; j++ )
+        {
+            if( bots[ i ].b_count[ j ] < MESSAGES )
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+void on_login( echo_session_t *session, int accepted, void *arg )
+{
+    ( void )session;
+    assert( accepted );
+    ( ( struct bot* )arg )->b_ready = 1;
+}
+
+void on_message( echo_session_t *session, int type, const char *payload,
+        size_t size, void *arg )
+{
+    char text[ 256 ], name[ 32 ];
+    struct bot *bot;
+    int from, n;
+
+    ( void )session;
+    bot = ( struct bot* )arg;
+    assert( type == ECHO_FRAME_TEXT && size < sizeof( text ) );
+
+    memcpy( text, payload, size );
+    text[ size ] = '\0';
+
+    if( sscanf( text, "%31s says:", name ) != 1 ||
+            strstr( text, " says:\n" ) == NULL )
+        return;
+
+    for( from = 0; from < NODES && strcmp( name, g_names[ from ] ); from++ );
+
+    assert( from < NODES );
+
+    if( strstr( text, ":\nprobe\n" ) != NULL )
+    {
+        bot->b_probed[ from ] = 1;
+    }
+    else if( sscanf( strstr( text, ":\n" ) + 2, "message %d", &n ) == 1 )
+    {
+        assert( n >= 0 && n < MESSAGES && !bot->b_seen[ from ][ n ] );
+        bot->b_seen[ from ][ n ] = 1;
+        bot->b_count[ from ]++;
+    }
+}
+
+void on_close( echo_session_t *session, int err, void *arg )
+{
+    ( void )session;
+    assert( err == 0 );
+    ( ( struct bot* )arg )->b_closed = 1;
+}
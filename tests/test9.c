@@ -0,0 +1,296 @@
+#include "echoclient.h"
+#include "testserver.h"
+#include "echopresence.h"
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define NODES       3
+#define BASE_PORT   5020
+#define NAMES       3000
+#define DEADLINE    60
+
+struct bot
+{
+    const char *b_name;
+    echo_session_t *b_session;
+    int b_accepted;
+    int b_rejected;
+    int b_closed;
+    int b_probed[ NODES ];
+};
+
+static time_t g_deadline;
+
+static void check_ring( void );
+static pid_t spawn_node( const char *server, int node, int *input );
+static void login( echo_client_loop_t *loop, struct bot *bot, int node,
+        const char *name );
+static void run_until( echo_client_loop_t *loop, const int *flag );
+static void run_for( echo_client_loop_t *loop, int milliseconds );
+static int all_probed( struct bot *probes );
+static void on_login( echo_session_t *session, int accepted, void *arg );
+static void on_message( echo_session_t *session, int type,
+        const char *payload, size_t size, void *arg );
+static void on_close( echo_session_t *session, int err, void *arg );
+
+static const echo_session_handler_t g_handler =
+{
+    on_login, on_message, NULL, on_close
+};
+
+int main( void )
+{
+    char server[ PATH_MAX ], dir[ ] = "/tmp/echo-test9-XXXXXX";
+    struct bot probes[ NODES ], first, second, third, late;
+    echo_client_loop_t *loop;
+    int inputs[ NODES ], i, status, err;
+    pid_t pids[ NODES ];
+
+    check_ring( );
+
+    assert( realpath( getenv( "ECHO_SERVER" ) != NULL ?
+                getenv( "ECHO_SERVER" ) : "./server", server ) != NULL );
+    assert( mkdtemp( dir ) != NULL && chdir( dir ) == 0 );
+    signal( SIGPIPE, SIG_IGN );
+    g_deadline = time( NULL ) + DEADLINE;
+
+    for( i = 0; i < NODES; i++ )
+    {
+        pids[ i ] = spawn_node( server, i, &inputs[ i ] );
+        test_server_wait( BASE_PORT + i );
+    }
+
+    assert( ( loop = echo_client_loop_create( NODES, &err ) ) != NULL );
+    memset( probes, 0, sizeof( probes ) );
+
+    /* Wait for the full mesh, the directory assumes it. */
+    for( i = 0; i < NODES; i++ )
+    {
+        login( loop, &probes[ i ], i, i == 0 ? "p0" : i == 1 ? "p1" : "p2" );
+    }
+
+    while( !all_probed( probes ) )
+    {
+        assert( time( NULL ) < g_deadline );
+
+        for( i = 0; i < NODES; i++ )
+        {
+            if( probes[ i ].b_accepted && !probes[ i ].b_closed )
+                echo_session_send( probes[ i ].b_session, "probe", 5,
+                        &err );
+        }
+
+        run_for( loop, 100 );
+    }
+
+    /* Whatever node owns the name, later logins elsewhere are refused,
+     * either on the spot or once the owner answered. */
+    login( loop, &first, 0, "dave" );
+    run_until( loop, &first.b_accepted );
+    login( loop, &second, 1, "dave" );
+    run_until( loop, &second.b_closed );
+    login( loop, &third, 2, "dave" );
+    run_until( loop, &third.b_closed );
+
+    run_for( loop, 500 );
+    assert( first.b_accepted && !first.b_closed );
+
+    /* Once released the name can be taken anywhere. A refusal cached by
+     * the node just before is allowed for a few seconds. */
+    echo_session_close( first.b_session );
+    run_until( loop, &first.b_closed );
+
+    while( 1 )
+    {
+        login( loop, &late, 2, "dave" );
+
+        while( !late.b_accepted && !late.b_closed )
+        {
+            run_for( loop, 100 );
+        }
+
+        if( late.b_accepted )
+            break;
+
+        run_for( loop, 500 );
+    }
+
+    run_for( loop, 1500 );
+    assert( !late.b_closed );
+
+    echo_client_loop_destroy( loop );
+
+    for( i = 0; i < NODES; i++ )
+    {
+        close( inputs[ i ] );
+        assert( waitpid( pids[ i ], &status, 0 ) == pids[ i ] );
+        assert( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Names spread over every node, and a node leaving or joining only moves
+ * the names it owns. */
+void check_ring( void )
+{
+    uint32_t three[ ] = { 1, 2, 3 }, two[ ] = { 1, 2 };
+    uint32_t four[ ] = { 1, 2, 3, 4 };
+    uint32_t owner, smaller, larger;
+    int share[ 5 ], moved, i;
+    char name[ 32 ];
+
+    memset( share, 0, sizeof( share ) );
+    moved = 0;
+
+    for( i = 0; i < NAMES; i++ )
+    {
+        sprintf( name, "user%d", i );
+        owner = echo_presence_hash_owner( three, 3, name );
+        smaller = echo_presence_hash_owner( two, 2, name );
+        larger = echo_presence_hash_owner( four, 4, name );
+
+        assert( owner >= 1 && owner <= 3 );
+        assert( owner == 3 || smaller == owner );
+        assert( larger == 4 || larger == owner );
+        assert( echo_presence_hash_owner( three, 3, name ) == owner );
+
+        share[ owner ]++;
+        moved += larger == 4;
+    }
+
+    for( i = 1; i <= 3; i++ )
+    {
+        assert( share[ i ] > NAMES / 6 );
+    }
+
+    assert( moved > NAMES / 8 && moved < NAMES / 2 );
+}
+
+pid_t spawn_node( const char *server, int node, int *input )
+{
+    char *argv[ 4 + 2 * NODES ], id[ 16 ], port[ 16 ];
+    char peers[ NODES ][ 32 ];
+    int argc, i;
+
+    sprintf( id, "%d", node + 1 );
+    sprintf( port, "%d", BASE_PORT + node );
+    argc = 0;
+    argv[ argc++ ] = ( char* )server;
+    argv[ argc++ ] = "--node-id";
+    argv[ argc++ ] = id;
+
+    for( i = 0; i < node; i++ )
+    {
+        sprintf( peers[ i ], "--peer=localhost:%d", BASE_PORT + i );
+        argv[ argc++ ] = peers[ i ];
+    }
+
+    argv[ argc++ ] = port;
+    argv[ argc ] = NULL;
+
+    return test_server_spawn( argv, input );
+}
+
+void login( echo_client_loop_t *loop, struct bot *bot, int node,
+        const char *name )
+{
+    int err;
+
+    memset( bot, 0, sizeof( struct bot ) );
+    bot->b_name = name;
+    bot->b_session = echo_client_loop_connect( loop, "localhost",
+            BASE_PORT + node, &g_handler, bot, &err );
+    assert( bot->b_session != NULL );
+    assert( echo_session_login( bot->b_session, name, 0, &err ) == 0 );
+}
+
+void run_until( echo_client_loop_t *loop, const int *flag )
+{
+    while( !*flag )
+    {
+        run_for( loop, 100 );
+    }
+}
+
+void run_for( echo_client_loop_t *loop, int milliseconds )
+{
+    struct timespec start, current;
+    int err;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    do
+    {
+        assert( time( NULL ) < g_deadline );
+        assert( echo_client_loop_run( loop, 10, &err ) != -1 );
+        clock_gettime( CLOCK_MONOTONIC, &current );
+    }
+    while( ( current.tv_sec - start.tv_sec ) * 1000 +
+            ( current.tv_nsec - start.tv_nsec ) / 1000000 < milliseconds );
+}
+
+int all_probed( struct bot *probes )
+{
+    int i, j;
+
+    for( i = 0; i < NODES; i++ )
+    {
+        for( j = 0; j < NODES; j++ )
+        {
+            if( !probes[ i ].b_probed[ j ] )
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+void on_login( echo_session_t *session, int accepted, void *arg )
+{
+    struct bot *bot;
+
+    ( void )session;
+    bot = ( struct bot* )arg;
+
+    if( accepted )
+    {
+        bot->b_accepted = 1;
+    }
+    else
+    {
+        bot->b_rejected = 1;
+    }
+}
+
+void on_message( echo_session_t *session, int type, const char *payload,
+        size_t size, void *arg )
+{
+    char text[ 256 ];
+    struct bot *bot;
+
+    ( void )session;
+    bot = ( struct bot* )arg;
+
+    if( type != ECHO_FRAME_TEXT || size >= sizeof( text ) )
+        return;
+
+    memcpy( text, payload, size );
+    text[ size ] = '\0';
+
+    if( sscanf( text, "p%d says:\nprobe\n", &type ) == 1 &&
+            type >= 0 && type < NODES )
+        bot->b_probed[ type ] = 1;
+}
+
+void on_close( echo_session_t *session, int err, void *arg )
+{
+    ( void )session;
+    ( void )err;
+    ( ( struct bot* )arg )->b_closed = 1;
+}
@@ -0,0 +1,27 @@
+#include "testclient.h"
+#include <assert.h>
+
+tcp_context_t *test_client_peer( int fd )
+{
+    tcp_context_t *ctx;
+    int err;
+
+    assert( ( ctx = tcp_context_create( &err ) ) != NULL );
+    ctx->tc_socket = fd;
+
+    return ctx;
+}
+
+echo_client_context_t *test_client_create( const char *uname, int fd,
+        int features )
+{
+    echo_client_context_t *client;
+    int err;
+
+    assert( ( client = echo_client_context_create( test_client_peer( fd ),
+                    uname, &err ) ) != NULL );
+    assert( echo_client_context_set_features( client, features,
+                &err ) == 0 );
+
+    return client;
+}
@@ -0,0 +1,30 @@
+#ifndef TESTCLIENT_H
+#define TESTCLIENT_H
+
+/*! \file testclient.h
+ *  \brief Contains helpers for the tests which drive client contexts over
+ *  socket pairs instead of a server.
+ */
+
+#include "echoclientcontext.h"
+
+/*! \fn tcp_context_t *test_client_peer( int fd )
+ *  \brief Wraps a connected socket, typically one end of a socket pair, in
+ *  a TCP context.
+ *  \param[in] fd The socket, owned by the context from then on.
+ *  \return The context.
+ */
+extern tcp_context_t *test_client_peer( int fd );
+
+/*! \fn echo_client_context_t *test_client_create( const char *uname, int fd, int features )
+ *  \brief Makes a client context on a connected socket, as the server does
+ *  after a login.
+ *  \param[in] uname The username.
+ *  \param[in] fd The socket, owned by the context from then on, or -1.
+ *  \param[in] features The ECHO_FEATURE_* bits negotiated.
+ *  \return The client context.
+ */
+extern echo_client_context_t *test_client_create( const char *uname, int fd,
+        int features );
+
+#endif /* TESTCLIENT_H */
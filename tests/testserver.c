@@ -0,0 +1,84 @@
+#include "testserver.h"
+#include "echoframe.h"
+#include <fcntl.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#define TRIES       100
+#define INTERVAL    50000
+
+pid_t test_server_spawn( char *argv[ ], int *input )
+{
+    int fds[ 2 ];
+    pid_t pid;
+
+    assert( pipe( fds ) == 0 );
+    fcntl( fds[ 1 ], F_SETFD, FD_CLOEXEC );
+    assert( ( pid = fork( ) ) != -1 );
+
+    if( pid > 0 )
+    {
+        close( fds[ 0 ] );
+        *input = fds[ 1 ];
+        return pid;
+    }
+
+    dup2( fds[ 0 ], STDIN_FILENO );
+    close( fds[ 0 ] );
+    close( fds[ 1 ] );
+
+    execv( argv[ 0 ], argv );
+    _exit( 127 );
+}
+
+void test_server_wait( int port )
+{
+    tcp_context_t *ctx;
+    int tries, err;
+
+    for( tries = 0; tries < TRIES; tries++ )
+    {
+        assert( ( ctx = tcp_context_create( &err ) ) != NULL );
+
+        if( tcp_context_connect( ctx, "localhost", port, &err ) == 0 )
+        {
+            tcp_context_destroy( ctx );
+            return;
+        }
+
+        tcp_context_destroy( ctx );
+        usleep( INTERVAL );
+    }
+
+    assert( !"server did not start" );
+}
+
+tcp_context_t *test_server_join( int port, const char *name, int timeout )
+{
+    char buffer[ ECHO_FRAME_MAX ];
+    struct timeval limit;
+    echo_frame_t frame;
+    tcp_context_t *ctx;
+    int err;
+
+    assert( ( ctx = tcp_context_create( &err ) ) != NULL );
+    assert( tcp_context_connect( ctx, "localhost", port, &err ) == 0 );
+    limit.tv_sec = timeout;
+    limit.tv_usec = 0;
+    assert( setsockopt( ctx->tc_socket, SOL_SOCKET, SO_RCVTIMEO, &limit,
+                sizeof( limit ) ) == 0 );
+    assert( echo_frame_send( ctx, ECHO_FRAME_HELLO, 0, name, strlen( name ),
+                &err ) > 0 );
+    assert( echo_frame_recv( ctx, &frame, buffer, sizeof( buffer ),
+                &err ) > 0 );
+
+    if( frame.ef_type == ECHO_FRAME_REJECT )
+    {
+        tcp_context_destroy( ctx );
+        return NULL;
+    }
+
+    assert( frame.ef_type == ECHO_FRAME_ACCEPT );
+
+    return ctx;
+}
@@ -0,0 +1,39 @@
+#ifndef TESTSERVER_H
+#define TESTSERVER_H
+
+/*! \file testserver.h
+ *  \brief Contains helpers for the tests which run ./server processes.
+ */
+
+#include "tcpcontext.h"
+#include <sys/types.h>
+
+/*! \fn pid_t test_server_spawn( char *argv[ ], int *input )
+ *  \brief Runs a server with its standard input on a pipe, closing which
+ *  makes it stop.
+ *  \param[in] argv The arguments, the path of the server first, terminated
+ *  by NULL.
+ *  \param[out] input The write end of the pipe.
+ *  \return The process ID of the server.
+ */
+extern pid_t test_server_spawn( char *argv[ ], int *input );
+
+/*! \fn void test_server_wait( int port )
+ *  \brief Waits for a server to take connections on the local port, failing
+ *  the test after five seconds.
+ *  \param[in] port The port the server listens on.
+ */
+extern void test_server_wait( int port );
+
+/*! \fn tcp_context_t *test_server_join( int port, const char *name, int timeout )
+ *  \brief Logs in to a local server and waits for the reply. Reads time out
+ *  so that a stuck server fails the test instead of hanging it.
+ *  \param[in] port The port the server listens on.
+ *  \param[in] name The username.
+ *  \param[in] timeout The seconds a read may wait, on this login and after.
+ *  \return The connection when accepted, NULL when the name is refused.
+ */
+extern tcp_context_t *test_server_join( int port, const char *name,
+        int timeout );
+
+#endif /* TESTSERVER_H */